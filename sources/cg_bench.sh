@@ -0,0 +1,48 @@
+#!/bin/bash
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# Times C code generation for test/cg_test.sql, which is the biggest input we
+# have handy.  Use this to check changes to the code generators or to the
+# buffer helpers they use.
+#
+# usage: ./cg_bench.sh [iterations] [path to cql]
+
+ITERATIONS="${1:-20}"
+CQL="${2:-out/cql}"
+
+DIR="$( dirname -- "$0"; )"
+cd "${DIR}" || exit 1
+
+if [ "$#" -lt 2 ]
+then
+  if ! make >"out/make.out" 2>&1
+  then
+    echo "CQL build failed"
+    cat "out/make.out"
+    exit 1
+  fi
+fi
+
+run_codegen() {
+  ${CQL} --dev --test --in test/cg_test.sql \
+    --cg out/cg_bench.h out/cg_bench.c out/cg_bench_exports.out \
+    --global_proc cql_startup --generate_exports 2>/dev/null
+}
+
+# one warm up run so that the first measurement isn't paying for a cold cache
+if ! run_codegen
+then
+  echo "codegen failed, run the tests first"
+  exit 1
+fi
+
+TIMEFORMAT="%R"
+echo "timing ${ITERATIONS} runs of ${CQL} over test/cg_test.sql"
+{ time (for ((i = 0; i < ITERATIONS; i++)); do run_codegen; done) ; } 2>"out/cg_bench.time"
+
+TOTAL=$(cat "out/cg_bench.time")
+echo "total ${TOTAL}s"
+awk -v total="${TOTAL}" -v n="${ITERATIONS}" 'BEGIN { printf("mean %.1f ms per run\n", total * 1000 / n); }'
@@ -7,6 +7,11 @@
 
 // Perform codegen of the various nodes to "C".
 
+// fork and waitpid are POSIX, not part of C99
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #if defined(CQL_AMALGAM_LEAN) && !defined(CQL_AMALGAM_CG_C)
 
 // stubs to avoid link errors.
@@ -26,11 +31,17 @@ cql_noexport void cg_c_cleanup() {}
 #include "cql.h"
 #include "gen_sql.h"
 #include "list.h"
+#include "rope.h"
 #include "sem.h"
 #include "eval.h"
 #include "symtab.h"
 #include "encoders.h"
 
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 static void cg_expr(ast_node *node, charbuf *is_null, charbuf *value, int32_t pri);
 static void cg_stmt_list(ast_node *node);
 static void cg_get_column(sem_t sem_type, CSTR cursor, int32_t index, CSTR var, charbuf *output);
@@ -71,6 +82,9 @@ static bool_t in_var_group_emit = false;
 // True if we are in a loop (hence the statement might run again)
 static bool_t cg_in_loop = false;
 
+// True if the fetch being emitted should read strings and blobs as borrowed views
+static bool_t cg_fetch_borrowed = false;
+
 // exports file if we are outputing exports
 static charbuf *exports_output = NULL;
 
@@ -145,6 +159,11 @@ static symtab *string_literals;
 // used to create SQL with the --compress option "pieces"
 static symtab *text_pieces;
 
+// Result set metadata tables are frequently duplicated because many procs return
+// exactly the same shape.  With --share_result_set_accessors this maps the text of each
+// table to the name of the proc that emitted it first, later procs just refer to that copy.
+static symtab *result_set_shapes;
+
 // When emitting procedure declarations we do not want duplicates
 // Especially when recursing over referenced procedures via object<proc_name SET>
 static symtab *emitted_proc_decls;
@@ -192,6 +211,100 @@ static int32_t cur_fragment_predicate = 0;
 static int32_t prev_variable_count;
 static int32_t cur_variable_count;
 
+// Each distinct variable in a statement is bound only once, these map the variable
+// name to its bind slot.  The uses buffer records the slot of each variable use
+// in order so the variable predicates can be emitted per slot.
+typedef struct cg_bound_variable {
+  ast_node *ast;    // the variable that is bound in this slot
+  int32_t slot;     // zero based, the parameter number is slot + 1
+} cg_bound_variable;
+
+typedef struct cg_variable_use {
+  int32_t slot;     // the slot this use refers to
+  bool_t repeat;    // true if an earlier use already claimed the slot
+} cg_variable_use;
+
+static symtab *bound_variable_slots;
+static int32_t bound_variable_count;
+static bytebuf bound_variable_uses = {NULL, 0, 0};
+
+// With --jobs the top level procs are emitted on worker processes, each into its own
+// buffers.  A few things in a proc depend on the procs that came before it: the literal
+// and piece numbering, the label and temporary numbering, the shared result set shapes,
+// and the declarations already in the exports file.  While in a job these are recorded
+// rather than resolved, the parent resolves them when it stitches the procs back
+// together in source order.
+static bool_t cg_in_job = false;
+
+// A placeholder in job output is written as this marker, a kind letter, a number, and
+// the marker again.  For a literal (L) or piece (P) the number is the index of the
+// recorded literal or piece.  For a case label (C), catch label (K) or string temporary
+// (S) it is the number relative to the start of the proc.  The compiler never writes the
+// marker itself, if the input has it anywhere then we don't use jobs at all.
+#define CG_JOB_MARKER '\x01'
+
+// How many of each numbered label or temporary a proc used, or, in the parent, the
+// counts to add to a proc's numbers.
+typedef struct cg_job_counts {
+  int32_t cases;
+  int32_t catches;
+  int32_t cstrs;
+} cg_job_counts;
+
+typedef struct cg_job_literal_info {
+  CSTR text;                 // the literal as written in the SQL
+  CSTR _Nullable proc_name;  // the proc that used it, part of the literal's name
+} cg_job_literal_info;
+
+typedef struct cg_job_piece_info {
+  CSTR text;                 // the piece as it will appear in the C string
+  int32_t len;               // the length of the piece before it was escaped
+} cg_job_piece_info;
+
+typedef struct cg_job_shape_info {
+  CSTR shape;                // the metadata table text
+  CSTR _Nullable owner;      // the owner the worker found, NULL if this proc became the owner
+  CSTR proc_name;            // the proc that made the lookup
+} cg_job_shape_info;
+
+// everything the current job proc recorded, in the order it happened
+static bytebuf job_literals = {NULL, 0, 0};
+static bytebuf job_pieces = {NULL, 0, 0};
+static bytebuf job_shapes = {NULL, 0, 0};
+
+// true if the current job proc wants its declaration in the exports file
+static bool_t job_exports_needed;
+
+// Record a literal for the parent to name and write a placeholder for the name.
+static void cg_job_literal(CSTR str, CSTR _Nullable proc_name, charbuf *output) {
+  int32_t index = (int32_t)(job_literals.used / sizeof(cg_job_literal_info));
+  cg_job_literal_info *info = bytebuf_new(&job_literals, cg_job_literal_info);
+  info->text = Strdup(str);
+  info->proc_name = proc_name;
+  bprintf(output, "%cL%d%c", CG_JOB_MARKER, index, CG_JOB_MARKER);
+}
+
+// Record a piece for the parent to intern and write a placeholder for its encoded id.
+static void cg_job_piece(CSTR str, int32_t len, charbuf *output) {
+  int32_t index = (int32_t)(job_pieces.used / sizeof(cg_job_piece_info));
+  cg_job_piece_info *info = bytebuf_new(&job_pieces, cg_job_piece_info);
+  info->text = Strdup(str);
+  info->len = len;
+  bprintf(output, "%cP%d%c", CG_JOB_MARKER, index, CG_JOB_MARKER);
+}
+
+// Emit a label or temporary name with its number.  These are numbered across the whole
+// file, in a job the number is only known relative to the proc so it is written as a
+// placeholder that the parent resolves.
+static void cg_numbered_name(CSTR prefix, char kind, int32_t number, charbuf *output) {
+  if (cg_in_job) {
+    bprintf(output, "%s%c%c%d%c", prefix, CG_JOB_MARKER, kind, number, CG_JOB_MARKER);
+  }
+  else {
+    bprintf(output, "%s%d", prefix, number);
+  }
+}
+
 // emit the line directive, escape the file name using the C convention
 static void cg_line_directive(CSTR filename, int32_t lineno, charbuf *output) {
   if (options.test || options.nolines) {
@@ -216,6 +329,84 @@ static void cg_line_directive_max(ast_node *ast, charbuf *output) {
   cg_line_directive(ast->filename, ast->lineno, output);
 }
 
+typedef struct cg_line_directive_state {
+  // the last "# 32" seen in the input, without the file name
+  charbuf *last_line_directive;
+
+  // true between the #define _PROC_ and #undef _PROC_ markers (i.e. in the text of a procedure)
+  bool_t now_in_proc;
+
+  // true immediately after we see something like # 32 "foo.sql" in the input
+  bool_t suppress_because_new_directive;
+} cg_line_directive_state;
+
+// true if the text (of the given length) starts with the prefix
+static bool_t cg_text_starts_with(CSTR text, uint32_t len, CSTR prefix) {
+  uint32_t prefix_len = (uint32_t)strlen(prefix);
+  return len >= prefix_len && !memcmp(text, prefix, prefix_len);
+}
+
+// Process one line of the input (without its linefeed), see below.
+static void cg_line_directives_one_line(
+  cg_line_directive_state *state,
+  CSTR line,
+  uint32_t len,
+  rope *output)
+{
+  CSTR start_proc = "#define _PROC_ "; // this marks the start of a proc
+  CSTR line_directive = "\x23line ";  // this marks the end of a proc
+  CSTR end_proc = "#undef _PROC_";  // this marks the end of a proc
+
+  CSTR trim = line;
+  while (trim < line + len && *trim == ' ') trim++;
+  uint32_t trim_len = (uint32_t)(line + len - trim);
+
+  if (cg_text_starts_with(trim, trim_len, start_proc)) {
+    // entering a procedure, we will start to emit additional line directives to stay on the same line
+    rope_append(output, line, len);
+    rope_puts(output, "\n");
+    state->now_in_proc = true;
+    return;
+  }
+  else if (cg_text_starts_with(trim, trim_len, end_proc)) {
+    // leaving a procedure, we will no longer emit additional line directives to stay on the same line
+    rope_append(output, line, len);
+    rope_puts(output, "\n");
+    state->now_in_proc = false;
+    return;
+  }
+  else if (cg_text_starts_with(trim, trim_len, "# ") || cg_text_starts_with(trim, trim_len, line_directive)) {
+    charbuf *last_line_directive = state->last_line_directive;
+    bclear(last_line_directive);
+    bprintf(last_line_directive, "%.*s", (int)trim_len, trim);
+    rope_append(output, last_line_directive->ptr, last_line_directive->used - 1);
+    rope_puts(output, "\n");
+    char* line_start = strchr(last_line_directive->ptr, ' ');
+    char* next_space = strchr(line_start + 1, ' ');
+    if (next_space) *next_space = '\0';
+
+    // this prevents us from emitting the sequence
+    // #line 32 "foo.sql"
+    // #line 32
+    // the second # 32 would be a waste...
+    state->suppress_because_new_directive = true;
+    return;
+  }
+
+  if (state->last_line_directive->ptr[0] && !state->suppress_because_new_directive && state->now_in_proc) {
+    // this forces us to stay on the current line until we explicitly switch lines
+    // every line becomes
+    // #line 32
+    // [whatever]
+    rope_puts(output, state->last_line_directive->ptr);
+    rope_puts(output, "\n");
+  }
+
+  state->suppress_because_new_directive = false;
+  rope_append(output, line, len);
+  rope_puts(output, "\n");
+}
+
 // The situation in CQL is that most statements, even single line statements,
 // end up generating many lines of C.  So the normal situation is that you need
 // to emit additional # directives to stay on the same line you were already on.
@@ -228,6 +419,9 @@ static void cg_line_directive_max(ast_node *ast, charbuf *output) {
 // * no additional outputs outside of procedures
 // * we use the #define _PROC_ and #undef _PROC_ markers to know if we are in a proc
 //
+// The input is walked a chunk at a time so it is never flattened, only a line
+// that straddles two chunks is put together in a buffer.
+//
 // Typical output:
 //
 // # 1 "foo.sql"
@@ -264,71 +458,46 @@ static void cg_line_directive_max(ast_node *ast, charbuf *output) {
 // }
 // #undef _PROC_
 //
-static void cg_insert_line_directives(CSTR input, charbuf *output)
+static void cg_insert_line_directives(rope *input, rope *output)
 {
-   CHARBUF_OPEN(last_line_directive);
-   CHARBUF_OPEN(line);
-
-   CSTR start_proc = "#define _PROC_ "; // this marks the start of a proc
-   size_t start_proc_len = strlen(start_proc);
-
-   CSTR line_directive = "\x23line ";  // this marks the end of a proc
-   size_t line_directive_len = strlen(line_directive);
-
-   CSTR end_proc = "#undef _PROC_";  // this marks the end of a proc
-   size_t end_proc_len = strlen(end_proc);
-
-   // true between the markers above (i.e. in the text of a procedure)
-   bool_t now_in_proc = false;
-
-   // true immediately after we see something like # 32 "foo.sql" in the input
-   bool_t suppress_because_new_directive = false;
-
-   while (breadline(&line, &input)) {
-      CSTR trim = line.ptr;
-      while (*trim == ' ') trim++;
-
-      if (!strncmp(trim, start_proc, start_proc_len)) {
-        // entering a procedure, we will start to emit additional line directives to stay on the same line
-        bprintf(output, "%s\n", line.ptr);
-        now_in_proc = true;
-        continue;
+  CHARBUF_OPEN(last_line_directive);
+  CHARBUF_OPEN(partial_line);
+
+  cg_line_directive_state state = {
+    .last_line_directive = &last_line_directive,
+  };
+
+  for (rope_chunk *chunk = input->head; chunk; chunk = chunk->next) {
+    CSTR p = chunk->ptr;
+    CSTR end = chunk->ptr + chunk->used;
+
+    while (p < end) {
+      CSTR nl = memchr(p, '\n', (size_t)(end - p));
+      if (!nl) {
+        // the rest of the line is in the next chunk
+        bprintf(&partial_line, "%.*s", (int)(end - p), p);
+        break;
       }
-      else if (!strncmp(trim, end_proc, end_proc_len)) {
-        // leaving a procedure, we will no longer emit additional line directives to stay on the same line
-        bprintf(output, "%s\n", line.ptr);
-        now_in_proc = false;
-        continue;
+
+      if (partial_line.used > 1) {
+        bprintf(&partial_line, "%.*s", (int)(nl - p), p);
+        cg_line_directives_one_line(&state, partial_line.ptr, partial_line.used - 1, output);
+        bclear(&partial_line);
       }
-      else if ((trim[0] == '#' && trim[1] == ' ') || !strncmp(trim, line_directive, line_directive_len)) {
-        bclear(&last_line_directive);
-        bprintf(&last_line_directive, "%s", trim);
-        bprintf(output, "%s\n", last_line_directive.ptr);
-        char* line_start = strchr(last_line_directive.ptr, ' ');
-        char* next_space = strchr(line_start + 1, ' ');
-        if (next_space) *next_space = '\0';
-
-        // this prevents us from emitting the sequence
-        // #line 32 "foo.sql"
-        // #line 32
-        // the second # 32 would be a waste...
-        suppress_because_new_directive = true;
-        continue;
+      else {
+        cg_line_directives_one_line(&state, p, (uint32_t)(nl - p), output);
       }
 
-      if (last_line_directive.ptr[0] && !suppress_because_new_directive && now_in_proc) {
-        // this forces us to stay on the current line until we explicitly switch lines
-        // every line becomes
-        // #line 32
-        // [whatever]
-        bprintf(output, "%s\n", last_line_directive.ptr);
-      }
+      p = nl + 1;
+    }
+  }
 
-      suppress_because_new_directive = false;
-      bprintf(output, "%s\n", line.ptr);
-   }
+  // a last line with no linefeed still gets one
+  if (partial_line.used > 1) {
+    cg_line_directives_one_line(&state, partial_line.ptr, partial_line.used - 1, output);
+  }
 
-  CHARBUF_CLOSE(line);
+  CHARBUF_CLOSE(partial_line);
   CHARBUF_CLOSE(last_line_directive);
 }
 
@@ -516,7 +685,7 @@ static void cg_var_decl(charbuf *output, sem_t sem_type, CSTR base_name, bool_t
   if (is_out_parameter(sem_type)) {
     bprintf(&name, "*_Nonnull ");
   }
-  bprintf(&name, "%s", base_name);
+  bputs(&name, base_name);
 
   switch (core_type) {
     case SEM_TYPE_CURSOR_FORMAL:
@@ -540,7 +709,7 @@ static void cg_var_decl(charbuf *output, sem_t sem_type, CSTR base_name, bool_t
       if (!is_full_decl) {
         cg_var_nullability_annotation(output, sem_type);
       }
-      bprintf(output, "%s", name.ptr);
+      bputs(output, name.ptr);
       cg_emit_null_init(output, is_full_decl);
       if (is_full_decl) {
         bprintf(cg_cleanup_output, "  %s(%s);\n", rt->cql_string_release, name.ptr);
@@ -552,7 +721,7 @@ static void cg_var_decl(charbuf *output, sem_t sem_type, CSTR base_name, bool_t
       if (!is_full_decl) {
         cg_var_nullability_annotation(output, sem_type);
       }
-      bprintf(output, "%s", name.ptr);
+      bputs(output, name.ptr);
       cg_emit_null_init(output, is_full_decl);
       if (is_full_decl) {
         bprintf(cg_cleanup_output, "  %s(%s);\n", rt->cql_blob_release, name.ptr);
@@ -564,7 +733,7 @@ static void cg_var_decl(charbuf *output, sem_t sem_type, CSTR base_name, bool_t
       if (!is_full_decl) {
         cg_var_nullability_annotation(output, sem_type);
       }
-      bprintf(output, "%s", name.ptr);
+      bputs(output, name.ptr);
       cg_emit_null_init(output, is_full_decl);
       if (is_full_decl) {
         bprintf(cg_cleanup_output, "  %s(%s);\n", rt->cql_object_release, name.ptr);
@@ -644,7 +813,7 @@ static bool_t is_result_set_type(sem_t sem_type, CSTR kind) {
 static void cg_col_reader_type(charbuf *output, sem_t sem_type, CSTR kind, CSTR base_name) {
   if (is_result_set_type(sem_type, kind)) {
     cg_result_set_type_from_kind(output, sem_type, kind);
-    bprintf(output, "%s", base_name);
+    bputs(output, base_name);
   }
   else {
     cg_var_decl(output, sem_type, base_name, CG_VAR_DECL_PROTO);
@@ -702,7 +871,7 @@ static void cg_scratch_var(ast_node *ast, sem_t sem_type, charbuf *var, charbuf
       bprintf(var, "*%s", name);
     }
     else {
-      bprintf(var, "%s", name);
+      bputs(var, name);
     }
   }
   else {
@@ -775,11 +944,11 @@ static void cg_scratch_var(ast_node *ast, sem_t sem_type, charbuf *var, charbuf
       // note that because reference types begin initialized to null we have to check their
       // value even though they are "non-null" so the is_null expression can't be 0 for these ever.
       bprintf(is_null, "!%s", var->ptr);
-      bprintf(value, "%s", var->ptr);
+      bputs(value, var->ptr);
     }
     else if (is_not_nullable(sem_type)) {
       bprintf(is_null, "0");
-      bprintf(value, "%s", var->ptr);
+      bputs(value, var->ptr);
     }
     else {
       bprintf(is_null, "%s.is_null", var->ptr);
@@ -1018,7 +1187,7 @@ static void cg_binary_compare(ast_node *ast, CSTR op, charbuf *is_null, charbuf
   else if (is_blob_op) {
     bool_t logical_not = is_ast_ne(ast) || is_ast_is_not(ast);
     if (logical_not) {
-      bprintf(&comparison, "%s", "!");
+      bputs(&comparison, "!");
     }
     bprintf(&comparison, "%s(%s, %s)", rt->cql_blob_equal, l_value.ptr, r_value.ptr);
   }
@@ -1032,7 +1201,7 @@ static void cg_binary_compare(ast_node *ast, CSTR op, charbuf *is_null, charbuf
   }
 
   if (is_not_nullable(sem_type_left) && is_not_nullable(sem_type_right)) {
-    bprintf(value, "%s", comparison.ptr);
+    bputs(value, comparison.ptr);
     bprintf(is_null, "0");
   }
   else {
@@ -1078,6 +1247,7 @@ static void cg_binary(ast_node *ast, CSTR op, charbuf *is_null, charbuf *value,
   CHARBUF_OPEN(result);
 
   CG_RESERVE_RESULT_VAR(ast, sem_type_result);
+  CG_SHARE_RESULT_VAR_SLOT();
   CG_PUSH_EVAL(l, pri_new);
   CG_PUSH_EVAL(r, pri_new);
 
@@ -1088,7 +1258,7 @@ static void cg_binary(ast_node *ast, CSTR op, charbuf *is_null, charbuf *value,
       bprintf(value, "(%s)", result.ptr);
     }
     else {
-      bprintf(value, "%s", result.ptr);
+      bputs(value, result.ptr);
     }
     bprintf(is_null, "0");
   }
@@ -1228,7 +1398,7 @@ static void cg_expr_is_null(ast_node *expr, charbuf *is_null, charbuf *value) {
   }
   else {
     CG_PUSH_EVAL(expr, C_EXPR_PRI_ROOT);
-    bprintf(value, "%s", expr_is_null.ptr);
+    bputs(value, expr_is_null.ptr);
     CG_POP_EVAL(expr);
   }
 }
@@ -1506,7 +1676,7 @@ static void cg_expr_or(ast_node *ast, CSTR str, charbuf *is_null, charbuf *value
       // Left is not true, it's null or false.  We need the right.
       // We already stored the statements right needs (if any).  Spit those out now.
       CG_PUSH_MAIN_INDENT(r, 2);
-      bprintf(cg_main_output, "%s", right_eval.ptr);
+      bputs(cg_main_output, right_eval.ptr);
 
       if (!is_nullable(sem_type_result)) {
         // If the result is not null then neither of the inputs are null
@@ -1618,7 +1788,7 @@ static void cg_expr_and(ast_node *ast, CSTR str, charbuf *is_null, charbuf *valu
       // Left is not false, it's null or true.  We need the right.
       // We already stored the statements right needs (if any).  Spit those out now.
       CG_PUSH_MAIN_INDENT(r, 2);
-      bprintf(cg_main_output, "%s", right_eval.ptr);
+      bputs(cg_main_output, right_eval.ptr);
 
       if (!is_nullable(sem_type_result)) {
         // If the result is not null then neither of the inputs are null
@@ -1681,6 +1851,7 @@ static void cg_unary(ast_node *ast, CSTR op, charbuf *is_null, charbuf *value, i
 
   CHARBUF_OPEN(result);
   CG_RESERVE_RESULT_VAR(ast, sem_type_result);
+  CG_SHARE_RESULT_VAR_SLOT();
   CG_PUSH_EVAL(expr, pri_new)
 
   if (needs_paren(ast, pri_new, pri)) {
@@ -1695,7 +1866,7 @@ static void cg_unary(ast_node *ast, CSTR op, charbuf *is_null, charbuf *value, i
 
   if (is_not_nullable(sem_type_expr)) {
     bprintf(is_null, "0");
-    bprintf(value, "%s", result.ptr);
+    bputs(value, result.ptr);
   }
   else {
     CG_USE_RESULT_VAR();
@@ -2100,7 +2271,9 @@ static void cg_expr_case(ast_node *case_expr, CSTR str, charbuf *is_null, charbu
     if (is_nullable(sem_type_expr)) {
       else_label_number = ++case_statement_count;
       bprintf(cg_main_output, "  if (%s) ", temp_is_null.ptr);
-      bprintf(cg_main_output, "goto case_else_%d;\n", else_label_number);
+      bprintf(cg_main_output, "goto ");
+      cg_numbered_name("case_else_", 'C', else_label_number, cg_main_output);
+      bprintf(cg_main_output, ";\n");
     }
 
     cg_case_list(case_list, temp_value.ptr, result_var.ptr, sem_type_result);
@@ -2114,7 +2287,8 @@ static void cg_expr_case(ast_node *case_expr, CSTR str, charbuf *is_null, charbu
   }
 
   if (else_label_number >= 0) {
-    bprintf(cg_main_output, "case_else_%d:\n", else_label_number);
+    cg_numbered_name("case_else_", 'C', else_label_number, cg_main_output);
+    bprintf(cg_main_output, ":\n");
   }
 
   // If there is an else clause, spit out the result for that now.
@@ -2194,12 +2368,12 @@ static void cg_expr_cast(ast_node *cast_expr, CSTR str, charbuf *is_null, charbu
 
   if (core_type_expr == core_type_result) {
     // no-op cast, just pass through
-    bprintf(is_null, "%s", expr_is_null.ptr);
-    bprintf(value, "%s", expr_value.ptr);
+    bputs(is_null, expr_is_null.ptr);
+    bputs(value, expr_value.ptr);
   }
   else if (is_not_nullable(sem_type_result)) {
     // simple cast, use the result with no temporary
-    bprintf(value, "%s", result.ptr);
+    bputs(value, result.ptr);
     bprintf(is_null, "0");
   }
   else {
@@ -2217,13 +2391,13 @@ static void cg_expr_cast(ast_node *cast_expr, CSTR str, charbuf *is_null, charbu
 // Here is a helper method for creating the name of the literal.  We use
 // some letters from the text of the literal in the variable name to make it
 // easier to find and recognize.
-static bool_t cg_make_nice_literal_name(CSTR str, charbuf *output) {
+static bool_t cg_make_nice_literal_name(CSTR str, CSTR _Nullable proc_name, charbuf *output) {
   // empty buffer (just the null terminator)
   Contract(output->used == 1);
 
   CSTR existing_name = find_literal(str);
   if (existing_name) {
-    bprintf(output, "%s", existing_name);
+    bputs(output, existing_name);
     return false;
   }
 
@@ -2245,9 +2419,8 @@ static bool_t cg_make_nice_literal_name(CSTR str, charbuf *output) {
     }
   }
 
-  if (current_proc) {
-    EXTRACT_STRING(name, current_proc->left);
-    bprintf(output, "%s", name);
+  if (proc_name) {
+    bputs(output, proc_name);
   }
 
   symtab_add(string_literals, str, Strdup(output->ptr));
@@ -2269,15 +2442,12 @@ static void cg_requote_literal(CSTR str, charbuf *output) {
 // then we declare that variable and emit the initializer.  The macro
 // cql_string_literal does the job for us while allowing the different
 // string implementations.  These go into the constants section.
-static void cg_string_literal(CSTR str, charbuf *output) {
-  Contract(str);
-  Contract(str[0] == '\'');
-
+static void cg_string_literal_name(CSTR str, CSTR _Nullable proc_name, charbuf *output) {
   CHARBUF_OPEN(name);
-  bool_t is_new = cg_make_nice_literal_name(str, &name);
+  bool_t is_new = cg_make_nice_literal_name(str, proc_name, &name);
 
   // Emit reference to a new shared string.
-  bprintf(output, name.ptr);
+  bputs(output, name.ptr);
 
   if (is_new) {
     // The shared string itself must live forever so it goes in global constants.
@@ -2289,6 +2459,26 @@ static void cg_string_literal(CSTR str, charbuf *output) {
   CHARBUF_CLOSE(name);
 }
 
+// The literal numbering depends on every literal that came before, so a proc
+// being emitted on a worker only records the literal, see cg_job_literal.
+static void cg_string_literal(CSTR str, charbuf *output) {
+  Contract(str);
+  Contract(str[0] == '\'');
+
+  CSTR proc_name = NULL;
+  if (current_proc) {
+    EXTRACT_STRING(name, current_proc->left);
+    proc_name = name;
+  }
+
+  if (cg_in_job) {
+    cg_job_literal(str, proc_name, output);
+  }
+  else {
+    cg_string_literal_name(str, proc_name, output);
+  }
+}
+
 // The rewritten between expression is designed to be super easy to code gen.
 // The semantic analyzer has already turned the between or not beween into a normal
 // combination of and/or so all we have to do is load up the temporary with the test
@@ -2347,7 +2537,7 @@ static void cg_id(ast_node *expr, charbuf *is_null, charbuf *value) {
 
   // map the logical @rc variable to the correct saved version
   if (!strcmp(name, "@rc")) {
-    bprintf(value, "%s", rcthrown_current);
+    bputs(value, rcthrown_current);
     bprintf(is_null, "0");
     rcthrown_used = true;
     return;
@@ -2374,7 +2564,7 @@ static void cg_id(ast_node *expr, charbuf *is_null, charbuf *value) {
     // Note that reference type identifiers can't be assumed to be not null
     // even if declared so, because they begin uninitialized.  Yes this is weird.
     // C has the same problem...
-    bprintf(value, "%s", name);
+    bputs(value, name);
     bprintf(is_null, "!%s", name);
   }
   else {
@@ -2383,7 +2573,7 @@ static void cg_id(ast_node *expr, charbuf *is_null, charbuf *value) {
       bprintf(is_null, "%s.is_null", name);
     }
     else {
-      bprintf(value, "%s", name);
+      bputs(value, name);
       bprintf(is_null, "0", name);
     }
   }
@@ -2541,7 +2731,7 @@ static void cg_func_attest_notnull(ast_node *call_ast, charbuf *is_null, charbuf
     }
 
     bprintf(is_null, "0");
-    bprintf(value, "%s", expr_value.ptr);
+    bputs(value, expr_value.ptr);
 
   CG_POP_EVAL(expr);
 }
@@ -2681,7 +2871,7 @@ static void cg_expr_num(ast_node *expr, CSTR op, charbuf *is_null, charbuf *valu
     bprintf(value, "_64(%s)", lit);
   }
   else {
-    bprintf(value, "%s", lit);
+    bputs(value, lit);
   }
 }
 
@@ -2714,6 +2904,70 @@ static void cg_expr_null(ast_node *expr, CSTR op, charbuf *is_null, charbuf *val
   bprintf(is_null, "1");
 }
 
+// If the evaluator can compute the expression at compile time then we emit
+// the result as a literal and skip the scratch variables and null tracking
+// entirely.  Literals (including negated numbers) are already as simple as they
+// get so those are left to the normal path.  A null result is fine too, the
+// expression is then simply known to be null.  We don't fold the few values that
+// have no simple C literal form (smallest int, non-finite reals) nor reals whose
+// printed form would not read back as exactly the same value.
+static bool_t cg_expr_constant(ast_node *expr, charbuf *is_null, charbuf *value, int32_t pri) {
+  if (is_ast_num(expr) || is_ast_null(expr) || is_ast_str(expr)) {
+    return false;
+  }
+
+  if (is_ast_uminus(expr) && is_ast_num(expr->left)) {
+    return false;
+  }
+
+  sem_t sem_type = expr->sem->sem_type;
+  if (!is_numeric(sem_type)) {
+    return false;
+  }
+
+  eval_node result = EVAL_NIL;
+  eval(expr, &result);
+
+  if (result.sem_type == SEM_TYPE_ERROR) {
+    return false;
+  }
+
+  if (result.sem_type == SEM_TYPE_NULL) {
+    bprintf(is_null, "1");
+    bprintf(value, "0");
+    return true;
+  }
+
+  eval_cast_to(&result, core_type_of(sem_type));
+
+  if (result.sem_type == SEM_TYPE_INTEGER && result.int32_value == INT32_MIN) {
+    return false;
+  }
+
+  if (result.sem_type == SEM_TYPE_REAL && !isfinite(result.real_value)) {
+    return false;
+  }
+
+  CHARBUF_OPEN(literal);
+  eval_format_number(&result, EVAL_FORMAT_FOR_C, &literal);
+
+  if (result.sem_type == SEM_TYPE_REAL && strtod(literal.ptr, NULL) != result.real_value) {
+    CHARBUF_CLOSE(literal);
+    return false;
+  }
+
+  if (literal.ptr[0] == '-' && pri >= C_EXPR_PRI_UNARY) {
+    bprintf(value, "(%s)", literal.ptr);
+  }
+  else {
+    bputs(value, literal.ptr);
+  }
+  bprintf(is_null, "0");
+
+  CHARBUF_CLOSE(literal);
+  return true;
+}
+
 // This is the main entry point for codegen of an expression.  It dispatches
 // to one of the above workers for all the complex types and handles a few primitives
 // in place. See the introductory notes to understand is_null and value.
@@ -2723,6 +2977,10 @@ static void cg_expr(ast_node *expr, charbuf *is_null, charbuf *value, int32_t pr
   Contract(value->used == 1);  // just the null (i.e. empty buffer)
   Contract(is_null->used == 1); // just the null (i.e. empty buffer)
 
+  if (cg_expr_constant(expr, is_null, value, pri)) {
+    return;
+  }
+
   // These are all the expressions there are, we have to find it in this table
   // or else someone added a new expression type and it isn't supported yet.
   symtab_entry *entry = symtab_find(cg_exprs, expr->type);
@@ -3167,7 +3425,7 @@ static void cg_param_name(ast_node *ast, charbuf *output) {
   EXTRACT_ANY_NOTNULL(name_ast, param_detail->left)
   EXTRACT_STRING(name, name_ast);
 
-  bprintf(output, "%s", name);
+  bputs(output, name);
 }
 
 // This loops through the parameters and emits each one as part of a call
@@ -3375,6 +3633,27 @@ static void find_identity_columns_callback(CSTR _Nonnull name, ast_node *_Nonnul
   bprintf(output, "  %d, // %s\n", col_index, name);
 }
 
+// If a metadata table with exactly this text has already been emitted then return
+// the name of the proc that owns it, otherwise the current proc becomes the owner.
+// In a job the answer is recorded so the parent can check it against the real owners.
+static CSTR find_result_set_shape_owner(CSTR shape, CSTR proc_name) {
+  symtab_entry *entry = symtab_find(result_set_shapes, shape);
+  CSTR owner = entry ? (CSTR)entry->val : NULL;
+
+  if (!owner) {
+    symtab_add(result_set_shapes, Strdup(shape), (void *)Strdup(proc_name));
+  }
+
+  if (cg_in_job) {
+    cg_job_shape_info *info = bytebuf_new(&job_shapes, cg_job_shape_info);
+    info->shape = Strdup(shape);
+    info->owner = owner;
+    info->proc_name = Strdup(proc_name);
+  }
+
+  return owner;
+}
+
 // Emit the array of identity columns (used by cql_rows_same to determine which columns identify the "same" record)
 // Return 1 if any identity columns were found; otherwise 0
 static bool_t cg_identity_columns(
@@ -3391,8 +3670,21 @@ static bool_t cg_identity_columns(
   CHARBUF_OPEN(cols);
   uint32_t count = find_identity_columns(misc_attrs, &find_identity_columns_callback, &cols);
   if (count > 0) {
-    bprintf(headers_output, "%scql_uint16 %s[];\n\n", rt->symbol_visibility, identity_columns_sym);
-    bprintf(defs_output, "\ncql_uint16 %s[] = { %d,\n%s};\n", identity_columns_sym, count, cols.ptr);
+    // identity columns are only shared along with the rest of the metadata (see cg_proc_result_set)
+    CHARBUF_OPEN(shape);
+    bprintf(&shape, "identity\n%s", cols.ptr);
+    CSTR owner = options.share_result_set_accessors ? find_result_set_shape_owner(shape.ptr, proc_name) : NULL;
+
+    if (owner) {
+      CG_CHARBUF_OPEN_SYM(owner_sym, owner, "_identity_columns");
+      bprintf(headers_output, "#define %s %s\n\n", identity_columns_sym, owner_sym.ptr);
+      CHARBUF_CLOSE(owner_sym);
+    }
+    else {
+      bprintf(headers_output, "%scql_uint16 %s[];\n\n", rt->symbol_visibility, identity_columns_sym);
+      bprintf(defs_output, "\ncql_uint16 %s[] = { %d,\n%s};\n", identity_columns_sym, count, cols.ptr);
+    }
+    CHARBUF_CLOSE(shape);
   }
   CHARBUF_CLOSE(cols);
   return count > 0;
@@ -3856,9 +4148,15 @@ static void cg_create_proc_stmt(ast_node *ast) {
   }
 
   if (options.generate_exports && !private_proc) {
-    gen_set_output_buffer(exports_output);
-    // the declare proc and any other procs it needs due to types with kind object<x SET>
-    gen_declare_proc_closure(ast, emitted_proc_decls);
+    if (cg_in_job) {
+      // which procs are already declared depends on the earlier procs, the parent does this
+      job_exports_needed = true;
+    }
+    else {
+      gen_set_output_buffer(exports_output);
+      // the declare proc and any other procs it needs due to types with kind object<x SET>
+      gen_declare_proc_closure(ast, emitted_proc_decls);
+    }
   }
 
   if (out_union_proc) {
@@ -3879,9 +4177,12 @@ static void cg_create_proc_stmt(ast_node *ast) {
   temp_statement_emitted = saved_temp_emitted;
   seed_declared = saved_seed_declared;
 
-  bprintf(cg_declarations_output, proc_fwd_ref.ptr);
+  // The proc was emitted into its own buffers, now we stitch them together in
+  // source order.  These are finished text, they are copied verbatim and must
+  // never be used as format strings.
+  bputs(cg_declarations_output, proc_fwd_ref.ptr);
   bprintf(cg_declarations_output, "%s) {\n", proc_decl.ptr);
-  bprintf(cg_declarations_output, proc_contracts.ptr);
+  bputs(cg_declarations_output, proc_contracts.ptr);
 
   if (dml_proc) {
     cg_emit_rc_vars(cg_declarations_output);
@@ -3900,7 +4201,7 @@ static void cg_create_proc_stmt(ast_node *ast) {
     bprintf(cg_declarations_output, "\n");
   }
 
-  bprintf(cg_declarations_output, "%s", proc_body.ptr);
+  bputs(cg_declarations_output, proc_body.ptr);
 
   cg_line_directive_max(ast, cg_declarations_output);
 
@@ -3928,7 +4229,7 @@ static void cg_create_proc_stmt(ast_node *ast) {
   }
 
   if (proc_cleanup.used > 1) {
-    bprintf(cg_declarations_output, proc_cleanup.ptr);
+    bputs(cg_declarations_output, proc_cleanup.ptr);
     empty_statement_needed = false;
   }
 
@@ -4088,7 +4389,7 @@ static void cg_declare_simple_var(sem_t sem_type, CSTR name) {
     cg_var_decl(cg_declarations_output, sem_type, name, CG_VAR_DECL_FULL);
   }
   if (!in_proc && !in_var_group_emit) {
-    bprintf(cg_header_output, "%s", rt->symbol_visibility);
+    bputs(cg_header_output, rt->symbol_visibility);
     cg_var_decl(cg_header_output, sem_type, name, CG_VAR_DECL_PROTO);
     bprintf(cg_header_output, ";\n");
   }
@@ -4115,6 +4416,12 @@ static void cg_declare_vars_type(ast_node *declare_vars_type) {
 // it will call us every time it finds a variable that needs to be bound.  That
 // variable is replaced by ? in the SQL output.  We end up with a list of variables
 // to bind on a silver platter (but in reverse order).
+//
+// A variable that is used more than once in the statement is bound only once,
+// the later uses refer back to the first binding with ?N.  SQLite numbers a
+// plain ? one past the largest parameter number seen so far so the first use of
+// each variable can stay a plain ?.  With conditional fragments some of the text
+// may not be included at runtime so there every use gets its explicit number.
 static bool_t cg_capture_variables(ast_node *ast, void *context, charbuf *buffer) {
   // all variables have a name
   Contract(ast->sem->name);
@@ -4140,9 +4447,45 @@ static bool_t cg_capture_variables(ast_node *ast, void *context, charbuf *buffer
   }
 
   list_item **head = (list_item**)context;
+
+  if (!bound_variable_slots) {
+    // not binding anything (e.g. just checking for variables)
+    add_item_to_list(head, ast);
+    bprintf(buffer, "?");
+    return true;
+  }
+
+  cg_variable_use *use = bytebuf_new(&bound_variable_uses, cg_variable_use);
+
+  // the same name with a different type (e.g. after nullability improvements)
+  // gets its own slot, the binding has to match the type exactly
+  symtab_entry *bound_entry = symtab_find(bound_variable_slots, ast->sem->name);
+  cg_bound_variable *bound = bound_entry ? (cg_bound_variable *)bound_entry->val : NULL;
+  if (bound && bound->ast->sem->sem_type == ast->sem->sem_type) {
+    use->slot = bound->slot;
+    use->repeat = true;
+    bprintf(buffer, "?%d", use->slot + 1);
+    return true;
+  }
+
+  // a fresh binding, it gets the next slot
+  use->slot = bound_variable_count++;
+  use->repeat = false;
   add_item_to_list(head, ast);
 
-  bprintf(buffer, "?");
+  if (!bound) {
+    bound = _ast_pool_new(cg_bound_variable);
+    bound->ast = ast;
+    bound->slot = use->slot;
+    symtab_add(bound_variable_slots, ast->sem->name, bound);
+  }
+
+  if (has_conditional_fragments) {
+    bprintf(buffer, "?%d", use->slot + 1);
+  }
+  else {
+    bprintf(buffer, "?");
+  }
   return true;
 }
 
@@ -4177,7 +4520,7 @@ static bool_t cg_table_rename(ast_node *ast, void *context, charbuf *buffer) {
   if (entry) {
     EXTRACT(cte_binding, entry->val);
     EXTRACT_STRING(actual, cte_binding->left);
-    bprintf(buffer, "%s", actual);
+    bputs(buffer, actual);
     handled = true;
   }
 
@@ -4284,7 +4627,7 @@ static void cg_fetch_column(sem_t sem_type, CSTR var) {
     bprintf(cg_main_output, "&");
   }
 
-  bprintf(cg_main_output, "%s", var);
+  bputs(cg_main_output, var);
 }
 
 // CQL uses the helper method cql_multibind to bind all the columns to a statement
@@ -4385,10 +4728,15 @@ static void cg_flush_piece(CSTR start, CSTR cur, charbuf *output) {
     start++;
   }
 
-  int32_t offset = cg_intern_piece(temp.ptr, len);
-  CHARBUF_CLOSE(temp);
+  if (cg_in_job) {
+    cg_job_piece(temp.ptr, len, output);
+  }
+  else {
+    int32_t offset = cg_intern_piece(temp.ptr, len);
+    cg_varinteger(offset + 1, output);
+  }
 
-  cg_varinteger(offset + 1, output);
+  CHARBUF_CLOSE(temp);
 }
 
 // Break the input string into pieces that are likely to be shared, assign each
@@ -4479,6 +4827,16 @@ static int32_t cg_fragment_count() {
   return (int32_t)(shared_fragment_strings.used / sizeof(CSTR));
 }
 
+// True if any of the uses in [first, limit) refers to the given slot.
+static bool_t cg_slot_used_in_range(cg_variable_use *uses, int32_t first, int32_t limit, int32_t slot) {
+  for (int32_t i = first; i < limit; i++) {
+    if (uses[i].slot == slot) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // when we complete a chunk of fragment text we have to emit the predicates
 // for the variables that were in that chunk.  We do this in the same
 // context as the conditional for that string.
@@ -4487,11 +4845,24 @@ static void cg_flush_variable_predicates() {
     return;
   }
 
+  cg_variable_use *uses = (cg_variable_use *)bound_variable_uses.ptr;
+
+  // a slot is bound if any of its uses is in a fragment that is included, so
+  // the uses after the first one can only turn the predicate on
+  int32_t first = prev_variable_count;
+
   while (prev_variable_count < cur_variable_count) {
+    cg_variable_use *use = &uses[prev_variable_count++];
+
+    if (cg_slot_used_in_range(uses, first, prev_variable_count - 1, use->slot)) {
+      // already covered by an earlier use in this same chunk of text
+      continue;
+    }
+
     if (cur_fragment_predicate == 0 || cur_fragment_predicate + 1 == max_fragment_predicate) {
       bprintf(cg_main_output, "_vpreds_%d[%d] = 1; // pred %d known to be 1\n",
       cur_bound_statement,
-      prev_variable_count++,
+      use->slot,
       cur_fragment_predicate);
     }
     else {
@@ -4499,9 +4870,10 @@ static void cg_flush_variable_predicates() {
       // for that context which was set in an earlier block.
       // TODO: I think we can prove that it's always true in the code block we are in
       // so this could be = 1 and hence is the same as the above.
-      bprintf(cg_main_output, "_vpreds_%d[%d] = _preds_%d[%d];\n",
+      bprintf(cg_main_output, "_vpreds_%d[%d] %s _preds_%d[%d];\n",
         cur_bound_statement,
-        prev_variable_count++,
+        use->slot,
+        use->repeat ? "|=" : "=",
         cur_bound_statement,
         cur_fragment_predicate);
     }
@@ -5030,6 +5402,9 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
   int32_t stmt_index = 0;
 
   bytebuf_open(&shared_fragment_strings);
+  bytebuf_open(&bound_variable_uses);
+  bound_variable_slots = symtab_new();
+  bound_variable_count = 0;
 
   if (stmt_name && !strcmp("_result", stmt_name)) {
     // predefined out argument
@@ -5072,6 +5447,8 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
   gen_set_output_buffer(&sql);
   gen_statement_with_callbacks(stmt, &callbacks);
 
+  SYMTAB_CLEANUP(bound_variable_slots);
+
   // whether or not there is a prepare statement
   bool_t has_prepare_stmt = !exec_only || vars;
 
@@ -5100,7 +5477,7 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
     CHARBUF_OPEN(t2);
       cg_pretty_quote_plaintext(sql.ptr, &t2, PRETTY_QUOTE_C | PRETTY_QUOTE_MULTI_LINE);
       cg_remove_slash_star_and_star_slash(&t2); // internal "*/" is fatal. "/*" can also be under certain compilation flags
-      bprintf(cg_main_output, "%s", t2.ptr);
+      bputs(cg_main_output, t2.ptr);
     CHARBUF_CLOSE(t2);
     bprintf(cg_main_output, " */\n");
 
@@ -5142,7 +5519,7 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
         bprintf(cg_main_output, "%d, _preds_%d,\n", scount, cur_bound_statement);
         bprintf(cg_declarations_output, "char _preds_%d[%d];\n", cur_bound_statement, scount);
         if (has_variables) {
-          bprintf(cg_declarations_output, "char _vpreds_%d[%d];\n", cur_bound_statement, cur_variable_count);
+          bprintf(cg_declarations_output, "char _vpreds_%d[%d];\n", cur_bound_statement, bound_variable_count);
         }
       }
       else {
@@ -5206,6 +5583,7 @@ static int32_t cg_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_t cg
 
   // vars is pool allocated, so we don't need to free it
   bytebuf_close(&shared_fragment_strings);
+  bytebuf_close(&bound_variable_uses);
 
   return stmt_index;
 }
@@ -5486,7 +5864,7 @@ static void cg_emit_one_const_group(ast_node *ast) {
 
        EXTRACT_STRING(literal, const_value->right);
        cg_requote_literal(literal, &quoted);
-       bprintf(cg_header_output, "%s", quoted.ptr);
+       bputs(cg_header_output, quoted.ptr);
 
        CHARBUF_CLOSE(quoted);
      }
@@ -5902,7 +6280,8 @@ static void cg_fetch_stmt(ast_node *ast) {
       db_sym, cursor_name, cursor_name, sptr->count);
   }
   else {
-    bprintf(cg_main_output, "cql_multifetch(_rc_, %s_stmt, %d", cursor_name, sptr->count);
+    CSTR multifetch = cg_fetch_borrowed ? "cql_multifetch_borrowed" : "cql_multifetch";
+    bprintf(cg_main_output, "%s(_rc_, %s_stmt, %d", multifetch, cursor_name, sptr->count);
   }
 
 
@@ -5915,7 +6294,7 @@ static void cg_fetch_stmt(ast_node *ast) {
       EXTRACT_ANY_NOTNULL(name_ast, item->left);
       EXTRACT_STRING(var, name_ast);
       sem_t sem_type_var = name_ast->sem->sem_type;
-      bprintf(cg_main_output, "%s", newline);
+      bputs(cg_main_output, newline);
       cg_fetch_column(sem_type_var, var);
     }
   }
@@ -5923,7 +6302,7 @@ static void cg_fetch_stmt(ast_node *ast) {
     for (int32_t i = 0; i < sptr->count; i++) {
       CHARBUF_OPEN(temp);
       bprintf(&temp, "%s.%s", cursor_name, sptr->names[i]);
-      bprintf(cg_main_output, "%s", newline);
+      bputs(cg_main_output, newline);
       cg_fetch_column(sptr->semtypes[i], temp.ptr);
       CHARBUF_CLOSE(temp);
     }
@@ -6122,6 +6501,36 @@ static void cg_while_stmt(ast_node *ast) {
   cg_in_loop = loop_saved;
 }
 
+// With --borrow_loop_fetch, a LOOP FETCH from a statement into the cursor's own
+// storage reads its strings and blobs as borrowed views (see cql_multifetch_borrowed).
+// There's only something to gain if the cursor has reference columns.
+static bool_t cg_loop_fetch_can_borrow(ast_node *fetch_stmt) {
+  EXTRACT(name_list, fetch_stmt->right);
+  sem_t sem_type = fetch_stmt->sem->sem_type;
+
+  if (!options.borrow_loop_fetch || name_list) {
+    return false;
+  }
+
+  if ((sem_type & SEM_TYPE_USES_OUT_UNION) || !(sem_type & SEM_TYPE_HAS_SHAPE_STORAGE)) {
+    return false;
+  }
+
+  return refs_count_sptr(fetch_stmt->left->sem->sptr) > 0;
+}
+
+// If the loop is left early the cursor still holds views of the current row,
+// those have to become real copies before the statement moves on.
+static void cg_own_borrowed_refs(CSTR cursor_name, sem_struct *sptr) {
+  bprintf(cg_main_output, "cql_own_borrowed_refs(%d", refs_count_sptr(sptr));
+  for (int32_t i = 0; i < sptr->count; i++) {
+    if (is_ref_type(sptr->semtypes[i])) {
+      bprintf(cg_main_output, ", &%s.%s", cursor_name, sptr->names[i]);
+    }
+  }
+  bprintf(cg_main_output, ");\n");
+}
+
 // The general pattern for this is very simple:
 //   for (;;) {
 //     do the fetch;
@@ -6141,10 +6550,14 @@ static void cg_loop_stmt(ast_node *ast) {
 
   // LOOP [fetch_stmt] BEGIN [stmt_list] END
 
+  bool_t borrowed = cg_loop_fetch_can_borrow(fetch_stmt);
+
   bprintf(cg_main_output, "for (;;) {\n");
   CG_PUSH_MAIN_INDENT(loop, 2);
 
+  cg_fetch_borrowed = borrowed;
   cg_fetch_stmt(fetch_stmt);
+  cg_fetch_borrowed = false;
 
   if (fetch_stmt->left->sem->sem_type & SEM_TYPE_HAS_SHAPE_STORAGE) {
     bprintf(cg_main_output, "if (!%s._has_row_) break;\n", cursor_name);
@@ -6163,6 +6576,10 @@ static void cg_loop_stmt(ast_node *ast) {
 
   bprintf(cg_main_output, "}\n");
 
+  if (borrowed) {
+    cg_own_borrowed_refs(cursor_name, fetch_stmt->left->sem->sptr);
+  }
+
   cg_in_loop = loop_saved;
 }
 
@@ -6400,7 +6817,7 @@ static void cg_emit_external_arglist(ast_node *arg_list, charbuf *prep, charbuf
 
       EXTRACT_STRING(literal, arg);
       cg_requote_literal(literal, &quoted);
-      bprintf(invocation, "%s", quoted.ptr);
+      bputs(invocation, quoted.ptr);
 
       CHARBUF_CLOSE(quoted);
     }
@@ -6410,12 +6827,15 @@ static void cg_emit_external_arglist(ast_node *arg_list, charbuf *prep, charbuf
       if (is_text(sem_type_arg)) {
         // external/unknown proc, convert to cstr first
         temp_cstr_count++;
-        bprintf(prep, "cql_alloc_cstr(_cstr_%d, %s);\n", temp_cstr_count, arg_value.ptr);
-        bprintf(invocation, "_cstr_%d", temp_cstr_count);
-        bprintf(cleanup, "cql_free_cstr(_cstr_%d, %s);\n", temp_cstr_count, arg_value.ptr);
+        CHARBUF_OPEN(cstr_name);
+        cg_numbered_name("_cstr_", 'S', temp_cstr_count, &cstr_name);
+        bprintf(prep, "cql_alloc_cstr(%s, %s);\n", cstr_name.ptr, arg_value.ptr);
+        bputs(invocation, cstr_name.ptr);
+        bprintf(cleanup, "cql_free_cstr(%s, %s);\n", cstr_name.ptr, arg_value.ptr);
+        CHARBUF_CLOSE(cstr_name);
       }
       else {
-        bprintf(invocation, "%s", arg_value.ptr);
+        bputs(invocation, arg_value.ptr);
       }
 
       CG_POP_EVAL(arg);
@@ -6453,7 +6873,7 @@ static void cg_emit_one_arg(ast_node *arg, sem_t sem_type_param, sem_t sem_type_
     if (is_out_parameter(sem_type_param)) {
       Contract(is_variable(sem_type_arg));  // previously checked (semantic pass)
       if (is_out_parameter(sem_type_arg)) {
-        bprintf(invocation, "%s", arg->sem->name);
+        bputs(invocation, arg->sem->name);
       }
       else {
         bprintf(invocation, "&%s", arg->sem->name);
@@ -6470,7 +6890,7 @@ static void cg_emit_one_arg(ast_node *arg, sem_t sem_type_param, sem_t sem_type_
 
     if (is_ref_type(sem_type_arg)) {
       // normal case, pass the reference
-      bprintf(invocation, "%s", arg_value.ptr);
+      bputs(invocation, arg_value.ptr);
       break;
     }
 
@@ -6479,13 +6899,15 @@ static void cg_emit_one_arg(ast_node *arg, sem_t sem_type_param, sem_t sem_type_
        must_box_arg |= is_ast_null(arg);
        must_box_arg |= is_not_nullable(sem_type_arg);
        must_box_arg |= core_type_of(sem_type_arg) != core_type_of(sem_type_param);
+       // a nullable expression that was folded to a constant has no variable to pass
+       must_box_arg |= !strcmp(arg_is_null.ptr, "0") || !strcmp(arg_is_null.ptr, "1");
     }
 
     if (must_box_arg) {
       // we have to pass a nullable of the exact type, box to that.
       CG_PUSH_TEMP(box_var, sem_type_param);
       cg_store(cg_main_output, box_var.ptr, sem_type_param, sem_type_arg, arg_is_null.ptr, arg_value.ptr);
-      bprintf(invocation, "%s", box_var.ptr);
+      bputs(invocation, box_var.ptr);
       CG_POP_TEMP(box_var);
       // burn the stack slot for the temporary, it can't be re-used during the call
       stack_level++;
@@ -6525,7 +6947,7 @@ static void cg_emit_one_arg(ast_node *arg, sem_t sem_type_param, sem_t sem_type_
     }
 
     // either way arg_value is now correct
-    bprintf(invocation, "%s", arg_value.ptr);
+    bputs(invocation, arg_value.ptr);
   }  while (0);
 
   CG_POP_EVAL(arg);
@@ -6879,7 +7301,7 @@ static void cg_call_stmt_with_cursor(ast_node *ast, CSTR cursor_name) {
     bprintf(&invocation, ");\n");
   }
 
-  bprintf(cg_main_output, "%s", invocation.ptr);
+  bputs(cg_main_output, invocation.ptr);
 
   if (out_union_proc && cursor_name) {
     // case 3a, capturing the cursor, we set the row index to -1 (it will be pre-incremented)
@@ -7012,8 +7434,8 @@ static void cg_trycatch_helper(ast_node *try_list, ast_node *try_extras, ast_nod
 
   // We need unique labels for this block
   ++catch_block_count;
-  bprintf(&catch_start, "catch_start_%d", catch_block_count);
-  bprintf(&catch_end, "catch_end_%d", catch_block_count);
+  cg_numbered_name("catch_start_", 'K', catch_block_count, &catch_start);
+  cg_numbered_name("catch_end_", 'K', catch_block_count, &catch_end);
 
   // Divert the error target.
   CSTR saved_error_target = error_target;
@@ -7064,7 +7486,7 @@ static void cg_trycatch_helper(ast_node *try_list, ast_node *try_extras, ast_nod
       bprintf(cg_main_output, "  int32_t %s = _rc_;\n", rcthrown.ptr);
     }
 
-    bprintf(cg_main_output, "%s", catch_block.ptr);
+    bputs(cg_main_output, catch_block.ptr);
 
   CHARBUF_CLOSE(catch_block);
 
@@ -7234,17 +7656,17 @@ static void cg_one_stmt(ast_node *stmt, ast_node *misc_attrs) {
       }
       gen_one_stmt(stmt);
       cg_remove_slash_star_and_star_slash(&tmp); // internal "*/" is fatal. "/*" can also be under certain compilation flags
-      bprintf(out, "%s", tmp.ptr);
+      bputs(out, tmp.ptr);
       CHARBUF_CLOSE(tmp);
       bprintf(out, ";\n*/\n");
     }
   }
 
   // and finally write what we saved
-  bprintf(cg_main_output, "%s", tmp_main.ptr);
-  bprintf(cg_header_output, "%s", tmp_header.ptr);
-  bprintf(cg_scratch_vars_output, "%s", tmp_scratch.ptr);
-  bprintf(cg_declarations_output, "%s", tmp_declarations.ptr);
+  bputs(cg_main_output, tmp_main.ptr);
+  bputs(cg_header_output, tmp_header.ptr);
+  bputs(cg_scratch_vars_output, tmp_scratch.ptr);
+  bputs(cg_declarations_output, tmp_declarations.ptr);
 
   CHARBUF_CLOSE(tmp_scratch);
   CHARBUF_CLOSE(tmp_main);
@@ -7252,6 +7674,417 @@ static void cg_one_stmt(ast_node *stmt, ast_node *misc_attrs) {
   CHARBUF_CLOSE(tmp_header);
 }
 
+// The outputs a top level statement can write to, a job captures each of these per proc.
+static charbuf **const cg_job_outputs[] = {
+  &cg_header_output,
+  &cg_main_output,
+  &cg_fwd_ref_output,
+  &cg_constants_output,
+  &cg_declarations_output,
+  &cg_scratch_vars_output,
+  &cg_cleanup_output,
+  &cg_pieces_output,
+};
+
+#define CG_JOB_OUTPUTS_COUNT ((int32_t)(sizeof(cg_job_outputs) / sizeof(cg_job_outputs[0])))
+
+static void cg_job_put_int(bytebuf *buf, int32_t val) {
+  bytebuf_append_var(buf, val);
+}
+
+// strings are stored with their nil terminator so they can be used in place, NULL is size 0
+static void cg_job_put_str(bytebuf *buf, CSTR _Nullable str) {
+  int32_t size = str ? (int32_t)strlen(str) + 1 : 0;
+  cg_job_put_int(buf, size);
+  if (size) {
+    bytebuf_append(buf, str, (uint32_t)size);
+  }
+}
+
+static int32_t cg_job_get_int(CSTR *cursor) {
+  int32_t val;
+  memcpy(&val, *cursor, sizeof(val));
+  *cursor += sizeof(val);
+  return val;
+}
+
+static CSTR _Nullable cg_job_get_str(CSTR *cursor) {
+  int32_t size = cg_job_get_int(cursor);
+  CSTR str = size ? *cursor : NULL;
+  *cursor += size;
+  return str;
+}
+
+// Copy job output to the real output replacing each placeholder with what it resolved to.
+// Numbered names are offset by the counts used before the proc.
+static void cg_job_resolve(CSTR text, CSTR *literals, CSTR *pieces, cg_job_counts *base, charbuf *output) {
+  for (;;) {
+    CSTR marker = strchr(text, CG_JOB_MARKER);
+    if (!marker) {
+      bputs(output, text);
+      return;
+    }
+
+    bprintf(output, "%.*s", (int)(marker - text), text);
+
+    char *end;
+    long index = strtol(marker + 2, &end, 10);
+    Invariant(*end == CG_JOB_MARKER);
+
+    switch (marker[1]) {
+      case 'L': bputs(output, literals[index]); break;
+      case 'P': bputs(output, pieces[index]); break;
+      case 'C': bprintf(output, "%d", base->cases + (int32_t)index); break;
+      case 'K': bprintf(output, "%d", base->catches + (int32_t)index); break;
+      default:
+        Invariant(marker[1] == 'S');
+        bprintf(output, "%d", base->cstrs + (int32_t)index);
+        break;
+    }
+    text = end + 1;
+  }
+}
+
+// True if any text in the tree has the job marker in it.  Everything the compiler writes
+// other than its own text comes from the tree, so if this is false the marker can only
+// appear in job output as part of a placeholder.
+static bool_t cg_job_marker_in_tree(ast_node *ast) {
+  for (; ast; ast = ast->right) {
+    if (is_ast_str(ast) || is_ast_num(ast) || is_ast_blob(ast)) {
+      // str, num, and blob nodes all have the text in the same place
+      CSTR value = is_ast_num(ast) ? ((num_ast_node *)ast)->value : ((str_ast_node *)ast)->value;
+      return (value && strchr(value, CG_JOB_MARKER)) || strchr(ast->filename, CG_JOB_MARKER);
+    }
+
+    if (is_primitive(ast)) {
+      return false;
+    }
+
+    if (cg_job_marker_in_tree(ast->left)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// This runs on a worker: emit one top level statement into fresh buffers.  If there is
+// a record then the buffers and everything the statement recorded are appended to it.
+static void cg_job_emit_one(ast_node *stmt, ast_node *misc_attrs, int32_t proc_index, bytebuf *_Nullable record) {
+  charbuf outputs[CG_JOB_OUTPUTS_COUNT];
+  charbuf *saved_outputs[CG_JOB_OUTPUTS_COUNT];
+
+  for (int32_t i = 0; i < CG_JOB_OUTPUTS_COUNT; i++) {
+    bopen(&outputs[i]);
+    saved_outputs[i] = *cg_job_outputs[i];
+    *cg_job_outputs[i] = &outputs[i];
+  }
+
+  bytebuf_open(&job_literals);
+  bytebuf_open(&job_pieces);
+  bytebuf_open(&job_shapes);
+  job_exports_needed = false;
+
+  // numbered names are written relative to the start of the statement
+  case_statement_count = 0;
+  catch_block_count = 0;
+  temp_cstr_count = 0;
+
+  cg_one_stmt(stmt, misc_attrs);
+
+  if (record) {
+    cg_job_put_int(record, proc_index);
+    cg_job_put_int(record, job_exports_needed);
+    cg_job_put_int(record, case_statement_count);
+    cg_job_put_int(record, catch_block_count);
+    cg_job_put_int(record, temp_cstr_count);
+
+    for (int32_t i = 0; i < CG_JOB_OUTPUTS_COUNT; i++) {
+      cg_job_put_str(record, outputs[i].ptr);
+    }
+
+    int32_t literals_count = (int32_t)(job_literals.used / sizeof(cg_job_literal_info));
+    cg_job_put_int(record, literals_count);
+    for (int32_t i = 0; i < literals_count; i++) {
+      cg_job_literal_info *info = &((cg_job_literal_info *)job_literals.ptr)[i];
+      cg_job_put_str(record, info->text);
+      cg_job_put_str(record, info->proc_name);
+    }
+
+    int32_t pieces_count = (int32_t)(job_pieces.used / sizeof(cg_job_piece_info));
+    cg_job_put_int(record, pieces_count);
+    for (int32_t i = 0; i < pieces_count; i++) {
+      cg_job_piece_info *info = &((cg_job_piece_info *)job_pieces.ptr)[i];
+      cg_job_put_str(record, info->text);
+      cg_job_put_int(record, info->len);
+    }
+
+    int32_t shapes_count = (int32_t)(job_shapes.used / sizeof(cg_job_shape_info));
+    cg_job_put_int(record, shapes_count);
+    for (int32_t i = 0; i < shapes_count; i++) {
+      cg_job_shape_info *info = &((cg_job_shape_info *)job_shapes.ptr)[i];
+      cg_job_put_str(record, info->shape);
+      cg_job_put_str(record, info->owner);
+      cg_job_put_str(record, info->proc_name);
+    }
+  }
+
+  bytebuf_close(&job_shapes);
+  bytebuf_close(&job_pieces);
+  bytebuf_close(&job_literals);
+
+  for (int32_t i = 0; i < CG_JOB_OUTPUTS_COUNT; i++) {
+    *cg_job_outputs[i] = saved_outputs[i];
+    bclose(&outputs[i]);
+  }
+}
+
+// This runs on a worker: emit procs [first, last) of the top level statement list and
+// write their records to the file.  The other top level statements before the last proc
+// are emitted too, and their output discarded, because they can change how later code
+// is generated (e.g. the blob mapping declarations for backed tables).  Earlier procs are
+// skipped, what they would change is exactly what gets recorded.
+static void cg_job_emit_procs(ast_node *head, int32_t first, int32_t last, FILE *file) {
+  cg_in_job = true;
+  int32_t proc_index = 0;
+
+  for (ast_node *ast = head; ast && proc_index < last; ast = ast->right) {
+    EXTRACT_STMT_AND_MISC_ATTRS(stmt, misc_attrs, ast);
+
+    if (!is_ast_create_proc_stmt(stmt)) {
+      cg_job_emit_one(stmt, misc_attrs, -1, NULL);
+    }
+    else if (proc_index++ >= first) {
+      bytebuf record;
+      bytebuf_open(&record);
+      cg_job_emit_one(stmt, misc_attrs, proc_index - 1, &record);
+      fwrite(record.ptr, 1, record.used, file);
+      bytebuf_close(&record);
+    }
+  }
+
+  cg_in_job = false;
+}
+
+// Stitch one proc emitted by a worker into the real outputs.  The record is always
+// consumed.  The literals and pieces are resolved in the order the proc used them, and
+// the labels and temporaries are offset by the counts so far, which numbers them all
+// exactly as if the proc had been emitted here.  If the worker's answers
+// about shared result set shapes don't match the real owners (an earlier worker emitted
+// the same shape first) the proc's code is wrong and we return false, the caller then
+// emits the proc normally.
+static bool_t cg_job_merge(CSTR *cursor, int32_t proc_index, ast_node *stmt) {
+  int32_t index = cg_job_get_int(cursor);
+  Invariant(index == proc_index);
+
+  bool_t exports_needed = !!cg_job_get_int(cursor);
+
+  cg_job_counts counts;
+  counts.cases = cg_job_get_int(cursor);
+  counts.catches = cg_job_get_int(cursor);
+  counts.cstrs = cg_job_get_int(cursor);
+
+  CSTR outputs[CG_JOB_OUTPUTS_COUNT];
+  for (int32_t i = 0; i < CG_JOB_OUTPUTS_COUNT; i++) {
+    outputs[i] = cg_job_get_str(cursor);
+  }
+
+  int32_t literals_count = cg_job_get_int(cursor);
+  cg_job_literal_info *literals = _new_array(cg_job_literal_info, (literals_count + 1));
+  for (int32_t i = 0; i < literals_count; i++) {
+    literals[i].text = cg_job_get_str(cursor);
+    literals[i].proc_name = cg_job_get_str(cursor);
+  }
+
+  int32_t pieces_count = cg_job_get_int(cursor);
+  cg_job_piece_info *pieces = _new_array(cg_job_piece_info, (pieces_count + 1));
+  for (int32_t i = 0; i < pieces_count; i++) {
+    pieces[i].text = cg_job_get_str(cursor);
+    pieces[i].len = cg_job_get_int(cursor);
+  }
+
+  int32_t shapes_count = cg_job_get_int(cursor);
+  cg_job_shape_info *shapes = _new_array(cg_job_shape_info, (shapes_count + 1));
+  for (int32_t i = 0; i < shapes_count; i++) {
+    shapes[i].shape = cg_job_get_str(cursor);
+    shapes[i].owner = cg_job_get_str(cursor);
+    shapes[i].proc_name = cg_job_get_str(cursor);
+  }
+
+  // replay the shape lookups against the real owners, the proc's own new shapes count
+  symtab *added = symtab_new_case_sens();
+  bool_t current = true;
+
+  for (int32_t i = 0; i < shapes_count && current; i++) {
+    symtab_entry *entry = symtab_find(added, shapes[i].shape);
+    if (!entry) {
+      entry = symtab_find(result_set_shapes, shapes[i].shape);
+    }
+    CSTR owner = entry ? (CSTR)entry->val : NULL;
+
+    if (!owner) {
+      current = !shapes[i].owner;
+      symtab_add(added, shapes[i].shape, (void *)shapes[i].proc_name);
+    }
+    else {
+      current = shapes[i].owner && !strcmp(owner, shapes[i].owner);
+    }
+  }
+
+  symtab_delete(added);
+
+  if (current) {
+    for (int32_t i = 0; i < shapes_count; i++) {
+      if (!shapes[i].owner) {
+        symtab_add(result_set_shapes, Strdup(shapes[i].shape), (void *)Strdup(shapes[i].proc_name));
+      }
+    }
+
+    CSTR *literal_names = _new_array(CSTR, (literals_count + 1));
+    for (int32_t i = 0; i < literals_count; i++) {
+      CHARBUF_OPEN(name);
+      cg_string_literal_name(literals[i].text, literals[i].proc_name, &name);
+      literal_names[i] = Strdup(name.ptr);
+      CHARBUF_CLOSE(name);
+    }
+
+    CSTR *piece_ids = _new_array(CSTR, (pieces_count + 1));
+    for (int32_t i = 0; i < pieces_count; i++) {
+      CHARBUF_OPEN(id);
+      cg_varinteger(cg_intern_piece(pieces[i].text, pieces[i].len) + 1, &id);
+      piece_ids[i] = Strdup(id.ptr);
+      CHARBUF_CLOSE(id);
+    }
+
+    if (exports_needed) {
+      gen_set_output_buffer(exports_output);
+      gen_declare_proc_closure(stmt, emitted_proc_decls);
+    }
+
+    cg_job_counts base = { case_statement_count, catch_block_count, temp_cstr_count };
+    for (int32_t i = 0; i < CG_JOB_OUTPUTS_COUNT; i++) {
+      cg_job_resolve(outputs[i], literal_names, piece_ids, &base, *cg_job_outputs[i]);
+    }
+
+    case_statement_count += counts.cases;
+    catch_block_count += counts.catches;
+    temp_cstr_count += counts.cstrs;
+
+    free(piece_ids);
+    free(literal_names);
+  }
+
+  free(shapes);
+  free(pieces);
+  free(literals);
+
+  return current;
+}
+
+// Emit the top level statements with the procs spread over options.jobs worker processes.
+// Each worker takes a contiguous run of procs, emits them, and writes them to a temporary
+// file.  Then we walk the statements in source order: other statements are emitted here
+// as usual and each proc is stitched in from its worker's file.  If anything goes wrong
+// with the workers all the procs are emitted here, so the output never depends on the
+// number of workers.  Returns false if there's no point in using workers.
+static bool_t cg_stmt_list_with_jobs(ast_node *head) {
+#ifdef _WIN32
+  return false;
+#else
+  int32_t procs_count = 0;
+  for (ast_node *ast = head; ast; ast = ast->right) {
+    EXTRACT_STMT(stmt, ast);
+    procs_count += is_ast_create_proc_stmt(stmt);
+  }
+
+  int32_t jobs = options.jobs < procs_count ? options.jobs : procs_count;
+  if (jobs < 2 || cg_job_marker_in_tree(head)) {
+    return false;
+  }
+
+  FILE **files = _new_array(FILE *, jobs);
+  pid_t *pids = _new_array(pid_t, jobs);
+  int32_t started = 0;
+  bool_t ok = true;
+
+  // anything buffered would otherwise be written again by each worker
+  fflush(NULL);
+
+  for (; started < jobs; started++) {
+    files[started] = tmpfile();
+    if (!files[started]) {
+      ok = false;
+      break;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      fclose(files[started]);
+      ok = false;
+      break;
+    }
+
+    if (pid == 0) {
+      int32_t first = (int32_t)((int64_t)procs_count * started / jobs);
+      int32_t last = (int32_t)((int64_t)procs_count * (started + 1) / jobs);
+      cg_job_emit_procs(head, first, last, files[started]);
+      _exit(fflush(files[started]) ? 1 : 0);
+    }
+
+    pids[started] = pid;
+  }
+
+  char **records = _new_array(char *, (started + 1));
+  CSTR *cursors = _new_array(CSTR, (started + 1));
+
+  for (int32_t j = 0; j < started; j++) {
+    int status;
+    if (waitpid(pids[j], &status, 0) != pids[j] || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      ok = false;
+    }
+
+    // every proc in the job has a record so there is always something in the file
+    fseek(files[j], 0, SEEK_END);
+    long size = ftell(files[j]);
+    records[j] = _new_array(char, (size > 0 ? size : 1));
+    rewind(files[j]);
+
+    ok &= size > 0 && fread(records[j], 1, (size_t)size, files[j]) == (size_t)size;
+    fclose(files[j]);
+    cursors[j] = records[j];
+  }
+
+  int32_t proc_index = 0;
+  int32_t job = 0;
+
+  for (ast_node *ast = head; ast; ast = ast->right) {
+    EXTRACT_STMT_AND_MISC_ATTRS(stmt, misc_attrs, ast);
+
+    if (ok && is_ast_create_proc_stmt(stmt)) {
+      while ((int64_t)procs_count * (job + 1) / jobs <= proc_index) {
+        job++;
+      }
+
+      if (cg_job_merge(&cursors[job], proc_index++, stmt)) {
+        continue;
+      }
+    }
+
+    cg_one_stmt(stmt, misc_attrs);
+  }
+
+  for (int32_t j = 0; j < started; j++) {
+    free(records[j]);
+  }
+
+  free(cursors);
+  free(records);
+  free(pids);
+  free(files);
+  return true;
+#endif
+}
+
 // Emit the nested statements with one more level of indenting.
 static void cg_stmt_list(ast_node *head) {
   if (!head) {
@@ -7305,7 +8138,10 @@ static void cg_stmt_list(ast_node *head) {
     }
   }
 
-  for (ast_node *ast = head; ast; ast = ast->right) {
+  // the top level procs can be emitted on workers, see cg_stmt_list_with_jobs
+  bool_t emitted = stmt_nesting_level == 1 && options.jobs > 1 && cg_stmt_list_with_jobs(head);
+
+  for (ast_node *ast = emitted ? NULL : head; ast; ast = ast->right) {
     EXTRACT_STMT_AND_MISC_ATTRS(stmt, misc_attrs, ast);
     cg_one_stmt(stmt, misc_attrs);
   }
@@ -7378,8 +8214,48 @@ typedef struct function_info {
   CSTR sym_suffix;
   CSTR value_suffix;
   uint32_t frag_type;
+  CSTR accessor_owner;
+  bool_t lazy_strings;
 } function_info;
 
+// With --share_result_set_accessors a proc whose shape matches an earlier proc doesn't
+// get its own accessors.  Instead we emit a macro that forwards to the accessor of the
+// proc that owns the shape.  The rows are laid out identically so the only thing needed
+// is a cast of the result set to the owner's type.
+static void cg_shared_accessor_macro(
+  function_info *info,
+  CSTR symbol_prefix,
+  CSTR accessor,
+  CSTR accessor_sym,
+  bool_t has_value)
+{
+  CG_CHARBUF_OPEN_SYM_WITH_PREFIX(
+    owner_sym,
+    symbol_prefix,
+    info->accessor_owner,
+    accessor,
+    info->col,
+    info->sym_suffix);
+
+  CG_CHARBUF_OPEN_SYM(owner_result_set_ref, info->accessor_owner, "_result_set_ref");
+
+  // a procedure that uses OUT gives exactly one row, so no index in the API
+  CSTR row = info->uses_out ? "" : ", row";
+  CSTR value = has_value ? ", new_value" : "";
+
+  bprintf(info->headers, "#define %s(result_set%s%s) %s((%s)(result_set)%s%s)\n",
+    accessor_sym,
+    row,
+    value,
+    owner_sym.ptr,
+    owner_result_set_ref.ptr,
+    row,
+    value);
+
+  CHARBUF_CLOSE(owner_result_set_ref);
+  CHARBUF_CLOSE(owner_sym);
+}
+
 // Using the information above we emit a column getter.  The essence of this
 // is to reach into the data field of the result set and index the requested row
 // then fetch the column.  There's two parts to this:
@@ -7392,6 +8268,9 @@ typedef struct function_info {
 //     the getter in the master query
 //   * for normal rowsets it's foo->data[i].column
 //   * for single row result sets it's just foo->data->column; there is only the one row
+//   * with cql:lazy_strings the string and blob cells may still be pending so we use the
+//     generic getter which makes only the cell it reads, and the other columns read the
+//     rows as they are; cql_result_set_get_data would make every pending cell
 static void cg_proc_result_set_getter(function_info *info) {
   charbuf *h = info->headers;
   charbuf *d = info->defs;
@@ -7407,6 +8286,12 @@ static void cg_proc_result_set_getter(function_info *info) {
     info->sym_suffix);
 
   CHARBUF_OPEN(func_decl);
+
+  if (info->accessor_owner) {
+    cg_shared_accessor_macro(info, "", "_get_", col_getter_sym.ptr, false);
+    goto cleanup;
+  }
+
   cg_col_reader_type(&func_decl, info->ret_type, info->ret_kind, col_getter_sym.ptr);
   bprintf(&func_decl, "(%s _Nonnull result_set", info->result_set_ref_type);
 
@@ -7430,11 +8315,22 @@ static void cg_proc_result_set_getter(function_info *info) {
   // Note that the special handling of assembly fragments is not needed for the non-inline-getters case
   // because in that case all the getters are emitted into the defs section anyway.
 
+  sem_t core_type = core_type_of(info->ret_type);
+  if (info->lazy_strings && (core_type == SEM_TYPE_TEXT || core_type == SEM_TYPE_BLOB)) {
+    CSTR getter = core_type == SEM_TYPE_TEXT ? rt->cql_result_set_get_string : rt->cql_result_set_get_blob;
+    bprintf(d, "  return %s((cql_result_set_ref)result_set, %s, %d);\n",
+      getter,
+      info->uses_out ? "0" : "row",
+      info->col_index);
+    bprintf(d, "}\n");
+    goto cleanup;
+  }
+
   bprintf(d,
     "  %s *data = (%s *)%s((cql_result_set_ref)result_set);\n",
     info->row_struct_type,
     info->row_struct_type,
-    rt->cql_result_set_get_data);
+    info->lazy_strings ? rt->cql_result_set_get_rows : rt->cql_result_set_get_data);
 
   CHARBUF_OPEN(cast_buffer);
 
@@ -7562,28 +8458,28 @@ static void cg_proc_result_set_type_based_getter(function_info *_Nonnull info)
 
   switch (info->name_type) {
     case SEM_TYPE_NULL:
-      bprintf(out, "%s", rt->cql_result_set_get_is_null);
+      bputs(out, rt->cql_result_set_get_is_null);
       break;
     case SEM_TYPE_BOOL:
-      bprintf(out, "%s", rt->cql_result_set_get_bool);
+      bputs(out, rt->cql_result_set_get_bool);
       break;
     case SEM_TYPE_REAL:
-      bprintf(out, "%s", rt->cql_result_set_get_double);
+      bputs(out, rt->cql_result_set_get_double);
       break;
     case SEM_TYPE_INTEGER:
-      bprintf(out, "%s", rt->cql_result_set_get_int32);
+      bputs(out, rt->cql_result_set_get_int32);
       break;
     case SEM_TYPE_LONG_INTEGER:
-      bprintf(out, "%s", rt->cql_result_set_get_int64);
+      bputs(out, rt->cql_result_set_get_int64);
       break;
     case SEM_TYPE_TEXT:
-      bprintf(out, "%s", rt->cql_result_set_get_string);
+      bputs(out, rt->cql_result_set_get_string);
       break;
     case SEM_TYPE_BLOB:
-      bprintf(out, "%s", rt->cql_result_set_get_blob);
+      bputs(out, rt->cql_result_set_get_blob);
       break;
     case SEM_TYPE_OBJECT:
-      bprintf(out, "%s", rt->cql_result_set_get_object);
+      bputs(out, rt->cql_result_set_get_object);
       break;
   }
   bprintf(out, "((cql_result_set_ref)result_set, %s, %d)%s;\n", row, info->col_index, trailing_string);
@@ -7641,6 +8537,14 @@ static void cg_proc_result_set_setter(function_info *_Nonnull info, bool_t use_i
     info->col,
     info->sym_suffix);
 
+  if (info->accessor_owner) {
+    // the inline setters only go with the type getters, those are never shared this way
+    Invariant(!use_inline);
+    cg_shared_accessor_macro(info, rt->symbol_prefix, "_set_", col_getter_sym.ptr, !is_set_null);
+    CHARBUF_CLOSE(col_getter_sym);
+    return;
+  }
+
   CHARBUF_OPEN(var_decl);
 
   if (!is_set_null) {
@@ -7780,6 +8684,7 @@ typedef struct fetch_result_info {
 //   * we may or may not have references in the data type, so we include those if needed
 //   * likewise identity columns
 //   * the autodrops helper itself tests for the presence of the attribute in the correct form
+//   * lazy strings (cql:lazy_strings) only apply when all the rows are fetched from a statement
 //
 // The above represents the runtime cql_fetch_info struct that will be used to either fetch all
 // rows or else fetch a single row from a given buffer.  Either way, the metadata is assembled
@@ -7819,6 +8724,11 @@ static void cg_fetch_info(fetch_result_info *info, charbuf *output)
     bprintf(&tmp, "  .crc = CRC_%s,\n", info->proc_sym);
     bprintf(&tmp, "  .perf_index = &%s,\n", info->perf_index);
 
+    // strings and blobs made only when they're read, this needs a statement to fetch from
+    if (info->use_stmt && info->refs_count && info->misc_attrs && exists_attribute_str(info->misc_attrs, "lazy_strings")) {
+      bprintf(&tmp, "  .lazy_strings = 1,\n");
+    }
+
     cg_autodrops(info->misc_attrs, &tmp);
 
     bprintf(&tmp, "};\n");
@@ -7910,6 +8820,42 @@ static void cg_proc_result_set(ast_node *ast) {
   sem_struct *sptr = ast->sem->sptr;
   uint32_t count = sptr->count;
 
+  // the index of the encode context column, -1 represents not found
+  int16_t encode_context_index = -1;
+
+  // The data types (with the column names in the comments) are the shape of the result.
+  // With --share_result_set_accessors procs with the same shape and the same kind of row
+  // storage share one copy of the data types and column offsets, the row structs are
+  // identical.  The later procs' names for these are then #define aliases, so without the
+  // option every proc gets its own real symbols.
+  // Neither base fragments nor extension fragments declare the result data shape
+  // the assembly fragement does that, all columns will be known at that time.
+  CSTR shape_owner = NULL;
+  CSTR row_storage = uses_out ? "out" : uses_out_union ? "out_union" : "result_set";
+
+  if (frag_type != FRAG_TYPE_BASE) {
+    for (int32_t i = 0; i < count; i++) {
+      sem_t sem_type = sptr->semtypes[i];
+      CSTR col = sptr->names[i];
+
+      bprintf(&data_types, "  ");
+      bool_t encode = should_encode_col(col, sem_type, use_encode, encode_columns);
+      cg_data_type(&data_types, encode, sem_type);
+      bprintf(&data_types, ", // %s\n", col);
+
+      if (encode_context_column != NULL && !strcmp(col, encode_context_column)) {
+        encode_context_index = (int16_t)i;
+      }
+    }
+
+    if (options.share_result_set_accessors) {
+      CHARBUF_OPEN(shape);
+      bprintf(&shape, "%s\n%s", row_storage, data_types.ptr);
+      shape_owner = find_result_set_shape_owner(shape.ptr, name);
+      CHARBUF_CLOSE(shape);
+    }
+  }
+
   // setting up perf index unless we are currently emitting an extension or base fragment
   // which do not fetch result independently (the assembly query generates the fetcher)
   if (frag_type != FRAG_TYPE_BASE) {
@@ -7934,16 +8880,18 @@ static void cg_proc_result_set(ast_node *ast) {
     }
 
     bprintf(h, "\n#define %s %d\n", data_types_count_sym.ptr, count);
-    bprintf(&data_types,
-            "\nuint8_t %s[%s] = {\n",
-            data_types_sym.ptr,
-            data_types_count_sym.ptr);
+
+    if (shape_owner) {
+      CG_CHARBUF_OPEN_SYM(owner_data_types_sym, shape_owner, "_data_types");
+      bprintf(h, "#define %s %s\n", data_types_sym.ptr, owner_data_types_sym.ptr);
+      CHARBUF_CLOSE(owner_data_types_sym);
+    }
   }
 
   // If we are generating the typed getters, setup the function tables.
   // Again, extension fragments and base fragments do not define the actual tables
   // for the result that's done by the assembly fragment.
-  if (options.generate_type_getters && frag_type != FRAG_TYPE_BASE) {
+  if (options.generate_type_getters && frag_type != FRAG_TYPE_BASE && !shape_owner) {
     bprintf(h,
       "\n%suint8_t %s[%s];\n",
       rt->symbol_visibility,
@@ -7969,30 +8917,43 @@ static void cg_proc_result_set(ast_node *ast) {
       exists_attribute_str(misc_attrs, "suppress_result_set");  // and suppress result set implies suppress getters
   }
 
-  // the index of the encode context column, -1 represents not found
-  int16_t encode_context_index = -1;
   // we may want the setters.
   bool_t emit_setters = misc_attrs && exists_attribute_str(misc_attrs, "emit_setters");
 
+  // the getters of a lazy result set must not make every pending cell
+  bool_t lazy_strings = misc_attrs && exists_attribute_str(misc_attrs, "lazy_strings");
+
+  // If we are sharing accessors then a proc with the same shape as an earlier one just
+  // forwards to that proc's accessors.  The object kinds are part of the accessor shape
+  // because they change the accessor types, and the owner must have emitted the same set
+  // of accessors, so the setters count too, as does cql:lazy_strings (it changes the
+  // getters).  The type getters are already shared helpers and fragments have their own
+  // linkage rules, so neither of those is included.
+  CSTR accessor_owner = NULL;
+
+  if (options.share_result_set_accessors &&
+      !options.generate_type_getters &&
+      frag_type == FRAG_TYPE_NONE &&
+      !suppress_getters) {
+    CHARBUF_OPEN(accessor_shape);
+    bprintf(&accessor_shape, "accessors%s%s\n%s\n%s",
+      emit_setters ? " and setters" : "",
+      lazy_strings ? " lazy" : "",
+      row_storage,
+      data_types.ptr);
+    for (int32_t i = 0; i < count; i++) {
+      bprintf(&accessor_shape, "%s\n", sptr->kinds[i] ? sptr->kinds[i] : "");
+    }
+    accessor_owner = find_result_set_shape_owner(accessor_shape.ptr, name);
+    CHARBUF_CLOSE(accessor_shape);
+  }
+
   // For each field emit the _get_field method
   for (int32_t i = 0; i < count; i++) {
     sem_t sem_type = sptr->semtypes[i];
     CSTR col = sptr->names[i];
     CSTR kind = sptr->kinds[i];
 
-    // Neither base fragments nor extension fragments declare the result data shape
-    // the assembly fragement does that, all columns will be known at that time.
-    if (frag_type != FRAG_TYPE_BASE) {
-      bprintf(&data_types, "  ");
-      bool_t encode = should_encode_col(col, sem_type, use_encode, encode_columns);
-      cg_data_type(&data_types, encode, sem_type);
-      bprintf(&data_types, ", // %s\n", col);
-
-      if (encode_context_column != NULL && !strcmp(col, encode_context_column)) {
-        encode_context_index = (int16_t)i;
-      }
-    }
-
     if (suppress_getters) {
       continue;
     }
@@ -8011,6 +8972,8 @@ static void cg_proc_result_set(ast_node *ast) {
       .row_struct_type = row_sym.ptr,
       .frag_type = frag_type,
       .ret_kind = kind,
+      .accessor_owner = accessor_owner,
+      .lazy_strings = lazy_strings,
     };
 
     // if the current row is equal or greater than the base query count
@@ -8127,15 +9090,25 @@ static void cg_proc_result_set(ast_node *ast) {
   // Skip generating reference and column offsets for extension and base fragments since they always
   // delegate to assembly fragment for retrieving results with proper index
   if (frag_type != FRAG_TYPE_BASE) {
-    bprintf(&data_types, "};\n");
-    bprintf(d, data_types.ptr);
+    if (!shape_owner) {
+      bprintf(d, "\nuint8_t %s[%s] = {\n", data_types_sym.ptr, data_types_count_sym.ptr);
+      bputs(d, data_types.ptr);
+      bputs(d, "};\n");
+    }
 
     if (refs_count && !uses_out) {
       // note: fetch procs have already emitted this.
       cg_refs_offset(d, sptr, refs_offset_sym.ptr, row_sym.ptr);
     }
 
-    cg_col_offsets(d, sptr, col_offsets_sym.ptr, row_sym.ptr);
+    if (shape_owner) {
+      CG_CHARBUF_OPEN_SYM(owner_col_offsets_sym, shape_owner, "_col_offsets");
+      bprintf(d, "\n#define %s %s\n", col_offsets_sym.ptr, owner_col_offsets_sym.ptr);
+      CHARBUF_CLOSE(owner_col_offsets_sym);
+    }
+    else {
+      cg_col_offsets(d, sptr, col_offsets_sym.ptr, row_sym.ptr);
+    }
   }
 
   bool_t has_identity_columns = cg_identity_columns(h, d, name, misc_attrs, identity_columns_sym.ptr);
@@ -8473,58 +9446,63 @@ cql_noexport void cg_c_main(ast_node *head) {
     CHARBUF_CLOSE(ignored);
   }
 
+  // The header and body are assembled as ropes; the big generated sections are
+  // borrowed directly from their buffers rather than copied into one giant
+  // charbuf, and the finished rope is written out chunk by chunk.
   CHARBUF_OPEN(exports_file);
-  CHARBUF_OPEN(header_file);
-  CHARBUF_OPEN(body_file);
+  ROPE_OPEN(header_file);
+  ROPE_OPEN(body_file);
   CHARBUF_OPEN(indent);
 
   if (exports_file_name) {
     exports_output = &exports_file;
 
     if (rt->exports_prefix) {
-      bprintf(exports_output, "%s", rt->exports_prefix);
+      bputs(exports_output, rt->exports_prefix);
     }
   }
 
   cg_stmt_list(head);
 
-  bprintf(&body_file, "%s", rt->source_prefix);
+  rope_puts(&body_file, rt->source_prefix);
 
   if (options.c_include_path) {
     // If your output path has inconvenient prefixes you can specify everything.
     // You use c_include_path to accomplish this.
 
-    bprintf(&body_file, "#include \"%s\"\n\n", options.c_include_path);
+    rope_printf(&body_file, "#include \"%s\"\n\n", options.c_include_path);
   }
   else if (options.c_include_namespace) {
     // If your output is just a base name, you might want to prefix it.
     // You can use c_include_namespace for this option.
 
-    bprintf(&body_file, "#include \"%s/%s\"\n\n", options.c_include_namespace, options.file_names[0]);
+    rope_printf(&body_file, "#include \"%s/%s\"\n\n", options.c_include_namespace, options.file_names[0]);
   } else {
     // If neither option specified then we use whatever was provided as the output path.
     // This is the most common case.
-    bprintf(&body_file, "#include \"%s\"\n\n", options.file_names[0]);
+    rope_printf(&body_file, "#include \"%s\"\n\n", options.file_names[0]);
   }
 
-  bprintf(&body_file, "%s", rt->source_wrapper_begin);
-  bprintf(&body_file, "#pragma clang diagnostic push\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wunknown-warning-option\"\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wbitwise-op-parentheses\"\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wshift-op-parentheses\"\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wlogical-not-parentheses\"\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wlogical-op-parentheses\"\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wliteral-conversion\"\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wunused-but-set-variable\"\n");
-  bprintf(&body_file, "#pragma clang diagnostic ignored \"-Wunused-function\"\n");
+  rope_puts(&body_file, rt->source_wrapper_begin);
+  rope_puts(&body_file, "#pragma clang diagnostic push\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wunknown-warning-option\"\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wbitwise-op-parentheses\"\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wshift-op-parentheses\"\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wlogical-not-parentheses\"\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wlogical-op-parentheses\"\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wliteral-conversion\"\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wunused-but-set-variable\"\n");
+  rope_puts(&body_file, "#pragma clang diagnostic ignored \"-Wunused-function\"\n");
 
-  bprintf(&body_file, "%s", cg_fwd_ref_output->ptr);
-  bprintf(&body_file, "%s", cg_constants_output->ptr);
+  rope_borrow_charbuf(&body_file, cg_fwd_ref_output);
+  rope_borrow_charbuf(&body_file, cg_constants_output);
 
   if (cg_pieces_output->used > 1) {
-    bprintf(&body_file, "static const char _pieces_[] = \n%s;\n", cg_pieces_output->ptr);
+    rope_puts(&body_file, "static const char _pieces_[] = \n");
+    rope_borrow_charbuf(&body_file, cg_pieces_output);
+    rope_puts(&body_file, ";\n");
   }
-  bprintf(&body_file, "%s", cg_declarations_output->ptr);
+  rope_borrow_charbuf(&body_file, cg_declarations_output);
 
   // main function after constants and decls (if needed)
 
@@ -8533,55 +9511,58 @@ cql_noexport void cg_c_main(ast_node *head) {
   if (global_proc_needed) {
     exit_on_no_global_proc();
 
-    bprintf(&body_file, "#define _PROC_ %s\n", global_proc_name);
+    rope_printf(&body_file, "#define _PROC_ %s\n", global_proc_name);
 
     bindent(&indent, cg_scratch_vars_output, 2);
-    bprintf(&body_file, "\ncql_code %s(sqlite3 *_Nonnull _db_) {\n", global_proc_name);
-    cg_emit_rc_vars(&body_file);
+    rope_printf(&body_file, "\ncql_code %s(sqlite3 *_Nonnull _db_) {\n", global_proc_name);
+
+    CHARBUF_OPEN(rc_vars);
+    cg_emit_rc_vars(&rc_vars);
+    rope_append(&body_file, rc_vars.ptr, rc_vars.used - 1);
+    CHARBUF_CLOSE(rc_vars);
 
-    bprintf(&body_file, "%s", indent.ptr);
-    bprintf(&body_file, "%s", cg_main_output->ptr);
-    bprintf(&body_file, "\n");
+    rope_borrow_charbuf(&body_file, &indent);
+    rope_borrow_charbuf(&body_file, cg_main_output);
+    rope_puts(&body_file, "\n");
     if (error_target_used) {
-      bprintf(&body_file, "%s:\n", error_target);
+      rope_printf(&body_file, "%s:\n", error_target);
     }
-    bprintf(&body_file, "%s", cg_cleanup_output->ptr);
-    bprintf(&body_file, "  return _rc_;\n");
-    bprintf(&body_file, "}\n");
-    bprintf(&body_file, "\n#undef _PROC_\n");
+    rope_borrow_charbuf(&body_file, cg_cleanup_output);
+    rope_puts(&body_file, "  return _rc_;\n");
+    rope_puts(&body_file, "}\n");
+    rope_puts(&body_file, "\n#undef _PROC_\n");
   }
 
-  bprintf(&body_file, "#pragma clang diagnostic pop\n");
-  bprintf(&body_file, "%s", rt->source_wrapper_end);
-
-  bprintf(&header_file, "%s", rt->header_prefix);
-  bprintf(&header_file, rt->cqlrt_template, rt->cqlrt);
-  bprintf(&header_file, "%s", rt->header_wrapper_begin);
-  bprintf(&header_file, "%s", cg_header_output->ptr);
-  bprintf(&header_file, "%s", rt->header_wrapper_end);
+  rope_puts(&body_file, "#pragma clang diagnostic pop\n");
+  rope_puts(&body_file, rt->source_wrapper_end);
 
-  CHARBUF_CLOSE(indent);
+  rope_puts(&header_file, rt->header_prefix);
+  rope_printf(&header_file, rt->cqlrt_template, rt->cqlrt);
+  rope_puts(&header_file, rt->header_wrapper_begin);
+  rope_borrow_charbuf(&header_file, cg_header_output);
+  rope_puts(&header_file, rt->header_wrapper_end);
 
-  cql_write_file(header_file_name, header_file.ptr);
+  rope_write_file(header_file_name, &header_file);
 
   if (options.nolines || options.test) {
-    cql_write_file(body_file_name, body_file.ptr);
+    rope_write_file(body_file_name, &body_file);
   }
   else {
-    CHARBUF_OPEN(body_with_line_directives);
+    ROPE_OPEN(body_with_line_directives);
 
-    cg_insert_line_directives(body_file.ptr, &body_with_line_directives);
-    cql_write_file(body_file_name, body_with_line_directives.ptr);
+    cg_insert_line_directives(&body_file, &body_with_line_directives);
+    rope_write_file(body_file_name, &body_with_line_directives);
 
-    CHARBUF_CLOSE(body_with_line_directives);
+    ROPE_CLOSE(body_with_line_directives);
   }
 
   if (exports_file_name) {
     cql_write_file(exports_file_name, exports_file.ptr);
   }
 
-  CHARBUF_CLOSE(body_file);
-  CHARBUF_CLOSE(header_file);
+  CHARBUF_CLOSE(indent);
+  ROPE_CLOSE(body_file);
+  ROPE_CLOSE(header_file);
   CHARBUF_CLOSE(exports_file);
 
   cg_c_cleanup();
@@ -8603,6 +9584,9 @@ cql_noexport void cg_c_init(void) {
   Contract(!emitted_proc_decls);
   emitted_proc_decls = symtab_new();
 
+  Contract(!result_set_shapes);
+  result_set_shapes = symtab_new_case_sens();
+
   DDL_STMT_INIT(drop_table_stmt);
   DDL_STMT_INIT(drop_view_stmt);
   DDL_STMT_INIT(drop_index_stmt);
@@ -8781,6 +9765,7 @@ cql_noexport void cg_c_cleanup() {
   SYMTAB_CLEANUP(string_literals);
   SYMTAB_CLEANUP(text_pieces);
   SYMTAB_CLEANUP(emitted_proc_decls);
+  SYMTAB_CLEANUP(result_set_shapes);
 
   base_fragment_name = NULL;
   exports_output = NULL;
@@ -8788,6 +9773,7 @@ cql_noexport void cg_c_cleanup() {
   cg_current_masks = NULL;
 
   cg_in_loop = false;
+  cg_fetch_borrowed = false;
   case_statement_count = 0;
   catch_block_count = 0;
   error_target = CQL_CLEANUP_DEFAULT_LABEL;
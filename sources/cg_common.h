@@ -155,6 +155,14 @@ CHARBUF_CLOSE(result_var_value); \
 CHARBUF_CLOSE(result_var_is_null); \
 CHARBUF_CLOSE(result_var);
 
+// The operands of a node whose result is computed by one final statement can
+// share the slot of its result variable; their values are read by that statement
+// before the result is written.  Call this after reserving, before evaluating
+// the operands.  The net effect is that a chain like a + b + c + d uses one
+// scratch variable rather than one per operator.
+#define CG_SHARE_RESULT_VAR_SLOT() \
+stack_level = stack_level_reserved;
+
 // This does reserve and use in one step
 #define CG_SETUP_RESULT_VAR(ast, sem_type) \
 CG_RESERVE_RESULT_VAR(ast, sem_type); \
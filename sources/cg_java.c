@@ -194,6 +194,51 @@ static void cg_java_proc_result_set_getter(
     bprintf(java, "%s;\n\n", getter_sig.ptr);
   }
 
+  // Result sets with many rows also get whole column getters for the primitive and
+  // string columns, these cross into native code once per column rather than once
+  // per cell.  Nullable primitives get the matching null flags too.
+  bool_t column_getters = !fetch_proc &&
+    (!options.java_fragment_interface_mode || cg_java_frag_type_query_proc(frag_type)) &&
+    !is_ast_declare_interface_stmt(ast);
+
+  CSTR column_type = NULL;
+  CSTR column_method = NULL;
+
+  switch (core_type) {
+    case SEM_TYPE_INTEGER:
+      column_type = rt->cql_int32;
+      column_method = "getIntegerColumn";
+      break;
+    case SEM_TYPE_LONG_INTEGER:
+      column_type = rt->cql_int64;
+      column_method = "getLongColumn";
+      break;
+    case SEM_TYPE_REAL:
+      column_type = rt->cql_double;
+      column_method = "getDoubleColumn";
+      break;
+    case SEM_TYPE_BOOL:
+      column_type = rt->cql_bool;
+      column_method = "getBooleanColumn";
+      break;
+    case SEM_TYPE_TEXT:
+      column_type = return_type;
+      column_method = encode && custom_type_for_encoded_column ? "getEncodedStringColumn" : "getStringColumn";
+      break;
+  }
+
+  if (column_getters && column_type) {
+    CG_CHARBUF_OPEN_SYM(column_getter, "get_", col_name, "_column");
+    bprintf(java, rt->cql_result_set_get_column, column_type, column_getter.ptr, column_method, col_index.ptr);
+    CHARBUF_CLOSE(column_getter);
+
+    if (!notnull && core_type != SEM_TYPE_TEXT) {
+      CG_CHARBUF_OPEN_SYM(is_null_getter, "get_", col_name, "_is_null_column");
+      bprintf(java, rt->cql_result_set_get_column, rt->cql_bool, is_null_getter.ptr, "isNullColumn", col_index.ptr);
+      CHARBUF_CLOSE(is_null_getter);
+    }
+  }
+
   if (encode) {
     bprintf(java, "public %s %sIsEncoded() {\n", rt->cql_bool, col_name_camel.ptr);
     bprintf(java, "  return mResultSet.getIsEncoded(%s);\n", col_index.ptr);
@@ -23,6 +23,7 @@ cql_noexport void cg_lua_cleanup() {}
 #include "cql.h"
 #include "gen_sql.h"
 #include "list.h"
+#include "rope.h"
 #include "sem.h"
 #include "eval.h"
 #include "symtab.h"
@@ -173,6 +174,24 @@ static int32_t lua_cur_fragment_predicate = 0;
 // we use these to emit the appropriate booleans for each bound variable
 static int32_t lua_prev_variable_count;
 static int32_t lua_cur_variable_count;
+
+// Each distinct variable in a statement is bound only once, these map the variable
+// name to its bind slot.  The uses buffer records the slot of each variable use
+// in order so the variable predicates can be emitted per slot.
+typedef struct lua_bound_variable {
+  ast_node *ast;    // the variable that is bound in this slot
+  int32_t slot;     // zero based, the parameter number is slot + 1
+} lua_bound_variable;
+
+typedef struct lua_variable_use {
+  int32_t slot;     // the slot this use refers to
+  bool_t repeat;    // true if an earlier use already claimed the slot
+} lua_variable_use;
+
+static symtab *lua_bound_variable_slots;
+static int32_t lua_bound_variable_count;
+static bytebuf lua_bound_variable_uses = {NULL, 0, 0};
+
 static bool_t lua_continue_label_needed;
 static int32_t lua_continue_label_number;
 static int32_t lua_continue_label_next;
@@ -1699,6 +1718,67 @@ static void cg_lua_expr_null(ast_node *expr, CSTR op, charbuf *value, int32_t pr
   bprintf(value, "nil");
 }
 
+// If the evaluator can compute the expression at compile time then we emit
+// the result as a literal, just like the C codegen does.  Literals are left to
+// the normal path.  A null result is simply nil.  Non-finite reals and reals
+// whose printed form would not read back exactly are not folded.
+static bool_t cg_lua_expr_constant(ast_node *expr, charbuf *value, int32_t pri) {
+  if (is_ast_num(expr) || is_ast_null(expr) || is_ast_str(expr)) {
+    return false;
+  }
+
+  if (is_ast_uminus(expr) && is_ast_num(expr->left)) {
+    return false;
+  }
+
+  sem_t sem_type = expr->sem->sem_type;
+  if (!is_numeric(sem_type)) {
+    return false;
+  }
+
+  eval_node result = EVAL_NIL;
+  eval(expr, &result);
+
+  if (result.sem_type == SEM_TYPE_ERROR) {
+    return false;
+  }
+
+  if (result.sem_type == SEM_TYPE_NULL) {
+    bprintf(value, "nil");
+    return true;
+  }
+
+  eval_cast_to(&result, core_type_of(sem_type));
+
+  if (result.sem_type == SEM_TYPE_BOOL) {
+    // as with bool literals, 0 is not falsey in LUA
+    bprintf(value, "%s", result.bool_value ? "true" : "false");
+    return true;
+  }
+
+  if (result.sem_type == SEM_TYPE_REAL && !isfinite(result.real_value)) {
+    return false;
+  }
+
+  CHARBUF_OPEN(literal);
+  eval_format_number(&result, EVAL_FORMAT_FOR_LUA, &literal);
+
+  if (result.sem_type == SEM_TYPE_REAL && strtod(literal.ptr, NULL) != result.real_value) {
+    CHARBUF_CLOSE(literal);
+    return false;
+  }
+
+  if (literal.ptr[0] == '-' && pri >= LUA_EXPR_PRI_UNARY) {
+    bprintf(value, "(%s)", literal.ptr);
+  }
+  else {
+    bputs(value, literal.ptr);
+  }
+
+  CHARBUF_CLOSE(literal);
+  return true;
+}
+
 // This is the main entry point for codegen of an expression.  It dispatches
 // to one of the above workers for all the complex types and handles a few primitives
 // in place.
@@ -1706,6 +1786,10 @@ static void cg_lua_expr(ast_node *expr, charbuf *value, int32_t pri) {
   Contract(value);
   Contract(value->used == 1);  // just the null (i.e. empty buffer)
 
+  if (cg_lua_expr_constant(expr, value, pri)) {
+    return;
+  }
+
   // These are all the expressions there are, we have to find it in this table
   // or else someone added a new expression type and it isn't supported yet.
   symtab_entry *entry = symtab_find(cg_exprs, expr->type);
@@ -2517,6 +2601,10 @@ static void cg_lua_declare_vars_type(ast_node *declare_vars_type) {
 // it will call us every time it finds a variable that needs to be bound.  That
 // variable is replaced by ? in the SQL output.  We end up with a list of variables
 // to bind on a silver platter (but in reverse order).
+//
+// As in the C codegen, a variable used more than once is bound only once and
+// the later uses refer back to it with ?N.  The first use stays a plain ? unless
+// there are conditional fragments, see cg_capture_variables.
 static bool_t cg_lua_capture_variables(ast_node *ast, void *context, charbuf *buffer) {
   // all variables have a name
   Contract(ast->sem->name);
@@ -2542,9 +2630,41 @@ static bool_t cg_lua_capture_variables(ast_node *ast, void *context, charbuf *bu
   }
 
   list_item **head = (list_item**)context;
+
+  if (!lua_bound_variable_slots) {
+    add_item_to_list(head, ast);
+    bprintf(buffer, "?");
+    return true;
+  }
+
+  lua_variable_use *use = bytebuf_new(&lua_bound_variable_uses, lua_variable_use);
+
+  symtab_entry *bound_entry = symtab_find(lua_bound_variable_slots, ast->sem->name);
+  lua_bound_variable *bound = bound_entry ? (lua_bound_variable *)bound_entry->val : NULL;
+  if (bound && bound->ast->sem->sem_type == ast->sem->sem_type) {
+    use->slot = bound->slot;
+    use->repeat = true;
+    bprintf(buffer, "?%d", use->slot + 1);
+    return true;
+  }
+
+  use->slot = lua_bound_variable_count++;
+  use->repeat = false;
   add_item_to_list(head, ast);
 
-  bprintf(buffer, "?");
+  if (!bound) {
+    bound = _ast_pool_new(lua_bound_variable);
+    bound->ast = ast;
+    bound->slot = use->slot;
+    symtab_add(lua_bound_variable_slots, ast->sem->name, bound);
+  }
+
+  if (lua_has_conditional_fragments) {
+    bprintf(buffer, "?%d", use->slot + 1);
+  }
+  else {
+    bprintf(buffer, "?");
+  }
   return true;
 }
 
@@ -2622,6 +2742,16 @@ static int32_t cg_lua_fragment_count() {
   return (int32_t)(lua_shared_fragment_strings.used / sizeof(CSTR));
 }
 
+// True if any of the uses in [first, limit) refers to the given slot.
+static bool_t cg_lua_slot_used_in_range(lua_variable_use *uses, int32_t first, int32_t limit, int32_t slot) {
+  for (int32_t i = first; i < limit; i++) {
+    if (uses[i].slot == slot) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // when we complete a chunk of fragment text we have to emit the predicates
 // for the variables that were in that chunk.  We do this in the same
 // context as the conditional for that string.
@@ -2630,13 +2760,34 @@ static void cg_lua_flush_variable_predicates() {
     return;
   }
 
+  lua_variable_use *uses = (lua_variable_use *)lua_bound_variable_uses.ptr;
+
+  // a slot is bound if any of its uses is in a fragment that is included
+  int32_t first = lua_prev_variable_count;
+
   while (lua_prev_variable_count < lua_cur_variable_count) {
+    lua_variable_use *use = &uses[lua_prev_variable_count++];
+
+    if (cg_lua_slot_used_in_range(uses, first, lua_prev_variable_count - 1, use->slot)) {
+      // already covered by an earlier use in this same chunk of text
+      continue;
+    }
+
     if (lua_cur_fragment_predicate == 0 || lua_cur_fragment_predicate + 1 == lua_max_fragment_predicate) {
       bprintf(cg_main_output, "_vpreds_%d[%d] = true -- pred %d known to be true\n",
       lua_cur_bound_statement,
-      lua_prev_variable_count++,
+      use->slot,
       lua_cur_fragment_predicate);
     }
+    else if (use->repeat) {
+      bprintf(cg_main_output, "_vpreds_%d[%d] = _vpreds_%d[%d] or _preds_%d[%d]\n",
+        lua_cur_bound_statement,
+        use->slot,
+        lua_cur_bound_statement,
+        use->slot,
+        lua_cur_bound_statement,
+        lua_cur_fragment_predicate);
+    }
     else {
       // If we're back in previous context we can always just use the predicate value
       // for that context which was set in an earlier block.
@@ -2644,7 +2795,7 @@ static void cg_lua_flush_variable_predicates() {
       // so this could be = 1 and hence is the same as the above.
       bprintf(cg_main_output, "_vpreds_%d[%d] = _preds_%d[%d]\n",
         lua_cur_bound_statement,
-        lua_prev_variable_count++,
+        use->slot,
         lua_cur_bound_statement,
         lua_cur_fragment_predicate);
     }
@@ -3162,6 +3313,9 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
   int32_t stmt_index = 0;
 
   bytebuf_open(&lua_shared_fragment_strings);
+  bytebuf_open(&lua_bound_variable_uses);
+  lua_bound_variable_slots = symtab_new();
+  lua_bound_variable_count = 0;
 
   cg_lua_classify_fragments(stmt);
 
@@ -3195,6 +3349,8 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
   gen_set_output_buffer(&sql);
   gen_statement_with_callbacks(stmt, &callbacks);
 
+  SYMTAB_CLEANUP(lua_bound_variable_slots);
+
   // whether or not there is a prepare statement
   bool_t has_prepare_stmt = !exec_only || vars;
 
@@ -3242,7 +3398,7 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
         bprintf(cg_main_output, "%d, _preds_%d,\n", scount, lua_cur_bound_statement);
         bprintf(cg_declarations_output, "local _preds_%d  -- %d possible fragments\n", lua_cur_bound_statement, scount);
         if (lua_has_variables) {
-          bprintf(cg_declarations_output, "local _vpreds_%d -- %d possible bindings\n", lua_cur_bound_statement, lua_cur_variable_count);
+          bprintf(cg_declarations_output, "local _vpreds_%d -- %d possible bindings\n", lua_cur_bound_statement, lua_bound_variable_count);
         }
       }
       else {
@@ -3327,6 +3483,7 @@ static int32_t cg_lua_bound_sql_statement(CSTR stmt_name, ast_node *stmt, int32_
 
   // vars is pool allocated, so we don't need to free it
   bytebuf_close(&lua_shared_fragment_strings);
+  bytebuf_close(&lua_bound_variable_uses);
   return stmt_index;
 }
 
@@ -5132,18 +5289,20 @@ cql_noexport void cg_lua_main(ast_node *head) {
   cg_lua_current_masks = &global_scratch_masks;
   cg_lua_zero_masks(cg_lua_current_masks);
 
-  CHARBUF_OPEN(body_file);
+  // As in the C output, the body is assembled as a rope that borrows the big generated
+  // sections rather than copying them into one charbuf, and it's written out chunk by chunk.
+  ROPE_OPEN(body_file);
   CHARBUF_OPEN(indent);
 
-  bprintf(&body_file, "%s", rt->source_prefix);
-  bprintf(&body_file, "%s", rt->source_wrapper_begin);
-  bprintf(&body_file, rt->cqlrt_template, rt->cqlrt);
+  rope_puts(&body_file, rt->source_prefix);
+  rope_puts(&body_file, rt->source_wrapper_begin);
+  rope_printf(&body_file, rt->cqlrt_template, rt->cqlrt);
 
   cg_lua_stmt_list(head);
 
-  bprintf(&body_file, "%s", cg_fwd_ref_output->ptr);
-  bprintf(&body_file, "%s", cg_constants_output->ptr);
-  bprintf(&body_file, "%s", cg_declarations_output->ptr);
+  rope_borrow_charbuf(&body_file, cg_fwd_ref_output);
+  rope_borrow_charbuf(&body_file, cg_constants_output);
+  rope_borrow_charbuf(&body_file, cg_declarations_output);
 
   // main function after constants and decls (if needed)
 
@@ -5153,29 +5312,30 @@ cql_noexport void cg_lua_main(ast_node *head) {
     exit_on_no_global_proc();
 
     bindent(&indent, cg_scratch_vars_output, 2);
-    bprintf(&body_file, "\nfunction %s(_db_)\n", global_proc_name);
-    cg_lua_emit_rc_vars(&body_file);
+    rope_printf(&body_file, "\nfunction %s(_db_)\n", global_proc_name);
 
-    bprintf(&body_file, "%s", indent.ptr);
-    bprintf(&body_file, "%s", cg_main_output->ptr);
-    bprintf(&body_file, "\n");
+    CHARBUF_OPEN(rc_vars);
+    cg_lua_emit_rc_vars(&rc_vars);
+    rope_append(&body_file, rc_vars.ptr, rc_vars.used - 1);
+    CHARBUF_CLOSE(rc_vars);
+
+    rope_borrow_charbuf(&body_file, &indent);
+    rope_borrow_charbuf(&body_file, cg_main_output);
+    rope_puts(&body_file, "\n");
     if (lua_error_target_used) {
-      bprintf(&body_file, "::%s::\n", lua_error_target);
+      rope_printf(&body_file, "::%s::\n", lua_error_target);
     }
-    bprintf(&body_file, "%s", cg_cleanup_output->ptr);
-    bprintf(&body_file, "  return _rc_\n");
-    bprintf(&body_file, "end\n");
+    rope_borrow_charbuf(&body_file, cg_cleanup_output);
+    rope_puts(&body_file, "  return _rc_\n");
+    rope_puts(&body_file, "end\n");
   }
 
-  bprintf(&body_file, "%s", rt->source_wrapper_end);
+  rope_puts(&body_file, rt->source_wrapper_end);
 
+  rope_write_file(body_file_name, &body_file);
 
   CHARBUF_CLOSE(indent);
-
-
-  cql_write_file(body_file_name, body_file.ptr);
-
-  CHARBUF_CLOSE(body_file);
+  ROPE_CLOSE(body_file);
 
   cg_lua_cleanup();
 }
@@ -22,6 +22,7 @@ cql_noexport void cg_objc_main(ast_node *head) {}
 #include "cql.h"
 #include "gen_sql.h"
 #include "list.h"
+#include "rope.h"
 #include "sem.h"
 #include "symtab.h"
 
@@ -571,31 +572,32 @@ cql_noexport void cg_objc_main(ast_node *head) {
   cg_objc_init();
 
   CHARBUF_OPEN(extension_header);
-  CHARBUF_OPEN(header_file);
+  ROPE_OPEN(header_file);
   CHARBUF_OPEN(imports);
 
   objc_extension_header = &extension_header;
 
-  bprintf(&header_file, "%s", rt->header_prefix);
-  bprintf(&header_file, "\n#import <%s>\n", options.objc_c_include_path);
+  rope_puts(&header_file, rt->header_prefix);
+  rope_printf(&header_file, "\n#import <%s>\n", options.objc_c_include_path);
 
   // gen objc code ....
   cg_objc_stmt_list(head);
 
-  bprintf(&header_file, "%s", rt->header_wrapper_begin);
+  rope_puts(&header_file, rt->header_wrapper_begin);
 
   if (is_string_column_encoded) {
-    bprintf(&header_file, "\n@class %s;\n", rt->cql_string_ref_encode);
+    rope_printf(&header_file, "\n@class %s;\n", rt->cql_string_ref_encode);
   }
 
-  bprintf(&header_file, "%s", cg_header_output->ptr);
-  bprintf(&header_file, "%s", rt->header_wrapper_end);
+  // the generated declarations are borrowed, not copied (see rope.h)
+  rope_borrow_charbuf(&header_file, cg_header_output);
+  rope_puts(&header_file, rt->header_wrapper_end);
 
   CSTR header_file_name = options.file_names[0];
-  cql_write_file(header_file_name, header_file.ptr);
+  rope_write_file(header_file_name, &header_file);
 
   CHARBUF_CLOSE(imports);
-  CHARBUF_CLOSE(header_file);
+  ROPE_CLOSE(header_file);
   CHARBUF_CLOSE(extension_header);
 
   // reset globals so they don't interfere with leaksan
@@ -22,6 +22,7 @@ cql_noexport void cg_schema_sqlite_main(ast_node *head) {}
 #include "cql.h"
 #include "gen_sql.h"
 #include "list.h"
+#include "rope.h"
 #include "sem.h"
 #include "symtab.h"
 #include "bytebuf.h"
@@ -238,6 +239,12 @@ static void cg_schema_helpers(charbuf *decls) {
   bprintf(decls, "-- holds all the table definitions out of sqlite_master\n");
   bprintf(decls, "DECLARE %s_tables_dict_ OBJECT<string_dictionary>;\n\n", global_proc_name);
 
+  bprintf(decls, "-- holds the columns of the tables we have probed, read from pragma_table_xinfo\n");
+  bprintf(decls, "DECLARE %s_columns_dict_ OBJECT<string_dictionary>;\n\n", global_proc_name);
+
+  bprintf(decls, "-- the leading columns of the table_xinfo pragma, the only ones we use\n");
+  bprintf(decls, "DECLARE SELECT FUNCTION pragma_table_xinfo(table_ TEXT NOT NULL) (cid INTEGER NOT NULL, name TEXT NOT NULL, type TEXT NOT NULL);\n\n");
+
   bprintf(decls, "-- helper proc for creating the dictionary of table defs from sqlite_master\n");
   bprintf(decls, "@attribute(cql:private)\n");
   bprintf(decls, "CREATE PROCEDURE %s_get_table_defs()\n", global_proc_name);
@@ -302,13 +309,23 @@ static void cg_schema_helpers(charbuf *decls) {
   bprintf(decls, "BEGIN\n");
   bprintf(decls, "  CALL cql_exec_internal(printf('DROP TABLE IF EXISTS %%s', table_name));\n");
   bprintf(decls, "  -- remove the table from our dictionary marking it dropped\n");
-  bprintf(decls, "  IF %s_tables_dict_ IS NULL THROW;\n", global_proc_name);
-  bprintf(decls, "  LET added := cql_string_dictionary_add(%s_tables_dict_, table_name, '');\n", global_proc_name);
+  bprintf(decls, "  IF %s_tables_dict_ IS NULL THEN\n", global_proc_name);
+  bprintf(decls, "    CALL %s_get_table_defs();\n", global_proc_name);
+  bprintf(decls, "  END IF;\n");
+  bprintf(decls, "  LET added := cql_string_dictionary_add(ifnull_throw(%s_tables_dict_), table_name, '');\n", global_proc_name);
+  bprintf(decls, "  -- anything we knew about its columns is now wrong\n");
+  bprintf(decls, "  SET %s_columns_dict_ := NULL;\n", global_proc_name);
   bprintf(decls, "END;\n\n");
 
   bprintf(decls, "-- helper proc to insert facet into cql_rebuilt_tables --\n");
   bprintf(decls, "CREATE PROCEDURE %s_rebuilt_tables_insert_helper(facet TEXT NOT NULL)\n", global_proc_name);
   bprintf(decls, "BEGIN\n");
+  if (options.preserve_recreate_data) {
+    // only a data preserving rebuild gets here, the table is made the first time it happens
+    bprintf(decls, "  CREATE TABLE IF NOT EXISTS cql_schema_rebuilt_tables(\n");
+    bprintf(decls, "    rebuild_facet TEXT NOT NULL\n");
+    bprintf(decls, "  );\n");
+  }
   bprintf(decls, "  INSERT INTO cql_schema_rebuilt_tables VALUES(facet);\n");
   bprintf(decls, "END;\n\n");
 }
@@ -334,9 +351,23 @@ static void cg_schema_emit_facet_functions(charbuf *decls) {
   bprintf(decls, "DECLARE FUNCTION cql_facet_find(facets facet_data, facet TEXT NOT NULL) LONG NOT NULL;\n\n");
 }
 
+// The name of the runtime helper that updates a recreate group, with --preserve_recreate_data
+// the helper tries to keep the data in the surviving columns before it falls back to the recreate.
+static CSTR cg_schema_recreate_group_helper() {
+  return options.preserve_recreate_data ? "cql_rebuild_recreate_group_preserving_data" : "cql_rebuild_recreate_group";
+}
+
 static void cg_schema_emit_recreate_update_functions(charbuf *decls) {
   bprintf(decls, "-- declare recreate update helpers-- \n");
-  bprintf(decls, "DECLARE PROCEDURE cql_rebuild_recreate_group (tables TEXT NOT NULL, indices TEXT NOT NULL, deletes TEXT NOT NULL, out result BOOL NOT NULL) USING TRANSACTION;\n");
+  if (options.preserve_recreate_data) {
+    bprintf(decls, "DECLARE PROCEDURE %s (tables TEXT NOT NULL, indices TEXT NOT NULL, deletes TEXT NOT NULL, facets TEXT NOT NULL, out result BOOL NOT NULL) USING TRANSACTION;\n",
+      cg_schema_recreate_group_helper());
+    bprintf(decls, "DECLARE PROCEDURE cql_rebuild_copy_group_data (tables TEXT NOT NULL, facets TEXT NOT NULL, out pending BOOL NOT NULL) USING TRANSACTION;\n");
+  }
+  else {
+    bprintf(decls, "DECLARE PROCEDURE %s (tables TEXT NOT NULL, indices TEXT NOT NULL, deletes TEXT NOT NULL, out result BOOL NOT NULL) USING TRANSACTION;\n",
+      cg_schema_recreate_group_helper());
+  }
 }
 
 // Emit all tables versioned as they before modifications, just the original items
@@ -1264,6 +1295,7 @@ static void cg_schema_manage_recreate_tables(
 
   CHARBUF_OPEN(recreate_without_virtual_tables);
   CHARBUF_OPEN(recreate_only_virtual_tables);
+  CHARBUF_OPEN(copy_tables);
   CHARBUF_OPEN(update_tables);
   CHARBUF_OPEN(update_indices);
   CHARBUF_OPEN(delete_tables);
@@ -1403,13 +1435,19 @@ static void cg_schema_manage_recreate_tables(
     // Construct call to cql_rebuild_recreate_group with CQL compressed strings (with --compress compiler flag)
     // After the call to cql_rebuild_recreate_group() result will hold 1 if we rebuilt and 0 if we recreated the group.
     bprintf(&update_proc, "    LET %s_result := ", migrate_key);
-    bprintf(&update_proc, "cql_rebuild_recreate_group(cql_compressed(");
+    bprintf(&update_proc, "%s(cql_compressed(", cg_schema_recreate_group_helper());
     cg_pretty_quote_compressed_text(update_tables.ptr, &update_proc);
     bprintf(&update_proc, "),\n      cql_compressed(");
     cg_pretty_quote_compressed_text(update_indices.ptr, &update_proc);
     bprintf(&update_proc, "),\n      cql_compressed(");
     cg_pretty_quote_compressed_text(delete_tables.ptr, &update_proc);
-    bprintf(&update_proc, "));\n");
+    if (options.preserve_recreate_data) {
+      // the copy progress is kept in the facets table
+      bprintf(&update_proc, "),\n      '%s_cql_schema_facets');\n", global_proc_name);
+    }
+    else {
+      bprintf(&update_proc, "));\n");
+    }
 
     // Case on result to see whether this group recreated or rebuilt.
     // If recreated, then we emit drop statements for all recursive child
@@ -1441,6 +1479,18 @@ static void cg_schema_manage_recreate_tables(
       cg_schema_add_recreate_table(&recreate_only_virtual_tables, table_crc, facet, update_proc, migrate_key);
     } else {
       cg_schema_add_recreate_table(&recreate_without_virtual_tables, table_crc, facet, update_proc, migrate_key);
+
+      // a group that is going to change gets its data copied ahead, a batch at a time
+      if (update_tables.used > 1) {
+        bprintf(&copy_tables, "  IF cql_facet_find(%s_facets, '%s') != %lld THEN\n", global_proc_name,
+          facet.ptr, (llint_t)table_crc);
+        bprintf(&copy_tables, "    IF cql_rebuild_copy_group_data(cql_compressed(");
+        cg_pretty_quote_compressed_text(update_tables.ptr, &copy_tables);
+        bprintf(&copy_tables, "),\n      '%s_cql_schema_facets') THEN\n", global_proc_name);
+        bprintf(&copy_tables, "      SET pending := TRUE;\n");
+        bprintf(&copy_tables, "    END IF;\n");
+        bprintf(&copy_tables, "  END IF;\n");
+      }
     }
     CHARBUF_CLOSE(update_proc);
     CHARBUF_CLOSE(facet);
@@ -1480,10 +1530,26 @@ static void cg_schema_manage_recreate_tables(
    (llint_t) all_virtual_tables_crc);
   bprintf(output, "END;\n\n");
 
+  // In incremental mode the data the groups keep is copied in a step of its own before the
+  // step that recreates them; the step runs again (committing each time) until nothing
+  // is pending.  The recreate finishes whatever is left and swaps the tables in.
+  if (options.preserve_recreate_data && options.incremental_upgrade) {
+    bprintf(output, "-- copy the data of the non-virtual @recreate tables that will be rebuilt, a batch per call\n");
+    bprintf(output, "@attribute(cql:private)\n");
+    bprintf(output, "CREATE PROCEDURE %s_cql_copy_recreate_data(OUT pending BOOL NOT NULL)\n", global_proc_name);
+    bprintf(output, "BEGIN\n");
+    bprintf(output, "  IF cql_facet_find(%s_facets, 'all_nonvirtual_tables_crc') == %lld RETURN; \n",
+      global_proc_name,
+      (llint_t) all_nonvirtual_tables_crc);
+    bprintf(output, "%s", copy_tables.ptr);
+    bprintf(output, "END;\n\n");
+  }
+
   CHARBUF_CLOSE(pending_table_creates);
   CHARBUF_CLOSE(delete_tables);
   CHARBUF_CLOSE(update_indices);
   CHARBUF_CLOSE(update_tables);
+  CHARBUF_CLOSE(copy_tables);
   CHARBUF_CLOSE(recreate_only_virtual_tables);
   CHARBUF_CLOSE(recreate_without_virtual_tables);
   symtab_delete(recreate_group_drops);
@@ -1545,6 +1611,273 @@ static llint_t cg_schema_compute_crc(
   return schema_crc;
 }
 
+// Tables that have create table or add column steps, only these can benefit
+// from a fingerprint.  Tables that have ever been unsubscribed can be dropped
+// and later re-created by the upgrader so they cannot be fingerprinted.  We
+// find both sets up front.
+static symtab *stepped_tables;
+static symtab *unsub_tables;
+
+// A fingerprint is the CRC of the final shape of a table.  Once an upgrade
+// has brought the table to that shape the fingerprint is stored in the
+// '<table>_table_crc' facet and later upgrades skip the create and add column
+// probes for that table entirely.  Only tables on the ordinary create plan
+// get a fingerprint; anything the upgrader might drop would leave a stale facet.
+static bool_t cg_schema_has_fingerprint(ast_node *ast) {
+  Contract(is_ast_create_table_stmt(ast));
+
+  if (is_virtual_ast(ast) || ast->sem->recreate || is_deleted(ast) || is_table_not_physical(ast)) {
+    return false;
+  }
+
+  if (!include_from_region(ast->sem->region, SCHEMA_TO_UPGRADE)) {
+    return false;
+  }
+
+  EXTRACT_NOTNULL(create_table_name_flags, ast->left);
+  EXTRACT_NOTNULL(table_flags_attrs, create_table_name_flags->left);
+  EXTRACT_OPTION(flags, table_flags_attrs->left);
+  EXTRACT_STRING(table_name, create_table_name_flags->right);
+
+  if (flags & TABLE_IS_TEMP) {
+    return false;
+  }
+
+  return symtab_find(stepped_tables, table_name) && !symtab_find(unsub_tables, table_name);
+}
+
+// The fingerprint is computed from the full table definition, all columns included.
+static llint_t cg_schema_table_fingerprint(ast_node *ast) {
+  gen_sql_callbacks callbacks;
+  init_gen_sql_callbacks(&callbacks);
+  callbacks.mode = gen_mode_no_annotations;
+
+  CHARBUF_OPEN(sql_out);
+  gen_set_output_buffer(&sql_out);
+  gen_statement_with_callbacks(ast, &callbacks);
+  llint_t crc = (llint_t)crc_charbuf(&sql_out);
+  CHARBUF_CLOSE(sql_out);
+
+  return crc;
+}
+
+// Emits the guard that skips a create table or add column step when the table
+// is already known to have its final shape.  The caller adds the actual probe.
+static void cg_schema_emit_fingerprint_guard(charbuf *output, ast_node *ast, CSTR table_name) {
+  if (cg_schema_has_fingerprint(ast)) {
+    bprintf(output, "cql_facet_find(%s_facets, '%s_table_crc') <> %lld AND\n       ",
+      global_proc_name,
+      table_name,
+      cg_schema_table_fingerprint(ast));
+  }
+}
+
+// After all the steps have run every fingerprinted table has its final shape.
+static void cg_schema_emit_set_table_crcs_proc(charbuf *output) {
+  bprintf(output, "@attribute(cql:private)\n");
+  bprintf(output, "CREATE PROCEDURE %s_cql_set_table_crcs()\n", global_proc_name);
+  bprintf(output, "BEGIN\n");
+
+  for (list_item *item = all_tables_list; item; item = item->next) {
+    ast_node *ast = item->ast;
+    Invariant(is_ast_create_table_stmt(ast));
+
+    if (!cg_schema_has_fingerprint(ast)) {
+      continue;
+    }
+
+    EXTRACT_NOTNULL(create_table_name_flags, ast->left);
+    EXTRACT_STRING(table_name, create_table_name_flags->right);
+    llint_t crc = cg_schema_table_fingerprint(ast);
+
+    bprintf(output, "  IF cql_facet_find(%s_facets, '%s_table_crc') <> %lld THEN\n", global_proc_name, table_name, crc);
+    bprintf(output, "    CALL %s_cql_set_facet_version('%s_table_crc', %lld);\n", global_proc_name, table_name, crc);
+    bprintf(output, "  END IF;\n");
+  }
+
+  bprintf(output, "END;\n\n");
+}
+
+// In incremental mode each unit of upgrade work (the preamble, each version,
+// and the finale) becomes its own step procedure.  A step records that it is
+// done in the 'cql_upgrade_step_<n>' facet, keyed by the target schema crc, so
+// a step that has already run for this schema is skipped.  The normal upgrade
+// just calls the steps in order; the incremental driver runs each one in its
+// own transaction.  This flushes the pending step, if there is one.
+static void cg_schema_end_step(
+  charbuf *main,
+  charbuf *steps,
+  charbuf *step,
+  int32_t *step_count,
+  llint_t schema_crc_no_virtual)
+{
+  if (step->used <= 1) {
+    return;
+  }
+
+  int32_t index = (*step_count)++;
+
+  bprintf(steps, "@attribute(cql:private)\n");
+  bprintf(steps, "CREATE PROCEDURE %s_cql_upgrade_step_%d()\n", global_proc_name, index);
+  bprintf(steps, "BEGIN\n");
+  bprintf(steps, "  LET facet := cql_compressed('cql_upgrade_step_%d');\n", index);
+  bprintf(steps, "  IF cql_facet_find(%s_facets, facet) <> %lld THEN\n", global_proc_name, schema_crc_no_virtual);
+  bprintf(steps, "%s", step->ptr);
+  bprintf(steps, "    CALL %s_cql_set_facet_version('cql_upgrade_step_%d', %lld);\n",
+    global_proc_name, index, schema_crc_no_virtual);
+  bprintf(steps, "  END IF;\n");
+  bprintf(steps, "END;\n\n");
+
+  bprintf(main, "    CALL %s_cql_upgrade_step_%d();\n", global_proc_name, index);
+
+  bclear(step);
+}
+
+// The entry points for running the upgrade a few steps at a time.  Each call
+// runs whole steps, each in its own transaction, until it runs out of steps,
+// reaches max_steps, or uses up budget_ms; at least one step is always run so
+// there is progress even with a tiny budget.  A zero (or negative) limit means
+// no limit.  The caller must not be in a transaction.  Between calls the
+// schema is partly upgraded (e.g. views are dropped until the last step) so the
+// app should keep calling until finished is true.
+static void cg_schema_emit_incremental_upgrade(
+  charbuf *output,
+  int32_t step_count,
+  int32_t max_schema_version,
+  llint_t schema_crc,
+  llint_t schema_crc_no_virtual,
+  bool_t has_temp_schema)
+{
+  // julianday is good to the millisecond, only differences are meaningful
+  bprintf(output, "@attribute(cql:private)\n");
+  bprintf(output, "CREATE PROCEDURE %s_cql_clock_ms(OUT ms REAL NOT NULL)\n", global_proc_name);
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  SET ms := (SELECT julianday('now') * 86400000.0);\n");
+  bprintf(output, "END;\n\n");
+
+  bprintf(output, "@attribute(cql:private)\n");
+  bprintf(output, "CREATE PROCEDURE %s_cql_upgrade_should_yield(\n", global_proc_name);
+  bprintf(output, "  steps_run INTEGER NOT NULL,\n");
+  bprintf(output, "  max_steps INTEGER NOT NULL,\n");
+  bprintf(output, "  start_ms REAL NOT NULL,\n");
+  bprintf(output, "  budget_ms LONG INTEGER NOT NULL,\n");
+  bprintf(output, "  OUT yield_ BOOL NOT NULL)\n");
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  SET yield_ := steps_run > 0 AND (\n");
+  bprintf(output, "    (max_steps > 0 AND steps_run >= max_steps) OR\n");
+  bprintf(output, "    (budget_ms > 0 AND %s_cql_clock_ms() - start_ms >= budget_ms));\n", global_proc_name);
+  bprintf(output, "END;\n\n");
+
+  // step_count is the virtual table step, it is run only when asked for
+  bprintf(output, "@attribute(cql:private)\n");
+  bprintf(output, "CREATE PROCEDURE %s_cql_run_upgrade_step(step INTEGER NOT NULL)\n", global_proc_name);
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  BEGIN IMMEDIATE TRANSACTION;\n");
+  bprintf(output, "  BEGIN TRY\n");
+  bprintf(output, "    SWITCH step\n");
+  for (int32_t i = 0; i < step_count; i++) {
+    bprintf(output, "    WHEN %d THEN\n", i);
+    bprintf(output, "      CALL %s_cql_upgrade_step_%d();\n", global_proc_name, i);
+  }
+  bprintf(output, "    WHEN %d THEN\n", step_count);
+  bprintf(output, "      CALL %s_cql_upgrade_virtual_tables();\n", global_proc_name);
+  bprintf(output, "    END;\n");
+  bprintf(output, "  END TRY;\n");
+  bprintf(output, "  BEGIN CATCH\n");
+  bprintf(output, "    ROLLBACK TRANSACTION;\n");
+  bprintf(output, "    THROW;\n");
+  bprintf(output, "  END CATCH;\n");
+  bprintf(output, "  COMMIT TRANSACTION;\n");
+  bprintf(output, "END;\n\n");
+
+  bprintf(output, "@attribute(cql:private)\n");
+  bprintf(output, "CREATE PROCEDURE %s_perform_upgrade_steps_incrementally(\n", global_proc_name);
+  bprintf(output, "  include_virtual_tables BOOL NOT NULL,\n");
+  bprintf(output, "  max_steps INTEGER NOT NULL,\n");
+  bprintf(output, "  budget_ms LONG INTEGER NOT NULL,\n");
+  bprintf(output, "  OUT finished BOOL NOT NULL)\n");
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  -- a downgrade is not attempted, there is nothing to do --\n");
+  bprintf(output, "  IF cql_facet_find(%s_facets, 'cql_schema_version') > %d THEN\n", global_proc_name, max_schema_version);
+  bprintf(output, "    SET finished := TRUE;\n");
+  bprintf(output, "    RETURN;\n");
+  bprintf(output, "  END IF;\n\n");
+  bprintf(output, "  LET start_ms := %s_cql_clock_ms();\n", global_proc_name);
+  bprintf(output, "  LET steps_run := 0;\n");
+  bprintf(output, "  LET step := 0;\n\n");
+  bprintf(output, "  -- if the schema without virtual tables is current there are no steps left --\n");
+  bprintf(output, "  IF cql_facet_find(%s_facets, 'cql_schema_crc_no_virtual') = %lld THEN\n",
+    global_proc_name, schema_crc_no_virtual);
+  bprintf(output, "    SET step := %d;\n", step_count);
+  bprintf(output, "  END IF;\n\n");
+  bprintf(output, "  WHILE step < %d\n", step_count);
+  bprintf(output, "  BEGIN\n");
+  bprintf(output, "    IF cql_facet_find(%s_facets, printf('cql_upgrade_step_%%d', step)) <> %lld THEN\n",
+    global_proc_name, schema_crc_no_virtual);
+  bprintf(output, "      IF %s_cql_upgrade_should_yield(steps_run, max_steps, start_ms, budget_ms) THEN\n", global_proc_name);
+  bprintf(output, "        RETURN;\n");
+  bprintf(output, "      END IF;\n");
+  bprintf(output, "      CALL %s_cql_run_upgrade_step(step);\n", global_proc_name);
+  bprintf(output, "      SET steps_run := steps_run + 1;\n");
+  bprintf(output, "      -- a step that has more to do (e.g. copying data) runs again --\n");
+  bprintf(output, "      IF cql_facet_find(%s_facets, printf('cql_upgrade_step_%%d', step)) <> %lld THEN\n",
+    global_proc_name, schema_crc_no_virtual);
+  bprintf(output, "        CONTINUE;\n");
+  bprintf(output, "      END IF;\n");
+  bprintf(output, "    END IF;\n");
+  bprintf(output, "    SET step := step + 1;\n");
+  bprintf(output, "  END;\n\n");
+  bprintf(output, "  CALL %s_cql_forget_upgrade_steps();\n\n", global_proc_name);
+  bprintf(output, "  IF include_virtual_tables AND cql_facet_find(%s_facets, 'cql_schema_crc') <> %lld THEN\n",
+    global_proc_name, schema_crc);
+  bprintf(output, "    IF %s_cql_upgrade_should_yield(steps_run, max_steps, start_ms, budget_ms) THEN\n", global_proc_name);
+  bprintf(output, "      RETURN;\n");
+  bprintf(output, "    END IF;\n");
+  bprintf(output, "    CALL %s_cql_run_upgrade_step(%d);\n", global_proc_name, step_count);
+  bprintf(output, "  END IF;\n\n");
+  bprintf(output, "  SET finished := TRUE;\n");
+  bprintf(output, "END;\n\n");
+
+  bprintf(output, "CREATE PROCEDURE %s_upgrade_incrementally(\n", global_proc_name);
+  bprintf(output, "  include_virtual_tables BOOL NOT NULL,\n");
+  bprintf(output, "  max_steps INTEGER NOT NULL,\n");
+  bprintf(output, "  budget_ms LONG INTEGER NOT NULL,\n");
+  bprintf(output, "  OUT finished BOOL NOT NULL)\n");
+  bprintf(output, "BEGIN\n");
+  bprintf(output, "  DECLARE schema_crc LONG INTEGER NOT NULL;\n");
+  bprintf(output, "\n");
+  bprintf(output, "  -- create schema facets information table --\n");
+  bprintf(output, "  CALL %s_create_cql_schema_facets_if_needed();\n\n", global_proc_name);
+  bprintf(output, "  -- fetch the last known schema crc, if it's different there are steps to run --\n");
+  bprintf(output, "  CALL %s_cql_get_facet_version('cql_schema_crc', schema_crc);\n\n", global_proc_name);
+  bprintf(output, "  IF schema_crc <> %lld THEN\n", schema_crc);
+  bprintf(output, "    BEGIN TRY\n");
+  bprintf(output, "      CALL %s_setup_facets();\n", global_proc_name);
+  bprintf(output, "      CALL %s_perform_upgrade_steps_incrementally(include_virtual_tables, max_steps, budget_ms, finished);\n", global_proc_name);
+  bprintf(output, "    END TRY;\n");
+  bprintf(output, "    BEGIN CATCH\n");
+  bprintf(output, "      SET %s_facets := NULL;\n", global_proc_name);
+  bprintf(output, "      SET %s_tables_dict_ := NULL;\n", global_proc_name);
+  bprintf(output, "      SET %s_columns_dict_ := NULL;\n", global_proc_name);
+  bprintf(output, "      THROW;\n");
+  bprintf(output, "    END CATCH;\n");
+  bprintf(output, "    SET %s_facets := NULL;\n", global_proc_name);
+  bprintf(output, "    SET %s_tables_dict_ := NULL;\n", global_proc_name);
+  bprintf(output, "    SET %s_columns_dict_ := NULL;\n", global_proc_name);
+  bprintf(output, "  ELSE\n");
+  bprintf(output, "    SET finished := TRUE;\n");
+  bprintf(output, "  END IF;\n");
+
+  if (has_temp_schema) {
+    bprintf(output, "\n  ---- install temp schema after upgrade is complete ----\n");
+    bprintf(output, "  IF finished THEN\n");
+    bprintf(output, "    CALL %s_cql_install_temp_schema();\n", global_proc_name);
+    bprintf(output, "  END IF;\n");
+  }
+
+  bprintf(output, "END;\n\n");
+}
+
 // Main entry point for schema upgrade code-gen.
 cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   Contract(options.file_names_count == 1);
@@ -1571,6 +1904,18 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
 
   group_drop_funcs = symtab_new();
 
+  stepped_tables = symtab_new();
+  unsub_tables = symtab_new();
+  for (int32_t i = 0; i < schema_items_count; i++) {
+    uint32_t type = notes[i].annotation_type;
+    if (type == SCHEMA_ANNOTATION_CREATE_TABLE || type == SCHEMA_ANNOTATION_CREATE_COLUMN) {
+      symtab_add(stepped_tables, notes[i].target_name, NULL);
+    }
+    else if (type == SCHEMA_ANNOTATION_UNSUB) {
+      symtab_add(unsub_tables, notes[i].target_name, NULL);
+    }
+  }
+
   CHARBUF_OPEN(preamble);
   CHARBUF_OPEN(main);
   CHARBUF_OPEN(decls);
@@ -1578,6 +1923,7 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   CHARBUF_OPEN(upgrade);
   CHARBUF_OPEN(baseline);
   CHARBUF_OPEN(drops);
+  CHARBUF_OPEN(step);
 
   bprintf(&decls, "%s", rt->source_prefix);
   bprintf(&decls, "-- no columns will be considered hidden in this script\n");
@@ -1629,21 +1975,36 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   bprintf(&preamble, "  END CATCH;\n");
   bprintf(&preamble, "END;\n\n");
 
-  bprintf(&preamble, "DECLARE FUNCTION _cql_contains_column_def(needle TEXT, haystack TEXT) BOOL NOT NULL;\n");
-
+  // The column catalog is keyed by "table.column" and is filled in from
+  // pragma_table_xinfo one table at a time, only for tables that get probed.
+  // The key "table." records that the table has been loaded.  A table with no
+  // columns doesn't exist (yet) so it is not marked and will be read again.
   bprintf(&preamble, "@attribute(cql:private)\n");
-  bprintf(&preamble, "CREATE PROC %s_column_exists(table_ TEXT NOT NULL, col_info TEXT NOT NULL, OUT exists_ BOOL NOT NULL)\n", global_proc_name);
+  bprintf(&preamble, "CREATE PROC %s_column_exists(table_ TEXT NOT NULL, column_ TEXT NOT NULL, OUT exists_ BOOL NOT NULL)\n", global_proc_name);
   bprintf(&preamble, "BEGIN\n");
-  bprintf(&preamble, "  IF %s_tables_dict_ IS NULL THROW;\n", global_proc_name);
-  bprintf(&preamble, "  LET table_str := cql_string_dictionary_find(%s_tables_dict_, table_);\n", global_proc_name);
-  bprintf(&preamble, "  SET exists_ := _cql_contains_column_def(table_str, col_info);\n");
+  bprintf(&preamble, "  IF %s_columns_dict_ IS NULL THEN\n", global_proc_name);
+  bprintf(&preamble, "    SET %s_columns_dict_ := cql_string_dictionary_create();\n", global_proc_name);
+  bprintf(&preamble, "  END IF;\n");
+  bprintf(&preamble, "  LET columns_ := ifnull_throw(%s_columns_dict_);\n", global_proc_name);
+  bprintf(&preamble, "  LET loaded := printf('%%s.', table_);\n");
+  bprintf(&preamble, "  IF cql_string_dictionary_find(columns_, loaded) IS NULL THEN\n");
+  bprintf(&preamble, "    DECLARE C CURSOR FOR SELECT name FROM pragma_table_xinfo(table_);\n");
+  bprintf(&preamble, "    LOOP FETCH C\n");
+  bprintf(&preamble, "    BEGIN\n");
+  bprintf(&preamble, "      LET added := cql_string_dictionary_add(columns_, printf('%%s.%%s', table_, C.name), '');\n");
+  bprintf(&preamble, "      SET added := cql_string_dictionary_add(columns_, loaded, '');\n");
+  bprintf(&preamble, "    END;\n");
+  bprintf(&preamble, "  END IF;\n");
+  bprintf(&preamble, "  SET exists_ := cql_string_dictionary_find(columns_, printf('%%s.%%s', table_, column_)) IS NOT NULL;\n");
   bprintf(&preamble, "END;\n\n");
 
   bprintf(&preamble, "@attribute(cql:private)\n");
   bprintf(&preamble, "CREATE PROC %s_table_exists(table_ TEXT NOT NULL, OUT exists_ BOOL NOT NULL)\n", global_proc_name);
   bprintf(&preamble, "BEGIN\n");
-  bprintf(&preamble, "  IF %s_tables_dict_ IS NULL THROW;\n", global_proc_name);
-  bprintf(&preamble, "  LET result := cql_string_dictionary_find(%s_tables_dict_, table_);\n", global_proc_name);
+  bprintf(&preamble, "  IF %s_tables_dict_ IS NULL THEN\n", global_proc_name);
+  bprintf(&preamble, "    CALL %s_get_table_defs();\n", global_proc_name);
+  bprintf(&preamble, "  END IF;\n");
+  bprintf(&preamble, "  LET result := cql_string_dictionary_find(ifnull_throw(%s_tables_dict_), table_);\n", global_proc_name);
   bprintf(&preamble, "  SET exists_ := result IS NOT NULL and result IS NOT '';\n");
   bprintf(&preamble, "END;\n\n");
 
@@ -1654,41 +2015,47 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   bprintf(&main, "BEGIN\n");
   bprintf(&main, "  LET facet := cql_compressed('cql_schema_crc_no_virtual');\n");
   bprintf(&main, "  IF cql_facet_find(%s_facets, facet) <> %lld THEN\n", global_proc_name, (llint_t) schema_crc_no_virtual);
-  bprintf(&main, "    DECLARE schema_version LONG INTEGER NOT NULL;\n");
+  // in incremental mode the work goes into step procedures, main just calls them
+  int32_t step_count = 0;
+  charbuf *work = options.incremental_upgrade ? &step : &main;
+
+  bprintf(work, "    DECLARE schema_version LONG INTEGER NOT NULL;\n");
 
   if (view_drops) {
-    bprintf(&main, "    -- dropping all views --\n");
-    bprintf(&main, "    CALL %s_cql_drop_all_views();\n\n", global_proc_name);
+    bprintf(work, "    -- dropping all views --\n");
+    bprintf(work, "    CALL %s_cql_drop_all_views();\n\n", global_proc_name);
   }
 
   if (index_drops) {
-    bprintf(&main, "    -- dropping condemned or changing indices --\n");
-    bprintf(&main, "    CALL %s_cql_drop_all_indices();\n\n", global_proc_name);
+    bprintf(work, "    -- dropping condemned or changing indices --\n");
+    bprintf(work, "    CALL %s_cql_drop_all_indices();\n\n", global_proc_name);
   }
 
   if (trigger_drops) {
-    bprintf(&main, "    -- dropping condemned or changing triggers --\n");
-    bprintf(&main, "    CALL %s_cql_drop_all_triggers();\n\n", global_proc_name);
+    bprintf(work, "    -- dropping condemned or changing triggers --\n");
+    bprintf(work, "    CALL %s_cql_drop_all_triggers();\n\n", global_proc_name);
   }
 
   if (options.min_schema_version == 0) {
     if (baseline.used > 1) {
       llint_t baseline_crc = (llint_t)crc_charbuf(&baseline);
-      bprintf(&main, "    ---- install baseline schema if needed ----\n\n");
-      bprintf(&main, "    CALL %s_cql_get_version_crc(0, schema_version);\n", global_proc_name);
-      bprintf(&main, "    IF schema_version != %lld THEN\n", baseline_crc);
-      bprintf(&main, "      CALL %s_cql_install_baseline_schema();\n", global_proc_name);
-      bprintf(&main, "      CALL %s_cql_set_version_crc(0, %lld);\n", global_proc_name, baseline_crc);
-      bprintf(&main, "    END IF;\n\n");
+      bprintf(work, "    ---- install baseline schema if needed ----\n\n");
+      bprintf(work, "    CALL %s_cql_get_version_crc(0, schema_version);\n", global_proc_name);
+      bprintf(work, "    IF schema_version != %lld THEN\n", baseline_crc);
+      bprintf(work, "      CALL %s_cql_install_baseline_schema();\n", global_proc_name);
+      bprintf(work, "      CALL %s_cql_set_version_crc(0, %lld);\n", global_proc_name, baseline_crc);
+      bprintf(work, "    END IF;\n\n");
     }
     else {
       // set the baseline schema CRC to -1;  We do this in case full unsub causes baseline
       // to go to nothing and subsequent removal of some unsubs needs to see that it changed.
-      bprintf(&main, "      CALL %s_cql_set_version_crc(0, -1);\n", global_proc_name);
+      bprintf(work, "      CALL %s_cql_set_version_crc(0, -1);\n", global_proc_name);
     }
   }
 
-  bprintf(&main, "    CALL %s_get_table_defs();\n\n", global_proc_name);
+  if (options.incremental_upgrade) {
+    cg_schema_end_step(&main, &preamble, &step, &step_count, schema_crc_no_virtual);
+  }
 
   uint32_t prev_version = 0;
 
@@ -1711,7 +2078,10 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
     }
 
     if (prev_version != vers) {
-      cg_schema_end_version(&main, &upgrade, &pending, prev_version);
+      cg_schema_end_version(work, &upgrade, &pending, prev_version);
+      if (options.incremental_upgrade) {
+        cg_schema_end_step(&main, &preamble, &step, &step_count, schema_crc_no_virtual);
+      }
       prev_version = (uint32_t)vers;
     }
 
@@ -1762,11 +2132,12 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
           target_name,
           col_name,
           col_type);
-        bprintf(&upgrade, "    IF NOT %s_column_exists(cql_compressed('%s'), cql_compressed('%s %s')) THEN \n",
+        bprintf(&upgrade, "    IF ");
+        cg_schema_emit_fingerprint_guard(&upgrade, note->target_ast, target_name);
+        bprintf(&upgrade, "NOT %s_column_exists(cql_compressed('%s'), cql_compressed('%s')) THEN\n",
           global_proc_name,
           target_name,
-          col_name,
-          col_type);
+          col_name);
         bprintf(&upgrade, "      ALTER TABLE %s ADD COLUMN %s;\n",
           target_name,
           sql_out.ptr);
@@ -1807,7 +2178,9 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
           }
         }
 
-        bprintf(&upgrade, "    IF NOT %s_table_exists(cql_compressed('%s')) THEN\n", global_proc_name, target_name);
+        bprintf(&upgrade, "    IF ");
+        cg_schema_emit_fingerprint_guard(&upgrade, note->target_ast, target_name);
+        bprintf(&upgrade, "NOT %s_table_exists(cql_compressed('%s')) THEN\n", global_proc_name, target_name);
         bprintf(&upgrade, "      -- creating table %s\n\n", target_name);
 
         gen_sql_callbacks callbacks;
@@ -1872,8 +2245,19 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
     }
   }
 
-  cg_schema_end_version(&main, &upgrade, &pending, prev_version);
+  cg_schema_end_version(work, &upgrade, &pending, prev_version);
+  if (options.incremental_upgrade) {
+    cg_schema_end_step(&main, &preamble, &step, &step_count, schema_crc_no_virtual);
+  }
 
+  // this step is not done (its facet is not set) until all the data has been copied
+  if (options.incremental_upgrade && options.preserve_recreate_data && recreate_items_count) {
+    bprintf(work, "    -- copy the data the @recreate groups keep ahead of the rebuild --\n");
+    bprintf(work, "    IF %s_cql_copy_recreate_data() THEN\n", global_proc_name);
+    bprintf(work, "      RETURN;\n");
+    bprintf(work, "    END IF;\n");
+    cg_schema_end_step(&main, &preamble, &step, &step_count, schema_crc_no_virtual);
+  }
 
   // compute additional drops due to net unsubscription
 
@@ -1901,7 +2285,7 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   reverse_list(&all_tables_list);
 
   if (drops.used > 1) {
-    bprintf(&main, "    CALL %s_cql_drop_tables();\n", global_proc_name);
+    bprintf(work, "    CALL %s_cql_drop_tables();\n", global_proc_name);
 
     bprintf(&preamble, "@attribute(cql:private)\n");
     bprintf(&preamble, "CREATE PROC %s_cql_drop_tables()\n", global_proc_name);
@@ -1911,33 +2295,70 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   }
 
   if (recreate_items_count) {
-    bprintf(&main, "    CALL %s_cql_recreate_non_virtual_tables();\n", global_proc_name);
+    bprintf(work, "    CALL %s_cql_recreate_non_virtual_tables();\n", global_proc_name);
   }
 
   if (view_creates) {
-    bprintf(&main, "    CALL %s_cql_create_all_views();\n", global_proc_name);
+    bprintf(work, "    CALL %s_cql_create_all_views();\n", global_proc_name);
   }
 
+  cg_schema_emit_set_table_crcs_proc(&preamble);
+  bprintf(work, "    CALL %s_cql_set_table_crcs();\n", global_proc_name);
+
   if (index_creates) {
-    bprintf(&main, "    CALL %s_cql_create_all_indices();\n", global_proc_name);
+    bprintf(work, "    CALL %s_cql_create_all_indices();\n", global_proc_name);
   }
 
   if (trigger_creates) {
-    bprintf(&main, "    CALL %s_cql_create_all_triggers();\n", global_proc_name);
+    bprintf(work, "    CALL %s_cql_create_all_triggers();\n", global_proc_name);
+  }
+
+  bprintf(work, "\n    CALL %s_cql_set_facet_version('cql_schema_version', %d);\n", global_proc_name, prev_version);
+  bprintf(work, "    CALL %s_cql_set_facet_version('cql_schema_crc_no_virtual', %lld);\n", global_proc_name, schema_crc_no_virtual);
+  if (options.incremental_upgrade) {
+    cg_schema_end_step(&main, &preamble, &step, &step_count, schema_crc_no_virtual);
+
+    // once every step is done the 'cql_schema_crc_no_virtual' facet says so, the step facets can go
+    bprintf(&preamble, "@attribute(cql:private)\n");
+    bprintf(&preamble, "CREATE PROCEDURE %s_cql_forget_upgrade_steps()\n", global_proc_name);
+    bprintf(&preamble, "BEGIN\n");
+    bprintf(&preamble, "  DELETE FROM %s_cql_schema_facets WHERE facet GLOB 'cql_upgrade_step_*';\n", global_proc_name);
+    bprintf(&preamble, "END;\n\n");
+    bprintf(&main, "    CALL %s_cql_forget_upgrade_steps();\n", global_proc_name);
   }
 
-  bprintf(&main, "\n    CALL %s_cql_set_facet_version('cql_schema_version', %d);\n", global_proc_name, prev_version);
-  bprintf(&main, "    CALL %s_cql_set_facet_version('cql_schema_crc_no_virtual', %lld);\n", global_proc_name, schema_crc_no_virtual);
   bprintf(&main, "  END IF;\n");
   bprintf(&main, "  IF include_virtual_tables THEN\n");
 
+  // the virtual tables are a step of their own in incremental mode, the driver runs it last
+  CSTR indent = "    ";
+  work = &main;
+
+  if (options.incremental_upgrade) {
+    bprintf(&preamble, "@attribute(cql:private)\n");
+    bprintf(&preamble, "CREATE PROCEDURE %s_cql_upgrade_virtual_tables()\n", global_proc_name);
+    bprintf(&preamble, "BEGIN\n");
+    indent = "  ";
+    work = &preamble;
+  }
+
   if (recreate_items_count) {
-    bprintf(&main, "    CALL %s_cql_recreate_virtual_tables();\n", global_proc_name);
+    bprintf(work, "%sCALL %s_cql_recreate_virtual_tables();\n", indent, global_proc_name);
   }
-  bprintf(&main, "    CALL %s_cql_set_facet_version('cql_schema_crc', %lld);\n", global_proc_name, schema_crc);
+  bprintf(work, "%sCALL %s_cql_set_facet_version('cql_schema_crc', %lld);\n", indent, global_proc_name, schema_crc);
+
+  if (options.incremental_upgrade) {
+    bprintf(&preamble, "END;\n\n");
+    bprintf(&main, "    CALL %s_cql_upgrade_virtual_tables();\n", global_proc_name);
+  }
+
   bprintf(&main, "  END IF;\n");
   bprintf(&main, "END;\n\n");
 
+  if (options.incremental_upgrade) {
+    cg_schema_emit_incremental_upgrade(&main, step_count, max_schema_version, schema_crc, schema_crc_no_virtual, has_temp_schema);
+  }
+
   bprintf(&main, "CREATE PROCEDURE %s_get_current_and_proposed_versions(\n", global_proc_name);
   bprintf(&main, "    out current long not null,\n");
   bprintf(&main, "    out proposed long not null\n");
@@ -1983,10 +2404,12 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   bprintf(&main, "    BEGIN CATCH\n");
   bprintf(&main, "      SET %s_facets := NULL;\n", global_proc_name);
   bprintf(&main, "      SET %s_tables_dict_ := NULL;\n", global_proc_name);
+  bprintf(&main, "      SET %s_columns_dict_ := NULL;\n", global_proc_name);
   bprintf(&main, "      THROW;\n");
   bprintf(&main, "    END CATCH;\n");
   bprintf(&main, "    SET %s_facets := NULL;\n", global_proc_name);
   bprintf(&main, "    SET %s_tables_dict_ := NULL;\n", global_proc_name);
+  bprintf(&main, "    SET %s_columns_dict_ := NULL;\n", global_proc_name);
   bprintf(&main, "  ELSE\n");
   bprintf(&main, "    -- some canonical result for no differences --\n");
   bprintf(&main, "    SELECT 'no differences' facet;\n");
@@ -2009,24 +2432,27 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
   bprintf(&main, "  CALL %s_helper(FALSE);\n", global_proc_name);
   bprintf(&main, "END;\n\n");
 
-  CHARBUF_OPEN(output_file);
+  // the sections are borrowed into the output rather than copied again (see rope.h)
+  ROPE_OPEN(output_file);
 
   // Enable these lines to force error tracing in the generated upgrader, useful for debugging
   //
-  // bprintf(&output_file, "@echo c,\"#undef cql_error_trace\\n\";\n");
-  // bprintf(&output_file, "@echo c,\"#define cql_error_trace() ");
-  // bprintf(&output_file, "fprintf(stderr, \\\"Error at %%s:%%d in %%s: %%d %%s\\\\n\\\",");
-  // bprintf(&output_file, " __FILE__, __LINE__, _PROC_, _rc_, sqlite3_errmsg(_db_))\";\n");
-  // bprintf(&output_file, "@echo c,\"\\n\\n\";\n\n");
+  // rope_puts(&output_file, "@echo c,\"#undef cql_error_trace\\n\";\n");
+  // rope_puts(&output_file, "@echo c,\"#define cql_error_trace() ");
+  // rope_puts(&output_file, "fprintf(stderr, \\\"Error at %s:%d in %s: %d %s\\\\n\\\",");
+  // rope_puts(&output_file, " __FILE__, __LINE__, _PROC_, _rc_, sqlite3_errmsg(_db_))\";\n");
+  // rope_puts(&output_file, "@echo c,\"\\n\\n\";\n\n");
 
-  bprintf(&output_file, "%s\n", decls.ptr);
-  bprintf(&output_file, "%s", preamble.ptr);
-  bprintf(&output_file, "%s", main.ptr);
+  rope_borrow_charbuf(&output_file, &decls);
+  rope_puts(&output_file, "\n");
+  rope_borrow_charbuf(&output_file, &preamble);
+  rope_borrow_charbuf(&output_file, &main);
 
-  cql_write_file(options.file_names[0], output_file.ptr);
+  rope_write_file(options.file_names[0], &output_file);
 
-  CHARBUF_CLOSE(output_file);
+  ROPE_CLOSE(output_file);
 
+  CHARBUF_CLOSE(step);
   CHARBUF_CLOSE(drops);
   CHARBUF_CLOSE(baseline);
   CHARBUF_CLOSE(upgrade);
@@ -2037,6 +2463,8 @@ cql_noexport void cg_schema_upgrade_main(ast_node *head) {
 
   SYMTAB_CLEANUP(full_drop_funcs);
   SYMTAB_CLEANUP(group_drop_funcs);
+  SYMTAB_CLEANUP(stepped_tables);
+  SYMTAB_CLEANUP(unsub_tables);
 }
 
 #endif
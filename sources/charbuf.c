@@ -33,38 +33,64 @@ cql_noexport void bclear(charbuf *b) {
   b->ptr[0] = 0;
 }
 
+// Make sure there is room for at least "needed" more bytes of text.  The buffer
+// grows geometrically so that building a big output with many small appends
+// costs linear time overall rather than re-copying the whole buffer each time
+// it fills up.
+cql_noexport void breserve(charbuf *b, uint32_t needed) {
+  // invariant is that there is already a null in the buffer
+  // we can re-use that one.
+  uint32_t avail = b->max - b->used;
+
+  if (needed <= avail) {
+    return;
+  }
+
+  uint32_t max = b->max * 2;
+  uint32_t min_max = b->used + needed + CHARBUF_GROWTH_SIZE;
+  if (max < min_max) {
+    max = min_max;
+  }
+
+  char *newptr = _new_array(char, max);
+
+  // note that b->used includes the current null terminator
+  memcpy(newptr, b->ptr, b->used);
+  if (b->ptr != &b->internal[0]) {
+    free(b->ptr);
+  }
+  b->ptr = newptr;
+  b->max = max;
+}
+
+// Most formats produce short strings that fit in the space we already have
+// so we format directly into the buffer on the first try.  Only if that
+// overflows do we grow the buffer (we know exactly how much we need now)
+// and run the format a second time.
 cql_noexport void vbprintf(charbuf *b, const char *format, va_list args) {
-  va_list pass1, pass2;
-  va_copy(pass1, args);
+  va_list pass2;
   va_copy(pass2, args);
 
   // invariant is that there is already a null in the buffer
   // we can re-use that one.
   uint32_t avail = b->max - b->used;
 
-  // does not include the trailing null
-  uint32_t needed = (uint32_t)vsnprintf(NULL, 0, format, pass1);
+  // clobber starting from the current null, there is one more byte
+  // than avail available to vsnprintf because we're backing off to
+  // globber the old null.  The result is always null terminated.
+  // The result does not include the trailing null.
+  uint32_t needed = (uint32_t)vsnprintf(b->ptr + b->used - 1, avail + 1, format, args);
 
   if (needed > avail) {
-    b->max += needed + CHARBUF_GROWTH_SIZE;
-    char *newptr = _new_array(char, b->max);
-
-    // note that b->used includes the current null terminator
-    memcpy(newptr, b->ptr, b->used);
-    if (b->ptr != &b->internal[0]) {
-      free(b->ptr);
-    }
+    // the output was truncated, make room and do it again, the partial
+    // output is simply overwritten
+    breserve(b, needed);
     avail = b->max - b->used;
-    b->ptr = newptr;
+    vsnprintf(b->ptr + b->used - 1, avail + 1, format, pass2);
   }
 
-  // clobber starting from the current null, there is one more byte
-  // than avail available to vsnprintf because we're backing off to
-  // globber the old null.  The result is always null terminated.
-  vsnprintf(b->ptr + b->used - 1, avail + 1, format, pass2);
   b->used += needed;
 
-  va_end(pass1);
   va_end(pass2);
 }
 
@@ -88,30 +114,27 @@ cql_noexport CSTR dup_printf(const char *format, ...) {
 }
 
 cql_noexport void bputc(charbuf *b, char c) {
- // invariant is that there is already a null in the buffer
- // we can re-use that one.
- uint32_t avail = b->max - b->used;
-
- if (avail < 1) {
-   b->max += CHARBUF_GROWTH_SIZE;
-   char *newptr = _new_array(char, b->max);
-
-   // note that b->used includes the current null terminator
-   memcpy(newptr, b->ptr, b->used);
-   if (b->ptr != &b->internal[0]) {
-     free(b->ptr);
-   }
-   avail = b->max - b->used;
-   b->ptr = newptr;
- }
+ breserve(b, 1);
 
  b->ptr[b->used-1] = c; // clobber the previous null
  b->ptr[b->used++] = 0; // put a new null in place, for sure room for this
 }
 
+// Append a string with no formatting at all, this is the fast path for
+// the very common bprintf(b, "%s", str) case.
+cql_noexport void bputs(charbuf *b, const char *str) {
+  uint32_t len = (uint32_t)strlen(str);
+  breserve(b, len);
+
+  // note that b->used includes the current null terminator, we copy
+  // the new null terminator along with the string
+  memcpy(b->ptr + b->used - 1, str, len + 1);
+  b->used += len;
+}
+
 cql_noexport void bindent(charbuf *output, charbuf *input, int32_t indent) {
   if (indent == 0) {
-    bprintf(output, "%s", input->ptr);
+    bputs(output, input->ptr);
     return;
   }
 
@@ -120,19 +143,27 @@ cql_noexport void bindent(charbuf *output, charbuf *input, int32_t indent) {
 
   const char *p = input->ptr;
 
+  // the output is at least as big as the input, reserving that much
+  // up front avoids most of the growth steps
+  breserve(output, input->used);
+
   for (;;) {
     if (!*p) break;
 
     // skip indenting blank lines
     if (*p != '\n') {
-      bprintf(output, "%s", spaces.ptr);
+      bputs(output, spaces.ptr);
     }
 
-    while (*p) {
-      char ch = *p++;
-      bputc(output, ch);
-      if (ch == '\n') break;
-    }
+    // copy the whole line including its linefeed (if any) in one step
+    const char *end = strchr(p, '\n');
+    uint32_t len = end ? (uint32_t)(end - p + 1) : (uint32_t)strlen(p);
+
+    breserve(output, len);
+    memcpy(output->ptr + output->used - 1, p, len);
+    output->used += len;
+    output->ptr[output->used - 1] = 0;
+    p += len;
   }
 
   CHARBUF_CLOSE(spaces);
@@ -25,10 +25,12 @@ cql_data_decl( int32_t charbuf_open_count );
 cql_noexport void bopen(charbuf* b);
 cql_noexport void bclose(charbuf *b);
 cql_noexport void bclear(charbuf *b);
+cql_noexport void breserve(charbuf *b, uint32_t needed);
 cql_noexport void vbprintf(charbuf *b, const char *format, va_list args);
 cql_noexport void bprintf(charbuf *b, const char *format, ...);
 cql_noexport CSTR dup_printf(const char *format, ...);
 cql_noexport void bputc(charbuf *b, char c);
+cql_noexport void bputs(charbuf *b, const char *str);
 cql_noexport void bindent(charbuf *output, charbuf *input, int32_t indent);
 cql_noexport bool_t breadline(charbuf *output, CSTR *data);
 
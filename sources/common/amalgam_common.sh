@@ -12,6 +12,7 @@ process_headers() {
 
   cat "bytebuf.h"
   cat "charbuf.h"
+  cat "rope.h"
   cat "symtab.h"
   cat "minipool.h"
   cat "list.h"
@@ -72,6 +73,7 @@ process_c_files() {
   cat "rt.c"
   cat "rt_common.c"
   cat "rewrite.c"
+  cat "rope.c"
   cat "sem.c"
   cat "sha256.c"
   cat "symtab.c"
@@ -113,6 +115,15 @@ generated SignedSource<<deadbeef8badf00ddefec8edfacefeed>>
 #include <string.h>
 #include <limits.h>
 #include <float.h>
+#include <math.h>
+
+// writev (used to write output files) and fork and waitpid (used by --jobs) are POSIX,
+// not part of C99, but these headers declare them without any feature macros
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #endif
 
@@ -40,6 +40,10 @@ copy_ref cg_test_c_with_namespace.c
 copy_ref cg_test_c_with_namespace.h
 copy_ref cg_test_c_with_type_getters.c
 copy_ref cg_test_c_with_type_getters.h
+copy_ref cg_test_c_with_shared_accessors.c
+copy_ref cg_test_c_with_shared_accessors.h
+copy_ref cg_test_c_with_borrow_loop_fetch.c
+copy_ref cg_test_c_with_borrow_loop_fetch.h
 copy_ref cg_test_exports.out
 copy_ref cg_test_extension_fragment_c.c
 copy_ref cg_test_extension_fragment_c.h
@@ -68,6 +72,10 @@ copy_ref cg_test_schema_partial_upgrade.out
 copy_ref cg_test_schema_partial_upgrade.err
 copy_ref cg_test_schema_min_version_upgrade.out
 copy_ref cg_test_schema_min_version_upgrade.err
+copy_ref cg_test_schema_preserve_upgrade.out
+copy_ref cg_test_schema_preserve_upgrade.err
+copy_ref cg_test_schema_incremental_upgrade.out
+copy_ref cg_test_schema_incremental_upgrade.err
 copy_ref cg_test_schema_prev.out
 copy_ref cg_test_schema_prev.err
 copy_ref cg_test_schema_sqlite.out
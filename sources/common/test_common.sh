@@ -226,6 +226,41 @@ code_gen_c_test() {
     failed
   fi
 
+  echo running codegen test on worker processes
+  if ! ${CQL} --dev --test --cg "${OUT_DIR}/cg_test_c_jobs.h" "${OUT_DIR}/cg_test_c_jobs.c" "${OUT_DIR}/cg_test_exports_jobs.out" --in "${TEST_DIR}/cg_test.sql" --global_proc cql_startup --generate_exports --jobs 4 2>"${OUT_DIR}/cg_test_c.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_c.err"
+    failed
+  fi
+
+  echo verifying the worker processes do not change the output
+  sed -e "s/cg_test_c_jobs.h/cg_test_c.h/" "${OUT_DIR}/cg_test_c_jobs.c" >"${OUT_DIR}/cg_test_c_jobs_renamed.c"
+  if ! cmp "${OUT_DIR}/cg_test_c.c" "${OUT_DIR}/cg_test_c_jobs_renamed.c" || \
+     ! cmp "${OUT_DIR}/cg_test_c.h" "${OUT_DIR}/cg_test_c_jobs.h" || \
+     ! cmp "${OUT_DIR}/cg_test_exports.out" "${OUT_DIR}/cg_test_exports_jobs.out"
+  then
+    echo "ERROR: codegen with --jobs differs from codegen without it"
+    failed
+  fi
+
+  echo verifying worker processes with the placeholder marker in the source
+  # the marker byte is what workers use for placeholders, text like this must not be taken for one
+  printf "create proc jobs_marker1()\nbegin\n  let s := 'a\\001L9\\001b';\nend;\ncreate proc jobs_marker2()\nbegin\n  let s := 'a\\001L0\\001b';\nend;\n" >"${OUT_DIR}/cg_test_jobs_marker.sql"
+  if ! ${CQL} --cg "${OUT_DIR}/cg_test_jobs_marker.h" "${OUT_DIR}/cg_test_jobs_marker.c" --in "${OUT_DIR}/cg_test_jobs_marker.sql" 2>"${OUT_DIR}/cg_test_c.err" || \
+     ! ${CQL} --cg "${OUT_DIR}/cg_test_jobs_marker.h" "${OUT_DIR}/cg_test_jobs_marker_jobs.c" --in "${OUT_DIR}/cg_test_jobs_marker.sql" --jobs 2 2>"${OUT_DIR}/cg_test_c.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_c.err"
+    failed
+  fi
+
+  if ! cmp "${OUT_DIR}/cg_test_jobs_marker.c" "${OUT_DIR}/cg_test_jobs_marker_jobs.c"
+  then
+    echo "ERROR: codegen with --jobs differs when the source has the marker byte"
+    failed
+  fi
+
   echo verifying globals codegen does not require a global proc
   # this has no --test directive and no --nolines
   if ! ${CQL} --cg "${OUT_DIR}/cg_test_c_globals.h" "${OUT_DIR}/cg_test_c_globals.c" --in "${TEST_DIR}/cg_test_c_globals.sql" 2>"${OUT_DIR}/cg_test_c.err"
@@ -273,6 +308,68 @@ code_gen_c_test() {
     failed
   fi
 
+  echo running codegen test with shared result set accessors
+  if ! ${CQL} --test --cg "${OUT_DIR}/cg_test_c_with_shared_accessors.h" "${OUT_DIR}/cg_test_c_with_shared_accessors.c" --in "${TEST_DIR}/cg_test_c_shared_accessors.sql" --global_proc cql_startup --share_result_set_accessors 2>"${OUT_DIR}/cg_test_c.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_c.err"
+    failed
+  fi
+
+  echo validating codegen
+  if ! "${OUT_DIR}/cql-verify" "${TEST_DIR}/cg_test_c_shared_accessors.sql" "${OUT_DIR}/cg_test_c_with_shared_accessors.h"
+  then
+    echo "ERROR: failed verification"
+    failed
+  fi
+
+  echo verifying shared result set accessors are the same on worker processes
+  if ! ${CQL} --test --cg "${OUT_DIR}/cg_test_c_with_shared_accessors_jobs.h" "${OUT_DIR}/cg_test_c_with_shared_accessors_jobs.c" --in "${TEST_DIR}/cg_test_c_shared_accessors.sql" --global_proc cql_startup --share_result_set_accessors --jobs 3 2>"${OUT_DIR}/cg_test_c.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_c.err"
+    failed
+  fi
+
+  sed -e "s/_jobs.h/.h/" "${OUT_DIR}/cg_test_c_with_shared_accessors_jobs.c" >"${OUT_DIR}/cg_test_c_with_shared_accessors_jobs_renamed.c"
+  if ! cmp "${OUT_DIR}/cg_test_c_with_shared_accessors.c" "${OUT_DIR}/cg_test_c_with_shared_accessors_jobs_renamed.c" || \
+     ! cmp "${OUT_DIR}/cg_test_c_with_shared_accessors.h" "${OUT_DIR}/cg_test_c_with_shared_accessors_jobs.h"
+  then
+    echo "ERROR: shared accessors codegen with --jobs differs from codegen without it"
+    failed
+  fi
+
+  echo testing for successful compilation of generated C with shared result set accessors
+  rm -f out/cg_test_c_with_shared_accessors.o
+  if ! do_make out/cg_test_c_with_shared_accessors.o
+  then
+    echo "ERROR: failed to compile the C code from the shared accessors code gen test"
+    failed
+  fi
+
+  echo running codegen test with borrowed loop fetch
+  if ! ${CQL} --test --cg "${OUT_DIR}/cg_test_c_with_borrow_loop_fetch.h" "${OUT_DIR}/cg_test_c_with_borrow_loop_fetch.c" --in "${TEST_DIR}/cg_test_c_borrow_loop_fetch.sql" --global_proc cql_startup --borrow_loop_fetch 2>"${OUT_DIR}/cg_test_c.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_c.err"
+    failed
+  fi
+
+  echo validating codegen
+  if ! "${OUT_DIR}/cql-verify" "${TEST_DIR}/cg_test_c_borrow_loop_fetch.sql" "${OUT_DIR}/cg_test_c_with_borrow_loop_fetch.c"
+  then
+    echo "ERROR: failed verification"
+    failed
+  fi
+
+  echo testing for successful compilation of generated C with borrowed loop fetch
+  rm -f out/cg_test_c_with_borrow_loop_fetch.o
+  if ! do_make out/cg_test_c_with_borrow_loop_fetch.o
+  then
+    echo "ERROR: failed to compile the C code from the borrowed loop fetch code gen test"
+    failed
+  fi
+
   echo running codegen test with namespace enabled
   if ! ${CQL} --dev --test --cg "${OUT_DIR}/cg_test_c_with_namespace.h" "${OUT_DIR}/cg_test_c_with_namespace.c" "${OUT_DIR}/cg_test_imports_with_namespace.ref" --in "${TEST_DIR}/cg_test.sq"l --global_proc cql_startup --c_include_namespace test_namespace --generate_exports 2>"${OUT_DIR}/cg_test_c.err"
   then
@@ -359,6 +456,10 @@ code_gen_c_test() {
   on_diff_exit cg_test_c_with_header.h
   on_diff_exit cg_test_c_with_type_getters.c
   on_diff_exit cg_test_c_with_type_getters.h
+  on_diff_exit cg_test_c_with_shared_accessors.c
+  on_diff_exit cg_test_c_with_shared_accessors.h
+  on_diff_exit cg_test_c_with_borrow_loop_fetch.c
+  on_diff_exit cg_test_c_with_borrow_loop_fetch.h
   on_diff_exit cg_test_exports.out
   on_diff_exit cg_test_base_fragment_c.c
   on_diff_exit cg_test_base_fragment_c.h
@@ -1001,6 +1102,63 @@ schema_migration_test() {
   echo "  computing diffs (empty if none)"
   on_diff_exit cg_test_schema_min_version_upgrade.out
   on_diff_exit cg_test_schema_min_version_upgrade.err
+
+  echo "  running schema migration with data preserving recreate"
+  if ! ${CQL} --cg "${OUT_DIR}/cg_test_schema_preserve_upgrade.out" --in "${TEST_DIR}/cg_test_schema_upgrade.sql" --global_proc test --rt schema_upgrade --preserve_recreate_data 2>"${OUT_DIR}/cg_test_schema_preserve_upgrade.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_schema_preserve_upgrade.err"
+    failed
+  fi
+
+  echo "  compiling the upgrade script with CQL"
+  if ! ${CQL} --cg "${OUT_DIR}/cg_test_schema_preserve_upgrade.h" "${OUT_DIR}/cg_test_schema_preserve_upgrade.c" --in "${OUT_DIR}/cg_test_schema_preserve_upgrade.out"
+  then
+    echo CQL compilation failed
+    failed;
+  fi
+
+  echo "  computing diffs (empty if none)"
+  on_diff_exit cg_test_schema_preserve_upgrade.out
+  on_diff_exit cg_test_schema_preserve_upgrade.err
+
+  echo "  running schema migration with incremental steps"
+  if ! ${CQL} --cg "${OUT_DIR}/cg_test_schema_incremental_upgrade.out" --in "${TEST_DIR}/cg_test_schema_upgrade.sql" --global_proc test --rt schema_upgrade --incremental_upgrade 2>"${OUT_DIR}/cg_test_schema_incremental_upgrade.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_schema_incremental_upgrade.err"
+    failed
+  fi
+
+  echo "  compiling the upgrade script with CQL"
+  if ! ${CQL} --cg "${OUT_DIR}/cg_test_schema_incremental_upgrade.h" "${OUT_DIR}/cg_test_schema_incremental_upgrade.c" --in "${OUT_DIR}/cg_test_schema_incremental_upgrade.out"
+  then
+    echo CQL compilation failed
+    failed;
+  fi
+
+  echo "  computing diffs (empty if none)"
+  on_diff_exit cg_test_schema_incremental_upgrade.out
+  on_diff_exit cg_test_schema_incremental_upgrade.err
+
+  echo "  running schema migration with incremental steps and data preserving recreate"
+  if ! ${CQL} --cg "${OUT_DIR}/cg_test_schema_incremental_preserve_upgrade.out" --in "${TEST_DIR}/cg_test_schema_upgrade.sql" --global_proc test --rt schema_upgrade --incremental_upgrade --preserve_recreate_data 2>"${OUT_DIR}/cg_test_schema_incremental_preserve_upgrade.err"
+  then
+    echo "ERROR:"
+    cat "${OUT_DIR}/cg_test_schema_incremental_preserve_upgrade.err"
+    failed
+  fi
+
+  echo "  compiling the upgrade script with CQL"
+  if ! ${CQL} --cg "${OUT_DIR}/cg_test_schema_incremental_preserve_upgrade.h" "${OUT_DIR}/cg_test_schema_incremental_preserve_upgrade.c" --in "${OUT_DIR}/cg_test_schema_incremental_preserve_upgrade.out"
+  then
+    echo CQL compilation failed
+    failed;
+  fi
+
+  echo "  computing diffs (empty if none)"
+  on_diff_exit cg_test_schema_incremental_preserve_upgrade.out
+  on_diff_exit cg_test_schema_incremental_preserve_upgrade.err
 }
 
 misc_cases() {
@@ -1320,6 +1478,19 @@ run_test() {
     failed
   fi
 
+  if ! ${CQL} --compress --jobs 4 --cg "${OUT_DIR}/run_test_compressed_jobs.h" "${OUT_DIR}/run_test_compressed_jobs.c" --in "${OUT_DIR}/run_test_cpp.out" --global_proc cql_startup --rt c
+  then
+    echo compressed codegen on worker processes failed.
+    failed
+  fi
+
+  sed -e "s/run_test_compressed_jobs.h/run_test_compressed.h/" "${OUT_DIR}/run_test_compressed_jobs.c" >"${OUT_DIR}/run_test_compressed_jobs_renamed.c"
+  if ! cmp "${OUT_DIR}/run_test_compressed.c" "${OUT_DIR}/run_test_compressed_jobs_renamed.c"
+  then
+    echo compressed codegen with --jobs differs from codegen without it
+    failed
+  fi
+
   if ! (echo "  compiling code (compressed version)"; do_make run_test_compressed )
   then
     echo build failed
@@ -1331,6 +1502,18 @@ run_test() {
     echo tests failed
     failed
   fi
+
+  if ! (echo "  compiling thread safe refs test"; do_make refs_thread_test )
+  then
+    echo build failed
+    failed
+  fi
+
+  if ! (echo "  executing thread safe refs test"; "./${OUT_DIR}/refs_thread_test")
+  then
+    echo tests failed
+    failed
+  fi
 }
 
 upgrade_test() {
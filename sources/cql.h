@@ -43,6 +43,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
 
 #ifndef CQL_AMALGAM
 
@@ -83,10 +84,14 @@ typedef struct cmd_options {
   bool_t codegen;
   bool_t compress;
   bool_t generate_type_getters;
+  bool_t share_result_set_accessors;
+  bool_t borrow_loop_fetch;
   bool_t generate_exports;
   bool_t run_unit_tests;
   bool_t nolines;
   bool_t schema_exclusive;
+  bool_t preserve_recreate_data;
+  bool_t incremental_upgrade;
   char *rt;
   char **file_names;
   int32_t file_names_count;
@@ -95,6 +100,7 @@ typedef struct cmd_options {
   char **exclude_regions;
   int32_t exclude_regions_count;
   int32_t min_schema_version;
+  int32_t jobs;
   char *c_include_path;
   char *objc_c_include_path;
   char *c_include_namespace;
@@ -423,6 +429,14 @@ typedef struct rtdata {
   // void *cql_result_set_get_data(** result_set)
   const char *cql_result_set_get_data;
 
+  // Retrieve the storage of the query data as it is, without making any pending string or blob cells.
+  // Used by the getters of cql:lazy_strings procs, which make only the cells they read.
+  // NOTE: This MUST be implemented as a macro, as it takes a result set as a param, which has an undefined type.
+  // @param result_set The cql result_set object.
+  // @return The data that was previous stored on the result set.
+  // void *cql_result_set_get_rows(** result_set)
+  const char *cql_result_set_get_rows;
+
   // Generic bool value getter on base result set object.
   // NOTE: This is only used when generate_type_getters is true.  This function should call through to the
   // inline type getters that are passed into the ctor for the result set.
@@ -580,6 +594,8 @@ typedef struct rtdata {
   const char *cql_result_set_has_identity_columns;
   // Template for the java method copy.
   const char *cql_result_set_copy;
+  // Template for the java whole column getters, one native call per column.
+  const char *cql_result_set_get_column;
 
   // The target type for NULL object value.
   const char *cql_target_null;
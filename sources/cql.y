@@ -2425,6 +2425,10 @@ static void parse_cmd(int argc, char **argv) {
       options.nolines = 1;
     } else if (strcmp(arg, "--schema_exclusive") == 0) {
       options.schema_exclusive = 1;
+    } else if (strcmp(arg, "--preserve_recreate_data") == 0) {
+      options.preserve_recreate_data = 1;
+    } else if (strcmp(arg, "--incremental_upgrade") == 0) {
+      options.incremental_upgrade = 1;
     } else if (strcmp(arg, "--dot") == 0) {
       options.print_dot = 1;
     } else if (strcmp(arg, "--sem") == 0) {
@@ -2437,6 +2441,10 @@ static void parse_cmd(int argc, char **argv) {
       options.generate_exports = 1;
     } else if (strcmp(arg, "--generate_type_getters") == 0) {
       options.generate_type_getters = 1;
+    } else if (strcmp(arg, "--share_result_set_accessors") == 0) {
+      options.share_result_set_accessors = 1;
+    } else if (strcmp(arg, "--borrow_loop_fetch") == 0) {
+      options.borrow_loop_fetch = 1;
     } else if (strcmp(arg, "--cg") == 0) {
       a = gather_arg_params(a, argc, argv, &options.file_names_count, &options.file_names);
       options.codegen = 1;
@@ -2480,6 +2488,9 @@ static void parse_cmd(int argc, char **argv) {
     } else if (strcmp(arg, "--min_schema_version") == 0) {
       a = gather_arg_param(a, argc, argv, NULL, "for the minimum schema version");
       options.min_schema_version = atoi(argv[a]);
+    } else if (strcmp(arg, "--jobs") == 0) {
+      a = gather_arg_param(a, argc, argv, NULL, "for the number of code generation workers");
+      options.jobs = atoi(argv[a]);
     } else if (strcmp(arg, "--global_proc") == 0) {
       a = gather_arg_param(a, argc, argv, NULL,  "for the global proc name");
       global_proc_name = argv[a];
@@ -2534,6 +2545,8 @@ cql_noexport CSTR cql_builtin_text() {
     "@attribute(cql:builtin)"
     "DECLARE FUNC cql_partition_create () CREATE OBJECT<partitioning> NOT NULL;"
     "@attribute(cql:builtin)"
+    "DECLARE FUNC cql_partition_create_sized (expected_rows INT NOT NULL, expected_keys INT NOT NULL) CREATE OBJECT<partitioning> NOT NULL;"
+    "@attribute(cql:builtin)"
     "DECLARE FUNC cql_partition_cursor (p OBJECT<partitioning> NOT NULL, key CURSOR, value CURSOR) BOOL NOT NULL;"
     "@attribute(cql:builtin)"
     "DECLARE FUNC cql_extract_partition (p OBJECT<partitioning> NOT NULL, key CURSOR) CREATE OBJECT NOT NULL;"
@@ -2863,6 +2876,12 @@ static void cql_usage() {
     "--schema_exclusive\n"
     "  the schema upgrade script assumes it owns all the schema in the database, it aggressively removes other things\n"
     "  used with --rt schema_upgrade\n"
+    "--preserve_recreate_data\n"
+    "  changed @recreate tables keep the data in their surviving columns when that's possible\n"
+    "  used with --rt schema_upgrade\n"
+    "--incremental_upgrade\n"
+    "  the schema upgrade script can also be run a few steps at a time, each step in its own transaction\n"
+    "  used with --rt schema_upgrade\n"
     "--java_package_name name\n"
     "  specifies the name of package a generated java class will be a part of\n"
     "--java_fragment_interface_mode\n"
@@ -2882,6 +2901,17 @@ static void cql_usage() {
     "  emits rowset accessors using shared type getters instead of individual functions\n"
     "  this makes them more interoperable if they share columns\n"
     "  used with --rt c\n"
+    "--share_result_set_accessors\n"
+    "  result sets with the same shape as an earlier result set use macros that forward to\n"
+    "  the earlier result set's accessors and metadata tables instead of getting their own copies\n"
+    "  used with --rt c\n"
+    "--jobs n\n"
+    "  emits the procedures on n worker processes; the output is identical to the output of one\n"
+    "  used with --rt c\n"
+    "--borrow_loop_fetch\n"
+    "  LOOP FETCH over a statement cursor reads string and blob columns as views of sqlite's\n"
+    "  memory instead of copying them; a view is copied only if it is retained\n"
+    "  used with --rt c\n"
     );
 }
 
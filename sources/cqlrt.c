@@ -8,46 +8,124 @@
 #include "cqlrt.h"
 #include <memory.h>
 #include <stdbool.h>
+#include <time.h>
+
+#ifdef CQL_ATOMIC_REFS
+
+// Every thread that creates or releases a reference gets its own counter slot
+// so that the bookkeeping doesn't put another contended cache line on every
+// retain and release.  Only the owning thread ever writes its slot, others
+// only read it when the total is requested.  Slots are never freed: a thread
+// that exits might still have a non-zero count (e.g. it created a string that
+// some other thread released) and that count is needed to make the sum right.
+typedef struct cql_refs_slot {
+  struct cql_refs_slot *_Nullable next;
+  int32_t count;
+} cql_refs_slot;
+
+static cql_refs_slot *_Nullable cql_refs_slots;
+static __thread cql_refs_slot *_Nullable cql_my_refs_slot;
+
+static cql_refs_slot *_Nonnull cql_refs_slot_register(void) {
+  cql_refs_slot *slot = calloc(1, sizeof(cql_refs_slot));
+  slot->next = __atomic_load_n(&cql_refs_slots, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&cql_refs_slots, &slot->next, slot, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    // slot->next was updated with the current head, try again
+  }
+  cql_my_refs_slot = slot;
+  return slot;
+}
+
+static void cql_outstanding_refs_add(int32_t delta) {
+  cql_refs_slot *slot = cql_my_refs_slot;
+  if (!slot) {
+    slot = cql_refs_slot_register();
+  }
+  // we're the only writer, the atomic store just keeps readers from seeing a torn value
+  __atomic_store_n(&slot->count, slot->count + delta, __ATOMIC_RELAXED);
+}
+
+int32_t cql_get_outstanding_refs(void) {
+  int32_t total = 0;
+  cql_refs_slot *slot = __atomic_load_n(&cql_refs_slots, __ATOMIC_ACQUIRE);
+  for ( ; slot; slot = slot->next) {
+    total += __atomic_load_n(&slot->count, __ATOMIC_RELAXED);
+  }
+  return total;
+}
+
+// Taking another reference needs no ordering, the caller already has one.
+#define cql_ref_count_inc(ref) __atomic_fetch_add(&(ref)->ref_count, 1, __ATOMIC_RELAXED)
+
+// The release half makes our writes visible to whoever drops the last
+// reference, the acquire half makes everyone's writes visible to the
+// finalizer if that turns out to be us.
+#define cql_ref_count_dec(ref) __atomic_sub_fetch(&(ref)->ref_count, 1, __ATOMIC_ACQ_REL)
+
+#define cql_outstanding_refs_inc() cql_outstanding_refs_add(1)
+#define cql_outstanding_refs_dec() cql_outstanding_refs_add(-1)
+
+// Several threads might fill in a string's hash at once, they all store the same value.
+#define cql_string_cached_hash(str) __atomic_load_n(&(str)->hash, __ATOMIC_RELAXED)
+#define cql_string_cache_hash(str, h) __atomic_store_n(&(str)->hash, h, __ATOMIC_RELAXED)
+
+#else
 
 int32_t cql_outstanding_refs = 0;
 
+#define cql_ref_count_inc(ref) ((ref)->ref_count++)
+#define cql_ref_count_dec(ref) (--(ref)->ref_count)
+
+#define cql_outstanding_refs_inc() (cql_outstanding_refs++)
+#define cql_outstanding_refs_dec() (cql_outstanding_refs--, cql_invariant(cql_outstanding_refs >= 0))
+
+#define cql_string_cached_hash(str) ((str)->hash)
+#define cql_string_cache_hash(str, h) ((str)->hash = (h))
+
+#endif
+
+// Borrowed views (see cql_string_view_fetch) are marked by this finalizer, there
+// is nothing to free because the bytes belong to sqlite.
+static void cql_view_finalize(cql_type_ref _Nonnull ref) {
+}
+
+#define cql_is_view(ref) ((ref)->finalize == &cql_view_finalize)
+
 void cql_retain(cql_type_ref _Nullable ref) {
   if (ref) {
-    ref->ref_count++;
-    cql_outstanding_refs++;
+    // anyone keeping a view might keep it past the current row, so they get a real copy
+    if (cql_is_view(ref)) {
+      cql_view_own(ref);
+    }
+    cql_ref_count_inc(ref);
+    cql_outstanding_refs_inc();
   }
 }
 
 void cql_release(cql_type_ref _Nullable ref) {
   if (ref)  {
-    if (--ref->ref_count == 0) {
+    if (cql_ref_count_dec(ref) == 0) {
       if (ref->finalize) {
         ref->finalize(ref);
       }
       free((void *)ref);
     }
-    cql_outstanding_refs--;
-    cql_invariant(cql_outstanding_refs >= 0);
+    cql_outstanding_refs_dec();
   }
 }
 
-static void cql_blob_finalize(cql_type_ref _Nonnull ref) {
-  cql_blob_ref blob = (cql_blob_ref)ref;
-  cql_invariant(blob->ptr != NULL);
-  free((void *)blob->ptr);
-  blob->size = 0;
-}
-
+// The bytes go in the same allocation as the header so there is one malloc
+// per blob and nothing extra to do at finalization.
 cql_blob_ref _Nonnull cql_blob_ref_new(const void *_Nonnull bytes, cql_uint32 size) {
   cql_invariant(bytes != NULL);
-  cql_blob_ref result = malloc(sizeof(cql_blob));
+  cql_blob_ref result = malloc(sizeof(cql_blob) + size);
   result->base.type = CQL_C_TYPE_BLOB;
   result->base.ref_count = 1;
-  result->base.finalize = &cql_blob_finalize;
-  result->ptr = malloc(size);
+  result->base.finalize = NULL;
+  result->ptr = result + 1;
   result->size = size;
   memcpy((void *)result->ptr, bytes, size);
-  cql_outstanding_refs++;
+  cql_outstanding_refs_inc();
   return result;
 }
 
@@ -81,45 +159,174 @@ cql_bool cql_blob_equal(cql_blob_ref _Nullable blob1, cql_blob_ref _Nullable blo
   return size1 == size2 && !memcmp(bytes1, bytes2, size1);
 }
 
-static void cql_string_finalize(cql_type_ref _Nonnull ref) {
-  cql_string_ref string = (cql_string_ref)ref;
-  cql_invariant(string->ptr != NULL);
-  free((void *)string->ptr);
-  string->ptr = NULL;  // in case of use after free, fail fast
+// The length of text that may have embedded nulls (e.g. from sqlite3_column_bytes)
+// as a C string.  Strings end at their first null, just as they did when they were
+// always measured with strlen, so hashing and comparing is unchanged.
+static cql_uint32 cql_cstr_length(const char *_Nonnull text, cql_uint32 length) {
+  const char *nul = memchr(text, 0, length);
+  return nul ? (cql_uint32)(nul - text) : length;
 }
 
-cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr) {
-  cql_invariant(cstr != NULL);
-  cql_string_ref result = malloc(sizeof(cql_string));
+// As with blobs, the text goes right after the header in the same allocation
+// so a string is one malloc no matter how long it is.  The text is always
+// null terminated so that it can be used directly as a C string.
+static cql_string_ref _Nonnull cql_string_ref_alloc(const char *_Nonnull cstr, cql_uint32 length) {
+  cql_string_ref result = malloc(sizeof(cql_string) + length + 1);
   result->base.type = CQL_C_TYPE_STRING;
   result->base.ref_count = 1;
-  result->base.finalize = &cql_string_finalize;
-  size_t cstrlen = strlen(cstr);
-  result->ptr = malloc(cstrlen + 1);
-  memcpy((void *)result->ptr, cstr, cstrlen + 1);
-  cql_outstanding_refs++;
+  result->base.finalize = NULL;
+  char *text = (char *)(result + 1);
+  memcpy(text, cstr, length);
+  text[length] = 0;
+  result->ptr = text;
+  result->length = length;
+  result->hash = 0;
+  cql_outstanding_refs_inc();
   return result;
 }
 
+cql_string_ref _Nonnull cql_string_ref_new_sized(const char *_Nonnull cstr, cql_uint32 length) {
+  cql_invariant(cstr != NULL);
+  return cql_string_ref_alloc(cstr, cql_cstr_length(cstr, length));
+}
+
+cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr) {
+  cql_invariant(cstr != NULL);
+  return cql_string_ref_alloc(cstr, (cql_uint32)strlen(cstr));
+}
+
+// A view that was made into a copy owns its bytes in their own allocation.
+static void cql_owned_view_finalize(cql_type_ref _Nonnull ref) {
+  if (ref->type == CQL_C_TYPE_STRING) {
+    free((void *)((cql_string_ref)ref)->ptr);
+  }
+  else {
+    free((void *)((cql_blob_ref)ref)->ptr);
+  }
+}
+
+// Copy the bytes of a view out of sqlite's memory, the view becomes an ordinary
+// string or blob in place so everyone that already has the pointer sees the copy.
+void cql_view_own(cql_type_ref _Nonnull ref) {
+  if (!cql_is_view(ref)) {
+    return;
+  }
+
+  if (ref->type == CQL_C_TYPE_STRING) {
+    cql_string_ref string = (cql_string_ref)ref;
+    char *text = malloc(string->length + 1);
+    memcpy(text, string->ptr, string->length + 1);
+    string->ptr = text;
+  }
+  else {
+    cql_invariant(ref->type == CQL_C_TYPE_BLOB);
+    cql_blob_ref blob = (cql_blob_ref)ref;
+    void *bytes = malloc(blob->size);
+    memcpy(bytes, blob->ptr, blob->size);
+    blob->ptr = bytes;
+  }
+
+  ref->finalize = &cql_owned_view_finalize;
+}
+
+// Fetch a nullable string column as a view.  If the target already holds a view
+// that only the cursor is using, it's simply pointed at the new row so steady
+// state scanning doesn't allocate at all.  Otherwise a new view header is made.
+void cql_string_view_fetch(sqlite3_stmt *_Nonnull stmt, cql_int32 index, cql_string_ref _Nullable *_Nonnull data) {
+  if (sqlite3_column_type(stmt, index) == SQLITE_NULL) {
+    cql_string_release(*data);
+    *data = NULL;
+    return;
+  }
+
+  // the text has to be fetched before the size so that the size is for the utf8 form
+  const char *text = (const char *)sqlite3_column_text(stmt, index);
+  cql_uint32 length = cql_cstr_length(text, (cql_uint32)sqlite3_column_bytes(stmt, index));
+
+  cql_string_ref view = *data;
+  if (!view || !cql_is_view(&view->base)) {
+    cql_string_release(view);
+    view = malloc(sizeof(cql_string));
+    view->base.type = CQL_C_TYPE_STRING;
+    view->base.ref_count = 1;
+    view->base.finalize = &cql_view_finalize;
+    cql_outstanding_refs_inc();
+    *data = view;
+  }
+
+  // views are never shared, retaining one would have made it a copy
+  cql_invariant(view->base.ref_count == 1);
+  view->ptr = text;
+  view->length = length;
+  view->hash = 0;
+}
+
+// As above, but for blobs.
+void cql_blob_view_fetch(sqlite3_stmt *_Nonnull stmt, cql_int32 index, cql_blob_ref _Nullable *_Nonnull data) {
+  if (sqlite3_column_type(stmt, index) == SQLITE_NULL) {
+    cql_blob_release(*data);
+    *data = NULL;
+    return;
+  }
+
+  // sqlite gives us no pointer at all for an empty blob
+  const void *bytes = sqlite3_column_blob(stmt, index);
+  cql_uint32 size = (cql_uint32)sqlite3_column_bytes(stmt, index);
+
+  cql_blob_ref view = *data;
+  if (!view || !cql_is_view(&view->base)) {
+    cql_blob_release(view);
+    view = malloc(sizeof(cql_blob));
+    view->base.type = CQL_C_TYPE_BLOB;
+    view->base.ref_count = 1;
+    view->base.finalize = &cql_view_finalize;
+    cql_outstanding_refs_inc();
+    *data = view;
+  }
+
+  cql_invariant(view->base.ref_count == 1);
+  view->ptr = bytes ? bytes : "";
+  view->size = size;
+}
+
+// Same ordering as strcmp but we already know where the strings end.
 cql_int32 cql_string_compare(cql_string_ref _Nonnull s1, cql_string_ref _Nonnull s2) {
   cql_invariant(s1 != NULL);
   cql_invariant(s2 != NULL);
-  return strcmp(s1->ptr, s2->ptr);
+  cql_uint32 len1 = s1->length;
+  cql_uint32 len2 = s2->length;
+  int result = memcmp(s1->ptr, s2->ptr, len1 < len2 ? len1 : len2);
+  if (result) {
+    return result;
+  }
+  return len1 < len2 ? -1 : len1 > len2;
 }
 
+// The hash is cached in the string, strings are immutable so it can never
+// go stale.
 cql_hash_code cql_string_hash(cql_string_ref _Nullable str) {
   cql_hash_code hash = 0;
   if (str) {
+    hash = cql_string_cached_hash(str);
+    if (hash) {
+      return hash;
+    }
+
     // djb2
     hash = 5381;
     const char *chars = str->ptr;
-    int c;
-    while ((c = *chars++))
-      hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    cql_uint32 length = str->length;
+    while (length--) {
+      hash = ((hash << 5) + hash) + *chars++; /* hash * 33 + c */
+    }
+
+    cql_string_cache_hash(str, hash);
   }
   return hash;
 }
 
+// Different lengths or different cached hashes settle it without looking
+// at the text at all.
 cql_bool cql_string_equal(cql_string_ref _Nullable s1, cql_string_ref _Nullable s2) {
   if (s1 == s2) {
     return cql_true;
@@ -127,7 +334,15 @@ cql_bool cql_string_equal(cql_string_ref _Nullable s1, cql_string_ref _Nullable
   if (!s1 || !s2) {
     return cql_false;
   }
-  return cql_string_compare(s1, s2) == 0;
+  if (s1->length != s2->length) {
+    return cql_false;
+  }
+  cql_hash_code hash1 = cql_string_cached_hash(s1);
+  cql_hash_code hash2 = cql_string_cached_hash(s2);
+  if (hash1 && hash2 && hash1 != hash2) {
+    return cql_false;
+  }
+  return memcmp(s1->ptr, s2->ptr, s1->length) == 0;
 }
 
 int cql_string_like(cql_string_ref _Nonnull s1, cql_string_ref _Nonnull s2) {
@@ -162,7 +377,7 @@ cql_result_set_ref _Nonnull cql_result_set_create(void *_Nonnull data, cql_int32
   result->meta = meta;
   result->count = count;
   result->data = data;
-  cql_outstanding_refs++;
+  cql_outstanding_refs_inc();
   return result;
 }
 
@@ -282,6 +497,43 @@ cql_double cql_decode_double(
   return -value;
 }
 
+// The encode context is only used by the naive string encoding if it's a string.
+static cql_string_ref _Nullable cql_encode_string_context(cql_int32 context_type, void *_Nullable context) {
+  if (context != NULL && CQL_CORE_DATA_TYPE_OF(context_type) == CQL_DATA_TYPE_STRING) {
+    return *(cql_string_ref *)context;
+  }
+  return NULL;
+}
+
+// naive encoding for string, the text is followed by a character and the encode
+// context (if it's a string).  This is the size of the encoded text without a
+// terminator, the lengths are already in the strings so nothing is scanned.
+static cql_uint32 cql_encode_string_size(cql_string_ref _Nonnull value, cql_string_ref _Nullable encode_context) {
+  return value->length + 1 + (encode_context ? encode_context->length : 0);
+}
+
+// Write the encoded text (see above) into exactly cql_encode_string_size bytes.
+static void cql_encode_string_write(char *_Nonnull dest, cql_string_ref _Nonnull value, cql_string_ref _Nullable encode_context) {
+  memcpy(dest, value->ptr, value->length);
+  dest[value->length] = '#';
+  if (encode_context) {
+    memcpy(dest + value->length + 1, encode_context->ptr, encode_context->length);
+  }
+}
+
+// The encoded string preceded by its size is appended to the buffer.
+static void cql_encode_string_append(
+  cql_bytebuf *_Nonnull buffer,
+  cql_string_ref _Nonnull value,
+  cql_int32 context_type,
+  void *_Nullable context)
+{
+  cql_string_ref encode_context = cql_encode_string_context(context_type, context);
+  cql_uint32 size = cql_encode_string_size(value, encode_context);
+  cql_bytebuf_append(buffer, &size, sizeof(size));
+  cql_encode_string_write(cql_bytebuf_alloc(buffer, (int)size), value, encode_context);
+}
+
 // naive implementation of encode for string. It appends a character
 // and encode context to the string
 cql_string_ref cql_encode_string_ref_new(
@@ -290,23 +542,11 @@ cql_string_ref cql_encode_string_ref_new(
   cql_int32 context_type,
   void *_Nullable context)
 {
-  size_t cstrlen = strlen(value->ptr);
-  size_t context_len = 0;
-  if (context != NULL && CQL_CORE_DATA_TYPE_OF(context_type) == CQL_DATA_TYPE_STRING) {
-    cql_string_ref _Nullable encode_context = *(cql_string_ref *)context;
-    context_len = strlen(encode_context->ptr);
-  }
-  char *tmp = malloc(cstrlen + 2 + context_len);
-  memcpy(tmp, value->ptr, cstrlen);
-  tmp[cstrlen] = '#';
-  // naive test case for string type encode context
-  if (context != NULL && CQL_CORE_DATA_TYPE_OF(context_type) == CQL_DATA_TYPE_STRING) {
-    cql_string_ref _Nullable encode_context = *(cql_string_ref *)context;
-    memcpy(tmp + cstrlen + 1, encode_context->ptr, context_len);
-    cstrlen += context_len;
-  }
-  tmp[cstrlen + 1] = 0;
-  cql_string_ref rs = cql_string_ref_new(tmp);
+  cql_string_ref encode_context = cql_encode_string_context(context_type, context);
+  cql_uint32 size = cql_encode_string_size(value, encode_context);
+  char *tmp = malloc(size);
+  cql_encode_string_write(tmp, value, encode_context);
+  cql_string_ref rs = cql_string_ref_new_sized(tmp, size);
   free(tmp);
   return rs;
 }
@@ -333,6 +573,13 @@ cql_string_ref cql_decode_string_ref_new(
   return rs;
 }
 
+// naive encoding for blob, a byte is appended to the blob data.  The encoded
+// bytes (value->size + 1 of them) are written to dest.
+static void cql_encode_blob_write(char *_Nonnull dest, cql_blob_ref _Nonnull value) {
+  memcpy(dest, value->ptr, value->size);
+  dest[value->size] = '#';
+}
+
 // naive implementation of encode for blob. It appends a byte to the blob
 cql_blob_ref cql_encode_blob_ref_new(
   cql_object_ref _Nullable encoder,
@@ -342,8 +589,7 @@ cql_blob_ref cql_encode_blob_ref_new(
 {
   cql_uint32 size = value->size + 1;
   char *tmp = malloc(size);
-  memcpy(tmp, value->ptr, size - 1);
-  tmp[size - 1] = '#';
+  cql_encode_blob_write(tmp, value);
   cql_blob_ref rs = cql_blob_ref_new(tmp, size);
   free(tmp);
   return rs;
@@ -365,6 +611,137 @@ cql_blob_ref cql_decode_blob_ref_new(
   return rs;
 }
 
+// The column encoder.  Numbers are just encoded in place.  Strings and blobs are
+// encoded in two passes: first every encoded value in the column goes into one
+// arena, then the new strings/blobs are made from the arena.  That's one buffer
+// for the whole column instead of a temporary for every value.  Each value is
+// preceded by its size in the arena.
+void cql_encode_column(
+  cql_object_ref _Nullable encoder,
+  cql_int32 type,
+  char *_Nonnull field,
+  cql_int32 rows,
+  cql_int32 rowsize,
+  cql_int32 context_type,
+  char *_Nullable context)
+{
+  cql_int32 core_type = CQL_CORE_DATA_TYPE_OF(type);
+  cql_bool notnull = !!(type & CQL_DATA_TYPE_NOT_NULL);
+
+  if (core_type == CQL_DATA_TYPE_STRING || core_type == CQL_DATA_TYPE_BLOB) {
+    cql_bytebuf arena;
+    cql_bytebuf_open(&arena);
+
+    char *row = field;
+    char *ctx = context;
+    for (cql_int32 i = 0; i < rows; i++, row += rowsize, ctx = ctx ? ctx + rowsize : NULL) {
+      if (core_type == CQL_DATA_TYPE_STRING) {
+        cql_string_ref str_ref = *(cql_string_ref *)row;
+        if (str_ref) {
+          cql_encode_string_append(&arena, str_ref, context_type, ctx);
+        }
+      }
+      else {
+        cql_blob_ref blob_ref = *(cql_blob_ref *)row;
+        if (blob_ref) {
+          cql_uint32 size = blob_ref->size + 1;
+          cql_bytebuf_append(&arena, &size, sizeof(size));
+          cql_encode_blob_write(cql_bytebuf_alloc(&arena, (int)size), blob_ref);
+        }
+      }
+    }
+
+    char *p = arena.ptr;
+    row = field;
+    for (cql_int32 i = 0; i < rows; i++, row += rowsize) {
+      if (core_type == CQL_DATA_TYPE_STRING) {
+        cql_string_ref *str_ref = (cql_string_ref *)row;
+        if (*str_ref) {
+          cql_uint32 size;
+          memcpy(&size, p, sizeof(size));
+          p += sizeof(size);
+          cql_string_ref new_str_ref = cql_string_ref_new_sized(p, size);
+          p += size;
+          cql_set_string_ref(str_ref, new_str_ref);
+          cql_string_release(new_str_ref);
+        }
+      }
+      else {
+        cql_blob_ref *blob_ref = (cql_blob_ref *)row;
+        if (*blob_ref) {
+          cql_uint32 size;
+          memcpy(&size, p, sizeof(size));
+          p += sizeof(size);
+          cql_blob_ref new_blob_ref = cql_blob_ref_new(p, size);
+          p += size;
+          cql_set_blob_ref(blob_ref, new_blob_ref);
+          cql_blob_release(new_blob_ref);
+        }
+      }
+    }
+
+    cql_bytebuf_close(&arena);
+    return;
+  }
+
+  for (cql_int32 i = 0; i < rows; i++, field += rowsize, context = context ? context + rowsize : NULL) {
+    switch (core_type) {
+      case CQL_DATA_TYPE_INT32: {
+        if (notnull) {
+          cql_int32 *int32_data = (cql_int32 *)field;
+          *int32_data = cql_encode_int32(encoder, *int32_data, context_type, context);
+        }
+        else {
+          cql_nullable_int32 *int32p = (cql_nullable_int32 *)field;
+          if (!int32p->is_null) {
+            int32p->value = cql_encode_int32(encoder, int32p->value, context_type, context);
+          }
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_INT64: {
+        if (notnull) {
+          cql_int64 *int64_data = (cql_int64 *)field;
+          *int64_data = cql_encode_int64(encoder, *int64_data, context_type, context);
+        }
+        else {
+          cql_nullable_int64 *int64p = (cql_nullable_int64 *)field;
+          if (!int64p->is_null) {
+            int64p->value = cql_encode_int64(encoder, int64p->value, context_type, context);
+          }
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_DOUBLE: {
+        if (notnull) {
+          cql_double *double_data = (cql_double *)field;
+          *double_data = cql_encode_double(encoder, *double_data, context_type, context);
+        }
+        else {
+          cql_nullable_double *doublep = (cql_nullable_double *)field;
+          if (!doublep->is_null) {
+            doublep->value = cql_encode_double(encoder, doublep->value, context_type, context);
+          }
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_BOOL: {
+        if (notnull) {
+          cql_bool *bool_data = (cql_bool *)field;
+          *bool_data = cql_encode_bool(encoder, *bool_data, context_type, context);
+        }
+        else {
+          cql_nullable_bool *boolp = (cql_nullable_bool *)field;
+          if (!boolp->is_null) {
+            boolp->value = cql_encode_bool(encoder, boolp->value, context_type, context);
+          }
+        }
+        break;
+      }
+    }
+  }
+}
+
 cql_object_ref cql_copy_encoder(sqlite3* db) {
   return NULL;  // no encoder object needed
 }
@@ -386,7 +763,7 @@ cql_object_ref _Nonnull _cql_generic_object_create(void *_Nonnull data, void (*f
   obj->base.finalize = _cql_generic_finalize;
   obj->ptr = data;
   obj->finalize = finalize;
-  cql_outstanding_refs++;
+  cql_outstanding_refs_inc();
   return obj;
 }
 
@@ -397,4 +774,59 @@ void *_Nonnull _cql_generic_object_get_data(cql_object_ref obj)
   return obj->ptr;
 }
 
+// The running totals for the steps of cql_rebuild_recreate_group, a step that
+// is not in this table is simply not timed.  Each thread has its own totals so
+// concurrent rebuilds (on different connections) don't disturb each other.
+typedef struct cql_rebuild_step_info {
+  const char *_Nonnull name;
+  int32_t count;
+  int64_t total_ns;
+  int64_t started_ns;
+} cql_rebuild_step_info;
+
+static __thread cql_rebuild_step_info cql_rebuild_steps[] = {
+  { "parse" },
+  { "deletes" },
+  { "rebuild" },
+  { "drops" },
+  { "creates" },
+};
+
+// wall time from a clock that can't jump, the steps are mostly waiting on sqlite
+static int64_t cql_rebuild_step_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static cql_rebuild_step_info *_Nullable cql_rebuild_step_find(const char *_Nonnull step) {
+  for (size_t i = 0; i < sizeof(cql_rebuild_steps) / sizeof(cql_rebuild_steps[0]); i++) {
+    if (!strcmp(cql_rebuild_steps[i].name, step)) {
+      return &cql_rebuild_steps[i];
+    }
+  }
+  return NULL;
+}
+
+void cql_rebuild_step_begin(const char *_Nonnull step) {
+  cql_rebuild_step_info *info = cql_rebuild_step_find(step);
+  if (info) {
+    info->started_ns = cql_rebuild_step_now_ns();
+  }
+}
+
+void cql_rebuild_step_end(const char *_Nonnull step) {
+  cql_rebuild_step_info *info = cql_rebuild_step_find(step);
+  if (info) {
+    info->count++;
+    info->total_ns += cql_rebuild_step_now_ns() - info->started_ns;
+  }
+}
+
+void cql_rebuild_step_stats(const char *_Nonnull step, int32_t *_Nonnull count, double *_Nonnull seconds) {
+  cql_rebuild_step_info *info = cql_rebuild_step_find(step);
+  *count = info ? info->count : 0;
+  *seconds = info ? (double)info->total_ns / 1e9 : 0;
+}
+
 #include "cqlrt_common.c"
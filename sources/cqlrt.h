@@ -55,6 +55,16 @@ typedef struct cql_type {
 
 void cql_retain(cql_type_ref _Nullable ref);
 void cql_release(cql_type_ref _Nullable ref);
+
+// Build with CQL_ATOMIC_REFS if references are going to be shared between
+// threads.  In that mode the reference counts are updated atomically and the
+// count of outstanding references is kept per thread; reading it sums the
+// per-thread counts so it is no longer a simple global.  It's only meant for
+// leak checking in tests anyway.
+#ifdef CQL_ATOMIC_REFS
+int32_t cql_get_outstanding_refs(void);
+#define cql_outstanding_refs cql_get_outstanding_refs()
+#endif
 cql_hash_code cql_ref_hash(cql_type_ref _Nonnull typeref);
 cql_bool cql_ref_equal(cql_type_ref _Nullable typeref1, cql_type_ref _Nullable typeref2);
 
@@ -89,6 +99,7 @@ typedef struct cql_partitioning {
   const void *_Nonnull ptr;
 } cql_partitioning;
 
+// like strings, the bytes of a blob are allocated along with the header
 #define cql_blob_retain(object) cql_retain((cql_type_ref)object);
 #define cql_blob_release(object) cql_release((cql_type_ref)object);
 cql_blob_ref _Nonnull cql_blob_ref_new(const void *_Nonnull data, cql_uint32 size);
@@ -98,15 +109,27 @@ cql_hash_code cql_blob_hash(cql_blob_ref _Nullable str);
 cql_bool cql_blob_equal(cql_blob_ref _Nullable blob1, cql_blob_ref _Nullable blob2);
 
 // builtin string
+// The length (in bytes, not counting the terminator) is computed once when the
+// string is made so that nothing has to scan for the terminator again.  Text
+// with embedded nulls ends at the first one, just like a C string.  The
+// hash is computed the first time it's needed and then cached; zero means
+// it hasn't been computed yet.  Strings made at runtime have their text in
+// the same allocation as the header, right after it; ptr points there.
 typedef struct cql_string *cql_string_ref;
 typedef struct cql_string {
   cql_type base;
   const char *_Nullable ptr;
+  cql_uint32 length;
+  cql_hash_code hash;
 } cql_string;
 cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr);
+cql_string_ref _Nonnull cql_string_ref_new_sized(const char *_Nonnull cstr, cql_uint32 length);
+#define cql_string_ref_new_with_length(cstr, length) cql_string_ref_new_sized(cstr, length)
 #define cql_string_retain(string) cql_retain((cql_type_ref)string);
 #define cql_string_release(string) cql_release((cql_type_ref)string);
 
+// The text of these must be a string literal, the ("" text) below enforces
+// that so that sizeof gives us the length.
 #define cql_string_literal(name, text) \
   static cql_string name##_ = { \
     .base = { \
@@ -115,6 +138,7 @@ cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr);
       .finalize = NULL, \
     }, \
     .ptr = text, \
+    .length = sizeof("" text) - 1, \
   }; \
   static cql_string_ref name = &name##_
 
@@ -126,6 +150,7 @@ cql_string_ref _Nonnull cql_string_ref_new(const char *_Nonnull cstr);
       .finalize = NULL, \
     }, \
     .ptr = proc_name, \
+    .length = sizeof("" proc_name) - 1, \
   }; \
   cql_string_ref name = &name##_
 
@@ -134,8 +159,20 @@ cql_hash_code cql_string_hash(cql_string_ref _Nullable str);
 cql_bool cql_string_equal(cql_string_ref _Nullable s1, cql_string_ref _Nullable s2);
 int cql_string_like(cql_string_ref _Nonnull s1, cql_string_ref _Nonnull s2);
 #define cql_alloc_cstr(cstr, str) const char *_Nonnull cstr = (str)->ptr
+#define cql_get_cstr_length(cstr, str) ((size_t)(str)->length)
 #define cql_free_cstr(cstr, str) 0
 
+// Borrowed views are strings and blobs whose bytes still belong to sqlite, they
+// are only valid until the statement is stepped again.  LOOP FETCH uses them
+// when compiled with --borrow_loop_fetch.  Retaining a view turns it into an
+// ordinary copy on the spot, so anything that keeps the value gets its own.
+void cql_string_view_fetch(sqlite3_stmt *_Nonnull stmt, cql_int32 index, cql_string_ref _Nullable *_Nonnull data);
+void cql_blob_view_fetch(sqlite3_stmt *_Nonnull stmt, cql_int32 index, cql_blob_ref _Nullable *_Nonnull data);
+void cql_view_own(cql_type_ref _Nonnull ref);
+#define cql_column_string_view(stmt, index, data) cql_string_view_fetch(stmt, index, data)
+#define cql_column_blob_view(stmt, index, data) cql_blob_view_fetch(stmt, index, data)
+#define cql_own_view(ref) cql_view_own(ref)
+
 // builtin result set
 typedef struct cql_result_set *cql_result_set_ref;
 
@@ -199,6 +236,15 @@ typedef struct cql_result_set_meta {
   // release custom internal memory for the rowset that ARE NOT released
   // by teardown
   void(*_Nullable custom_teardown)(cql_result_set_ref _Nonnull result_set);
+
+  // the string and blob bytes of cells that are not references yet, while
+  // heapPending is set such cells hold their heap offset plus one (always odd)
+  // see cql_result_set_materialize.  Reading such a cell writes the reference
+  // into the result set; with CQL_ATOMIC_REFS the reference is published with a
+  // compare and swap so readers on different threads agree on one reference.
+  const uint8_t *_Nullable heap;
+  uint32_t heapSize;
+  cql_bool heapPending;
 } cql_result_set_meta;
 
 typedef struct cql_result_set {
@@ -220,7 +266,19 @@ cql_result_set_ref _Nonnull cql_result_set_create(
 #define cql_result_set_release(result_set) cql_release((cql_type_ref)result_set);
 #define cql_result_set_note_ownership_transferred(result_set)
 #define cql_result_set_get_meta(result_set) (&((cql_result_set_ref)result_set)->meta)
-#define cql_result_set_get_data(result_set) ((cql_result_set_ref)result_set)->data
+// The rows as stored, string and blob cells may still be pending (see heap
+// above).  Generated code uses cql_result_set_get_data which makes them first,
+// except for the getters of cql:lazy_strings procs which only make what they read.
+#define cql_result_set_get_rows(result_set) ((cql_result_set_ref)result_set)->data
+#ifdef CQL_ATOMIC_REFS
+#define cql_result_set_heap_pending(result_set) \
+  __atomic_load_n(&cql_result_set_get_meta(result_set)->heapPending, __ATOMIC_ACQUIRE)
+#else
+#define cql_result_set_heap_pending(result_set) cql_result_set_get_meta(result_set)->heapPending
+#endif
+#define cql_result_set_get_data(result_set) \
+  (cql_result_set_heap_pending(result_set) ? cql_result_set_materialize((cql_result_set_ref)result_set) : (void)0, \
+   cql_result_set_get_rows(result_set))
 #define cql_result_set_get_count(result_set) ((cql_result_set_ref)result_set)->count
 
 #ifdef CQL_RUN_TEST
@@ -236,6 +294,15 @@ SQLITE_API cql_code mockable_sqlite3_step(sqlite3_stmt *_Nonnull);
 #define cql_profile_start(crc, index) (void)crc; (void)index;
 #define cql_profile_stop(crc, index)  (void)crc; (void)index;
 
+// cql_rebuild_recreate_group steps are timed: each step ("parse", "deletes", "rebuild",
+// "drops", "creates") keeps a running count and total elapsed time (monotonic clock)
+// which can be read with cql_rebuild_step_stats.  The totals are per thread.
+#define cql_rebuild_step_start(step) cql_rebuild_step_begin(step)
+#define cql_rebuild_step_stop(step) cql_rebuild_step_end(step)
+void cql_rebuild_step_begin(const char *_Nonnull step);
+void cql_rebuild_step_end(const char *_Nonnull step);
+void cql_rebuild_step_stats(const char *_Nonnull step, int32_t *_Nonnull count, double *_Nonnull seconds);
+
 // the basic version doesn't use column getters
 #define CQL_NO_GETTERS 1
 
@@ -280,6 +347,21 @@ cql_blob_ref _Nonnull cql_encode_blob_ref_new(
   cql_int32 context_type,
   void *_Nullable context);
 
+// Encodes all the values of one column of a result set in one call.  The field
+// in the first row is at field and each next row is rowsize bytes further on, the
+// encode context (if any) steps the same way.  Values are replaced in place and
+// nullable values that are null are left alone.  Runtimes that don't define
+// CQL_HAS_COLUMN_ENCODER get a version built on the per value encoders above.
+#define CQL_HAS_COLUMN_ENCODER 1
+void cql_encode_column(
+  cql_object_ref _Nullable encoder,
+  cql_int32 type,
+  char *_Nonnull field,
+  cql_int32 rows,
+  cql_int32 rowsize,
+  cql_int32 context_type,
+  char *_Nullable context);
+
 cql_bool cql_decode_bool(
   cql_object_ref _Nullable encoder,
   cql_bool value,
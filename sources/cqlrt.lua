@@ -522,7 +522,7 @@ end
 
 function cql_multibind_var(db, stmt, bind_count, bind_preds, types, ...)
   -- values to bind come in as varargs
-  local bind_index = 1
+  -- the statement uses numbered parameters (?N) so skipped values keep their index
   local rc = sqlite3.OK
   local count = select('#', ...)
   for i = 1, count
@@ -530,9 +530,8 @@ function cql_multibind_var(db, stmt, bind_count, bind_preds, types, ...)
     if bind_preds[i-1] then
       local code = string.byte(types, i, i)
       local column = select(i,...)
-      rc = cql_bind_one(stmt, bind_index, column, code)
+      rc = cql_bind_one(stmt, i, column, code)
       if rc ~= sqlite3.OK then break end
-      bind_index = bind_index + 1
     end
   end;
   return rc
@@ -644,6 +643,11 @@ function cql_partition_create()
   return {};
 end;
 
+-- tables size themselves, the hints are not needed here
+function cql_partition_create_sized(expected_rows, expected_keys)
+  return {};
+end;
+
 function cql_make_str_key(key_table)
   local key = ""
   for k,v in pairs(key_table)
@@ -889,47 +893,383 @@ function _cql_create_table_name_from_table_creation_statement(create)
 end
 
 
+-- nil if the statement doesn't look like an index creation at all
 function _cql_create_table_name_from_index_creation_statement(index_create)
-  local needle = "ON "
-  local lineStartIt = string.find(index_create, needle) + #needle
-  local i = string.find(index_create, "[(]")
+  local needle = " ON "
+  local lineStartIt = string.find(index_create, needle, 1, true)
+  if lineStartIt == nil then return nil end
+  lineStartIt = lineStartIt + #needle
+  local i = string.find(index_create, "[(]", lineStartIt)
+  if i == nil then return nil end
   local space = string.byte(" ")
-  while string.byte(index_create, i-1) == space do
+  while i > lineStartIt and string.byte(index_create, i-1) == space do
     i = i - 1
   end
   return string.sub(index_create, lineStartIt, i-1);
 end
 
+-- the preserving rebuild copies at most this many rows of a table per batch
+CQL_REBUILD_COPY_BATCH_ROWS = 5000
 
-function cql_rebuild_recreate_group(db, tables, indices, deletes)
+-- a string literal for SQL
+function _cql_sql_text(str)
+  return "'" .. (string.gsub(str, "'", "''")) .. "'"
+end
+
+-- run a query that produces one value (or none), the value is nil if there is no row
+function _cql_rebuild_query(db, sql)
+  local stmt = db:prepare(sql)
+  if stmt == nil then
+    return db:errcode(), nil
+  end
+  local rc = stmt:step()
+  local result = nil
+  if rc == sqlite3.ROW then
+    result = stmt:get_value(0)
+  end
+  stmt:finalize()
+  if rc == sqlite3.ROW or rc == sqlite3.DONE then
+    rc = sqlite3.OK
+  end
+  return rc, result
+end
+
+-- data can only be carried over into ordinary tables with plain names
+function _cql_can_preserve_table(create, name)
+  if string.find(create, "^%s*CREATE VIRTUAL TABLE ") then
+    return false
+  end
+  return string.find(name, "^[%w_]+$") ~= nil
+end
+
+-- every table must be preservable, and with foreign keys enforced nothing may refer to the group
+function _cql_rebuild_check_preservable(db, tableList, tableNames)
+  for i = 1, #tableList do
+    if not _cql_can_preserve_table(tableList[i], tableNames[i]) then
+      return sqlite3.ERROR
+    end
+  end
+
+  local rc, enforced = _cql_rebuild_query(db, "PRAGMA foreign_keys")
+  if rc ~= sqlite3.OK or enforced == 0 then
+    return rc
+  end
+
+  for i = 1, #tableNames do
+    local count
+    rc, count = _cql_rebuild_query(db, string.format(
+      "SELECT count(*) FROM sqlite_master M, pragma_foreign_key_list(M.name) F " ..
+      "WHERE M.type = 'table' AND F.\"table\" = %s COLLATE NOCASE", _cql_sql_text(tableNames[i])))
+    if rc ~= sqlite3.OK then return rc end
+    if count ~= 0 then return sqlite3.CONSTRAINT end
+  end
+  return sqlite3.OK
+end
+
+function _cql_rebuild_table_exists(db, name)
+  local rc, count = _cql_rebuild_query(db, string.format(
+    "SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = %s COLLATE NOCASE", _cql_sql_text(name)))
+  return rc, count ~= nil and count ~= 0
+end
+
+-- the first rowid alias no column hides, nil if the table has no rowid (e.g. WITHOUT ROWID)
+function _cql_rebuild_rowid_name(db, name)
+  for _, alias in ipairs({"rowid", "_rowid_", "oid"}) do
+    local rc, taken = _cql_rebuild_query(db, string.format(
+      "SELECT count(*) FROM pragma_table_xinfo(%s) WHERE name = '%s' COLLATE NOCASE", _cql_sql_text(name), alias))
+    if rc ~= sqlite3.OK then return nil end
+    if taken == 0 then
+      local stmt = db:prepare(string.format("SELECT %s FROM \"%s\"", alias, name))
+      if stmt == nil then return nil end
+      stmt:finalize()
+      return alias
+    end
+  end
+  return nil
+end
+
+-- forget the copy in progress (if any) for one table
+function _cql_rebuild_discard_copy(db, facets, name)
+  return cql_exec(db, string.format(
+    "DROP TABLE IF EXISTS \"cql_rebuild_new_%s\";\n" ..
+    "DROP TRIGGER IF EXISTS \"cql_rebuild_%s_insert\";\n" ..
+    "DROP TRIGGER IF EXISTS \"cql_rebuild_%s_update\";\n" ..
+    "DROP TRIGGER IF EXISTS \"cql_rebuild_%s_delete\";\n" ..
+    "DELETE FROM \"%s\" WHERE facet = 'cql_rebuild_copy_%s';\n",
+    name, name, name, name, facets, name))
+end
+
+function _cql_rebuild_discard_copies(db, facets, tableNames)
+  local rc = sqlite3.OK
+  for i = 1, #tableNames do
+    rc = _cql_rebuild_discard_copy(db, facets, tableNames[i])
+    if rc ~= sqlite3.OK then break end
+  end
+  return rc
+end
+
+-- Copy the surviving columns of a table into its staging table in rowid order, a batch
+-- at a time, recording the last rowid copied in the 'cql_rebuild_copy_<name>' facet.
+-- A later call resumes after it if the staging table and the triggers that guard it
+-- are intact, the triggers discard the progress if a row already copied changes.  At
+-- most max_batches batches are copied (0 means all), the second result is true if rows
+-- remain.  This mirrors _cql_rebuild_copy_table in cqlrt_common.c.
+function _cql_rebuild_copy_table(db, facets, create, name, max_batches)
+  local shape = string.gsub(string.sub(create, string.find(create, "[(]"), #create), "[%s;]+$", "")
+  local staging = string.format("CREATE TABLE \"cql_rebuild_new_%s\"%s", name, shape)
+  local rowid = _cql_rebuild_rowid_name(db, name)
+  local rc = sqlite3.OK
+  local value
+
+  if rowid == nil and max_batches ~= 0 then
+    -- no batches for this one, the final rebuild copies it in one go
+    return rc, false
+  end
+
+  local resume = false
+  if rowid ~= nil then
+    rc, value = _cql_rebuild_query(db, string.format(
+      "SELECT (SELECT count(*) FROM \"%s\" WHERE facet = 'cql_rebuild_copy_%s') + " ..
+      "(SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = 'cql_rebuild_new_%s' AND sql = %s) + " ..
+      "(SELECT count(*) FROM sqlite_master WHERE type = 'trigger' AND name IN " ..
+      "('cql_rebuild_%s_insert', 'cql_rebuild_%s_update', 'cql_rebuild_%s_delete'))",
+      facets, name, name, _cql_sql_text(staging), name, name, name))
+    if rc ~= sqlite3.OK then return rc, false end
+    resume = value == 5
+  end
+
+  local lower = math.mininteger
+  if resume then
+    rc, value = _cql_rebuild_query(db, string.format(
+      "SELECT version FROM \"%s\" WHERE facet = 'cql_rebuild_copy_%s'", facets, name))
+    if rc ~= sqlite3.OK or value == math.maxinteger then return rc, false end
+    lower = value + 1
+  else
+    rc = _cql_rebuild_discard_copy(db, facets, name)
+    if rc ~= sqlite3.OK then return rc, false end
+    rc = cql_exec(db, staging)
+    if rc ~= sqlite3.OK then return rc, false end
+
+    if max_batches ~= 0 then
+      local progress = string.format("(SELECT version FROM \"%s\" WHERE facet = 'cql_rebuild_copy_%s')", facets, name)
+      local discard = string.format("BEGIN DELETE FROM \"%s\" WHERE facet = 'cql_rebuild_copy_%s'; END;\n", facets, name)
+      rc = cql_exec(db,
+        string.format("CREATE TRIGGER \"cql_rebuild_%s_insert\" AFTER INSERT ON \"%s\" WHEN new.%s <= %s ",
+          name, name, rowid, progress) .. discard ..
+        string.format("CREATE TRIGGER \"cql_rebuild_%s_update\" AFTER UPDATE ON \"%s\" WHEN old.%s <= %s OR new.%s <= %s ",
+          name, name, rowid, progress, rowid, progress) .. discard ..
+        string.format("CREATE TRIGGER \"cql_rebuild_%s_delete\" AFTER DELETE ON \"%s\" WHEN old.%s <= %s ",
+          name, name, rowid, progress) .. discard)
+      if rc ~= sqlite3.OK then return rc, false end
+    end
+  end
+
+  -- the columns the new and old shape have in common, generated columns can't be copied
+  local columns
+  rc, columns = _cql_rebuild_query(db, string.format(
+    "SELECT group_concat(printf('\"%%w\"', N.name), ', ') " ..
+    "FROM pragma_table_xinfo('cql_rebuild_new_%s') N JOIN pragma_table_xinfo('%s') O ON N.name = O.name COLLATE NOCASE " ..
+    "WHERE N.hidden = 0 AND O.hidden = 0", name, name))
+  if rc ~= sqlite3.OK or columns == nil then return rc, false end
+
+  if rowid == nil then
+    return cql_exec(db, string.format(
+      "INSERT INTO \"cql_rebuild_new_%s\"(%s) SELECT %s FROM \"%s\"", name, columns, columns, name)), false
+  end
+
+  local batches = 0
+  while true do
+    if max_batches ~= 0 and batches == max_batches then
+      return rc, true
+    end
+
+    local upper
+    rc, upper = _cql_rebuild_query(db, string.format(
+      "SELECT max(r) FROM (SELECT %s AS r FROM \"%s\" WHERE %s >= %d ORDER BY %s LIMIT %d)",
+      rowid, name, rowid, lower, rowid, CQL_REBUILD_COPY_BATCH_ROWS))
+    if rc ~= sqlite3.OK or upper == nil then break end
+
+    rc = cql_exec(db, string.format(
+      "INSERT INTO \"cql_rebuild_new_%s\"(%s) SELECT %s FROM \"%s\" WHERE %s BETWEEN %d AND %d;\n" ..
+      "INSERT OR REPLACE INTO \"%s\"(facet, version) VALUES('cql_rebuild_copy_%s', %d);\n",
+      name, columns, columns, name, rowid, lower, upper, facets, name, upper))
+    if rc ~= sqlite3.OK or upper == math.maxinteger then break end
+    lower = upper + 1
+    batches = batches + 1
+  end
+  return rc, false
+end
+
+-- build each existing table under a temporary name with its surviving columns, drop the
+-- old ones and rename the new ones into place, see cqlrt_common.c for the details
+function _cql_rebuild_tables_preserving_data(db, facets, tableList, tableNames, tableIndices)
+  local rc = _cql_rebuild_check_preservable(db, tableList, tableNames)
+  if rc ~= sqlite3.OK then return rc end
+
+  local preserved = {}
+  for i = 1, #tableList do
+    rc, preserved[i] = _cql_rebuild_table_exists(db, tableNames[i])
+    if rc ~= sqlite3.OK then return rc end
+    if preserved[i] then
+      rc = _cql_rebuild_copy_table(db, facets, tableList[i], tableNames[i], 0)
+      if rc ~= sqlite3.OK then return rc end
+    end
+  end
+
+  local dropBatch = {}
+  for i = #tableList, 1, -1 do
+    table.insert(dropBatch, string.format("DROP TABLE IF EXISTS \"%s\"", tableNames[i]))
+  end
+  rc = cql_exec(db, table.concat(dropBatch, ";\n"))
+  if rc ~= sqlite3.OK then return rc end
+
+  -- in legacy mode the rename doesn't validate views and triggers that mention the dropped tables
+  local legacy_alter_table
+  rc, legacy_alter_table = _cql_rebuild_query(db, "PRAGMA legacy_alter_table")
+  if rc ~= sqlite3.OK then return rc end
+  rc = cql_exec(db, "PRAGMA legacy_alter_table = ON")
+  if rc ~= sqlite3.OK then return rc end
+
+  local createBatch = {}
+  for i = 1, #tableList do
+    if preserved[i] then
+      table.insert(createBatch, string.format("ALTER TABLE \"cql_rebuild_new_%s\" RENAME TO \"%s\"", tableNames[i], tableNames[i]))
+    else
+      table.insert(createBatch, tableList[i])
+    end
+    for _, indexCreate in ipairs(tableIndices[tableNames[i]]) do
+      table.insert(createBatch, indexCreate)
+    end
+  end
+  rc = cql_exec(db, table.concat(createBatch, ";\n"))
+
+  if legacy_alter_table == 0 then
+    local rc2 = cql_exec(db, "PRAGMA legacy_alter_table = OFF")
+    if rc == sqlite3.OK then rc = rc2 end
+  end
+
+  if rc == sqlite3.OK then
+    rc = _cql_rebuild_discard_copies(db, facets, tableNames)
+  end
+  return rc
+end
+
+-- every statement is parsed once, the indices are grouped by table up front
+-- and the DDL runs as three batches inside one savepoint; given the facets table
+-- we first try to keep the data (see _cql_rebuild_tables_preserving_data)
+function _cql_rebuild_recreate_group(db, tables, indices, deletes, facets)
   local tableList = _cql_create_upgrader_input_statement_list(tables, "CREATE ");
   local indexList = _cql_create_upgrader_input_statement_list(indices, "CREATE ");
   local deleteList = _cql_create_upgrader_input_statement_list(deletes, "DROP ");
 
-  local rc = sqlite3.OK
+  local tableNames = {}
+  local tableIndices = {}
+  for i = 1, #tableList do
+    tableNames[i] = _cql_create_table_name_from_table_creation_statement(tableList[i])
+    tableIndices[tableNames[i]] = {}
+  end
+  for j = 1, #indexList do
+    local indexTableName = _cql_create_table_name_from_index_creation_statement(indexList[j])
+    if indexTableName == nil then
+      -- an index we can't parse fails the rebuild before anything is changed
+      return sqlite3.ERROR, false
+    end
+    local found = tableIndices[indexTableName]
+    if found then
+      table.insert(found, indexList[j])
+    end
+  end
+
+  local deleteBatch = {}
   for i = 1, #deleteList do
-    rc = cql_exec(db, deleteList[i])
-    if rc ~= sqlite3.OK then return rc end
+    table.insert(deleteBatch, deleteList[i])
   end
+  local dropBatch = {}
   for i = #tableList, 1, -1 do
-    local table_name = _cql_create_table_name_from_table_creation_statement(tableList[i])
-    local drop = "DROP TABLE IF EXISTS "
-    drop = drop .. table_name
-    rc = cql_exec(db, drop)
-    if rc ~= sqlite3.OK then return rc end
+    table.insert(dropBatch, "DROP TABLE IF EXISTS " .. tableNames[i])
   end
+  local createBatch = {}
   for i = 1, #tableList do
-    rc = cql_exec(db, tableList[i])
-    if rc ~= sqlite3.OK then return rc end
-    local table_name = _cql_create_table_name_from_table_creation_statement(tableList[i])
-    for j = 1, #indexList do
-      local index_table_name = _cql_create_table_name_from_index_creation_statement(indexList[j])
-      if table_name == index_table_name then
-        rc = cql_exec(db, indexList[j])
-        if rc ~= sqlite3.OK then return rc end
+    table.insert(createBatch, tableList[i])
+    for _, indexCreate in ipairs(tableIndices[tableNames[i]]) do
+      table.insert(createBatch, indexCreate)
+    end
+  end
+
+  local rc = cql_exec(db, "SAVEPOINT cql_rebuild_recreate_group")
+  if rc ~= sqlite3.OK then return rc end
+  local batches = {deleteBatch, dropBatch, createBatch}
+  local rebuilt = false
+  for step, batch in ipairs(batches) do
+    if #batch > 0 then
+      rc = cql_exec(db, table.concat(batch, ";\n"))
+    end
+    if rc == sqlite3.OK and step == 1 and facets ~= nil then
+      rc = cql_exec(db, "SAVEPOINT cql_rebuild_preserving_data")
+      if rc == sqlite3.OK then
+        rebuilt = _cql_rebuild_tables_preserving_data(db, facets, tableList, tableNames, tableIndices) == sqlite3.OK
+        if not rebuilt then
+          cql_exec(db, "ROLLBACK TO cql_rebuild_preserving_data")
+          rc = _cql_rebuild_discard_copies(db, facets, tableNames)
+        end
+        if rc == sqlite3.OK then
+          rc = cql_exec(db, "RELEASE cql_rebuild_preserving_data")
+        end
       end
     end
+    if rc ~= sqlite3.OK then
+      cql_exec(db, "ROLLBACK TO cql_rebuild_recreate_group")
+      cql_exec(db, "RELEASE cql_rebuild_recreate_group")
+      return rc, false
+    end
+    if rebuilt then break end
   end
-  -- returning result = false (because we went with recreate plan)
-  return rc, false
+  rc = cql_exec(db, "RELEASE cql_rebuild_recreate_group")
+  -- result is true if we kept the data, false if we went with the recreate plan
+  return rc, rebuilt and rc == sqlite3.OK
+end
+
+function cql_rebuild_recreate_group(db, tables, indices, deletes)
+  return _cql_rebuild_recreate_group(db, tables, indices, deletes, nil)
+end
+
+-- the --preserve_recreate_data flavor, copy progress is kept in the facets table
+function cql_rebuild_recreate_group_preserving_data(db, tables, indices, deletes, facets)
+  return _cql_rebuild_recreate_group(db, tables, indices, deletes, facets)
+end
+
+-- copy at most one batch of each table of the group ahead of the rebuild, the second
+-- result is true if there is more to copy; see cql_rebuild_copy_group_data in cqlrt_common.c
+function cql_rebuild_copy_group_data(db, tables, facets)
+  local tableList = _cql_create_upgrader_input_statement_list(tables, "CREATE ");
+  local tableNames = {}
+  for i = 1, #tableList do
+    tableNames[i] = _cql_create_table_name_from_table_creation_statement(tableList[i])
+  end
+
+  local rc = cql_exec(db, "SAVEPOINT cql_rebuild_copy_group_data")
+  if rc ~= sqlite3.OK then return rc, false end
+
+  local pending = false
+  rc = _cql_rebuild_check_preservable(db, tableList, tableNames)
+  for i = 1, #tableList do
+    if rc ~= sqlite3.OK then break end
+    local exists, table_pending
+    rc, exists = _cql_rebuild_table_exists(db, tableNames[i])
+    if rc == sqlite3.OK and exists then
+      rc, table_pending = _cql_rebuild_copy_table(db, facets, tableList[i], tableNames[i], 1)
+      pending = pending or table_pending
+    end
+  end
+
+  if rc ~= sqlite3.OK then
+    -- nothing is copied ahead of time for this group
+    pending = false
+    cql_exec(db, "ROLLBACK TO cql_rebuild_copy_group_data")
+    rc = _cql_rebuild_discard_copies(db, facets, tableNames)
+  end
+
+  local rc2 = cql_exec(db, "RELEASE cql_rebuild_copy_group_data")
+  if rc == sqlite3.OK then rc = rc2 end
+  return rc, pending
 end
@@ -186,6 +186,13 @@ typedef struct cql_result_set_meta {
   // release custom internal memory for the rowset that ARE NOT released
   // by teardown
   void(*_Nullable custom_teardown)(cql_result_set_ref _Nonnull result_set);
+
+  // the string and blob bytes of cells that are not references yet, while
+  // heapPending is set such cells hold their heap offset plus one (always odd)
+  // see cql_result_set_materialize
+  const uint8_t *_Nullable heap;
+  uint32_t heapSize;
+  cql_bool heapPending;
 } cql_result_set_meta;
 
 typedef struct cql_result_set {
@@ -209,7 +216,11 @@ cql_result_set *_Nonnull cql_get_result_set_from_ref(cql_result_set_ref _Nonnull
 #define cql_result_set_note_ownership_transferred(result_set)
 
 #define cql_result_set_get_meta(result_set_ref) (&cql_get_result_set_from_ref(result_set_ref)->meta)
-#define cql_result_set_get_data(result_set_ref) (cql_get_result_set_from_ref(result_set_ref)->data)
+#define cql_result_set_get_rows(result_set_ref) (cql_get_result_set_from_ref(result_set_ref)->data)
+#define cql_result_set_heap_pending(result_set_ref) cql_result_set_get_meta(result_set_ref)->heapPending
+#define cql_result_set_get_data(result_set_ref) \
+  (cql_result_set_heap_pending(result_set_ref) ? cql_result_set_materialize(result_set_ref) : (void)0, \
+   cql_result_set_get_rows(result_set_ref))
 #define cql_result_set_get_count(result_set_ref) (cql_get_result_set_from_ref(result_set_ref)->count)
 
 #ifdef CQL_RUN_TEST
@@ -13,6 +13,13 @@
 #include <alloca.h>
 #endif // TARGET_OS_LINUX
 
+#if !defined(TARGET_OS_WIN32) || !TARGET_OS_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // !TARGET_OS_WIN32
+
 #ifndef STACK_BYTES_ALLOC
 #if defined(TARGET_OS_WIN32) && TARGET_OS_WIN32
 #define STACK_BYTES_ALLOC(N, C) char *N = (char *)_alloca(C)
@@ -155,6 +162,13 @@ char *_Nonnull cql_address_of_col(
     cql_int32 col,
     cql_int32 *_Nonnull type);
 
+static void cql_result_set_materialize_cell(
+    cql_result_set_meta *_Nonnull meta,
+    uint8_t data_type,
+    cql_type_ref _Nullable *_Nonnull cell);
+
+static void cql_result_set_blob_pad(cql_bytebuf *_Nonnull b, uint32_t align);
+
 // The variable byte encoding is little endian, you stop when you reach
 // a byte that does not have the high bit set.  This is good enough for 2^28 bits
 // in four bytes which is more than enough for sql strings...
@@ -331,7 +345,10 @@ void cql_column_nullable_string_ref(
     *data = NULL;
   }
   else {
-    *data = cql_string_ref_new((const char *)sqlite3_column_text(stmt, index));
+    // the text has to be fetched before the size so that the size is for the utf8 form
+    const char *text = (const char *)sqlite3_column_text(stmt, index);
+    cql_uint32 length = (cql_uint32)sqlite3_column_bytes(stmt, index);
+    *data = cql_string_ref_new_with_length(text, length);
   }
 }
 
@@ -344,7 +361,9 @@ void cql_column_string_ref(
 {
   // the target may already have data, release it if it does
   cql_string_release(*data);
-  *data = cql_string_ref_new((const char *)sqlite3_column_text(stmt, index));
+  const char *text = (const char *)sqlite3_column_text(stmt, index);
+  cql_uint32 length = (cql_uint32)sqlite3_column_bytes(stmt, index);
+  *data = cql_string_ref_new_with_length(text, length);
 }
 
 // Read a nullable blob reference from the statement at the indicated index.
@@ -829,7 +848,10 @@ static void cql_fetch_field(
 // generated code cost to just the offsets and types.  This version does
 // the fetch based on the "fetch info" which includes, among other things
 // an array of types and an array of offsets.
-void cql_multifetch_meta(char *_Nonnull data, cql_fetch_info *_Nonnull info) {
+//
+// cql_fetch_all_results turns enable_encoding off and instead encodes the whole
+// result set a column at a time once all the rows are in.
+static void cql_fetch_row_meta(char *_Nonnull data, cql_fetch_info *_Nonnull info, cql_bool enable_encoding) {
   cql_contract(info->stmt);
   cql_contract(info->db);
   sqlite3_stmt *stmt = info->stmt;
@@ -866,20 +888,70 @@ void cql_multifetch_meta(char *_Nonnull data, cql_fetch_info *_Nonnull info) {
     char *field = data + col_offsets[column];
     // We're fetching column values from db to store in a result_set. Therefore we
     // need to encode those values because it's the result_set output of the proc.
-    // Because of that we set enable_encoding = TRUE. The value true means if the
-    // field has the CQL_DATA_TYPE_ENCODED bit then encode otherwise don't
+    // Unless the caller is going to do it later enable_encoding is true, which means
+    // if the field has the CQL_DATA_TYPE_ENCODED bit then encode otherwise don't
     cql_fetch_field(type,
                     column,
                     db,
                     stmt,
                     field,
-                    true /* enable_encoding */,
+                    enable_encoding,
                     encode_context_type,
                     encode_context_field,
                     info->encoder);
   }
 }
 
+// The usual case, fetch one row with encoding.
+void cql_multifetch_meta(char *_Nonnull data, cql_fetch_info *_Nonnull info) {
+  cql_fetch_row_meta(data, info, true /* enable_encoding */);
+}
+
+// Like cql_fetch_row_meta but string and blob cells are left pending: the bytes
+// go into the heap (in the same format as the result set wire format) and the
+// cell gets the heap offset plus one.  The references are made only if the
+// cell is read, see cql_result_set_materialize.  Encoding is never on here.
+static void cql_fetch_row_lazy(char *_Nonnull data, cql_fetch_info *_Nonnull info, cql_bytebuf *_Nonnull heap) {
+  sqlite3_stmt *stmt = info->stmt;
+  uint8_t *_Nonnull data_types = info->data_types;
+  uint16_t *_Nonnull col_offsets = info->col_offsets;
+
+  uint32_t count = col_offsets[0];
+  col_offsets++;
+
+  for (cql_int32 column = 0; column < count; column++) {
+    uint8_t type = data_types[column];
+    uint8_t core_data_type = CQL_CORE_DATA_TYPE_OF(type);
+    char *field = data + col_offsets[column];
+
+    if (core_data_type != CQL_DATA_TYPE_STRING && core_data_type != CQL_DATA_TYPE_BLOB) {
+      cql_fetch_field(type, column, info->db, stmt, field, false, -1, NULL, NULL);
+      continue;
+    }
+
+    uintptr_t slot = 0;
+    if (sqlite3_column_type(stmt, column) != SQLITE_NULL) {
+      // the bytes must be fetched before their size, sqlite may convert them
+      bool is_string = core_data_type == CQL_DATA_TYPE_STRING;
+      const void *bytes = is_string ? (const void *)sqlite3_column_text(stmt, column) : sqlite3_column_blob(stmt, column);
+      uint32_t length = (uint32_t)sqlite3_column_bytes(stmt, column);
+
+      cql_result_set_blob_pad(heap, 4);
+      slot = heap->used + 1;
+      cql_bytebuf_append(heap, &length, sizeof(length));
+      if (length) {
+        cql_bytebuf_append(heap, bytes, (int32_t)length);
+      }
+      if (is_string) {
+        char nul = 0;
+        cql_bytebuf_append(heap, &nul, 1);
+      }
+    }
+
+    memcpy(field, &slot, sizeof(slot));
+  }
+}
+
 // This method lets us get lots of columns out of a statement with one call
 // in the generated code saving us a lot of error management and reducing the
 // generated code cost to just the offsets and types.  This version does the
@@ -919,6 +991,73 @@ void cql_multifetch(cql_code rc, sqlite3_stmt *_Nullable stmt, cql_int32 count,
   va_end(args);
 }
 
+// This is cql_multifetch for LOOP FETCH when compiled with --borrow_loop_fetch.
+// String and blob columns become borrowed views of sqlite's own copy of the
+// column (if the runtime supports views) so a scan doesn't allocate per row.
+// A view is only good until the statement is stepped again.  The runtime turns
+// a view into an ordinary copy if anyone retains it, which is what happens if
+// the value is stored anywhere that outlives the row.  Views that are still in
+// the cursor when the loop ends are made into copies by cql_own_borrowed_refs.
+void cql_multifetch_borrowed(cql_code rc, sqlite3_stmt *_Nullable stmt, cql_int32 count, ...) {
+  va_list args;
+  va_start(args, count);
+
+  if (rc != SQLITE_ROW) {
+    cql_multinull(count, &args);
+    va_end(args);
+    return;
+  }
+
+  cql_contract(stmt);
+  sqlite3 *db = sqlite3_db_handle(stmt);
+
+  for (cql_int32 column = 0; column < count; column++) {
+    cql_int32 type = va_arg(args, cql_int32);
+    void *field = va_arg(args, void *);
+
+    switch (CQL_CORE_DATA_TYPE_OF(type)) {
+      case CQL_DATA_TYPE_STRING:
+        cql_column_string_view(stmt, column, (cql_string_ref *)field);
+        break;
+      case CQL_DATA_TYPE_BLOB:
+        cql_column_blob_view(stmt, column, (cql_blob_ref *)field);
+        break;
+      default:
+        // see cql_multifetch for why there is no encoding here
+        cql_fetch_field(type,
+                        column,
+                        db,
+                        stmt,
+                        field,
+                        false /* enable_encoding */,
+                        -1 /* encode_context_type */,
+                        NULL /* encode_context_field */,
+                        NULL /* encoder */);
+        break;
+    }
+  }
+
+  va_end(args);
+}
+
+// When a LOOP FETCH over borrowed views ends early (i.e. LEAVE) the cursor still
+// has its row but the statement might be stepped or finalized before the
+// cursor is next used, so the remaining views are made into ordinary copies.
+// The arguments are the addresses of the cursor's reference fields.
+void cql_own_borrowed_refs(cql_int32 count, ...) {
+  va_list args;
+  va_start(args, count);
+
+  for (cql_int32 i = 0; i < count; i++) {
+    cql_type_ref *ref = va_arg(args, cql_type_ref *);
+    if (*ref) {
+      cql_own_view(*ref);
+    }
+  }
+
+  va_end(args);
+}
+
 // This method lets us get lots of columns out of a statement with one call
 // in the generated code saving us a lot of error management and reducing the
 // generated code cost to just the offsets and types.  This version does the
@@ -1200,8 +1339,11 @@ static void cql_multibind_v(
     cql_int32 type = va_arg(*args, cql_int32);
     cql_int32 core_data_type = CQL_CORE_DATA_TYPE_OF(type);
 
+    // the statement uses numbered parameters (?N) when there are variable
+    // predicates so a skipped variable still uses up its column number
     if (vpreds && !vpreds[i]) {
       cql_skip_arg(type, args);
+      column++;
       continue;
     }
 
@@ -1380,26 +1522,44 @@ void cql_retain_offsets(void *_Nonnull pv, cql_uint16 refs_count, cql_uint16 ref
   }
 }
 
-// Teardown an entire result set by iterating the rows and then releasing
-// all of the references in each row using cql_release_offsets.  Once that
-// is done, it's safe to free the entire blob of storage.
-void cql_result_set_teardown(cql_result_set_ref _Nonnull result_set) {
+// Release all of the references in each row of a result set using
+// cql_release_offsets.  Cells that are still pending (see
+// cql_result_set_materialize) are heap offsets, not references, so if there
+// are any each reference is checked.
+static void cql_result_set_release_rows(cql_result_set_ref _Nonnull result_set) {
   cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
   size_t row_size = meta->rowsize;
   cql_int32 count = cql_result_set_get_count(result_set);
   cql_uint16 refs_count = meta->refsCount;
   cql_uint16 refs_offset = meta->refsOffset;
-  char *_Nullable data = (char *)cql_result_set_get_data(result_set);
-  char *_Nullable row = data;
+  char *_Nullable row = (char *)cql_result_set_get_rows(result_set);
+
+  if (!refs_count || !count) {
+    return;
+  }
 
-  if (refs_count && count) {
-    for (cql_int32 i = 0; i < count; i++) {
+  for (cql_int32 i = 0; i < count; i++, row += row_size) {
+    if (!meta->heapPending) {
       cql_release_offsets(row, refs_count, refs_offset);
-      row += row_size;
+      continue;
+    }
+
+    cql_type_ref *refs = (cql_type_ref *)(row + refs_offset);
+    for (cql_int32 j = 0; j < refs_count; j++) {
+      if (!((uintptr_t)refs[j] & 1)) {
+        cql_release(refs[j]);
+      }
     }
   }
+}
 
-  free(data);
+// Teardown an entire result set by iterating the rows and then releasing
+// all of the references in each row.  Once that is done, it's safe to free
+// the entire blob of storage, and the heap of lazy strings if there is one.
+void cql_result_set_teardown(cql_result_set_ref _Nonnull result_set) {
+  cql_result_set_release_rows(result_set);
+  free(cql_result_set_get_rows(result_set));
+  free((void *)cql_result_set_get_meta(result_set)->heap);
 }
 
 // Record the desired user-teardown function
@@ -1616,6 +1776,20 @@ cql_bool cql_rows_same(
   return true;
 }
 
+// The metadata for a new result set with ordinary malloc'd rows in the shape
+// of the given one.  The given one might have its rows somewhere else (e.g.
+// mapped) with a teardown to match, none of that applies to the new one.
+static cql_result_set_meta cql_result_set_owned_meta(cql_result_set_meta *_Nonnull meta) {
+  cql_result_set_meta result = *meta;
+  if (result.heap) {
+    result.teardown = cql_result_set_teardown;
+    result.heap = NULL;
+    result.heapSize = 0;
+    result.heapPending = false;
+  }
+  return result;
+}
+
 // This helper allows you to copy out some of the rows of a result set to make a new result set.
 // The helper uses only metadata to do its job so, as with the others, codegen
 // for this is very economical.  The result set includes in it already all the
@@ -1650,7 +1824,7 @@ void cql_rowset_copy(
     cql_retain_offsets(row, refs_count, refs_offset);
   }
 
-  *to_result_set = cql_result_set_create(new_data, count, *meta);
+  *to_result_set = cql_result_set_create(new_data, count, cql_result_set_owned_meta(meta));
 }
 
 // This method is the workhorse of result set reading, the contract is a bit
@@ -1718,7 +1892,14 @@ char *_Nonnull cql_address_of_col(
   // Get the column offset, and rowsize and do the math to compute the data pointer.
   cql_uint16 offset = meta->columnOffsets[col + 1];
   size_t row_size = meta->rowsize;
-  return ((char *)cql_result_set_get_data(result_set)) + row * row_size + offset;
+  char *data = ((char *)cql_result_set_get_rows(result_set)) + row * row_size + offset;
+
+  // only this one cell is made, the rest stay pending
+  if (cql_result_set_heap_pending(result_set)) {
+    cql_result_set_materialize_cell(meta, data_type, (cql_type_ref *)data);
+  }
+
+  return data;
 }
 
 // This is the helper method that reads an int32 out of a rowset at a particular row and column.
@@ -1974,7 +2155,7 @@ cql_bool cql_result_set_get_is_null_col(
 
   cql_uint16 offset = meta->columnOffsets[col + 1];
   size_t row_size = meta->rowsize;
-  char *data =((char *)cql_result_set_get_data(result_set)) + row * row_size + offset;
+  char *data =((char *)cql_result_set_get_rows(result_set)) + row * row_size + offset;
 
   int32_t core_data_type = CQL_CORE_DATA_TYPE_OF(data_type);
 
@@ -2037,7 +2218,7 @@ void cql_result_set_set_to_null_col(
 
   cql_uint16 offset = meta->columnOffsets[col + 1];
   size_t row_size = meta->rowsize;
-  char *data =((char *)cql_result_set_get_data(result_set)) + row * row_size + offset;
+  char *data =((char *)cql_result_set_get_rows(result_set)) + row * row_size + offset;
 
   int32_t core_data_type = CQL_CORE_DATA_TYPE_OF(data_type);
 
@@ -2183,6 +2364,142 @@ void cql_initialize_meta(cql_result_set_meta *_Nonnull meta, cql_fetch_info *_No
   #endif
 }
 
+#ifndef CQL_HAS_COLUMN_ENCODER
+
+// The runtime does not have a column encoder so we make one out of the per value
+// encoders.  Each row is encoded in place.  Nullable values that are null are
+// left alone.  The context, if any, moves along with the rows.
+static void cql_encode_column(
+  cql_object_ref _Nullable encoder,
+  cql_int32 type,
+  char *_Nonnull field,
+  cql_int32 rows,
+  cql_int32 rowsize,
+  cql_int32 context_type,
+  char *_Nullable context)
+{
+  for (cql_int32 i = 0; i < rows; i++, field += rowsize, context = context ? context + rowsize : NULL) {
+    switch (type & ~CQL_DATA_TYPE_ENCODED) {
+      case CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_NOT_NULL: {
+        cql_int32 *int32_data = (cql_int32 *)field;
+        *int32_data = cql_encode_int32(encoder, *int32_data, context_type, context);
+        break;
+      }
+      case CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_NOT_NULL: {
+        cql_int64 *int64_data = (cql_int64 *)field;
+        *int64_data = cql_encode_int64(encoder, *int64_data, context_type, context);
+        break;
+      }
+      case CQL_DATA_TYPE_DOUBLE | CQL_DATA_TYPE_NOT_NULL: {
+        cql_double *double_data = (cql_double *)field;
+        *double_data = cql_encode_double(encoder, *double_data, context_type, context);
+        break;
+      }
+      case CQL_DATA_TYPE_BOOL | CQL_DATA_TYPE_NOT_NULL: {
+        cql_bool *bool_data = (cql_bool *)field;
+        *bool_data = cql_encode_bool(encoder, *bool_data, context_type, context);
+        break;
+      }
+      case CQL_DATA_TYPE_INT32: {
+        cql_nullable_int32 *_Nonnull int32p = (cql_nullable_int32 *_Nonnull)field;
+        if (!int32p->is_null) {
+          int32p->value = cql_encode_int32(encoder, int32p->value, context_type, context);
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_INT64: {
+        cql_nullable_int64 *_Nonnull int64p = (cql_nullable_int64 *_Nonnull)field;
+        if (!int64p->is_null) {
+          int64p->value = cql_encode_int64(encoder, int64p->value, context_type, context);
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_DOUBLE: {
+        cql_nullable_double *_Nonnull doublep = (cql_nullable_double *_Nonnull)field;
+        if (!doublep->is_null) {
+          doublep->value = cql_encode_double(encoder, doublep->value, context_type, context);
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_BOOL: {
+        cql_nullable_bool *_Nonnull boolp = (cql_nullable_bool *_Nonnull)field;
+        if (!boolp->is_null) {
+          boolp->value = cql_encode_bool(encoder, boolp->value, context_type, context);
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_STRING | CQL_DATA_TYPE_NOT_NULL:
+      case CQL_DATA_TYPE_STRING: {
+        cql_string_ref *str_ref = (cql_string_ref *)field;
+        if (*str_ref) {
+          cql_string_ref new_str_ref = cql_encode_string_ref_new(encoder, *str_ref, context_type, context);
+          cql_set_string_ref(str_ref, new_str_ref);
+          cql_string_release(new_str_ref);
+        }
+        break;
+      }
+      case CQL_DATA_TYPE_BLOB | CQL_DATA_TYPE_NOT_NULL:
+      case CQL_DATA_TYPE_BLOB: {
+        cql_blob_ref *blob_ref = (cql_blob_ref *)field;
+        if (*blob_ref) {
+          cql_blob_ref new_blob_ref = cql_encode_blob_ref_new(encoder, *blob_ref, context_type, context);
+          cql_set_blob_ref(blob_ref, new_blob_ref);
+          cql_blob_release(new_blob_ref);
+        }
+        break;
+      }
+    }
+  }
+}
+
+#endif
+
+// Encodes all the columns of a block of rows that have the CQL_DATA_TYPE_ENCODED
+// bit.  We go a column at a time so that the runtime gets each column in one call.
+// The columns are still done in order so any column that uses the encode context
+// sees it exactly as it would have if we had gone row by row.  When the rows were
+// just fetched the context column was never encoded so skip_context is set.
+static void cql_encode_columns(
+  cql_fetch_info *_Nonnull info,
+  cql_object_ref _Nullable encoder,
+  char *_Nonnull data,
+  cql_int32 rows,
+  cql_bool skip_context)
+{
+  uint8_t *_Nonnull data_types = info->data_types;
+  uint16_t *_Nonnull col_offsets = info->col_offsets;
+
+  uint32_t count = col_offsets[0];
+  col_offsets++;
+
+  cql_int32 encode_context_type = -1;
+  char *encode_context_field = NULL;
+  if (info->encode_context_index >= 0) {
+    encode_context_type = data_types[info->encode_context_index];
+    encode_context_field = data + col_offsets[info->encode_context_index];
+  }
+
+  for (cql_int32 column = 0; column < count; column++) {
+    uint8_t type = data_types[column];
+    if (!(type & CQL_DATA_TYPE_ENCODED)) {
+      continue;
+    }
+
+    if (skip_context && column == info->encode_context_index) {
+      continue;
+    }
+
+    cql_encode_column(
+      encoder,
+      type,
+      data + col_offsets[column],
+      rows,
+      info->rowsize,
+      encode_context_type,
+      encode_context_field);
+  }
+}
+
 // true if any of the columns of this result set are to be encoded
 // all we have to do is check the encoded bit on the data types
 static cql_bool cql_are_any_encoded(cql_fetch_info *_Nonnull info) {
@@ -2216,13 +2533,22 @@ cql_code cql_fetch_all_results(
   int32_t rowsize = info->rowsize;
   char *row;
   cql_code rc = info->rc;
+  cql_bool lazy = false;
+  cql_bytebuf heap;
 
   if (rc != SQLITE_OK) goto cql_error;
 
-  if (cql_are_any_encoded(info)) {
+  cql_bool encoded = cql_are_any_encoded(info);
+  if (encoded) {
     info->encoder = cql_copy_encoder(info->db);
   }
 
+  // encoding needs the values so lazy strings are only for plain result sets
+  lazy = info->lazy_strings && info->refs_count && !encoded;
+  if (lazy) {
+    cql_bytebuf_open(&heap);
+  }
+
   for (;;) {
     rc = sqlite3_step(stmt);
     if (rc == SQLITE_DONE) break;
@@ -2231,18 +2557,36 @@ cql_code cql_fetch_all_results(
     row = cql_bytebuf_alloc(&b, rowsize);
     memset(row, 0, rowsize);
 
-    cql_multifetch_meta((char *)row, info);
+    if (lazy) {
+      cql_fetch_row_lazy((char *)row, info, &heap);
+    }
+    else {
+      // the encoding is done below, all at once
+      cql_fetch_row_meta((char *)row, info, false /* enable_encoding */);
+    }
   }
 
   // If all is well, we close the statement and we're done with OK result.
   // If anything went wrong we free all the memory and we're outta here.
 
   cql_finalize_stmt(&stmt);
+
+  if (encoded && count) {
+    cql_encode_columns(info, info->encoder, b.ptr, count, true /* skip_context */);
+  }
+
   cql_result_set_meta meta;
   cql_initialize_meta(&meta, info);
   cql_object_release(info->encoder); // nullsafe
   info->encoder = NULL;
 
+  if (lazy) {
+    // the result set owns the heap now, teardown frees it
+    meta.heap = (const uint8_t *)heap.ptr;
+    meta.heapSize = heap.used;
+    meta.heapPending = count != 0;
+  }
+
   *result_set = cql_result_set_create(b.ptr, count, meta);
   cql_autodrop_tables(info->db, info->autodrop_tables);
   cql_profile_stop(info->crc, info->perf_index);
@@ -2250,12 +2594,16 @@ cql_code cql_fetch_all_results(
 
 cql_error:
   // If we have allocated any rows, and they need cleanup, clean them up now
-  if (info->refs_count) {
+  // lazy rows have no references, only heap offsets
+  if (info->refs_count && !lazy) {
     row = b.ptr;
     for (cql_int32 i = 0; i < count ; i++, row += rowsize) {
       cql_release_offsets(row, info->refs_count, info->refs_offset);
     }
   }
+  if (lazy) {
+    cql_bytebuf_close(&heap);
+  }
   cql_bytebuf_close(&b);
   cql_finalize_stmt(&stmt);
   cql_log_database_error(info->db, "cql", "database error");
@@ -2287,119 +2635,12 @@ static void cql_encode_new_result_set_data(
     return;
   }
 
-  int32_t rowsize = info->rowsize;
-  uint8_t *_Nonnull data_types = info->data_types;
-  uint16_t *_Nonnull col_offsets = info->col_offsets;
-
-  uint32_t count = col_offsets[0];
-  col_offsets++;
-
-  cql_bool got_encoder = false;
-  cql_object_ref encoder = NULL;
-
-  cql_int32 encode_context_type = -1;
-  if (info->encode_context_index >= 0) {
-    encode_context_type = data_types[info->encode_context_index];
+  if (!rows || !cql_are_any_encoded(info)) {
+    return;
   }
-  char *encode_context_field = NULL;
-  char *row = data;
-  for (cql_int32 i = 0; i < rows ; i++, row += rowsize) {
-    if (info->encode_context_index >= 0) {
-      encode_context_field = row + col_offsets[info->encode_context_index];
-    }
-    for (cql_int32 column = 0; column < count; column++) {
-      uint8_t type = data_types[column];
-      char *field = row + col_offsets[column];
-
-      if (!got_encoder && type & CQL_DATA_TYPE_ENCODED) {
-        encoder = cql_copy_encoder(db);
-        got_encoder = true;
-      }
 
-      switch (type) {
-        case CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_ENCODED | CQL_DATA_TYPE_NOT_NULL: {
-          cql_int32 *int32_data = (cql_int32 *)field;
-          *int32_data = cql_encode_int32(encoder, *int32_data, encode_context_type, encode_context_field);
-          break;
-        }
-        case CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_ENCODED | CQL_DATA_TYPE_NOT_NULL: {
-          cql_int64 *int64_data = (cql_int64 *)field;
-          *int64_data = cql_encode_int64(encoder, *int64_data, encode_context_type, encode_context_field);
-          break;
-        }
-        case CQL_DATA_TYPE_DOUBLE | CQL_DATA_TYPE_ENCODED | CQL_DATA_TYPE_NOT_NULL: {
-          cql_double *double_data = (cql_double *)field;
-          *double_data = cql_encode_double(encoder, *double_data, encode_context_type, encode_context_field);
-          break;
-        }
-        case CQL_DATA_TYPE_BOOL | CQL_DATA_TYPE_ENCODED | CQL_DATA_TYPE_NOT_NULL: {
-          cql_bool *bool_data = (cql_bool *)field;
-          *bool_data = cql_encode_bool(encoder, *bool_data, encode_context_type, encode_context_field);
-          break;
-        }
-        case CQL_DATA_TYPE_STRING | CQL_DATA_TYPE_ENCODED | CQL_DATA_TYPE_NOT_NULL: {
-          cql_string_ref *str_ref = (cql_string_ref *)field;
-          cql_string_ref new_str_ref = cql_encode_string_ref_new(encoder, *str_ref, encode_context_type, encode_context_field);
-          cql_set_string_ref(str_ref, new_str_ref);
-          cql_string_release(new_str_ref);
-          break;
-        }
-        case CQL_DATA_TYPE_BLOB | CQL_DATA_TYPE_ENCODED | CQL_DATA_TYPE_NOT_NULL: {
-          cql_blob_ref *blob_ref = (cql_blob_ref *)field;
-          cql_blob_ref new_blob_ref = cql_encode_blob_ref_new(encoder, *blob_ref, encode_context_type, encode_context_field);
-          cql_set_blob_ref(blob_ref, new_blob_ref);
-          cql_blob_release(new_blob_ref);
-          break;
-        }
-        case CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_ENCODED: {
-          cql_nullable_int32 *_Nonnull int32p = (cql_nullable_int32 *_Nonnull)field;
-          if (!int32p->is_null) {
-            int32p->value = cql_encode_int32(encoder, int32p->value, encode_context_type, encode_context_field);
-          }
-          break;
-        }
-        case CQL_DATA_TYPE_INT64 | CQL_DATA_TYPE_ENCODED: {
-          cql_nullable_int64 *_Nonnull int64p = (cql_nullable_int64 *_Nonnull)field;
-          if (!int64p->is_null) {
-            int64p->value = cql_encode_int64(encoder, int64p->value, encode_context_type, encode_context_field);
-          }
-          break;
-        }
-        case CQL_DATA_TYPE_DOUBLE | CQL_DATA_TYPE_ENCODED: {
-          cql_nullable_double *_Nonnull doublep = (cql_nullable_double *_Nonnull)field;
-          if (!doublep->is_null) {
-            doublep->value = cql_encode_double(encoder, doublep->value, encode_context_type, encode_context_field);
-          }
-          break;
-        }
-        case CQL_DATA_TYPE_BOOL | CQL_DATA_TYPE_ENCODED: {
-          cql_nullable_bool *_Nonnull boolp = (cql_nullable_bool *_Nonnull)field;
-          if (!boolp->is_null) {
-            boolp->value = cql_encode_bool(encoder, boolp->value, encode_context_type, encode_context_field);
-          }
-          break;
-        }
-        case CQL_DATA_TYPE_STRING | CQL_DATA_TYPE_ENCODED: {
-          cql_string_ref *str_ref = (cql_string_ref *)field;
-          if (*str_ref) {
-            cql_string_ref new_str_ref = cql_encode_string_ref_new(encoder, *str_ref, encode_context_type, encode_context_field);
-            cql_set_string_ref(str_ref, new_str_ref);
-            cql_string_release(new_str_ref);
-          }
-          break;
-        }
-        case CQL_DATA_TYPE_BLOB | CQL_DATA_TYPE_ENCODED: {
-          cql_blob_ref *blob_ref = (cql_blob_ref *)field;
-          if (*blob_ref) {
-            cql_blob_ref new_blob_ref = cql_encode_blob_ref_new(encoder, *blob_ref, encode_context_type, encode_context_field);
-            cql_set_blob_ref(blob_ref, new_blob_ref);
-            cql_blob_release(new_blob_ref);
-          }
-          break;
-        }
-      }
-    }
-  }
+  cql_object_ref encoder = cql_copy_encoder(db);
+  cql_encode_columns(info, encoder, data, rows, false /* skip_context */);
   cql_object_release(encoder);
 }
 
@@ -2514,38 +2755,68 @@ cql_code cql_no_rows_stmt(sqlite3 *_Nonnull db, sqlite3_stmt *_Nullable *_Nonnul
 }
 
 // basic closed hash table, small initial size with doubling
+// the capacity is always a power of two so the slot is just the low bits of the hash
 #define HASHTAB_INIT_SIZE 4
 #define HASHTAB_LOAD_FACTOR .75
 
+// The key hash functions are not uniformly good in their low bits, which
+// are all we use for the slot, so the bits are mixed before use.  This is
+// the 64 bit finalizer from MurmurHash3.
+static uint64_t cql_hashtab_mix(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
 // helper to set the payload array, used at init time and during rehash
 static void cql_hashtab_set_payload(cql_hashtab *_Nonnull ht) {
   ht->payload = (cql_hashtab_entry *)calloc(ht->capacity, sizeof(cql_hashtab_entry));
 }
 
+// Move the entries of the old payload into the (empty) current payload.  The
+// hash table still owns the same keys and values so there is no retain or
+// release and the stored hash means no key is hashed or compared again.
+static void cql_hashtab_move_entries(
+  cql_hashtab *_Nonnull ht,
+  cql_hashtab_entry *_Nonnull old_payload,
+  cql_int32 old_capacity)
+{
+  uint32_t mask = (uint32_t)ht->capacity - 1;
+  cql_hashtab_entry *payload = ht->payload;
+
+  for (cql_int32 i = 0; i < old_capacity; i++) {
+    if (old_payload[i].key) {
+      uint32_t offset = (uint32_t)old_payload[i].hash & mask;
+      while (payload[offset].key) {
+        offset = (offset + 1) & mask;
+      }
+      payload[offset] = old_payload[i];
+    }
+  }
+}
+
+// Make sure the table can hold at least count entries without rehashing.  The
+// capacity stops doubling before it would overflow, the count is an int32 too so
+// the biggest capacity can always hold it.
+static void cql_hashtab_reserve(cql_hashtab *_Nonnull ht, cql_int32 count) {
+  cql_int32 capacity = ht->capacity;
+  while (count > capacity * HASHTAB_LOAD_FACTOR && capacity <= INT32_MAX / 2) {
+    capacity *= 2;
+  }
 
-// fwd ref needed for rehash
-static cql_bool cql_hashtab_add(cql_hashtab *_Nonnull ht, cql_int64 key_new, cql_int64 val_new);
+  if (capacity == ht->capacity) {
+    return;
+  }
 
-// Rehash to a bigger size, all the items are re-inserted.
-// Note we have to release the old values because the new values
-// are retained upon insertion.  This keeps the reference counting correct.
-static void cql_hashtab_rehash(cql_hashtab *_Nonnull ht) {
-  uint32_t old_capacity = ht->capacity;
+  cql_int32 old_capacity = ht->capacity;
   cql_hashtab_entry *old_payload = ht->payload;
 
-  ht->count = 0;
-  ht->capacity *= 2;
+  ht->capacity = capacity;
   cql_hashtab_set_payload(ht);
-
-  for (uint32_t i = 0; i < old_capacity; i++) {
-    cql_int64 key = old_payload[i].key;
-    cql_int64 val = old_payload[i].val;
-    if (key) {
-      cql_hashtab_add(ht, key, val);
-      ht->release_key(ht->context, key);
-      ht->release_val(ht->context, val);
-    }
-  }
+  cql_hashtab_move_entries(ht, old_payload, old_capacity);
 
   free(old_payload);
 }
@@ -2600,8 +2871,9 @@ static cql_bool cql_hashtab_add(
   cql_int64 key_new,
   cql_int64 val_new)
 {
-  uint32_t hash = (uint32_t)ht->hash_key(ht->context, key_new);
-  uint32_t offset = hash % ht->capacity;
+  uint64_t hash = cql_hashtab_mix(ht->hash_key(ht->context, key_new));
+  uint32_t mask = (uint32_t)ht->capacity - 1;
+  uint32_t offset = (uint32_t)hash & mask;
   cql_hashtab_entry *payload = ht->payload;
 
   for (;;) {
@@ -2612,23 +2884,21 @@ static cql_bool cql_hashtab_add(
 
       payload[offset].key = key_new;
       payload[offset].val = val_new;
+      payload[offset].hash = hash;
 
       ht->count++;
       if (ht->count > ht->capacity * HASHTAB_LOAD_FACTOR) {
-        cql_hashtab_rehash(ht);
+        cql_hashtab_reserve(ht, ht->count);
       }
 
       return true;
     }
 
-    if (ht->compare_keys(ht->context, key, key_new)) {
+    if (payload[offset].hash == hash && ht->compare_keys(ht->context, key, key_new)) {
       return false;
     }
 
-    offset++;
-    if (offset >= ht->capacity) {
-      offset = 0;
-    }
+    offset = (offset + 1) & mask;
   }
 }
 
@@ -2638,24 +2908,22 @@ static cql_hashtab_entry *_Nullable cql_hashtab_find(
   cql_hashtab *_Nonnull ht,
   cql_int64 key_needed)
 {
-  uint32_t hash = (uint32_t)ht->hash_key(ht->context, key_needed);
-  uint32_t offset = hash % ht->capacity;
+  uint64_t hash = cql_hashtab_mix(ht->hash_key(ht->context, key_needed));
+  uint32_t mask = (uint32_t)ht->capacity - 1;
+  uint32_t offset = (uint32_t)hash & mask;
   cql_hashtab_entry *payload = ht->payload;
 
   for (;;) {
-    cql_int64 key = ht->payload[offset].key;
+    cql_int64 key = payload[offset].key;
     if (!key) {
       return NULL;
     }
 
-    if (ht->compare_keys(ht->context, key, key_needed)) {
+    if (payload[offset].hash == hash && ht->compare_keys(ht->context, key, key_needed)) {
       return &payload[offset];
     }
 
-    offset++;
-    if (offset >= ht->capacity) {
-      offset = 0;
-    }
+    offset = (offset + 1) & mask;
   }
 }
 
@@ -3002,7 +3270,7 @@ cql_code cql_serialize_to_blob(cql_blob_ref _Nullable *_Nonnull blob, cql_dynami
         case CQL_DATA_TYPE_STRING: {
           cql_string_ref str_ref = *(cql_string_ref *)(cursor + offset);
           cql_alloc_cstr(temp, str_ref);
-          cql_bytebuf_append(&b, temp, (uint32_t)(strlen(temp) + 1));
+          cql_bytebuf_append(&b, temp, (uint32_t)(cql_get_cstr_length(temp, str_ref) + 1));
           cql_free_cstr(temp, str_ref);
           break;
         }
@@ -3058,7 +3326,7 @@ cql_code cql_serialize_to_blob(cql_blob_ref _Nullable *_Nonnull blob, cql_dynami
           if (str_ref) {
             cql_setbit(bits, nullable_index);
             cql_alloc_cstr(temp, str_ref);
-            cql_bytebuf_append(&b, temp, (uint32_t)(strlen(temp) + 1));
+            cql_bytebuf_append(&b, temp, (uint32_t)(cql_get_cstr_length(temp, str_ref) + 1));
             cql_free_cstr(temp, str_ref);
           }
           break;
@@ -3088,13 +3356,495 @@ cql_code cql_serialize_to_blob(cql_blob_ref _Nullable *_Nonnull blob, cql_dynami
   return SQLITE_OK;
 }
 
-// Generic method to hash a dynamic cursor:
-// Note this code takes advantage of the fact that null valued primitives
-// are normalized to "isnull = 1" and "value = 0" so the whole thing can
-// be hashed with impunity even when it is in the null state.  With not
-// much work this assumption could be removed if needed at a later time.
-cql_int64 cql_cursor_hash(cql_dynamic_cursor *_Nonnull dyn_cursor)
-{
+// The result set wire format is for moving a whole result set to another
+// process built from the same sources (so same ABI, same endianness).  It is
+// laid out so that the reader can map it and use the rows where they are:
+//  * a fixed header (cql_result_set_blob_header below)
+//  * the data type of each column, padded to 8 bytes
+//  * the row block, exactly as it is in memory, except that every string or
+//    blob slot holds an offset into the heap (plus one) instead of a pointer,
+//    zero is null.
+//  * the heap, each entry is a 4 byte aligned uint32 length followed by the
+//    bytes; strings also have a trailing nul so they can be used in place
+// Object columns cannot go to another process so result sets that have any
+// can't be written.
+#define CQL_RESULT_SET_BLOB_MAGIC 0x53524c43  // "CLRS"
+#define CQL_RESULT_SET_BLOB_VERSION 1
+
+typedef struct cql_result_set_blob_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t column_count;
+  uint32_t row_count;
+  uint32_t rowsize;
+  uint32_t heap_offset;
+  uint32_t heap_size;
+} cql_result_set_blob_header;
+
+#define CQL_RESULT_SET_BLOB_ALIGN(x, n) (((x) + (n) - 1) & ~(size_t)((n) - 1))
+
+// offset of the row block, it follows the header and the padded data types
+static size_t cql_result_set_blob_rows_offset(uint32_t column_count) {
+  return sizeof(cql_result_set_blob_header) + CQL_RESULT_SET_BLOB_ALIGN(column_count, 8);
+}
+
+// Pads the buffer with zeros to the indicated alignment.
+static void cql_result_set_blob_pad(cql_bytebuf *_Nonnull b, uint32_t align) {
+  uint32_t needed = (uint32_t)CQL_RESULT_SET_BLOB_ALIGN(b->used, align) - b->used;
+  if (needed) {
+    memset(cql_bytebuf_alloc(b, needed), 0, needed);
+  }
+}
+
+// Writes the result set in the wire format above into a new blob.  The row block
+// is copied in one go, only the string and blob slots are visited after that.
+cql_code cql_result_set_to_blob(
+  cql_result_set_ref _Nonnull result_set,
+  cql_blob_ref _Nullable *_Nonnull blob)
+{
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  cql_int32 count = cql_result_set_get_count(result_set);
+  cql_int32 column_count = meta->columnCount;
+  uint16_t *offsets = meta->columnOffsets;
+  uint8_t *types = meta->dataTypes;
+  size_t rowsize = meta->rowsize;
+
+  for (cql_int32 col = 0; col < column_count; col++) {
+    if (CQL_CORE_DATA_TYPE_OF(types[col]) == CQL_DATA_TYPE_OBJECT) {
+      return SQLITE_ERROR;
+    }
+  }
+
+  cql_bytebuf b;
+  cql_bytebuf_open(&b);
+
+  // the header is written last, when we know the heap size
+  size_t rows_offset = cql_result_set_blob_rows_offset((uint32_t)column_count);
+  cql_bytebuf_alloc(&b, sizeof(cql_result_set_blob_header));
+  cql_bytebuf_append(&b, types, column_count);
+  cql_result_set_blob_pad(&b, 8);
+  cql_invariant(b.used == rows_offset);
+
+  char *data = (char *)cql_result_set_get_data(result_set);
+  if (count) {
+    cql_bytebuf_append(&b, data, (int32_t)(count * rowsize));
+  }
+
+  uint32_t heap_offset = b.used;
+
+  if (meta->refsCount) {
+    char *row = data;
+    for (cql_int32 i = 0; i < count; i++, row += rowsize) {
+      for (cql_int32 col = 0; col < column_count; col++) {
+        uint8_t core_data_type = CQL_CORE_DATA_TYPE_OF(types[col]);
+        if (core_data_type != CQL_DATA_TYPE_STRING && core_data_type != CQL_DATA_TYPE_BLOB) {
+          continue;
+        }
+
+        uint16_t offset = offsets[col + 1];
+        cql_type_ref ref = *(cql_type_ref *)(row + offset);
+        uintptr_t slot = 0;
+
+        if (ref) {
+          cql_result_set_blob_pad(&b, 4);
+          slot = b.used - heap_offset + 1;
+
+          if (core_data_type == CQL_DATA_TYPE_STRING) {
+            cql_string_ref str_ref = (cql_string_ref)ref;
+            cql_alloc_cstr(temp, str_ref);
+            uint32_t length = (uint32_t)cql_get_cstr_length(temp, str_ref);
+            cql_append_value(b, length);
+            char nul = 0;
+            cql_bytebuf_append(&b, temp, (int32_t)length);
+            cql_append_value(b, nul);
+            cql_free_cstr(temp, str_ref);
+          }
+          else {
+            cql_blob_ref blob_ref = (cql_blob_ref)ref;
+            uint32_t size = cql_get_blob_size(blob_ref);
+            cql_append_value(b, size);
+            cql_bytebuf_append(&b, cql_get_blob_bytes(blob_ref), (int32_t)size);
+          }
+        }
+
+        // the buffer may have moved, always address the copied row afresh
+        memcpy(b.ptr + rows_offset + i * rowsize + offset, &slot, sizeof(slot));
+      }
+    }
+  }
+
+  cql_result_set_blob_header header = {
+    .magic = CQL_RESULT_SET_BLOB_MAGIC,
+    .version = CQL_RESULT_SET_BLOB_VERSION,
+    .column_count = (uint16_t)column_count,
+    .row_count = (uint32_t)count,
+    .rowsize = (uint32_t)rowsize,
+    .heap_offset = heap_offset,
+    .heap_size = b.used - heap_offset,
+  };
+  memcpy(b.ptr, &header, sizeof(header));
+
+  cql_blob_ref new_blob = cql_blob_ref_new((const uint8_t *)b.ptr, b.used);
+  cql_blob_release(*blob);
+  *blob = new_blob;
+
+  cql_bytebuf_close(&b);
+  return SQLITE_OK;
+}
+
+// Finds the heap entry a string or blob slot points to, false if the slot
+// points outside of the heap (or a string isn't terminated).
+static bool cql_result_set_blob_heap_entry(
+  const uint8_t *_Nonnull heap,
+  uint32_t heap_size,
+  uintptr_t slot,
+  bool is_string,
+  const uint8_t *_Nullable *_Nonnull bytes,
+  uint32_t *_Nonnull length)
+{
+  uint64_t pos = slot - 1;
+  if (pos + sizeof(uint32_t) > heap_size) {
+    return false;
+  }
+
+  memcpy(length, heap + pos, sizeof(uint32_t));
+  pos += sizeof(uint32_t);
+
+  if (pos + *length + is_string > heap_size) {
+    return false;
+  }
+
+  if (is_string && heap[pos + *length]) {
+    return false;
+  }
+
+  *bytes = heap + pos;
+  return true;
+}
+
+// Checks that every string and blob slot of the rows refers to a good heap
+// entry and that no NOT NULL slot is null.  Object columns can't be stored.
+static bool cql_result_set_blob_check_slots(
+  cql_result_set_meta *_Nonnull meta,
+  const uint8_t *_Nonnull rows,
+  cql_int32 count,
+  const uint8_t *_Nonnull heap,
+  uint32_t heap_size)
+{
+  cql_int32 column_count = meta->columnCount;
+  uint16_t *offsets = meta->columnOffsets;
+  uint8_t *types = meta->dataTypes;
+  size_t rowsize = meta->rowsize;
+  const uint8_t *entry;
+  uint32_t length;
+
+  for (cql_int32 col = 0; col < column_count; col++) {
+    if (CQL_CORE_DATA_TYPE_OF(types[col]) == CQL_DATA_TYPE_OBJECT) {
+      return false;
+    }
+  }
+
+  for (cql_int32 i = 0; i < count; i++) {
+    for (cql_int32 col = 0; col < column_count; col++) {
+      uint8_t type = types[col];
+      uint8_t core_data_type = CQL_CORE_DATA_TYPE_OF(type);
+      if (core_data_type != CQL_DATA_TYPE_STRING && core_data_type != CQL_DATA_TYPE_BLOB) {
+        continue;
+      }
+
+      uintptr_t slot;
+      memcpy(&slot, rows + i * rowsize + offsets[col + 1], sizeof(slot));
+      if (slot == 0) {
+        if (type & CQL_DATA_TYPE_NOT_NULL) {
+          return false;
+        }
+        continue;
+      }
+
+      bool is_string = core_data_type == CQL_DATA_TYPE_STRING;
+      if (!cql_result_set_blob_heap_entry(heap, heap_size, slot, is_string, &entry, &length)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Makes a result set from bytes in the wire format, which may be mapped
+// memory.  The shape has to match the provided metadata exactly, this is the
+// metadata of any result set of the expected type.  Everything is validated
+// before anything is allocated so a bad buffer leaks nothing.  The rows are
+// copied in one go and then only the string and blob slots are fixed up.
+cql_code cql_result_set_from_buffer(
+  cql_result_set_meta *_Nonnull meta,
+  const void *_Nonnull buffer,
+  size_t size,
+  cql_result_set_ref _Nullable *_Nonnull result_set)
+{
+  *result_set = NULL;
+
+  const uint8_t *bytes = (const uint8_t *)buffer;
+  cql_result_set_blob_header header;
+
+  if (size < sizeof(header)) {
+    return SQLITE_ERROR;
+  }
+
+  memcpy(&header, bytes, sizeof(header));
+
+  cql_int32 column_count = meta->columnCount;
+  uint16_t *offsets = meta->columnOffsets;
+  uint8_t *types = meta->dataTypes;
+  size_t rowsize = meta->rowsize;
+  size_t rows_offset = cql_result_set_blob_rows_offset(header.column_count);
+
+  if (header.magic != CQL_RESULT_SET_BLOB_MAGIC ||
+      header.version != CQL_RESULT_SET_BLOB_VERSION ||
+      header.column_count != column_count ||
+      header.rowsize != rowsize ||
+      rows_offset > size ||
+      memcmp(bytes + sizeof(header), types, column_count) ||
+      header.heap_offset != rows_offset + (uint64_t)header.row_count * rowsize ||
+      (uint64_t)header.heap_offset + header.heap_size > size) {
+    return SQLITE_ERROR;
+  }
+
+  cql_int32 count = (cql_int32)header.row_count;
+  const uint8_t *rows = bytes + rows_offset;
+  const uint8_t *heap = bytes + header.heap_offset;
+  const uint8_t *entry;
+  uint32_t length;
+
+  // validate every string and blob slot before we allocate anything
+  if (!cql_result_set_blob_check_slots(meta, rows, count, heap, header.heap_size)) {
+    return SQLITE_ERROR;
+  }
+
+  // at least one row so that the data is never null
+  char *data = calloc(count ? count : 1, rowsize);
+  if (count) {
+    memcpy(data, rows, count * rowsize);
+  }
+
+  if (meta->refsCount) {
+    char *row = data;
+    for (cql_int32 i = 0; i < count; i++, row += rowsize) {
+      for (cql_int32 col = 0; col < column_count; col++) {
+        uint8_t core_data_type = CQL_CORE_DATA_TYPE_OF(types[col]);
+        if (core_data_type != CQL_DATA_TYPE_STRING && core_data_type != CQL_DATA_TYPE_BLOB) {
+          continue;
+        }
+
+        cql_type_ref *target = (cql_type_ref *)(row + offsets[col + 1]);
+        uintptr_t slot;
+        memcpy(&slot, target, sizeof(slot));
+        *target = NULL;
+
+        if (slot == 0) {
+          continue;
+        }
+
+        bool is_string = core_data_type == CQL_DATA_TYPE_STRING;
+        cql_result_set_blob_heap_entry(heap, header.heap_size, slot, is_string, &entry, &length);
+
+        if (is_string) {
+          *target = (cql_type_ref)cql_string_ref_new_with_length((const char *)entry, length);
+        }
+        else {
+          *target = (cql_type_ref)cql_blob_ref_new(entry, length);
+        }
+      }
+    }
+  }
+
+  *result_set = cql_result_set_create(data, count, cql_result_set_owned_meta(meta));
+  return SQLITE_OK;
+}
+
+// Same as above for a blob made by cql_result_set_to_blob.
+cql_code cql_result_set_from_blob(
+  cql_result_set_meta *_Nonnull meta,
+  cql_blob_ref _Nonnull blob,
+  cql_result_set_ref _Nullable *_Nonnull result_set)
+{
+  return cql_result_set_from_buffer(meta, cql_get_blob_bytes(blob), cql_get_blob_size(blob), result_set);
+}
+
+#ifdef CQL_ATOMIC_REFS
+
+// Readers on several threads might make the same pending cell at once.  Each
+// makes its own reference and the first to swap it into the cell wins; the
+// others release theirs and use the winner's, so the cell changes only once.
+// The acquire half makes the winner's reference visible to the losers and to
+// anyone who loads the cell later.
+#define cql_cell_load(cell) __atomic_load_n(cell, __ATOMIC_ACQUIRE)
+#define cql_cell_publish(cell, pending, ref) \
+  __atomic_compare_exchange_n(cell, pending, ref, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define cql_heap_pending_clear(meta) __atomic_store_n(&(meta)->heapPending, false, __ATOMIC_RELEASE)
+
+#else
+
+#define cql_cell_load(cell) (*(cell))
+#define cql_cell_publish(cell, pending, ref) (*(cell) = (ref), true)
+#define cql_heap_pending_clear(meta) ((meta)->heapPending = false)
+
+#endif
+
+// Makes the reference for one pending string or blob cell from its heap entry,
+// anything else is left as it is.  Every slot was checked when the result set
+// was made so a bad entry here is a contract failure.
+static void cql_result_set_materialize_cell(
+  cql_result_set_meta *_Nonnull meta,
+  uint8_t data_type,
+  cql_type_ref _Nullable *_Nonnull cell)
+{
+  uint8_t core_data_type = CQL_CORE_DATA_TYPE_OF(data_type);
+  if (core_data_type != CQL_DATA_TYPE_STRING && core_data_type != CQL_DATA_TYPE_BLOB) {
+    return;
+  }
+
+  cql_type_ref pending = cql_cell_load(cell);
+  uintptr_t slot = (uintptr_t)pending;
+  if (!(slot & 1)) {
+    // null or already a reference
+    return;
+  }
+
+  bool is_string = core_data_type == CQL_DATA_TYPE_STRING;
+
+  const uint8_t *bytes = (const uint8_t *)"";
+  uint32_t length = 0;
+  bool found = cql_result_set_blob_heap_entry(meta->heap, meta->heapSize, slot, is_string, &bytes, &length);
+  cql_contract(found);
+
+  cql_type_ref ref;
+  if (is_string) {
+    ref = (cql_type_ref)cql_string_ref_new_with_length((const char *)bytes, length);
+  }
+  else {
+    ref = (cql_type_ref)cql_blob_ref_new(bytes, length);
+  }
+
+  if (!cql_cell_publish(cell, &pending, ref)) {
+    // another reader made this cell first, pending now holds its reference
+    cql_release(ref);
+  }
+}
+
+// Makes every pending cell of the result set into a reference.  This happens
+// the first time the rows are used directly (e.g. by a generated getter or to
+// copy or hash rows); the generic getters only make the cells they read.
+void cql_result_set_materialize(cql_result_set_ref _Nonnull result_set) {
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  if (!cql_result_set_heap_pending(result_set)) {
+    return;
+  }
+
+  cql_int32 count = cql_result_set_get_count(result_set);
+  cql_int32 column_count = meta->columnCount;
+  size_t rowsize = meta->rowsize;
+  char *row = (char *)cql_result_set_get_rows(result_set);
+
+  for (cql_int32 i = 0; i < count; i++, row += rowsize) {
+    for (cql_int32 col = 0; col < column_count; col++) {
+      cql_result_set_materialize_cell(meta, meta->dataTypes[col], (cql_type_ref *)(row + meta->columnOffsets[col + 1]));
+    }
+  }
+
+  cql_heap_pending_clear(meta);
+}
+
+#if !defined(TARGET_OS_WIN32) || !TARGET_OS_WIN32
+
+// A mapped result set has its rows and heap in a private mapping of the file,
+// the mapping starts with the header, see cql_result_set_from_file.
+static void cql_result_set_mapped_teardown(cql_result_set_ref _Nonnull result_set) {
+  cql_result_set_meta *meta = cql_result_set_get_meta(result_set);
+  cql_result_set_release_rows(result_set);
+
+  uint8_t *base = (uint8_t *)cql_result_set_get_rows(result_set) - cql_result_set_blob_rows_offset((uint32_t)meta->columnCount);
+  munmap(base, (size_t)(meta->heap - base) + meta->heapSize);
+}
+
+// Opens a file written from cql_result_set_to_blob as a result set without
+// copying it.  The file is mapped privately (copy on write) and the rows are
+// used where they are; string and blob cells stay pending, as heap offsets,
+// until they are read, and then they are made in place.  The header, the column
+// types (against the metadata of a result set of the expected shape), and every
+// string and blob slot are checked here, just like cql_result_set_from_buffer,
+// so a damaged file fails to open rather than failing when a cell is read.
+// Nothing is allocated for the cells until they are used.
+cql_code cql_result_set_from_file(
+  cql_result_set_meta *_Nonnull meta,
+  const char *_Nonnull path,
+  cql_result_set_ref _Nullable *_Nonnull result_set)
+{
+  *result_set = NULL;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return SQLITE_CANTOPEN;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(cql_result_set_blob_header)) {
+    close(fd);
+    return SQLITE_ERROR;
+  }
+
+  size_t size = (size_t)st.st_size;
+  uint8_t *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    return SQLITE_IOERR;
+  }
+
+  cql_result_set_blob_header header;
+  memcpy(&header, base, sizeof(header));
+
+  cql_int32 column_count = meta->columnCount;
+  size_t rowsize = meta->rowsize;
+  size_t rows_offset = cql_result_set_blob_rows_offset(header.column_count);
+
+  // same as cql_result_set_from_buffer except that the heap must end the file
+  if (header.magic != CQL_RESULT_SET_BLOB_MAGIC ||
+      header.version != CQL_RESULT_SET_BLOB_VERSION ||
+      header.column_count != column_count ||
+      header.rowsize != rowsize ||
+      rows_offset > size ||
+      memcmp(base + sizeof(header), meta->dataTypes, column_count) ||
+      header.heap_offset != rows_offset + (uint64_t)header.row_count * rowsize ||
+      (uint64_t)header.heap_offset + header.heap_size != size) {
+    munmap(base, size);
+    return SQLITE_ERROR;
+  }
+
+  if (!cql_result_set_blob_check_slots(meta, base + rows_offset, (cql_int32)header.row_count, base + header.heap_offset, header.heap_size)) {
+    munmap(base, size);
+    return SQLITE_ERROR;
+  }
+
+  cql_result_set_meta mapped_meta = cql_result_set_owned_meta(meta);
+  mapped_meta.teardown = cql_result_set_mapped_teardown;
+  mapped_meta.heap = base + header.heap_offset;
+  mapped_meta.heapSize = header.heap_size;
+  mapped_meta.heapPending = meta->refsCount != 0;
+
+  *result_set = cql_result_set_create(base + rows_offset, (cql_int32)header.row_count, mapped_meta);
+  return SQLITE_OK;
+}
+
+#endif // !TARGET_OS_WIN32
+
+// Generic method to hash a dynamic cursor:
+// Note this code takes advantage of the fact that null valued primitives
+// are normalized to "isnull = 1" and "value = 0" so the whole thing can
+// be hashed with impunity even when it is in the null state.  With not
+// much work this assumption could be removed if needed at a later time.
+cql_int64 cql_cursor_hash(cql_dynamic_cursor *_Nonnull dyn_cursor)
+{
   if (!*dyn_cursor->cursor_has_row) {
     return 0;
   }
@@ -3416,6 +4166,14 @@ error:
   return SQLITE_ERROR;
 }
 
+// Each key owns a run of rows in the shared row arena.  The rows of a run are
+// chained together through the links arena in the order they were added.
+typedef struct cql_partition_run {
+  cql_int32 first; // arena index of the first row of this key
+  cql_int32 last; // arena index of the last row, the next row is linked here
+  cql_int32 count; // number of rows in the run
+} cql_partition_run;
+
 // The outside world does not need to know the details of the partitioning
 // so it's defined locally.
 typedef struct cql_partition {
@@ -3426,8 +4184,52 @@ typedef struct cql_partition {
   cql_dynamic_cursor c_val; // row values must also be all the same
   cql_bool has_row; // the stored dynamic cursors above need a has row field, it's here, always true
   cql_bool did_extract; // true if we have begun extracting (no more adding after that)
+  cql_bytebuf rows; // every value row for every key, in the order they were added
+  cql_bytebuf links; // for each row, the index of the next row with the same key or -1
+  cql_bytebuf runs; // one cql_partition_run per key
+  cql_int32 row_count; // the number of rows in the arena
+  cql_int32 expected_rows; // cardinality hint for the row arena, zero if none
+  cql_int32 extracted_count; // the number of keys whose run is now a result set
 } cql_partition;
 
+// The hash table value for a key is either the index of its run (plus one so that
+// it is never zero, the hash table doesn't release zero values, and shifted so the
+// low bit is clear) or, once extracted, its result set with the low bit set.
+#define CQL_PARTITION_RUN_VAL(index) (((cql_int64)(index) + 1) << 1)
+#define CQL_PARTITION_RUN_INDEX(val) ((cql_int32)((val) >> 1) - 1)
+
+// Grows the buffer so that it can hold at least bytes without reallocating.
+static void cql_partition_presize(cql_bytebuf *_Nonnull b, int32_t bytes) {
+  if (bytes > b->max) {
+    b->max = bytes;
+    b->ptr = realloc(b->ptr, bytes);
+  }
+}
+
+// Gets memory from one of the arenas.  Unlike cql_bytebuf_alloc these always
+// double, past its growth cap a big partition would otherwise copy the whole
+// arena again every 200KB.
+static void *_Nonnull cql_partition_alloc(cql_bytebuf *_Nonnull b, int32_t needed) {
+  if (needed > b->max - b->used) {
+    cql_contract(needed <= INT32_MAX - b->used);
+    int32_t bytes = b->max <= INT32_MAX / 2 ? b->max * 2 : INT32_MAX;
+    if (bytes < b->used + needed) {
+      bytes = b->used + needed;
+    }
+    cql_partition_presize(b, bytes);
+  }
+
+  void *result = b->ptr + b->used;
+  b->used += needed;
+  return result;
+}
+
+// The size of count items of the given size, or 0 if that doesn't fit in an
+// arena.  A hint that big can't be met so it is just ignored.
+static int32_t cql_partition_hint_bytes(cql_int32 count, size_t size) {
+  return count > 0 && (size_t)count <= INT32_MAX / size ? count * (int32_t)size : 0;
+}
+
 // Any remaining keys should release their references and give back their memory.
 // We only have to release if there is at least one reference.
 static void cql_partition_key_release(void *_Nullable context, cql_int64 key) {
@@ -3439,11 +4241,10 @@ static void cql_partition_key_release(void *_Nullable context, cql_int64 key) {
   free((void *)pv);
 }
 
-// We're just going to look at the buffer and release any pointers in any rows
-// before releasing the buffer itself.  We only have to do the release operations
-// if there was at least one reference in the data.  Otherwise closing the buffer
-// releases its internal storage.  The buffer itself doesn't know what it's holding
-// so we have to do the internal releases for it.
+// Rows that were never extracted still hold their references, we walk the run
+// and release them.  The arena memory itself is freed in one go at finalization.
+// Rows that went into a result set belong to that result set now so for those
+// keys we just release the result set.
 static void cql_partition_val_release(void *_Nullable context, cql_int64 val) {
   if (val & 1) {
     // this means there is a pre-allocated result set here, we just release it
@@ -3453,28 +4254,24 @@ static void cql_partition_val_release(void *_Nullable context, cql_int64 val) {
   }
 
   cql_partition *_Nonnull self = context;
-  cql_bytebuf * buffer = (cql_bytebuf *)val;
   int16_t refs_count = self->c_val.cursor_refs_count;
 
   if (refs_count) {
     int16_t refs_offset = self->c_val.cursor_refs_offset;
     size_t rowsize = self->c_val.cursor_size;
-    int32_t count = buffer->used / rowsize;
+    cql_int32 *links = (cql_int32 *)self->links.ptr;
+    cql_partition_run *run = (cql_partition_run *)self->runs.ptr + CQL_PARTITION_RUN_INDEX(val);
 
-    char *row = buffer->ptr;
-    for (cql_int32 i = 0; i < count ; i++, row += rowsize) {
-      cql_release_offsets(row, refs_count, refs_offset);
+    for (cql_int32 i = run->first; i >= 0; i = links[i]) {
+      cql_release_offsets(self->rows.ptr + i * rowsize, refs_count, refs_offset);
     }
   }
-  // releases the internal buffer
-  cql_bytebuf_close(buffer);
-  free(buffer);
 }
 
 // When we're going to tear down the partition we want to release anything left in it.
 // We just change the release functions now so that they actually do something.  The
-// helpers above will free the keys/values including iterating the buffer contents if
-// there are any unused buffers left.
+// helpers above will free the keys and release any rows that were not extracted,
+// after that the arenas can go.
 static void cql_partition_finalize(void *_Nonnull data) {
   // recover self
   cql_partition *_Nonnull self = data;
@@ -3491,6 +4288,10 @@ static void cql_partition_finalize(void *_Nonnull data) {
 
   cql_hashtab_delete(self->ht);
 
+  cql_bytebuf_close(&self->rows);
+  cql_bytebuf_close(&self->links);
+  cql_bytebuf_close(&self->runs);
+
   free(self);
 }
 
@@ -3520,11 +4321,11 @@ static bool cql_key_cursor_eq(void *_Nullable context, cql_int64 key1, cql_int64
 }
 
 // This makes an empty partitioning object, which is basically just a configured
-// hash table.  The hash table is set to use the helpers above.  Normally there
-// is no need to retain/release when rehashing or copying as the hash table is
-// the one and only owner of this particular data.  However, we change the
-// finalization functions at shutdown to allow the hashtable to help us clean
-// up its contents when they are condemned.
+// hash table and the arenas for the rows.  The hash table is set to use the helpers
+// above.  Normally there is no need to retain/release when rehashing or copying as
+// the hash table is the one and only owner of this particular data.  However, we
+// change the finalization functions at shutdown to allow the hashtable to help us
+// clean up its contents when they are condemned.
 cql_object_ref _Nonnull cql_partition_create() {
 
   cql_partition *_Nonnull self = calloc(1, sizeof(cql_partition));
@@ -3544,6 +4345,33 @@ cql_object_ref _Nonnull cql_partition_create() {
       self
     );
 
+  cql_bytebuf_open(&self->rows);
+  cql_bytebuf_open(&self->links);
+  cql_bytebuf_open(&self->runs);
+
+  return obj;
+}
+
+// As above but if the caller knows roughly how many rows and distinct keys are
+// coming everything is sized for that up front.  The row arena can't be sized
+// until we see the first row (that's when we learn the row size) so we just
+// remember the hint for it.
+cql_object_ref _Nonnull cql_partition_create_sized(cql_int32 expected_rows, cql_int32 expected_keys) {
+  cql_object_ref obj = cql_partition_create();
+  cql_partition *_Nonnull self = _cql_generic_object_get_data(obj);
+
+  int32_t links_bytes = cql_partition_hint_bytes(expected_rows, sizeof(cql_int32));
+  if (links_bytes) {
+    self->expected_rows = expected_rows;
+    cql_partition_presize(&self->links, links_bytes);
+  }
+
+  int32_t runs_bytes = cql_partition_hint_bytes(expected_keys, sizeof(cql_partition_run));
+  if (runs_bytes) {
+    cql_partition_presize(&self->runs, runs_bytes);
+    cql_hashtab_reserve(self->ht, expected_keys);
+  }
+
   return obj;
 }
 
@@ -3552,11 +4380,11 @@ cql_object_ref _Nonnull cql_partition_create() {
 // by its key.  Of course the key doesn't have to be in the row but that's the normal
 // pattern.  That is, normally key and val are looking at the same data with key
 // being a subset of the columns of val. We are going to hash the key and then
-// append the val to a buffer associated with that key.  We make the buffers on
-// demand so, there are never really any empty buffers except for a brief instant.
-// Any missing keys will have no data.  We use the cursor hashing and equality helpers
-// to do the hash table work.  We use the usual retain/release helpers for cursors
-// to ensure that the right number of retain/release calls happen on each key/value.
+// append the val to the row arena, linking it to the end of that key's run.  Runs are
+// made on demand so, there are never really any empty runs. Any missing keys will
+// have no data.  We use the cursor hashing and equality helpers to do the hash table
+// work.  We use the usual retain/release helpers for cursors to ensure that the right
+// number of retain/release calls happen on each key/value.
 cql_bool cql_partition_cursor(
   cql_object_ref _Nonnull obj,
   cql_dynamic_cursor *_Nonnull key,
@@ -3588,6 +4416,12 @@ cql_bool cql_partition_cursor(
     self->c_key.cursor_has_row = &self->has_row;
     self->c_key2.cursor_has_row = &self->has_row;
     self->c_val.cursor_has_row = &self->has_row;
+
+    // now that we know the row size the row arena can use the hint
+    int32_t rows_bytes = cql_partition_hint_bytes(self->expected_rows, val->cursor_size);
+    if (rows_bytes) {
+      cql_partition_presize(&self->rows, rows_bytes);
+    }
   }
 
   if (!*key->cursor_has_row || !*val->cursor_has_row) {
@@ -3597,29 +4431,37 @@ cql_bool cql_partition_cursor(
   // we want to avoid storing the whole dynamic cursor since they are all the same
   // so we hash on the data and we use the context to get the cursor back
   cql_hashtab_entry *entry = cql_hashtab_find(self->ht, (cql_int64)key->cursor_data);
-  cql_bytebuf *buf = NULL;
+  cql_int32 row_index = self->row_count++;
+  cql_partition_run *run = NULL;
 
   if (entry) {
-    // we already have a buffer, we can append
-    buf = (cql_bytebuf *)entry->val;
+    // we already have a run, link the new row to the end of it
+    run = (cql_partition_run *)self->runs.ptr + CQL_PARTITION_RUN_INDEX(entry->val);
+    ((cql_int32 *)self->links.ptr)[run->last] = row_index;
   }
   else {
-    // create buffer and add to hash table
-    buf = malloc(sizeof(*buf));
-    cql_bytebuf_open(buf);
+    // start a new run and add it to the hash table
+    cql_int32 run_index = (cql_int32)(self->runs.used / sizeof(cql_partition_run));
+    run = cql_partition_alloc(&self->runs, sizeof(cql_partition_run));
+    run->first = row_index;
+    run->count = 0;
 
     char *k = malloc(key->cursor_size);
     memcpy(k, key->cursor_data, key->cursor_size);
     cql_retain_offsets(k, key->cursor_refs_count, key->cursor_refs_offset);
 
-    cql_bool added = cql_hashtab_add(self->ht, (cql_int64)k, (cql_int64)buf);
+    cql_bool added = cql_hashtab_add(self->ht, (cql_int64)k, CQL_PARTITION_RUN_VAL(run_index));
     cql_invariant(added);
   }
 
-  cql_invariant(buf);
+  run->last = row_index;
+  run->count++;
 
-  // append this value to the growable buffer
-  char *new_data = cql_bytebuf_alloc(buf, (int)val->cursor_size);
+  cql_int32 *link = cql_partition_alloc(&self->links, sizeof(cql_int32));
+  *link = -1;
+
+  // append this value to the row arena
+  char *new_data = cql_partition_alloc(&self->rows, (int32_t)val->cursor_size);
   memcpy(new_data, val->cursor_data, val->cursor_size);
   cql_retain_offsets(new_data, val->cursor_refs_count, val->cursor_refs_offset);
 
@@ -3627,10 +4469,15 @@ cql_bool cql_partition_cursor(
 }
 
 // Here we have created partitions previously and we're going to look them up.
-// The idea is that if rows for a particular key combo exists then
-// we make a result set out of that bunch of rows. If not, we return an
+// The idea is that if rows for a particular key combo exists then we gather that
+// key's run out of the arena into a result set in one pass. If not, we return an
 // empty result set (0 rows).  To save space we only create one empty result
 // set for all cases in any given partition because all empty results are the same.
+//
+// Each extracted run is copied out of the arena so until every key has been
+// extracted the extracted rows are held twice, once in the arena and once in
+// their result set.  When the last key is extracted all the rows belong to
+// result sets and the arenas are freed right away rather than at finalization.
 cql_object_ref _Nonnull cql_extract_partition(
   cql_object_ref _Nonnull obj,
   cql_dynamic_cursor *_Nonnull key)
@@ -3646,7 +4493,6 @@ cql_object_ref _Nonnull cql_extract_partition(
     cql_contract(self->c_val.cursor_size);
 
     cql_hashtab_entry *entry = cql_hashtab_find(self->ht, (cql_int64)key->cursor_data);
-    cql_bytebuf *buf = NULL;
 
     if (entry) {
       // If we've already computed the value then re-use what we returned before.
@@ -3660,19 +4506,29 @@ cql_object_ref _Nonnull cql_extract_partition(
       }
 
       // we have data for this key
-      buf = (cql_bytebuf *)entry->val;
+      cql_partition_run *run = (cql_partition_run *)self->runs.ptr + CQL_PARTITION_RUN_INDEX(entry->val);
+
+      // We always make a run with at least one row, if this is zero something very bad has happened.
+      cql_invariant(run->count > 0);
 
-      // We always load a valid buffer, if this is zero something very bad has happened.
-      cql_invariant(buf);
+      size_t rowsize = self->c_val.cursor_size;
+      cql_int32 *links = (cql_int32 *)self->links.ptr;
 
-      cql_int32 count = (cql_int32)(buf->used / self->c_val.cursor_size);
+      // Gather the run into the result set's storage.  This is a plain copy, the
+      // references move with the rows; the arena copies are not released again
+      // because the hash table will no longer point at this run.
+      char *data = malloc(run->count * rowsize);
+      char *row = data;
+      for (cql_int32 i = run->first; i >= 0; i = links[i], row += rowsize) {
+        memcpy(row, self->rows.ptr + i * rowsize, rowsize);
+      }
 
       cql_fetch_info info = {
         .data_types = self->c_val.cursor_data_types,
         .col_offsets = self->c_val.cursor_col_offsets,
         .refs_count = self->c_val.cursor_refs_count,
         .refs_offset = self->c_val.cursor_refs_offset,
-        .rowsize = (int32_t)self->c_val.cursor_size,
+        .rowsize = (int32_t)rowsize,
         .encode_context_index = -1,
       };
 
@@ -3680,18 +4536,18 @@ cql_object_ref _Nonnull cql_extract_partition(
       cql_result_set_meta meta;
       cql_initialize_meta(&meta, &info);
 
-      void *data = buf->ptr;
-
-      // the bytebuf has been harvested, we can free it now.  We do not "close" it
-      // because the result set is taking over the growable buffer, we don't want
-      // the buffer to be freed.
-      free(buf);
-
       // retain our copy in case we need it again
-      cql_object_ref result = (cql_object_ref)cql_result_set_create(data, count, meta);
+      cql_object_ref result = (cql_object_ref)cql_result_set_create(data, run->count, meta);
       cql_object_retain(result);
 
-      entry->val = 1|(cql_int64)result; // store the result but set the LSB so we know it's not a buffer
+      entry->val = 1|(cql_int64)result; // store the result but set the LSB so we know it's not a run
+
+      // if that was the last run nothing refers to the arenas anymore
+      if (++self->extracted_count == (cql_int32)(self->runs.used / sizeof(cql_partition_run))) {
+        cql_bytebuf_close(&self->rows);
+        cql_bytebuf_close(&self->links);
+        cql_bytebuf_close(&self->runs);
+      }
       return result;
     }
   }
@@ -3730,7 +4586,9 @@ cql_bool _cql_contains_column_def(cql_string_ref _Nullable haystack_, cql_string
 
   cql_bool found = false;
 
-  if (!needle[0] || !haystack[0]) {
+  // the needle can't match at offset zero so it has to be shorter than the haystack
+  size_t needle_len = cql_get_cstr_length(needle, needle_);
+  if (!needle_len || needle_len >= cql_get_cstr_length(haystack, haystack_)) {
     goto cleanup;
   }
 
@@ -4080,7 +4938,7 @@ static cql_object_ref _Nonnull _cql_create_upgrader_input_statement_list(cql_str
 {
   cql_object_ref list = cql_string_list_create();
   cql_alloc_cstr(c_str, str);
-  if (strlen(c_str) == 0) goto cleanup;
+  if (cql_get_cstr_length(c_str, str) == 0) goto cleanup;
   char* lineStart = (char*)(c_str);
   // skip leading whitespace
   while (lineStart[0] == ' '){
@@ -4139,11 +4997,20 @@ cleanup:
   return list;
 }
 
+// Make a string out of the len bytes starting at text, which are not null terminated.
+static cql_string_ref _Nonnull _cql_string_ref_from_range(const char *_Nonnull text, cql_int32 len)
+{
+  STACK_BYTES_ALLOC(temp, len + 1);
+  memcpy(temp, text, len);
+  temp[len] = '\0';
+  return cql_string_ref_new(temp);
+}
+
 // This function assumes the input follows CQL railroad syntax and contains
 // characters uptil atleast the first "(" if it exists
-static char* _Nonnull _cql_create_table_name_from_table_creation_statement(cql_string_ref _Nonnull create)
+static cql_string_ref _Nonnull _cql_create_table_name_from_table_creation_statement(cql_string_ref _Nonnull create)
 {
-  char* p;
+  const char *p;
   // https://cgsql.dev/program-diagram#create_virtual_table_stmt
   // table name always preceeds "USING "
   cql_alloc_cstr(c_create, create);
@@ -4151,105 +5018,715 @@ static char* _Nonnull _cql_create_table_name_from_table_creation_statement(cql_s
   // https://cgsql.dev/program-diagram#create_table_stmt
   // table name always preceeds the first open paren
   else p = strchr(c_create, '(');
-  cql_free_cstr(c_create, create);
   // backspace spaces (if they exist) between table name preceeding pattern. We don't
   // want extra spaces in our table names.
   while (p[-1] == ' ') p--;
-  char* lineStart = p;
+  const char *lineStart = p;
   // find space preceeding table name
   while (lineStart[-1] != ' '){
     lineStart--;
   }
-  cql_int32 bytes = (cql_int32)(p - lineStart);
-  char* table_name = malloc(bytes + 1);
-  memcpy(table_name, lineStart, bytes);
-  table_name[bytes] = '\0';
+  cql_string_ref table_name = _cql_string_ref_from_range(lineStart, (cql_int32)(p - lineStart));
+  cql_free_cstr(c_create, create);
   return table_name;
 }
 
 // This function is passed in an index creation statement generated from the CQL upgrader.
-// We need this helper to be able to map indices to tables.
-static char* _Nonnull _cql_create_table_name_from_index_creation_statement(cql_string_ref _Nonnull index_create)
+// We need this helper to be able to map indices to tables.  The result is NULL if the
+// statement doesn't look like an index creation at all.
+static cql_string_ref _Nullable _cql_create_table_name_from_index_creation_statement(cql_string_ref _Nonnull index_create)
 {
-  // table name follows "ON " in the create_index_stmt pattern
+  // table name follows " ON " in the create_index_stmt pattern
   // table name is followed by an open paren
   // https://cgsql.dev/program-diagram#create_index_stmt
   cql_alloc_cstr(c_index_create, index_create);
-  char* lineStart = strstr(c_index_create, "ON ") + strlen("ON ");
-  cql_free_cstr(c_index_create, index_create);
-  char* q = strchr(lineStart, '('); // add space logic
+  const char *lineStart = strstr(c_index_create, " ON ");
+  const char *q = lineStart ? strchr(lineStart + strlen(" ON "), '(') : NULL;
+  if (!q) {
+    cql_free_cstr(c_index_create, index_create);
+    return NULL;
+  }
+  lineStart += strlen(" ON ");
   // backspace spaces between index name and (
-  while (q[-1] == ' '){
+  while (q > lineStart && q[-1] == ' '){
     q--;
   }
-  cql_int32 index_bytes = (cql_int32)(q - lineStart);
-  char* index_table_name = malloc(index_bytes + 1);
-  memcpy(index_table_name, lineStart, index_bytes);
-  index_table_name[index_bytes] = '\0';
+  cql_string_ref index_table_name = _cql_string_ref_from_range(lineStart, (cql_int32)(q - lineStart));
+  cql_free_cstr(c_index_create, index_create);
   return index_table_name;
 }
 
-// This function provides the naive implementation of cql_rebuild_recreate_group called in
+static void _cql_append_text(cql_bytebuf *_Nonnull batch, const char *_Nonnull text)
+{
+  cql_bytebuf_append(batch, text, (int32_t)strlen(text));
+}
+
+// Add one statement to a DDL batch, the statements from the upgrader may or may not
+// have their own trailing semicolon; an extra one is just an empty statement.
+static void _cql_append_statement(cql_bytebuf *_Nonnull batch, cql_string_ref _Nonnull statement)
+{
+  cql_alloc_cstr(c_statement, statement);
+  cql_bytebuf_append(batch, c_statement, (int32_t)cql_get_cstr_length(c_statement, statement));
+  cql_bytebuf_append(batch, ";\n", 2);
+  cql_free_cstr(c_statement, statement);
+}
+
+// Run the accumulated batch (if any) as one sqlite3_exec and reset it for the next step.
+static cql_code _cql_exec_batch(sqlite3 *_Nonnull db, cql_bytebuf *_Nonnull batch)
+{
+  cql_code rc = SQLITE_OK;
+  if (batch->used) {
+    cql_bytebuf_append_null(batch);
+    rc = cql_exec(db, batch->ptr);
+    batch->used = 0;
+  }
+  return rc;
+}
+
+// Add the creates for all the indices on table t (see the chains below).
+static void _cql_append_index_creates(
+  cql_bytebuf *_Nonnull batch,
+  cql_object_ref _Nonnull indexList,
+  cql_int32 *_Nonnull first_index,
+  cql_int32 *_Nonnull next_index,
+  cql_int32 t)
+{
+  for (cql_int32 j = first_index[t]; j >= 0; j = next_index[j]) {
+    _cql_append_statement(batch, cql_string_list_get_string(indexList, j));
+  }
+}
+
+// Run a query that produces one value (or none) and return it as an integer.
+static cql_code _cql_query_int(sqlite3 *_Nonnull db, const char *_Nonnull sql, cql_int64 *_Nonnull result)
+{
+  sqlite3_stmt *stmt = NULL;
+  *result = 0;
+  cql_code rc = cql_sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+      *result = sqlite3_column_int64(stmt, 0);
+    }
+    rc = rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
+  }
+  cql_sqlite3_finalize(stmt);
+  return rc;
+}
+
+// Data can only be carried over into ordinary tables with plain names; they are
+// the only ones we can safely build under a different name and swap in.
+static cql_bool _cql_can_preserve_table(cql_string_ref _Nonnull create, cql_string_ref _Nonnull name)
+{
+  cql_bool ok = true;
+  cql_alloc_cstr(c_create, create);
+  if (!strncmp("CREATE VIRTUAL TABLE ", c_create, sizeof("CREATE VIRTUAL TABLE ") - 1)) {
+    ok = false;
+  }
+  cql_free_cstr(c_create, create);
+
+  cql_alloc_cstr(c_name, name);
+  for (const char *p = c_name; ok && *p; p++) {
+    ok = (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_';
+  }
+  cql_free_cstr(c_name, name);
+  return ok;
+}
+
+// Add SQL made by sqlite3_mprintf to a DDL batch and free it.
+static void _cql_append_sql(cql_bytebuf *_Nonnull batch, char *_Nonnull sql)
+{
+  _cql_append_text(batch, sql);
+  sqlite3_free(sql);
+}
+
+// Run a query made by sqlite3_mprintf that produces one integer, then free it.
+static cql_code _cql_query_int_sql(sqlite3 *_Nonnull db, char *_Nonnull sql, cql_int64 *_Nonnull result)
+{
+  cql_code rc = _cql_query_int(db, sql, result);
+  sqlite3_free(sql);
+  return rc;
+}
+
+// As above but *is_null tells a NULL (or no row at all) apart from a real value.
+static cql_code _cql_query_nullable_int_sql(
+  sqlite3 *_Nonnull db,
+  char *_Nonnull sql,
+  cql_int64 *_Nonnull result,
+  cql_bool *_Nonnull is_null)
+{
+  sqlite3_stmt *stmt = NULL;
+  *result = 0;
+  *is_null = true;
+  cql_code rc = cql_sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  sqlite3_free(sql);
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+      *result = sqlite3_column_int64(stmt, 0);
+      *is_null = false;
+    }
+    rc = rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
+  }
+  cql_sqlite3_finalize(stmt);
+  return rc;
+}
+
+// Run one statement made by sqlite3_mprintf and free it.
+static cql_code _cql_exec_sql(sqlite3 *_Nonnull db, char *_Nonnull sql)
+{
+  cql_code rc = cql_exec(db, sql);
+  sqlite3_free(sql);
+  return rc;
+}
+
+// The names of the tables in a list of creates, in the same order.
+static cql_object_ref _Nonnull _cql_rebuild_table_names(cql_object_ref _Nonnull tableList)
+{
+  cql_object_ref table_names = cql_string_list_create();
+  for (cql_int32 i = 0; i < cql_string_list_get_count(tableList); i++) {
+    cql_string_ref table_name = _cql_create_table_name_from_table_creation_statement(cql_string_list_get_string(tableList, i));
+    cql_string_list_add_string(table_names, table_name);
+    cql_string_release(table_name);
+  }
+  return table_names;
+}
+
+// Data can only be kept if every table of the group can be built under another name
+// (see _cql_can_preserve_table).  With foreign keys enforced, dropping the old tables
+// would fire foreign key actions against rows we are trying to keep, so in that case
+// we only proceed if nothing refers to the tables of the group at all.
+static cql_code _cql_rebuild_check_preservable(
+  sqlite3 *_Nonnull db,
+  cql_object_ref _Nonnull tableList,
+  cql_object_ref _Nonnull table_names)
+{
+  cql_int32 table_count = cql_string_list_get_count(tableList);
+  cql_int64 value;
+
+  for (cql_int32 i = 0; i < table_count; i++) {
+    if (!_cql_can_preserve_table(cql_string_list_get_string(tableList, i), cql_string_list_get_string(table_names, i))) {
+      return SQLITE_ERROR;
+    }
+  }
+
+  cql_code rc = _cql_query_int(db, "PRAGMA foreign_keys", &value);
+  if (rc != SQLITE_OK || !value) return rc;
+
+  for (cql_int32 i = 0; i < table_count; i++) {
+    cql_alloc_cstr(c_name, cql_string_list_get_string(table_names, i));
+    char *sql = sqlite3_mprintf(
+      "SELECT count(*) FROM sqlite_master M, pragma_foreign_key_list(M.name) F "
+      "WHERE M.type = 'table' AND F.\"table\" = '%q' COLLATE NOCASE", c_name);
+    cql_free_cstr(c_name, cql_string_list_get_string(table_names, i));
+    rc = _cql_query_int_sql(db, sql, &value);
+    if (rc == SQLITE_OK && value) rc = SQLITE_CONSTRAINT;
+    if (rc != SQLITE_OK) return rc;
+  }
+  return SQLITE_OK;
+}
+
+static cql_code _cql_rebuild_table_exists(sqlite3 *_Nonnull db, const char *_Nonnull c_name, cql_bool *_Nonnull exists)
+{
+  cql_int64 value;
+  cql_code rc = _cql_query_int_sql(db, sqlite3_mprintf(
+    "SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = '%q' COLLATE NOCASE", c_name), &value);
+  *exists = value != 0;
+  return rc;
+}
+
+// The name to use for the rowid of a table.  A column can take the name rowid (or one of
+// its aliases) and hide the real one, so we use the first alias that is not taken.  NULL
+// if there is no usable rowid at all (e.g. WITHOUT ROWID), such a table can't be copied
+// in batches.
+static const char *_Nullable _cql_rebuild_rowid_name(sqlite3 *_Nonnull db, const char *_Nonnull c_name)
+{
+  static const char *const aliases[] = { "rowid", "_rowid_", "oid" };
+  for (size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+    cql_int64 taken;
+    cql_code rc = _cql_query_int_sql(db, sqlite3_mprintf(
+      "SELECT count(*) FROM pragma_table_xinfo('%q') WHERE name = '%s' COLLATE NOCASE", c_name, aliases[i]), &taken);
+    if (rc != SQLITE_OK) return NULL;
+    if (taken) continue;
+
+    sqlite3_stmt *stmt = NULL;
+    char *sql = sqlite3_mprintf("SELECT %s FROM \"%w\"", aliases[i], c_name);
+    rc = cql_sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    sqlite3_free(sql);
+    cql_sqlite3_finalize(stmt);
+    return rc == SQLITE_OK ? aliases[i] : NULL;
+  }
+  return NULL;
+}
+
+// Forget the copy in progress (if any) for one table: its staging table, the triggers
+// that guard it, and its progress facet.
+static cql_code _cql_rebuild_discard_copy(sqlite3 *_Nonnull db, const char *_Nonnull facets, const char *_Nonnull c_name)
+{
+  return _cql_exec_sql(db, sqlite3_mprintf(
+    "DROP TABLE IF EXISTS \"cql_rebuild_new_%w\";\n"
+    "DROP TRIGGER IF EXISTS \"cql_rebuild_%w_insert\";\n"
+    "DROP TRIGGER IF EXISTS \"cql_rebuild_%w_update\";\n"
+    "DROP TRIGGER IF EXISTS \"cql_rebuild_%w_delete\";\n"
+    "DELETE FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q';\n",
+    c_name, c_name, c_name, c_name, facets, c_name));
+}
+
+static cql_code _cql_rebuild_discard_copies(sqlite3 *_Nonnull db, const char *_Nonnull facets, cql_object_ref _Nonnull table_names)
+{
+  cql_code rc = SQLITE_OK;
+  for (cql_int32 i = 0; rc == SQLITE_OK && i < cql_string_list_get_count(table_names); i++) {
+    cql_alloc_cstr(c_name, cql_string_list_get_string(table_names, i));
+    rc = _cql_rebuild_discard_copy(db, facets, c_name);
+    cql_free_cstr(c_name, cql_string_list_get_string(table_names, i));
+  }
+  return rc;
+}
+
+// Copy the surviving columns of a table into its staging table "cql_rebuild_new_<name>",
+// which has the new shape.  The rows are copied in rowid order in batches of at most
+// CQL_REBUILD_COPY_BATCH_ROWS rows and after each batch the last rowid copied is recorded
+// in the facet 'cql_rebuild_copy_<name>' of the facets table.  A later call, perhaps in
+// a later run of the upgrader, resumes after that rowid if the staging table is still
+// there with the expected shape and the triggers are still in place; otherwise the copy
+// starts over.  The triggers delete the facet if a row that was already copied changes,
+// so such writes can't be lost.  At most max_batches batches are copied (0 means copy
+// everything, then no triggers are needed), *pending is set if there are rows left.
+static cql_code _cql_rebuild_copy_table(
+  sqlite3 *_Nonnull db,
+  const char *_Nonnull facets,
+  cql_string_ref _Nonnull create,
+  cql_string_ref _Nonnull name,
+  cql_int32 max_batches,
+  cql_bool *_Nonnull pending)
+{
+  cql_code rc = SQLITE_OK;
+  cql_int64 value = 0;
+  cql_bool is_null;
+  char *columns = NULL;
+
+  *pending = false;
+
+  cql_alloc_cstr(c_name, name);
+  cql_alloc_cstr(c_create, create);
+
+  // this is exactly the text sqlite_master will hold for the staging table
+  const char *shape = strchr(c_create, '(');
+  int len = (int)strlen(shape);
+  while (len > 0 && (shape[len - 1] == ' ' || shape[len - 1] == '\n' || shape[len - 1] == ';')) len--;
+  char *staging = sqlite3_mprintf("CREATE TABLE \"cql_rebuild_new_%w\"%.*s", c_name, len, shape);
+
+  const char *rowid = _cql_rebuild_rowid_name(db, c_name);
+  if (!rowid && max_batches) {
+    // no batches for this one, the final rebuild copies it in one go
+    goto cleanup;
+  }
+
+  cql_bool resume = false;
+  if (rowid) {
+    rc = _cql_query_int_sql(db, sqlite3_mprintf(
+      "SELECT (SELECT count(*) FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q') + "
+      "(SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = 'cql_rebuild_new_%q' AND sql = '%q') + "
+      "(SELECT count(*) FROM sqlite_master WHERE type = 'trigger' AND name IN "
+      "('cql_rebuild_%q_insert', 'cql_rebuild_%q_update', 'cql_rebuild_%q_delete'))",
+      facets, c_name, c_name, staging, c_name, c_name, c_name), &value);
+    if (rc != SQLITE_OK) goto cleanup;
+    resume = value == 5;
+  }
+
+  cql_int64 lower = INT64_MIN;
+
+  if (resume) {
+    rc = _cql_query_int_sql(db, sqlite3_mprintf(
+      "SELECT version FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q'", facets, c_name), &value);
+    if (rc != SQLITE_OK || value == INT64_MAX) goto cleanup;
+    lower = value + 1;
+  }
+  else {
+    rc = _cql_rebuild_discard_copy(db, facets, c_name);
+    if (rc != SQLITE_OK) goto cleanup;
+    rc = cql_exec(db, staging);
+    if (rc != SQLITE_OK) goto cleanup;
+
+    if (max_batches) {
+      rc = _cql_exec_sql(db, sqlite3_mprintf(
+        "CREATE TRIGGER \"cql_rebuild_%w_insert\" AFTER INSERT ON \"%w\" "
+        "WHEN new.%s <= (SELECT version FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q') "
+        "BEGIN DELETE FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q'; END;\n"
+        "CREATE TRIGGER \"cql_rebuild_%w_update\" AFTER UPDATE ON \"%w\" "
+        "WHEN old.%s <= (SELECT version FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q') "
+        "OR new.%s <= (SELECT version FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q') "
+        "BEGIN DELETE FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q'; END;\n"
+        "CREATE TRIGGER \"cql_rebuild_%w_delete\" AFTER DELETE ON \"%w\" "
+        "WHEN old.%s <= (SELECT version FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q') "
+        "BEGIN DELETE FROM \"%w\" WHERE facet = 'cql_rebuild_copy_%q'; END;\n",
+        c_name, c_name, rowid, facets, c_name, facets, c_name,
+        c_name, c_name, rowid, facets, c_name, rowid, facets, c_name, facets, c_name,
+        c_name, c_name, rowid, facets, c_name, facets, c_name));
+      if (rc != SQLITE_OK) goto cleanup;
+    }
+  }
+
+  // the columns the new and old shape have in common, generated columns can't be copied
+  sqlite3_stmt *stmt = NULL;
+  char *sql = sqlite3_mprintf(
+    "SELECT group_concat(printf('\"%%w\"', N.name), ', ') "
+    "FROM pragma_table_xinfo('cql_rebuild_new_%q') N JOIN pragma_table_xinfo('%q') O ON N.name = O.name COLLATE NOCASE "
+    "WHERE N.hidden = 0 AND O.hidden = 0", c_name, c_name);
+  rc = cql_sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  sqlite3_free(sql);
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_step(stmt) == SQLITE_ROW ? SQLITE_OK : sqlite3_errcode(db);
+  }
+  if (rc == SQLITE_OK && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+    columns = sqlite3_mprintf("%s", (const char *)sqlite3_column_text(stmt, 0));
+  }
+  cql_sqlite3_finalize(stmt);
+  if (rc != SQLITE_OK || !columns) goto cleanup;
+
+  if (!rowid) {
+    rc = _cql_exec_sql(db, sqlite3_mprintf(
+      "INSERT INTO \"cql_rebuild_new_%w\"(%s) SELECT %s FROM \"%w\"", c_name, columns, columns, c_name));
+    goto cleanup;
+  }
+
+  for (cql_int32 batches = 0; ; batches++) {
+    if (max_batches && batches == max_batches) {
+      *pending = true;
+      break;
+    }
+
+    cql_int64 upper;
+    rc = _cql_query_nullable_int_sql(db, sqlite3_mprintf(
+      "SELECT max(r) FROM (SELECT %s AS r FROM \"%w\" WHERE %s >= %lld ORDER BY %s LIMIT %d)",
+      rowid, c_name, rowid, (long long)lower, rowid, CQL_REBUILD_COPY_BATCH_ROWS), &upper, &is_null);
+    if (rc != SQLITE_OK || is_null) break;
+
+    rc = _cql_exec_sql(db, sqlite3_mprintf(
+      "INSERT INTO \"cql_rebuild_new_%w\"(%s) SELECT %s FROM \"%w\" WHERE %s BETWEEN %lld AND %lld;\n"
+      "INSERT OR REPLACE INTO \"%w\"(facet, version) VALUES('cql_rebuild_copy_%q', %lld);\n",
+      c_name, columns, columns, c_name, rowid, (long long)lower, (long long)upper,
+      facets, c_name, (long long)upper));
+    if (rc != SQLITE_OK || upper == INT64_MAX) break;
+    lower = upper + 1;
+  }
+
+cleanup:
+  sqlite3_free(columns);
+  sqlite3_free(staging);
+  cql_free_cstr(c_create, create);
+  cql_free_cstr(c_name, name);
+  return rc;
+}
+
+// Rebuild the tables of a group keeping the data in any columns that survive.  Each
+// table that already exists is built under a temporary name and its surviving columns
+// are copied into it (see above, this finishes any copy that earlier upgrade steps
+// began).  Then the old tables are dropped (in drop order) and the new ones are renamed
+// into place (in create order) along with their indices.  New tables are simply created.
+// Any failure (e.g. a new NOT NULL column with no default, or a new constraint the old
+// data violates) is reported and the caller falls back to the plain recreate.  All the
+// SQL is made with sqlite3_mprintf, names are quoted.
+static cql_code _cql_rebuild_tables_preserving_data(
+  sqlite3 *_Nonnull db,
+  const char *_Nonnull facets,
+  cql_object_ref _Nonnull tableList,
+  cql_object_ref _Nonnull table_names,
+  cql_object_ref _Nonnull indexList,
+  cql_int32 *_Nonnull first_index,
+  cql_int32 *_Nonnull next_index,
+  cql_bytebuf *_Nonnull batch)
+{
+  cql_int32 table_count = cql_string_list_get_count(tableList);
+  cql_bool *preserved = calloc(table_count + 1, sizeof(cql_bool));
+  cql_int64 legacy_alter_table = 0;
+  cql_bool pending;
+
+  cql_code rc = _cql_rebuild_check_preservable(db, tableList, table_names);
+  if (rc != SQLITE_OK) goto cleanup;
+
+  // build the new tables beside the old ones and copy the surviving columns
+  for (cql_int32 i = 0; i < table_count; i++) {
+    cql_string_ref name = cql_string_list_get_string(table_names, i);
+    cql_alloc_cstr(c_name, name);
+    rc = _cql_rebuild_table_exists(db, c_name, &preserved[i]);
+    cql_free_cstr(c_name, name);
+    if (rc != SQLITE_OK) goto cleanup;
+
+    // if there is nothing to keep the table will be created normally
+    if (preserved[i]) {
+      rc = _cql_rebuild_copy_table(db, facets, cql_string_list_get_string(tableList, i), name, 0, &pending);
+      if (rc != SQLITE_OK) goto cleanup;
+    }
+  }
+
+  // drop the old tables, most dependent first
+  for (cql_int32 i = table_count - 1; i >= 0; i--) {
+    cql_alloc_cstr(c_name, cql_string_list_get_string(table_names, i));
+    _cql_append_sql(batch, sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\";\n", c_name));
+    cql_free_cstr(c_name, cql_string_list_get_string(table_names, i));
+  }
+  rc = _cql_exec_batch(db, batch);
+  if (rc != SQLITE_OK) goto cleanup;
+
+  // Rename the new tables into place.  In legacy mode the rename doesn't try to fix up
+  // (and therefore validate) views and triggers that mention the tables we just dropped.
+  rc = _cql_query_int(db, "PRAGMA legacy_alter_table", &legacy_alter_table);
+  if (rc != SQLITE_OK) goto cleanup;
+  rc = cql_exec(db, "PRAGMA legacy_alter_table = ON");
+  if (rc != SQLITE_OK) goto cleanup;
+
+  for (cql_int32 i = 0; i < table_count; i++) {
+    if (preserved[i]) {
+      cql_alloc_cstr(c_name, cql_string_list_get_string(table_names, i));
+      _cql_append_sql(batch, sqlite3_mprintf("ALTER TABLE \"cql_rebuild_new_%w\" RENAME TO \"%w\";\n", c_name, c_name));
+      cql_free_cstr(c_name, cql_string_list_get_string(table_names, i));
+    }
+    else {
+      _cql_append_statement(batch, cql_string_list_get_string(tableList, i));
+    }
+    _cql_append_index_creates(batch, indexList, first_index, next_index, i);
+  }
+  rc = _cql_exec_batch(db, batch);
+
+  if (!legacy_alter_table) {
+    cql_code rc2 = cql_exec(db, "PRAGMA legacy_alter_table = OFF");
+    if (rc == SQLITE_OK) rc = rc2;
+  }
+
+  // the copies are done, their progress facets go
+  if (rc == SQLITE_OK) {
+    rc = _cql_rebuild_discard_copies(db, facets, table_names);
+  }
+
+cleanup:
+  batch->used = 0;
+  free(preserved);
+  return rc;
+}
+
+// The incremental upgrader calls this in a step of its own, before the step that
+// recreates the groups, until nothing is pending.  Each call copies at most one batch
+// of each table of the group into its staging table and commits with the step, so
+// a big table is copied over several steps (and if need be several runs) instead of
+// in the one transaction that swaps the tables.  A group whose data can't be kept is
+// left alone, the recreate will fall back for it as usual.
+cql_code cql_rebuild_copy_group_data(
+  sqlite3 *_Nonnull db,
+  cql_string_ref _Nonnull tables,
+  cql_string_ref _Nonnull facets,
+  cql_bool *_Nonnull pending)
+{
+  *pending = false;
+
+  cql_object_ref tableList = _cql_create_upgrader_input_statement_list(tables, "CREATE ");
+  cql_object_ref table_names = _cql_rebuild_table_names(tableList);
+  cql_alloc_cstr(c_facets, facets);
+
+  cql_code rc = cql_exec(db, "SAVEPOINT cql_rebuild_copy_group_data");
+  if (rc != SQLITE_OK) goto cleanup;
+
+  rc = _cql_rebuild_check_preservable(db, tableList, table_names);
+
+  for (cql_int32 i = 0; rc == SQLITE_OK && i < cql_string_list_get_count(tableList); i++) {
+    cql_string_ref name = cql_string_list_get_string(table_names, i);
+    cql_bool exists;
+    cql_bool table_pending = false;
+    cql_alloc_cstr(c_name, name);
+    rc = _cql_rebuild_table_exists(db, c_name, &exists);
+    cql_free_cstr(c_name, name);
+    if (rc == SQLITE_OK && exists) {
+      rc = _cql_rebuild_copy_table(db, c_facets, cql_string_list_get_string(tableList, i), name, 1, &table_pending);
+      *pending = *pending || table_pending;
+    }
+  }
+
+  if (rc != SQLITE_OK) {
+    // nothing is copied ahead of time for this group
+    *pending = false;
+    (void)cql_exec(db, "ROLLBACK TO cql_rebuild_copy_group_data");
+    rc = _cql_rebuild_discard_copies(db, c_facets, table_names);
+  }
+
+  cql_code rc2 = cql_exec(db, "RELEASE cql_rebuild_copy_group_data");
+  if (rc == SQLITE_OK) rc = rc2;
+
+cleanup:
+  cql_free_cstr(c_facets, facets);
+  cql_object_release(table_names);
+  cql_object_release(tableList);
+  return rc;
+}
+
+// This function provides the implementation of cql_rebuild_recreate_group called in
 // the cg_schema CQL upgrader. We take input three recreate-group specific strings.
 // tables: series of semi-colon seperated CREATE (VIRTUAL) TABLE statements
 // indices: series of semi-colon seperated CREATE INDEX statements
 // deletes: series of semi-colon seperated DROP TABLE statements (ex: unsubscribed or deleted tables)
 //
-// We currently always do recreate here (no rebuild). We just drop our tables, and recreate the
-// tables and any indices that might have been dropped.
-cql_code cql_rebuild_recreate_group(sqlite3 *_Nonnull db, cql_string_ref _Nonnull tables, cql_string_ref _Nonnull indices, cql_string_ref _Nonnull deletes, cql_bool *_Nonnull result)
+// Normally we recreate here (no rebuild). We just drop our tables, and recreate the
+// tables and any indices that might have been dropped.  If we are given the facets table
+// we first try to rebuild the tables keeping their surviving columns (see above); if that
+// works result is set to true, if not we discard any copies in progress and quietly fall
+// back to the recreate.
+//
+// Every statement is parsed exactly once: the indices are threaded onto chains, one per table,
+// using a map from table name to table position.  The DDL is then run in three batches
+// (deletes, drops, creates) inside one savepoint so a failure leaves the group as it was.
+// Each step is bracketed with cql_rebuild_step_start/stop so runtimes can time them.
+static cql_code _cql_rebuild_recreate_group(
+  sqlite3 *_Nonnull db,
+  cql_string_ref _Nonnull tables,
+  cql_string_ref _Nonnull indices,
+  cql_string_ref _Nonnull deletes,
+  cql_string_ref _Nullable facets,
+  cql_bool *_Nonnull result)
 {
   *result = false; // result holds false because we default to recreate (no rebuild)
+
+  cql_rebuild_step_start("parse");
+
   // process parseWord separated strings into lists
   cql_object_ref tableList = _cql_create_upgrader_input_statement_list(tables, "CREATE ");
   cql_object_ref indexList = _cql_create_upgrader_input_statement_list(indices, "CREATE ");
   cql_object_ref deleteList = _cql_create_upgrader_input_statement_list(deletes, "DROP ");
 
+  cql_int32 table_count = cql_string_list_get_count(tableList);
+  cql_int32 index_count = cql_string_list_get_count(indexList);
+
+  // first_index[t] is the first index on table t, next_index[i] is the next index on the same table
+  cql_object_ref table_names = cql_string_list_create();
+  cql_object_ref table_positions = cql_facets_create();
+  cql_int32 *first_index = malloc(sizeof(cql_int32) * (table_count + 1));
+  cql_int32 *next_index = malloc(sizeof(cql_int32) * (index_count + 1));
+
+  for (cql_int32 i = 0; i < table_count; i++) {
+    cql_string_ref table_name = _cql_create_table_name_from_table_creation_statement(cql_string_list_get_string(tableList, i));
+    cql_string_list_add_string(table_names, table_name);
+    cql_facet_add(table_positions, table_name, i);
+    cql_string_release(table_name);
+    first_index[i] = -1;
+  }
+
+  cql_bytebuf batch;
+  cql_bytebuf_open(&batch);
   cql_code rc = SQLITE_OK;
+
+  // walk the indices backwards so that each chain ends up in the original order;
+  // indices on tables that are not in this group are ignored, an index we can't
+  // parse fails the rebuild before anything is changed
+  for (cql_int32 j = index_count - 1; j >= 0; j--) {
+    cql_string_ref index_table_name = _cql_create_table_name_from_index_creation_statement(cql_string_list_get_string(indexList, j));
+    if (!index_table_name) {
+      cql_rebuild_step_stop("parse");
+      rc = SQLITE_ERROR;
+      goto cleanup;
+    }
+    cql_int64 t = cql_facet_find(table_positions, index_table_name);
+    cql_string_release(index_table_name);
+    if (t >= 0) {
+      next_index[j] = first_index[t];
+      first_index[t] = j;
+    }
+  }
+
+  cql_rebuild_step_stop("parse");
+
+  rc = cql_exec(db, "SAVEPOINT cql_rebuild_recreate_group");
+  if (rc != SQLITE_OK) goto cleanup;
+
   // Execute all delete table drops
-  for (cql_int32 i = 0; i < cql_string_list_get_count(deleteList); i++){
-    cql_string_ref delete = cql_string_list_get_string(deleteList, i);
-    rc = cql_exec_internal(db, delete);
-    if (rc != SQLITE_OK) goto cleanup;
+  cql_rebuild_step_start("deletes");
+  for (cql_int32 i = 0; i < cql_string_list_get_count(deleteList); i++) {
+    _cql_append_statement(&batch, cql_string_list_get_string(deleteList, i));
   }
+  rc = _cql_exec_batch(db, &batch);
+  cql_rebuild_step_stop("deletes");
+  if (rc != SQLITE_OK) goto rollback;
+
+  if (facets) {
+    cql_rebuild_step_start("rebuild");
+    rc = cql_exec(db, "SAVEPOINT cql_rebuild_preserving_data");
+    if (rc != SQLITE_OK) goto rollback;
+    cql_alloc_cstr(c_facets, facets);
+    rc = _cql_rebuild_tables_preserving_data(db, c_facets, tableList, table_names, indexList, first_index, next_index, &batch);
+    if (rc == SQLITE_OK) {
+      *result = true;
+    }
+    else {
+      (void)cql_exec(db, "ROLLBACK TO cql_rebuild_preserving_data");
+      rc = _cql_rebuild_discard_copies(db, c_facets, table_names);
+    }
+    cql_free_cstr(c_facets, facets);
+    if (rc == SQLITE_OK) {
+      rc = cql_exec(db, "RELEASE cql_rebuild_preserving_data");
+    }
+    cql_rebuild_step_stop("rebuild");
+    if (rc != SQLITE_OK) goto rollback;
+    if (*result) goto release;
+  }
+
   // Execute all table drops based on the list of creates given by the CQL
   // upgrader backwards.
   // Intuitively, need to drop the tables with the most dependencies first.
-  for (cql_int32 i = cql_string_list_get_count(tableList) - 1; i >= 0; i--){
-    cql_string_ref tableCreate = cql_string_list_get_string(tableList, i);
-    char* table_name = _cql_create_table_name_from_table_creation_statement(tableCreate);
-    cql_int32 bytes = (cql_int32)(strlen(table_name)) + sizeof("DROP TABLE IF EXISTS ");
-    char* drop = malloc(bytes);
-    snprintf(drop, bytes, "DROP TABLE IF EXISTS %s", table_name);
-    rc = cql_exec(db, drop);
-    free(table_name);
-    free(drop);
-    if (rc != SQLITE_OK) goto cleanup;
+  cql_rebuild_step_start("drops");
+  for (cql_int32 i = table_count - 1; i >= 0; i--) {
+    const char drop[] = "DROP TABLE IF EXISTS ";
+    cql_bytebuf_append(&batch, drop, sizeof(drop) - 1);
+    _cql_append_statement(&batch, cql_string_list_get_string(table_names, i));
   }
+  rc = _cql_exec_batch(db, &batch);
+  cql_rebuild_step_stop("drops");
+  if (rc != SQLITE_OK) goto rollback;
+
   // Execute all table creates in the order provided
-  for (cql_int32 i = 0; i < cql_string_list_get_count(tableList); i++){
-    cql_string_ref tableCreate = cql_string_list_get_string(tableList, i);
-    rc = cql_exec_internal(db, tableCreate);
-    if (rc != SQLITE_OK) goto cleanup;
-    char* table_name = _cql_create_table_name_from_table_creation_statement(tableCreate);
-    // Indices are already deleted with the table drops
-    // We need to recreate indices alongside the tables incase future table creates refer to the index
-    for (cql_int32 j = 0; j < cql_string_list_get_count(indexList); j++){
-      cql_string_ref indexCreate = cql_string_list_get_string(indexList, j);
-      char* index_table_name = _cql_create_table_name_from_index_creation_statement(indexCreate);
-      if (!strcmp(table_name, index_table_name)) {
-        free(index_table_name);
-        rc = cql_exec_internal(db, indexCreate);
-        if (rc != SQLITE_OK) goto cleanup;
-      } else{
-        free(index_table_name);
-      }
-    }
-    free(table_name);
+  // Indices are already deleted with the table drops
+  // We need to recreate indices alongside the tables incase future table creates refer to the index
+  cql_rebuild_step_start("creates");
+  for (cql_int32 i = 0; i < table_count; i++) {
+    _cql_append_statement(&batch, cql_string_list_get_string(tableList, i));
+    _cql_append_index_creates(&batch, indexList, first_index, next_index, i);
   }
-  cleanup:
-    cql_object_release(tableList);
-    cql_object_release(indexList);
-    cql_object_release(deleteList);
-    return rc;
+  rc = _cql_exec_batch(db, &batch);
+  cql_rebuild_step_stop("creates");
+  if (rc != SQLITE_OK) goto rollback;
+
+release:
+  rc = cql_exec(db, "RELEASE cql_rebuild_recreate_group");
+  goto cleanup;
+
+rollback:
+  // the rollback can't fail in any way we could do something about, the error we report
+  // is the one that got us here
+  *result = false;
+  (void)cql_exec(db, "ROLLBACK TO cql_rebuild_recreate_group");
+  (void)cql_exec(db, "RELEASE cql_rebuild_recreate_group");
+
+cleanup:
+  cql_bytebuf_close(&batch);
+  free(first_index);
+  free(next_index);
+  cql_object_release(table_positions);
+  cql_object_release(table_names);
+  cql_object_release(tableList);
+  cql_object_release(indexList);
+  cql_object_release(deleteList);
+  return rc;
+}
+
+cql_code cql_rebuild_recreate_group(sqlite3 *_Nonnull db, cql_string_ref _Nonnull tables, cql_string_ref _Nonnull indices, cql_string_ref _Nonnull deletes, cql_bool *_Nonnull result)
+{
+  return _cql_rebuild_recreate_group(db, tables, indices, deletes, NULL, result);
+}
+
+// The --preserve_recreate_data flavor, the group keeps the data in its surviving columns if it can.
+// Copy progress is kept in the given facets table (see cql_rebuild_copy_group_data).
+cql_code cql_rebuild_recreate_group_preserving_data(
+  sqlite3 *_Nonnull db,
+  cql_string_ref _Nonnull tables,
+  cql_string_ref _Nonnull indices,
+  cql_string_ref _Nonnull deletes,
+  cql_string_ref _Nonnull facets,
+  cql_bool *_Nonnull result)
+{
+  return _cql_rebuild_recreate_group(db, tables, indices, deletes, facets, result);
 }
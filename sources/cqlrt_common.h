@@ -45,6 +45,40 @@
 #define cql_error_report()
 #endif
 
+#ifndef cql_get_cstr_length
+// the length of a string from cql_alloc_cstr, runtimes whose strings already
+// know their length can provide it directly and skip the scan
+#define cql_get_cstr_length(cstr, str) strlen(cstr)
+#endif
+
+#ifndef cql_string_ref_new_with_length
+// make a string whose length is already known (e.g. from sqlite3_column_bytes),
+// runtimes that have no use for the length can simply ignore it
+#define cql_string_ref_new_with_length(cstr, length) cql_string_ref_new(cstr)
+#endif
+
+#ifndef cql_column_string_view
+// Runtimes that support borrowed string and blob views (see cql_multifetch_borrowed)
+// provide these; by default the columns are simply copied and there is nothing to own.
+#define cql_column_string_view(stmt, index, data) cql_column_nullable_string_ref(stmt, index, data)
+#define cql_column_blob_view(stmt, index, data) cql_column_nullable_blob_ref(stmt, index, data)
+#define cql_own_view(ref)
+#endif
+
+#ifndef cql_rebuild_step_start
+// cql_rebuild_recreate_group brackets each of its steps ("parse", "deletes", "rebuild",
+// "drops", "creates") with these so that runtimes can time them (no-op by default,
+// the reference runtime in cqlrt.h keeps running totals)
+#define cql_rebuild_step_start(step)
+#define cql_rebuild_step_stop(step)
+#endif
+
+#ifndef CQL_REBUILD_COPY_BATCH_ROWS
+// the preserving rebuild copies at most this many rows of a table per batch, see
+// cql_rebuild_copy_group_data
+#define CQL_REBUILD_COPY_BATCH_ROWS 5000
+#endif
+
 #ifndef __has_attribute         // Optional of course.
   #define __has_attribute(x) 0  // Compatibility with non-clang compilers.
 #endif
@@ -110,10 +144,14 @@ typedef struct cql_dynamic_cursor {
   uint16_t cursor_refs_offset;
 } cql_dynamic_cursor;
 
+#ifndef CQL_ATOMIC_REFS
 CQL_EXPORT int32_t cql_outstanding_refs;
+#endif
 
 CQL_EXPORT void cql_copyoutrow(sqlite3 *_Nullable db, cql_result_set_ref _Nonnull rs, cql_int32 row, cql_int32 count, ...);
 CQL_EXPORT void cql_multifetch(cql_code rc, sqlite3_stmt *_Nullable stmt, cql_int32 count, ...);
+CQL_EXPORT void cql_multifetch_borrowed(cql_code rc, sqlite3_stmt *_Nullable stmt, cql_int32 count, ...);
+CQL_EXPORT void cql_own_borrowed_refs(cql_int32 count, ...);
 CQL_EXPORT void cql_multibind(cql_code *_Nonnull rc, sqlite3 *_Nonnull db, sqlite3_stmt *_Nullable *_Nonnull pstmt, cql_int32 count, ...);
 CQL_EXPORT void cql_multibind_var(cql_code *_Nonnull rc, sqlite3 *_Nonnull db, sqlite3_stmt *_Nullable *_Nonnull pstmt, cql_int32 count, const char *_Nullable vpreds, ...);
 CQL_EXPORT cql_code cql_best_error(cql_code rc);
@@ -134,6 +172,7 @@ typedef struct cql_fetch_info {
   int64_t crc;
   int32_t *_Nullable perf_index;
   cql_object_ref _Nullable encoder;
+  cql_bool lazy_strings;
 } cql_fetch_info;
 
 CQL_EXPORT void cql_multifetch_meta(char *_Nonnull data, cql_fetch_info *_Nonnull info);
@@ -313,6 +352,16 @@ CQL_EXPORT void cql_result_set_set_blob_col(cql_result_set_ref _Nonnull result_s
 CQL_EXPORT cql_code cql_deserialize_from_blob(cql_blob_ref _Nullable b, cql_dynamic_cursor *_Nonnull dyn_cursor);
 CQL_EXPORT cql_code cql_serialize_to_blob(cql_blob_ref _Nullable *_Nonnull b, cql_dynamic_cursor *_Nonnull dyn_cursor);
 
+// whole result set wire format, the reader needs the metadata of a result set of the same shape
+CQL_EXPORT cql_code cql_result_set_to_blob(cql_result_set_ref _Nonnull result_set, cql_blob_ref _Nullable *_Nonnull blob);
+CQL_EXPORT cql_code cql_result_set_from_blob(cql_result_set_meta *_Nonnull meta, cql_blob_ref _Nonnull blob, cql_result_set_ref _Nullable *_Nonnull result_set);
+CQL_EXPORT cql_code cql_result_set_from_buffer(cql_result_set_meta *_Nonnull meta, const void *_Nonnull buffer, size_t size, cql_result_set_ref _Nullable *_Nonnull result_set);
+
+// a result set over a mapped file written from cql_result_set_to_blob, strings and blobs are made when read;
+// opening it still checks every string and blob slot so it takes time in proportion to the rows
+CQL_EXPORT cql_code cql_result_set_from_file(cql_result_set_meta *_Nonnull meta, const char *_Nonnull path, cql_result_set_ref _Nullable *_Nonnull result_set);
+CQL_EXPORT void cql_result_set_materialize(cql_result_set_ref _Nonnull result_set);
+
 CQL_EXPORT cql_bool cql_result_set_get_is_null_col(cql_result_set_ref _Nonnull result_set, cql_int32 row, cql_int32 col);
 CQL_EXPORT cql_bool cql_result_set_get_is_encoded_col(cql_result_set_ref _Nonnull result_set, cql_int32 col);
 
@@ -335,16 +384,18 @@ CQL_EXPORT void cql_results_from_data(
   cql_fetch_info *_Nonnull info,
   cql_result_set_ref _Nullable *_Nonnull result_set);
 
-// data entry for a closed hash table
+// data entry for a closed hash table, the hash of the key is kept so that
+// probing and rehashing never have to recompute it
 typedef struct cql_hashtab_entry {
  cql_int64 key;
  cql_int64 val;
+ uint64_t hash;
 } cql_hashtab_entry;
 
 // hash table with payloads and capacity info
 typedef struct cql_hashtab {
   cql_int32 count;
-  cql_int32 capacity;
+  cql_int32 capacity; // always a power of two
   cql_hashtab_entry *_Nullable payload;
   uint64_t (*_Nonnull hash_key)(void *_Nullable context, cql_int64 key);
   bool (*_Nonnull compare_keys)(void *_Nullable context, cql_int64 key1, cql_int64 key2);
@@ -366,6 +417,7 @@ CQL_EXPORT cql_object_ref _Nonnull _cql_generic_object_create(void *_Nonnull dat
 CQL_EXPORT void *_Nonnull _cql_generic_object_get_data(cql_object_ref _Nonnull obj);
 
 CQL_EXPORT cql_object_ref _Nonnull cql_partition_create(void);
+CQL_EXPORT cql_object_ref _Nonnull cql_partition_create_sized(cql_int32 expected_rows, cql_int32 expected_keys);
 
 CQL_EXPORT cql_bool cql_partition_cursor(
   cql_object_ref _Nonnull obj,
@@ -402,5 +454,7 @@ CQL_EXPORT sqlite3_stmt *_Nullable cql_unbox_stmt(cql_object_ref _Nonnull ref);
 CQL_EXPORT cql_string_ref _Nonnull cql_uncompress(const char *_Nonnull base, const char *_Nonnull frags);
 
 cql_code cql_rebuild_recreate_group(sqlite3 *_Nonnull db, cql_string_ref _Nonnull tables, cql_string_ref _Nonnull indices, cql_string_ref _Nonnull deletes, cql_bool *_Nonnull result);
+cql_code cql_rebuild_recreate_group_preserving_data(sqlite3 *_Nonnull db, cql_string_ref _Nonnull tables, cql_string_ref _Nonnull indices, cql_string_ref _Nonnull deletes, cql_string_ref _Nonnull facets, cql_bool *_Nonnull result);
+cql_code cql_rebuild_copy_group_data(sqlite3 *_Nonnull db, cql_string_ref _Nonnull tables, cql_string_ref _Nonnull facets, cql_bool *_Nonnull pending);
 
 CQL_EXTERN_C_END
@@ -274,6 +274,50 @@ static sem_t eval_combined_type(eval_node *left, eval_node *right) {
   return result;
 }
 
+// True if the int64 operation can't be done without overflow (which is undefined
+// behavior in C) so it must not be evaluated at compile time.  Only the operators
+// that can overflow are checked, op is the first character of the operator.
+static bool_t eval_int64_overflows(char op, int64_t a, int64_t b) {
+  switch (op) {
+    case '+':
+      return (b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b);
+
+    case '-':
+      return (b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b);
+
+    case '*':
+      if (a > 0) {
+        return b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a;
+      }
+      if (a < 0) {
+        return b > 0 ? a < INT64_MIN / b : (b != 0 && b < INT64_MAX / a);
+      }
+      return false;
+
+    case '/':
+    case '%':
+      return a == INT64_MIN && b == -1;
+  }
+  return false;
+}
+
+// As above for int32, the sum, difference, or product of two int32 values always fits
+// in an int64 so we can just check the range of the exact result.
+static bool_t eval_int32_overflows(char op, int32_t a, int32_t b) {
+  int64_t r = 0;
+  switch (op) {
+    case '+': r = (int64_t)a + b; break;
+    case '-': r = (int64_t)a - b; break;
+    case '*': r = (int64_t)a * b; break;
+    case '/':
+    case '%':
+      return a == INT32_MIN && b == -1;
+    default:
+      return false;
+  }
+  return r < INT32_MIN || r > INT32_MAX;
+}
+
 #define DIV_TEST(x)
 
 // All the normal binary operators are handled the same way, only the operator actually varies.
@@ -320,11 +364,19 @@ static sem_t eval_combined_type(eval_node *left, eval_node *right) {
   \
   switch (core_type) { \
   case SEM_TYPE_INTEGER: \
+    if (eval_int32_overflows((#op)[0], left.int32_value, right.int32_value)) { \
+      /* overflow is undefined, we can't know the answer */ \
+      return; \
+    } \
     result->sem_type = SEM_TYPE_INTEGER; \
     result->int32_value = (left.int32_value op right.int32_value); \
     break; \
   \
   case SEM_TYPE_LONG_INTEGER: \
+    if (eval_int64_overflows((#op)[0], left.int64_value, right.int64_value)) { \
+      /* overflow is undefined, we can't know the answer */ \
+      return; \
+    } \
     result->sem_type = SEM_TYPE_LONG_INTEGER; \
     result->int64_value = (left.int64_value op right.int64_value); \
     break; \
@@ -378,11 +430,19 @@ static sem_t eval_combined_type(eval_node *left, eval_node *right) {
   \
   switch (core_type) { \
   case SEM_TYPE_INTEGER: \
+    if (eval_int32_overflows((#op)[0], left.int32_value, right.int32_value)) { \
+      /* overflow is undefined, we can't know the answer */ \
+      return; \
+    } \
     result->sem_type = SEM_TYPE_INTEGER; \
     result->int32_value = (left.int32_value op right.int32_value); \
     break; \
   \
   case SEM_TYPE_LONG_INTEGER: \
+    if (eval_int64_overflows((#op)[0], left.int64_value, right.int64_value)) { \
+      /* overflow is undefined, we can't know the answer */ \
+      return; \
+    } \
     result->sem_type = SEM_TYPE_LONG_INTEGER; \
     result->int64_value = (left.int64_value op right.int64_value); \
     break; \
@@ -755,10 +815,20 @@ static void eval_uminus(ast_node *expr, eval_node *result) {
 
   switch (result->sem_type) {
     case SEM_TYPE_INTEGER:
+      if (result->int32_value == INT32_MIN) {
+        // -INT32_MIN overflows, that's undefined
+        result->sem_type = SEM_TYPE_ERROR;
+        return;
+      }
       result->int32_value = -result->int32_value;
       break;
 
     case SEM_TYPE_LONG_INTEGER:
+      if (result->int64_value == INT64_MIN) {
+        // likewise -INT64_MIN
+        result->sem_type = SEM_TYPE_ERROR;
+        return;
+      }
       result->int64_value = -result->int64_value;
       break;
 
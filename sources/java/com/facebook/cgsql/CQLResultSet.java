@@ -124,6 +124,43 @@ public final class CQLResultSet {
     return getIsEncoded(result_set_ref, column);
   }
 
+  // Whole column getters, one native call per column instead of one per cell.
+  // For nullable columns the value of a null row is unspecified, use isNullColumn.
+  public boolean[] getBooleanColumn(int column) {
+    return getBooleanColumn(result_set_ref, column);
+  }
+
+  public int[] getIntegerColumn(int column) {
+    return getIntegerColumn(result_set_ref, column);
+  }
+
+  public long[] getLongColumn(int column) {
+    return getLongColumn(result_set_ref, column);
+  }
+
+  public double[] getDoubleColumn(int column) {
+    return getDoubleColumn(result_set_ref, column);
+  }
+
+  public boolean[] isNullColumn(int column) {
+    return isNullColumn(result_set_ref, column);
+  }
+
+  public String[] getStringColumn(int column) {
+    return getStringColumn(result_set_ref, column);
+  }
+
+  public EncodedString[] getEncodedStringColumn(int column) {
+    String[] strings = getStringColumn(column);
+    EncodedString[] result = new EncodedString[strings.length];
+    for (int row = 0; row < strings.length; row++) {
+      if (strings[row] != null) {
+        result[row] = new EncodedString(strings[row]);
+      }
+    }
+    return result;
+  }
+
   // native calls
   public native void close(long result_set_ref);
 
@@ -154,4 +191,16 @@ public final class CQLResultSet {
   public native long copy(long result_set_ref, int row, int count);
 
   public native boolean getIsEncoded(long result_set_ref, int column);
+
+  public native boolean[] getBooleanColumn(long result_set_ref, int column);
+
+  public native int[] getIntegerColumn(long result_set_ref, int column);
+
+  public native long[] getLongColumn(long result_set_ref, int column);
+
+  public native double[] getDoubleColumn(long result_set_ref, int column);
+
+  public native boolean[] isNullColumn(long result_set_ref, int column);
+
+  public native String[] getStringColumn(long result_set_ref, int column);
 }
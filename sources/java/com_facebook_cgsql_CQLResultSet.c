@@ -204,3 +204,134 @@ JNIEXPORT jboolean JNICALL Java_com_facebook_cgsql_CQLResultSet_getIsEncoded
   cql_result_set_ref ref = (cql_result_set_ref)(rs);
   return cql_result_set_get_is_encoded_col(ref, col);
 }
+
+// The column getters below copy a whole column out of the result set with one
+// JNI call rather than one call per cell.  The primitive ones write straight
+// into the new Java array.
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getBooleanColumn
+ * Signature: (JI)[Z
+ */
+JNIEXPORT jbooleanArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getBooleanColumn
+  (JNIEnv *env, jobject thiz, jlong rs, jint col) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+  cql_int32 count = cql_result_set_get_count(ref);
+
+  jbooleanArray ret = (*env)->NewBooleanArray(env, count);
+  jboolean *values = (*env)->GetPrimitiveArrayCritical(env, ret, NULL);
+  for (cql_int32 row = 0; row < count; row++) {
+    values[row] = cql_result_set_get_bool_col(ref, row, col);
+  }
+  (*env)->ReleasePrimitiveArrayCritical(env, ret, values, 0);
+  return ret;
+}
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getIntegerColumn
+ * Signature: (JI)[I
+ */
+JNIEXPORT jintArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getIntegerColumn
+  (JNIEnv *env, jobject thiz, jlong rs, jint col) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+  cql_int32 count = cql_result_set_get_count(ref);
+
+  jintArray ret = (*env)->NewIntArray(env, count);
+  jint *values = (*env)->GetPrimitiveArrayCritical(env, ret, NULL);
+  for (cql_int32 row = 0; row < count; row++) {
+    values[row] = cql_result_set_get_int32_col(ref, row, col);
+  }
+  (*env)->ReleasePrimitiveArrayCritical(env, ret, values, 0);
+  return ret;
+}
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getLongColumn
+ * Signature: (JI)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getLongColumn
+  (JNIEnv *env, jobject thiz, jlong rs, jint col) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+  cql_int32 count = cql_result_set_get_count(ref);
+
+  jlongArray ret = (*env)->NewLongArray(env, count);
+  jlong *values = (*env)->GetPrimitiveArrayCritical(env, ret, NULL);
+  for (cql_int32 row = 0; row < count; row++) {
+    values[row] = cql_result_set_get_int64_col(ref, row, col);
+  }
+  (*env)->ReleasePrimitiveArrayCritical(env, ret, values, 0);
+  return ret;
+}
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getDoubleColumn
+ * Signature: (JI)[D
+ */
+JNIEXPORT jdoubleArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getDoubleColumn
+  (JNIEnv *env, jobject thiz, jlong rs, jint col) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+  cql_int32 count = cql_result_set_get_count(ref);
+
+  jdoubleArray ret = (*env)->NewDoubleArray(env, count);
+  jdouble *values = (*env)->GetPrimitiveArrayCritical(env, ret, NULL);
+  for (cql_int32 row = 0; row < count; row++) {
+    values[row] = cql_result_set_get_double_col(ref, row, col);
+  }
+  (*env)->ReleasePrimitiveArrayCritical(env, ret, values, 0);
+  return ret;
+}
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    isNullColumn
+ * Signature: (JI)[Z
+ */
+JNIEXPORT jbooleanArray JNICALL Java_com_facebook_cgsql_CQLResultSet_isNullColumn
+  (JNIEnv *env, jobject thiz, jlong rs, jint col) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+  cql_int32 count = cql_result_set_get_count(ref);
+
+  jbooleanArray ret = (*env)->NewBooleanArray(env, count);
+  jboolean *values = (*env)->GetPrimitiveArrayCritical(env, ret, NULL);
+  for (cql_int32 row = 0; row < count; row++) {
+    values[row] = cql_result_set_get_is_null_col(ref, row, col);
+  }
+  (*env)->ReleasePrimitiveArrayCritical(env, ret, values, 0);
+  return ret;
+}
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getStringColumn
+ * Signature: (JI)[Ljava/lang/String;
+ */
+JNIEXPORT jobjectArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getStringColumn
+  (JNIEnv *env, jobject thiz, jlong rs, jint col) {
+  cql_result_set_ref ref = (cql_result_set_ref)(rs);
+  cql_int32 count = cql_result_set_get_count(ref);
+
+  jclass string_class = (*env)->FindClass(env, "java/lang/String");
+  jobjectArray ret = (*env)->NewObjectArray(env, count, string_class, NULL);
+  (*env)->DeleteLocalRef(env, string_class);
+
+  for (cql_int32 row = 0; row < count; row++) {
+    cql_string_ref str = cql_result_set_get_string_col(ref, row, col);
+    if (!str) {
+      // null strings stay null in the array
+      continue;
+    }
+    cql_alloc_cstr(c_str, str);
+    jstring value = (*env)->NewStringUTF(env, c_str);
+    cql_free_cstr(c_str, str);
+    (*env)->SetObjectArrayElement(env, ret, row, value);
+
+    // the array holds the string now, drop our local ref so big columns
+    // don't run out of local references
+    (*env)->DeleteLocalRef(env, value);
+  }
+  return ret;
+}
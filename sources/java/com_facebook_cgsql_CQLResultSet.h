@@ -134,6 +134,54 @@ JNIEXPORT jlong JNICALL Java_com_facebook_cgsql_CQLResultSet_copy
 JNIEXPORT jboolean JNICALL Java_com_facebook_cgsql_CQLResultSet_getIsEncoded
   (JNIEnv *, jobject, jlong, jint);
 
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getBooleanColumn
+ * Signature: (JI)[Z
+ */
+JNIEXPORT jbooleanArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getBooleanColumn
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getIntegerColumn
+ * Signature: (JI)[I
+ */
+JNIEXPORT jintArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getIntegerColumn
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getLongColumn
+ * Signature: (JI)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getLongColumn
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getDoubleColumn
+ * Signature: (JI)[D
+ */
+JNIEXPORT jdoubleArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getDoubleColumn
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    isNullColumn
+ * Signature: (JI)[Z
+ */
+JNIEXPORT jbooleanArray JNICALL Java_com_facebook_cgsql_CQLResultSet_isNullColumn
+  (JNIEnv *, jobject, jlong, jint);
+
+/*
+ * Class:     com_facebook_cgsql_CQLResultSet
+ * Method:    getStringColumn
+ * Signature: (JI)[Ljava/lang/String;
+ */
+JNIEXPORT jobjectArray JNICALL Java_com_facebook_cgsql_CQLResultSet_getStringColumn
+  (JNIEnv *, jobject, jlong, jint);
+
 #ifdef __cplusplus
 }
 #endif
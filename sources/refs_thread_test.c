@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Stress test for the CQL_ATOMIC_REFS flavor of the runtime.  A result set
+// full of strings is shared by several threads which retain and release it
+// (and the strings in it) as fast as they can.  Strings are also created on
+// one thread and released on another.  At the end there must be no
+// outstanding references and the result set must have been torn down
+// exactly once.  The strings start out pending (as heap offsets, the way a
+// lazy fetch leaves them) so the threads race to make them; every thread must
+// see the one reference that won, and the ones that lost must be released.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cqlrt.h"
+
+#ifndef CQL_ATOMIC_REFS
+#error "this test is only meaningful with CQL_ATOMIC_REFS"
+#endif
+
+#define THREAD_COUNT 8
+#define ITERATIONS 20000
+#define ROW_COUNT 16
+
+typedef struct test_row {
+  cql_int32 id;
+  cql_string_ref _Nonnull name;
+} test_row;
+
+static uint16_t test_col_offsets[] = { 2, offsetof(test_row, id), offsetof(test_row, name) };
+static uint8_t test_data_types[] = {
+  CQL_DATA_TYPE_INT32 | CQL_DATA_TYPE_NOT_NULL,
+  CQL_DATA_TYPE_STRING | CQL_DATA_TYPE_NOT_NULL,
+};
+
+static int32_t teardown_count;
+static int32_t failures;
+
+static void test_custom_teardown(cql_result_set_ref _Nonnull result_set) {
+  __atomic_fetch_add(&teardown_count, 1, __ATOMIC_RELAXED);
+}
+
+#define EXPECT(cond, ...) \
+  if (!(cond)) { \
+    fprintf(stderr, __VA_ARGS__); \
+    __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED); \
+  }
+
+static cql_result_set_ref _Nonnull make_result_set(void) {
+  test_row *rows = calloc(ROW_COUNT, sizeof(test_row));
+
+  // each heap entry is the length, the bytes, and a terminating nul
+  uint8_t *heap = calloc(ROW_COUNT, 16);
+  uint32_t heap_size = 0;
+  for (int32_t i = 0; i < ROW_COUNT; i++) {
+    uint32_t length = (uint32_t)snprintf((char *)heap + heap_size + sizeof(length), 12, "row_%d", i);
+    memcpy(heap + heap_size, &length, sizeof(length));
+    rows[i].id = i;
+    rows[i].name = (cql_string_ref)(uintptr_t)(heap_size + 1);
+    heap_size += 16;
+  }
+
+  cql_result_set_meta meta = {
+    .teardown = cql_result_set_teardown,
+    .custom_teardown = test_custom_teardown,
+    .refsCount = 1,
+    .refsOffset = offsetof(test_row, name),
+    .columnOffsets = test_col_offsets,
+    .rowsize = sizeof(test_row),
+    .columnCount = 2,
+    .dataTypes = test_data_types,
+    .encodeContextIndex = -1,
+    .heap = heap,
+    .heapSize = heap_size,
+    .heapPending = true,
+  };
+
+  cql_result_set_ref result_set = cql_result_set_create(rows, ROW_COUNT, meta);
+  EXPECT(cql_result_set_get_meta(result_set)->heapPending, "expected the strings still pending\n");
+  return result_set;
+}
+
+typedef struct worker_args {
+  cql_result_set_ref _Nonnull result_set;
+  int32_t seed;
+
+  // strings made by another thread that this thread must release
+  cql_string_ref _Nonnull handoff[ITERATIONS / 100];
+} worker_args;
+
+static void *worker(void *context) {
+  worker_args *args = context;
+  cql_result_set_ref result_set = args->result_set;
+  cql_string_ref seen[ROW_COUNT] = { NULL };
+
+  for (int32_t i = 0; i < ITERATIONS; i++) {
+    cql_int32 row = (i + args->seed) % ROW_COUNT;
+
+    // half the threads make every remaining cell at once part way through
+    if (i == ROW_COUNT / 2 && args->seed % 2) {
+      cql_result_set_materialize(result_set);
+    }
+
+    cql_result_set_retain(result_set);
+    cql_string_ref name = cql_result_set_get_string_col(result_set, row, 1);
+    cql_string_retain(name);
+
+    // once made, a cell never changes
+    if (!seen[row]) {
+      seen[row] = name;
+    }
+    EXPECT(seen[row] == name, "row %d changed its string\n", row);
+
+    char expected[32];
+    snprintf(expected, sizeof(expected), "row_%d", row);
+    cql_string_ref temp = cql_string_ref_new(expected);
+    EXPECT(cql_string_equal(name, temp), "row %d has the wrong name\n", row);
+    cql_string_release(temp);
+
+    cql_string_release(name);
+    cql_result_set_release(result_set);
+
+    if (i % 100 == 0) {
+      cql_string_release(args->handoff[i / 100]);
+    }
+  }
+
+  // this thread's own count is almost certainly not zero, only the sum is
+  cql_result_set_release(result_set);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  cql_result_set_ref result_set = make_result_set();
+
+  pthread_t threads[THREAD_COUNT];
+  worker_args *args = calloc(THREAD_COUNT, sizeof(worker_args));
+
+  for (int32_t t = 0; t < THREAD_COUNT; t++) {
+    args[t].result_set = result_set;
+    args[t].seed = t;
+    cql_result_set_retain(result_set);
+    for (int32_t i = 0; i < ITERATIONS / 100; i++) {
+      args[t].handoff[i] = cql_string_ref_new("handoff");
+    }
+  }
+
+  for (int32_t t = 0; t < THREAD_COUNT; t++) {
+    pthread_create(&threads[t], NULL, worker, &args[t]);
+  }
+
+  // give up our own reference while the workers are still running so that
+  // the last release (and the teardown) happens on one of them
+  cql_result_set_release(result_set);
+
+  for (int32_t t = 0; t < THREAD_COUNT; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  free(args);
+
+  EXPECT(teardown_count == 1, "result set torn down %d times\n", teardown_count);
+  EXPECT(cql_outstanding_refs == 0, "%d outstanding refs\n", cql_outstanding_refs);
+
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+
+  printf("refs thread test passed\n");
+  return 0;
+}
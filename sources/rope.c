@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "cql.h"
+#include "charbuf.h"
+#include "rope.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// fileno is POSIX, not C99, so strict C99 headers don't declare it.  As in the lexer
+// we declare it here rather than asking for all of POSIX with _POSIX_C_SOURCE, which
+// in the amalgam would apply to every file.
+int fileno(FILE *);
+#endif
+
+// The most iovecs we hand to writev in one call, this is comfortably under
+// the IOV_MAX of every platform we care about.
+#define ROPE_IOV_BATCH 64
+
+cql_data_defn( int32_t rope_open_count );
+
+cql_noexport void rope_open(rope *r) {
+  r->head = NULL;
+  r->tail = NULL;
+  r->length = 0;
+  rope_open_count++;
+}
+
+cql_noexport void rope_close(rope *r) {
+  rope_chunk *chunk = r->head;
+  while (chunk) {
+    rope_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  r->head = NULL;
+  r->tail = NULL;
+  r->length = 0;
+  rope_open_count--;
+}
+
+// Thread a chunk onto the end of the rope, this is the only place the
+// chain is extended so the tail pointer is always correct.
+static void rope_link(rope *r, rope_chunk *chunk) {
+  chunk->next = NULL;
+  if (r->tail) {
+    r->tail->next = chunk;
+  }
+  else {
+    r->head = chunk;
+  }
+  r->tail = chunk;
+}
+
+// Make a new owned chunk with room for at least "needed" bytes.  There is
+// always one extra byte of storage so that vsnprintf can put its null
+// terminator in the chunk; the null is never counted as part of the text.
+static rope_chunk *rope_new_chunk(rope *r, uint32_t needed) {
+  uint32_t max = needed > ROPE_CHUNK_SIZE ? needed : ROPE_CHUNK_SIZE;
+  rope_chunk *chunk = malloc(sizeof(rope_chunk) + max + 1);
+  chunk->ptr = chunk->storage;
+  chunk->used = 0;
+  chunk->max = max;
+  rope_link(r, chunk);
+  return chunk;
+}
+
+// Bytes available at the end of the tail chunk, borrowed chunks never
+// have room because they have no storage of their own.
+static uint32_t rope_avail(rope *r) {
+  rope_chunk *tail = r->tail;
+  return tail && tail->max ? tail->max - tail->used : 0;
+}
+
+// Copy the text into the rope.  We fill whatever is left of the current tail
+// chunk and then start a new chunk for the rest.  Nothing already in the
+// rope is ever moved.
+cql_noexport void rope_append(rope *r, const char *text, uint32_t len) {
+  uint32_t avail = rope_avail(r);
+  uint32_t first = len < avail ? len : avail;
+
+  if (first) {
+    memcpy(r->tail->storage + r->tail->used, text, first);
+    r->tail->used += first;
+  }
+
+  if (len > first) {
+    rope_chunk *chunk = rope_new_chunk(r, len - first);
+    memcpy(chunk->storage, text + first, len - first);
+    chunk->used = len - first;
+  }
+
+  r->length += len;
+}
+
+cql_noexport void rope_puts(rope *r, const char *text) {
+  rope_append(r, text, (uint32_t)strlen(text));
+}
+
+// Format directly into the tail chunk if the result fits, this is the
+// common case and it needs only one formatting pass.  If it doesn't fit
+// we know exactly how big it is so we make a chunk of the right size and
+// format again into that.
+cql_noexport void rope_printf(rope *r, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+
+  va_list pass2;
+  va_copy(pass2, args);
+
+  uint32_t avail = rope_avail(r);
+  char *dest = r->tail && avail ? r->tail->storage + r->tail->used : NULL;
+
+  // there is always one more byte than avail in an owned chunk (see above)
+  uint32_t needed = (uint32_t)vsnprintf(dest, dest ? avail + 1 : 0, format, args);
+
+  if (dest && needed <= avail) {
+    r->tail->used += needed;
+  }
+  else if (needed) {
+    rope_chunk *chunk = rope_new_chunk(r, needed);
+    vsnprintf(chunk->storage, needed + 1, format, pass2);
+    chunk->used = needed;
+  }
+
+  r->length += needed;
+
+  va_end(pass2);
+  va_end(args);
+}
+
+// Add the text to the rope without copying it.  The caller guarantees that
+// the text outlives the rope (or at least outlives the last use of it).
+cql_noexport void rope_borrow(rope *r, const char *text, uint32_t len) {
+  if (!len) {
+    return;
+  }
+
+  rope_chunk *chunk = malloc(sizeof(rope_chunk));
+  chunk->ptr = text;
+  chunk->used = len;
+  chunk->max = 0;
+  rope_link(r, chunk);
+  r->length += len;
+}
+
+// Borrow the current contents of the charbuf, the charbuf must not be
+// changed or closed while the rope is still in use.
+cql_noexport void rope_borrow_charbuf(rope *r, charbuf *b) {
+  // b->used includes the null terminator, the rope doesn't store those
+  rope_borrow(r, b->ptr, b->used - 1);
+}
+
+// Move all of the chunks of src onto the end of dest, this is O(1) no matter
+// how much text is involved.  src is left empty but still open.
+cql_noexport void rope_splice(rope *dest, rope *src) {
+  if (!src->head) {
+    return;
+  }
+
+  if (dest->tail) {
+    dest->tail->next = src->head;
+  }
+  else {
+    dest->head = src->head;
+  }
+
+  dest->tail = src->tail;
+  dest->length += src->length;
+
+  src->head = NULL;
+  src->tail = NULL;
+  src->length = 0;
+}
+
+// Flatten the rope onto the end of the charbuf; this is one allocation (at most)
+// and one copy of each chunk.
+cql_noexport void rope_to_charbuf(rope *r, charbuf *output) {
+  breserve(output, r->length);
+
+  // note that output->used includes the current null terminator
+  char *dest = output->ptr + output->used - 1;
+
+  for (rope_chunk *chunk = r->head; chunk; chunk = chunk->next) {
+    memcpy(dest, chunk->ptr, chunk->used);
+    dest += chunk->used;
+  }
+
+  *dest = 0;
+  output->used += r->length;
+}
+
+#ifdef cql_write_file
+
+// If the embedding application has replaced cql_write_file then it gets the
+// usual single "gulp" of text; we can't bypass it and write the file directly.
+cql_noexport void rope_write_file(const char *file_name, rope *r) {
+  CHARBUF_OPEN(flat);
+  rope_to_charbuf(r, &flat);
+  cql_write_file(file_name, flat.ptr);
+  CHARBUF_CLOSE(flat);
+}
+
+#elif defined(_WIN32)
+
+cql_noexport void rope_write_file(const char *file_name, rope *r) {
+  FILE *file = cql_open_file_for_write(file_name);
+  for (rope_chunk *chunk = r->head; chunk; chunk = chunk->next) {
+    fwrite(chunk->ptr, 1, chunk->used, file);
+  }
+  fclose(file);
+}
+
+#else
+
+// Write the chunks out with writev, a batch at a time.  The chunks are never
+// flattened so there is no copy of the whole output, no matter how big it is.
+// writev is allowed to do a partial write so we have to be prepared to resume
+// from the middle of a chunk.
+cql_noexport void rope_write_file(const char *file_name, rope *r) {
+  FILE *file = cql_open_file_for_write(file_name);
+  int fd = fileno(file);
+
+  struct iovec iov[ROPE_IOV_BATCH];
+  rope_chunk *chunk = r->head;
+  uint32_t offset = 0;  // bytes of the current chunk already written
+
+  while (chunk) {
+    int32_t count = 0;
+    for (rope_chunk *c = chunk; c && count < ROPE_IOV_BATCH; c = c->next) {
+      uint32_t skip = c == chunk ? offset : 0;
+      iov[count].iov_base = (void *)(c->ptr + skip);
+      iov[count].iov_len = c->used - skip;
+      count++;
+    }
+
+    ssize_t written = writev(fd, iov, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cql_error("unable to write %s\n", file_name);
+      fclose(file);
+      cql_cleanup_and_exit(1);
+    }
+
+    // advance past whatever was written, possibly stopping mid-chunk
+    size_t remaining = (size_t)written;
+    while (chunk && remaining >= chunk->used - offset) {
+      remaining -= chunk->used - offset;
+      offset = 0;
+      chunk = chunk->next;
+    }
+    offset += (uint32_t)remaining;
+  }
+
+  fclose(file);
+}
+
+#endif
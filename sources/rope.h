@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// A rope is a chain of text chunks.  Unlike charbuf, appending never moves
+// the text that is already in the rope and splicing one rope onto another
+// is O(1).  Chunks can also "borrow" text that lives elsewhere (e.g. in a
+// charbuf that outlives the rope) so that big generated sections can be
+// stitched together into one output without copying them.  The finished
+// rope can be written straight to a file, chunk by chunk.
+
+#pragma once
+
+#include "cql.h"
+#include "charbuf.h"
+
+#define ROPE_CHUNK_SIZE (1024*64)
+
+typedef struct rope_chunk {
+  struct rope_chunk *_Nullable next;
+  const char *_Nonnull ptr;   // the text in this chunk, storage[] or borrowed
+  uint32_t used;              // bytes of text in the chunk (no null terminator)
+  uint32_t max;               // size of storage[], zero for a borrowed chunk
+  char storage[];
+} rope_chunk;
+
+typedef struct rope {
+  rope_chunk *_Nullable head;
+  rope_chunk *_Nullable tail;
+  uint32_t length;            // total bytes of text in all the chunks
+} rope;
+
+cql_data_decl( int32_t rope_open_count );
+
+cql_noexport void rope_open(rope *_Nonnull r);
+cql_noexport void rope_close(rope *_Nonnull r);
+cql_noexport void rope_append(rope *_Nonnull r, const char *_Nonnull text, uint32_t len);
+cql_noexport void rope_puts(rope *_Nonnull r, const char *_Nonnull text);
+cql_noexport void rope_printf(rope *_Nonnull r, const char *_Nonnull format, ...);
+cql_noexport void rope_borrow(rope *_Nonnull r, const char *_Nonnull text, uint32_t len);
+cql_noexport void rope_borrow_charbuf(rope *_Nonnull r, charbuf *_Nonnull b);
+cql_noexport void rope_splice(rope *_Nonnull dest, rope *_Nonnull src);
+cql_noexport void rope_to_charbuf(rope *_Nonnull r, charbuf *_Nonnull output);
+cql_noexport void rope_write_file(const char *_Nonnull file_name, rope *_Nonnull r);
+
+#define ROPE_OPEN(x) \
+  int32_t __saved_rope_count##x = rope_open_count; \
+  rope x; \
+  rope_open(&x)
+
+#define ROPE_CLOSE(x) \
+  rope_close(&x); \
+  Invariant(__saved_rope_count##x == rope_open_count)
@@ -87,6 +87,7 @@ static rtdata rt_c = {
   .cql_result_set_release = "cql_result_set_release",
   .cql_result_set_get_count = "cql_result_set_get_count",
   .cql_result_set_get_data = "cql_result_set_get_data",
+  .cql_result_set_get_rows = "cql_result_set_get_rows",
   .cql_result_set_get_bool = "cql_result_set_get_bool_col",
   .cql_result_set_get_double = "cql_result_set_get_double_col",
   .cql_result_set_get_int32 = "cql_result_set_get_int32_col",
@@ -244,6 +245,10 @@ static rtdata rt_java = {
     "  }\n"
     "  return new %s(resultSet);\n"
     "}\n\n",
+  .cql_result_set_get_column =
+    "public %s[] %s() {\n"
+    "  return mResultSet.%s(%s);\n"
+    "}\n\n",
   .cql_target_null = "null",
 };
 
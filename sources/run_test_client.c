@@ -6,6 +6,7 @@
  */
 
 #include <setjmp.h>
+#include <unistd.h>
 
 #include "cqlrt.h"
 #include "run_test.h"
@@ -19,6 +20,8 @@ cql_code test_blob_rowsets(sqlite3 *db);
 cql_code test_sparse_blob_rowsets(sqlite3 *db);
 cql_code test_c_one_row_result(sqlite3 *db);
 cql_code test_ref_comparisons(sqlite3 *db);
+cql_code test_string_length_and_hash(sqlite3 *db);
+cql_code test_borrowed_views(sqlite3 *db);
 cql_code test_all_column_fetchers(sqlite3 *db);
 cql_code test_error_case_rowset(sqlite3 *db);
 cql_code test_autodrop_rowset(sqlite3 *db);
@@ -29,6 +32,10 @@ cql_code test_cql_bytebuf_alloc_within_bytebuf_exp_growth_cap(sqlite3 *db);
 cql_code test_cql_bytebuf_alloc_over_bytebuf_exp_growth_cap(sqlite3 *db);
 cql_code test_all_column_encoded_fetchers(sqlite3 *db);
 cql_code test_all_column_encoded_with_context_fetchers(sqlite3 *db);
+cql_code test_encoded_column_batches(sqlite3 *db);
+cql_code test_result_set_wire_format(sqlite3 *db);
+cql_code test_mapped_result_set(sqlite3 *db);
+cql_code test_lazy_strings(sqlite3 *db);
 cql_code test_all_column_encoded_cursor(sqlite3 *db);
 cql_code test_all_column_encoded_out_union(sqlite3 *db);
 cql_code test_all_column_encoded_multi_out_union(sqlite3 *db);
@@ -37,6 +44,8 @@ cql_code test_all_column_some_encoded_field_with_encode_context(sqlite3 *db);
 cql_code test_all_column_encoded_runtime_turn_on_off(sqlite3 *db);
 cql_code test_cql_contract_argument_notnull_tripwires(sqlite3 *db);
 cql_code test_cql_rebuild_recreate_group(sqlite3 *db);
+cql_code test_cql_rebuild_recreate_group_preserving_data(sqlite3 *db);
+cql_code test_cql_rebuild_copy_group_data(sqlite3 *db);
 void take_bool(cql_nullable_bool x, cql_nullable_bool y);
 void take_bool_not_null(cql_bool x, cql_bool y);
 
@@ -123,6 +132,12 @@ cql_code run_client(sqlite3 *db) {
   SQL_E(test_ref_comparisons(db));
   E(!cql_outstanding_refs, "outstanding refs in test_ref_comparisons: %d\n", cql_outstanding_refs);
 
+  SQL_E(test_string_length_and_hash(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_string_length_and_hash: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_borrowed_views(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_borrowed_views: %d\n", cql_outstanding_refs);
+
   SQL_E(test_sparse_blob_rowsets(db));
   E(!cql_outstanding_refs, "outstanding refs in test_sparse_blob_rowsets: %d\n", cql_outstanding_refs);
 
@@ -144,6 +159,18 @@ cql_code run_client(sqlite3 *db) {
   SQL_E(test_all_column_encoded_with_context_fetchers(db));
   E(!cql_outstanding_refs, "outstanding refs in test_all_column_encoded_with_context_fetchers: %d\n", cql_outstanding_refs);
 
+  SQL_E(test_encoded_column_batches(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_encoded_column_batches: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_result_set_wire_format(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_result_set_wire_format: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_mapped_result_set(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_mapped_result_set: %d\n", cql_outstanding_refs);
+
+  SQL_E(test_lazy_strings(db));
+  E(!cql_outstanding_refs, "outstanding refs in test_lazy_strings: %d\n", cql_outstanding_refs);
+
   SQL_E(test_all_column_encoded_cursor(db));
   E(!cql_outstanding_refs, "outstanding refs in test_all_column_encoded_cursor: %d\n", cql_outstanding_refs);
 
@@ -200,6 +227,16 @@ cql_code run_client(sqlite3 *db) {
     "outstanding refs in test_cql_rebuild_recreate_group: %d\n",
     cql_outstanding_refs);
 
+  SQL_E(test_cql_rebuild_recreate_group_preserving_data(db));
+  E(!cql_outstanding_refs,
+    "outstanding refs in test_cql_rebuild_recreate_group_preserving_data: %d\n",
+    cql_outstanding_refs);
+
+  SQL_E(test_cql_rebuild_copy_group_data(db));
+  E(!cql_outstanding_refs,
+    "outstanding refs in test_cql_rebuild_copy_group_data: %d\n",
+    cql_outstanding_refs);
+
   return SQLITE_OK;
 }
 
@@ -417,6 +454,124 @@ cql_code test_ref_comparisons(sqlite3 *db) {
   return SQLITE_OK;
 }
 
+cql_code test_string_length_and_hash(sqlite3 *db) {
+  printf("Running string length and hash test\n");
+  tests++;
+
+  cql_string_literal(literal, "hello");
+  cql_string_ref hello = cql_string_ref_new("hello");
+  cql_string_ref help = cql_string_ref_new("help");
+  cql_string_ref empty = cql_string_ref_new("");
+
+  E(literal->length == 5, "literal length %d\n", literal->length);
+  E(hello->length == 5, "string length %d\n", hello->length);
+  E(empty->length == 0, "empty string length %d\n", empty->length);
+
+  // the hash is filled in on first use and then reused
+  E(!hello->hash, "hash should not be computed yet\n");
+  cql_hash_code hash = cql_string_hash(hello);
+  E(hello->hash == hash, "hash should be cached\n");
+  E(cql_string_hash(hello) == hash, "cached hash should be returned\n");
+  E(cql_string_hash(literal) == hash, "literal should hash the same\n");
+
+  E(cql_string_equal(literal, hello), "equal strings should be equal\n");
+  E(!cql_string_equal(hello, help), "different lengths should not be equal\n");
+  E(!cql_string_equal(hello, empty), "empty should not equal hello\n");
+
+  // ordering is the same as strcmp, prefixes sort first
+  E(cql_string_compare(help, hello) > 0, "help should sort after hello\n");
+  E(cql_string_compare(empty, help) < 0, "empty should sort first\n");
+  E(cql_string_compare(hello, literal) == 0, "equal strings should compare equal\n");
+
+  // the hash is the same djb2 over the C string that it always was
+  cql_hash_code djb2 = 5381;
+  for (const char *p = "hello"; *p; p++) {
+    djb2 = ((djb2 << 5) + djb2) + *p;
+  }
+  E(hash == djb2, "hash should be djb2 of the text\n");
+
+  // text with an embedded null ends at the null, however the string is made
+  cql_string_ref sized = cql_string_ref_new_sized("help\0ful", 8);
+  cql_string_ref fetched = NULL;
+  cql_string_ref viewed = NULL;
+  sqlite3_stmt *stmt = NULL;
+  SQL_E(sqlite3_prepare_v2(db, "select 'help' || char(0) || 'ful'", -1, &stmt, NULL));
+  E(sqlite3_step(stmt) == SQLITE_ROW, "expected a row\n");
+  E(sqlite3_column_bytes(stmt, 0) == 8, "sqlite should have all the bytes\n");
+  cql_column_nullable_string_ref(stmt, 0, &fetched);
+  cql_string_view_fetch(stmt, 0, &viewed);
+
+  cql_string_ref with_nuls[] = { sized, fetched, viewed };
+  for (int32_t i = 0; i < 3; i++) {
+    cql_string_ref str = with_nuls[i];
+    E(str->length == 4, "string %d length %d\n", i, str->length);
+    E(cql_string_hash(str) == cql_string_hash(help), "string %d should hash like help\n", i);
+    E(cql_string_equal(str, help), "string %d should equal help\n", i);
+    E(cql_string_compare(str, help) == 0, "string %d should compare equal to help\n", i);
+  }
+
+  cql_string_release(viewed);
+  sqlite3_finalize(stmt);
+  cql_string_release(fetched);
+  cql_string_release(sized);
+  cql_string_release(hello);
+  cql_string_release(help);
+  cql_string_release(empty);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+cql_code test_borrowed_views(sqlite3 *db) {
+  printf("Running borrowed views test\n");
+  tests++;
+
+  sqlite3_stmt *stmt = NULL;
+  SQL_E(sqlite3_prepare_v2(db,
+    "select 'row1', x'01' union all select 'row2', x'0202' union all select 'row3', NULL",
+    -1, &stmt, NULL));
+
+  cql_string_ref name = NULL;
+  cql_blob_ref bytes = NULL;
+
+  cql_code rc = sqlite3_step(stmt);
+  cql_multifetch_borrowed(rc, stmt, 2, CQL_DATA_TYPE_STRING, &name, CQL_DATA_TYPE_BLOB, &bytes);
+  E(!strcmp(name->ptr, "row1"), "expected row1 got %s\n", name->ptr);
+  E(name->length == 4, "expected length 4\n");
+  E(bytes->size == 1, "expected 1 byte blob\n");
+
+  // keep the first row's name past the next step, retaining it makes it a copy
+  cql_string_ref kept = NULL;
+  cql_set_string_ref(&kept, name);
+  cql_string_ref first_view = name;
+
+  rc = sqlite3_step(stmt);
+  cql_multifetch_borrowed(rc, stmt, 2, CQL_DATA_TYPE_STRING, &name, CQL_DATA_TYPE_BLOB, &bytes);
+  E(!strcmp(kept->ptr, "row1"), "kept string should still be row1, got %s\n", kept->ptr);
+  E(name != first_view, "the escaped view should not be reused\n");
+  E(!strcmp(name->ptr, "row2"), "expected row2 got %s\n", name->ptr);
+  E(bytes->size == 2, "expected 2 byte blob\n");
+
+  // nothing escaped this time so the same view is pointed at the next row
+  cql_string_ref second_view = name;
+  rc = sqlite3_step(stmt);
+  cql_multifetch_borrowed(rc, stmt, 2, CQL_DATA_TYPE_STRING, &name, CQL_DATA_TYPE_BLOB, &bytes);
+  E(name == second_view, "the view should have been reused\n");
+  E(!strcmp(name->ptr, "row3"), "expected row3 got %s\n", name->ptr);
+  E(bytes == NULL, "expected null blob\n");
+
+  // the loop ends early, the views are made into copies before the statement goes away
+  cql_own_borrowed_refs(2, &name, &bytes);
+  cql_finalize_stmt(&stmt);
+  E(!strcmp(name->ptr, "row3"), "owned string should still be row3, got %s\n", name->ptr);
+
+  cql_string_release(name);
+  cql_string_release(kept);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
 cql_code test_bytebuf_growth(sqlite3 *db) {
   tests++;
   printf("Running C client test with huge number of rows\n");
@@ -940,6 +1095,282 @@ static void cql_result_set_set_custom_teardown_callback(cql_result_set_ref _Nonn
   cql_result_set_set_custom_teardown_callback_count = 1;
 }
 
+// Many rows, each with its own context and with nulls sprinkled in different rows
+// for each column, every value must decode back with its own row's context.
+cql_code test_encoded_column_batches(sqlite3 *db) {
+  printf("Running encoded column batches test\n");
+  tests++;
+
+  cql_object_ref encoder = cql_copy_encoder(db);
+
+  load_encoded_column_batches_result_set_ref result_set;
+  SQL_E(load_encoded_column_batches_fetch_results(db, &result_set));
+  E(load_encoded_column_batches_result_count(result_set) == 100, "expected 100 rows from result table\n");
+
+  char buf[32];
+  for (cql_int32 row = 0; row < 100; row++) {
+    cql_string_ref context_value = load_encoded_column_batches_get_context(result_set, row);
+    char *context = (char *)&context_value;
+
+    cql_string_ref s = load_encoded_column_batches_get_s(result_set, row);
+    if (row % 3 == 0) {
+      E(!s, "expected s is null in row %d\n", row);
+    }
+    else {
+      cql_string_ref s_decode = cql_decode_string_ref_new(encoder, s, CQL_DATA_TYPE_STRING, context);
+      snprintf(buf, sizeof(buf), "s_%d", row);
+      E(!strcmp(s_decode->ptr, buf), "expected s is %s, value %s\n", buf, s_decode->ptr);
+      cql_string_release(s_decode);
+    }
+
+    cql_blob_ref bl = load_encoded_column_batches_get_bl(result_set, row);
+    if (row % 5 == 0) {
+      E(!bl, "expected bl is null in row %d\n", row);
+    }
+    else {
+      cql_blob_ref bl_decode = cql_decode_blob_ref_new(encoder, bl, CQL_DATA_TYPE_STRING, context);
+      int len = snprintf(buf, sizeof(buf), "b_%d", row);
+      E(bl_decode->size == len && !memcmp(bl_decode->ptr, buf, len), "expected bl is %s in row %d\n", buf, row);
+      cql_blob_release(bl_decode);
+    }
+
+    if (row % 4 == 0) {
+      E(load_encoded_column_batches_get_i_is_null(result_set, row), "expected i is null in row %d\n", row);
+    }
+    else {
+      cql_int32 i = load_encoded_column_batches_get_i_value(result_set, row);
+      cql_int32 i_decode = cql_decode_int32(encoder, i, CQL_DATA_TYPE_STRING, context);
+      E(i_decode == row, "expected i is %d, value %d\n", row, i_decode);
+    }
+  }
+
+  cql_result_set_release(result_set);
+  cql_object_release(encoder);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// A result set written to a blob and read back must have the same rows, and the
+// copy must not depend on the original.  Bad buffers and the wrong shape are rejected.
+cql_code test_result_set_wire_format(sqlite3 *db) {
+  printf("Running result set wire format test\n");
+  tests++;
+
+  load_wire_format_rows_result_set_ref result_set;
+  SQL_E(load_wire_format_rows_fetch_results(db, &result_set));
+  E(load_wire_format_rows_result_count(result_set) == 50, "expected 50 rows from result table\n");
+
+  cql_blob_ref blob = NULL;
+  SQL_E(cql_result_set_to_blob((cql_result_set_ref)result_set, &blob));
+
+  cql_result_set_meta meta = *cql_result_set_get_meta(result_set);
+
+  cql_result_set_ref copy;
+  SQL_E(cql_result_set_from_blob(&meta, blob, &copy));
+  E(cql_result_set_get_count(copy) == 50, "expected 50 rows in the copy\n");
+
+  for (cql_int32 row = 0; row < 50; row++) {
+    E(meta.rowsEqual((cql_result_set_ref)result_set, row, copy, row), "row %d is different in the copy\n", row);
+  }
+
+  // the copy stands on its own
+  cql_result_set_release(result_set);
+
+  load_wire_format_rows_result_set_ref rows = (load_wire_format_rows_result_set_ref)copy;
+  E(!strcmp(load_wire_format_rows_get_s(rows, 7)->ptr, "str_7"), "expected s is str_7\n");
+  E(load_wire_format_rows_get_ns(rows, 14)->length == 0, "expected ns is empty\n");
+  E(!load_wire_format_rows_get_ns(rows, 4), "expected ns is null\n");
+  E(load_wire_format_rows_get_nbl(rows, 7)->size == 1, "expected nbl is one byte\n");
+  E(!load_wire_format_rows_get_nbl(rows, 6), "expected nbl is null\n");
+  E(load_wire_format_rows_get_l(rows, 9) == 9000000000000, "expected l is 9000000000000\n");
+  E(load_wire_format_rows_get_nd_is_null(rows, 10), "expected nd is null\n");
+
+  // a copy of the bytes somewhere else (e.g. mapped) reads the same
+  cql_uint32 size = cql_get_blob_size(blob);
+  void *bytes = malloc(size);
+  memcpy(bytes, cql_get_blob_bytes(blob), size);
+
+  cql_result_set_ref again;
+  SQL_E(cql_result_set_from_buffer(&meta, bytes, size, &again));
+  for (cql_int32 row = 0; row < 50; row++) {
+    E(meta.rowsEqual(copy, row, again, row), "row %d is different in the buffer copy\n", row);
+  }
+  cql_result_set_release(again);
+
+  // the heap is at the end so truncation is always noticed
+  E(cql_result_set_from_buffer(&meta, bytes, size - 1, &again) == SQLITE_ERROR, "truncated buffer accepted\n");
+  E(!again, "expected no result set from a truncated buffer\n");
+
+  cql_result_set_meta wrong_meta = meta;
+  wrong_meta.rowsize += 8;
+  E(cql_result_set_from_buffer(&wrong_meta, bytes, size, &again) == SQLITE_ERROR, "wrong shape accepted\n");
+
+  free(bytes);
+  cql_result_set_release(copy);
+  cql_blob_release(blob);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// A result set saved to a file and opened mapped reads the same, the generic
+// getters only make the cells they read and anything that uses the rows directly
+// makes the rest.  A file that doesn't match the shape, or has a bad slot, is rejected.
+cql_code test_mapped_result_set(sqlite3 *db) {
+  printf("Running mapped result set test\n");
+  tests++;
+
+  load_wire_format_rows_result_set_ref result_set;
+  SQL_E(load_wire_format_rows_fetch_results(db, &result_set));
+
+  cql_blob_ref blob = NULL;
+  SQL_E(cql_result_set_to_blob((cql_result_set_ref)result_set, &blob));
+
+  char path[] = "/tmp/cql_mapped_result_set_XXXXXX";
+  int fd = mkstemp(path);
+  E(fd >= 0, "could not make a temp file\n");
+  FILE *f = fdopen(fd, "wb");
+  E(fwrite(cql_get_blob_bytes(blob), 1, cql_get_blob_size(blob), f) == cql_get_blob_size(blob), "short write\n");
+  fclose(f);
+  cql_blob_release(blob);
+
+  cql_result_set_meta meta = *cql_result_set_get_meta(result_set);
+  cql_result_set_ref mapped;
+  SQL_E(cql_result_set_from_file(&meta, path, &mapped));
+  E(cql_result_set_get_count(mapped) == 50, "expected 50 rows in the mapped result set\n");
+
+  // nothing is made until it is read
+  cql_int32 refs = cql_outstanding_refs;
+  E(cql_result_set_get_int64_col(mapped, 9, 4) == 9000000000000, "expected l is 9000000000000\n");
+  E(!cql_result_set_get_is_null_col(mapped, 8, 6), "expected s is not null\n");
+  E(cql_result_set_get_is_null_col(mapped, 4, 7), "expected ns is null\n");
+  E(cql_outstanding_refs == refs, "expected no new references\n");
+
+  cql_string_ref s = cql_result_set_get_string_col(mapped, 8, 6);
+  E(!strcmp(s->ptr, "str_8"), "expected s is str_8\n");
+  E(cql_result_set_get_string_col(mapped, 8, 6) == s, "expected the same string the second time\n");
+  E(cql_outstanding_refs == refs + 1, "expected one new reference\n");
+  E(cql_result_set_get_meta(mapped)->heapPending, "expected the other cells still pending\n");
+
+  // using the rows directly makes the rest
+  load_wire_format_rows_result_set_ref rows = (load_wire_format_rows_result_set_ref)mapped;
+  E(!strcmp(load_wire_format_rows_get_s(rows, 7)->ptr, "str_7"), "expected s is str_7\n");
+  E(!cql_result_set_get_meta(mapped)->heapPending, "expected no pending cells\n");
+
+  for (cql_int32 row = 0; row < 50; row++) {
+    E(meta.rowsEqual((cql_result_set_ref)result_set, row, mapped, row), "row %d is different when mapped\n", row);
+  }
+
+  // a copy is an ordinary result set
+  cql_result_set_ref copy;
+  cql_rowset_copy(mapped, &copy, 10, 5);
+  cql_result_set_release(mapped);
+  E(cql_result_set_get_meta(copy)->teardown == cql_result_set_teardown, "expected an ordinary teardown\n");
+  E(meta.rowsEqual((cql_result_set_ref)result_set, 12, copy, 2), "copied row is different\n");
+  cql_result_set_release(copy);
+
+  // the wrong shape, and a file that is too short, are not accepted
+  cql_result_set_meta wrong_meta = meta;
+  wrong_meta.rowsize += 8;
+  E(cql_result_set_from_file(&wrong_meta, path, &mapped) == SQLITE_ERROR, "wrong shape accepted\n");
+  E(!mapped, "expected no result set for the wrong shape\n");
+
+  // every slot is checked when the file is opened: a NOT NULL string that is
+  // null, or one outside of the heap, is not accepted (the heap offset and size
+  // are the last two fields of the 24 byte header)
+  uint32_t heap_bounds[2];
+  f = fopen(path, "r+b");
+  E(f && fseek(f, 16, SEEK_SET) == 0 && fread(heap_bounds, sizeof(heap_bounds), 1, f) == 1, "could not read the header\n");
+  long slot_offset = (long)(heap_bounds[0] - 50 * meta.rowsize + 8 * meta.rowsize + meta.columnOffsets[7]);
+  uintptr_t bad_slots[] = { 0, (uintptr_t)heap_bounds[1] + 1 };
+  for (int32_t i = 0; i < 2; i++) {
+    E(fseek(f, slot_offset, SEEK_SET) == 0 && fwrite(&bad_slots[i], sizeof(uintptr_t), 1, f) == 1, "could not damage the file\n");
+    fflush(f);
+    E(cql_result_set_from_file(&meta, path, &mapped) == SQLITE_ERROR, "bad slot %d accepted\n", i);
+    E(!mapped, "expected no result set for a bad slot\n");
+  }
+  fclose(f);
+
+  E(truncate(path, 100) == 0, "could not truncate the file\n");
+  E(cql_result_set_from_file(&meta, path, &mapped) == SQLITE_ERROR, "truncated file accepted\n");
+
+  unlink(path);
+  E(cql_result_set_from_file(&meta, path, &mapped) == SQLITE_CANTOPEN, "missing file opened\n");
+
+  cql_result_set_release(result_set);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// With lazy strings the fetch makes no strings or blobs at all, the generic and
+// generated getters make (and keep) just the ones they read, and the rows end up the same
+// as an ordinary fetch once everything has been made.
+cql_code test_lazy_strings(sqlite3 *db) {
+  printf("Running lazy strings test\n");
+  tests++;
+
+  cql_int32 refs = cql_outstanding_refs;
+  load_lazy_strings_result_set_ref lazy;
+  SQL_E(load_lazy_strings_fetch_results(db, &lazy));
+  cql_result_set_ref rs = (cql_result_set_ref)lazy;
+  E(cql_outstanding_refs == refs + 1, "expected only the result set to be made\n");
+  E(cql_result_set_get_count(rs) == 50, "expected 50 rows from result table\n");
+
+  // the generated getters of other columns don't make anything
+  E(load_lazy_strings_get_l(lazy, 9) == 9000000000000, "expected l is 9000000000000\n");
+  E(load_lazy_strings_get_i(lazy, 3) == 3, "expected i is 3\n");
+  E(load_lazy_strings_get_nd_is_null(lazy, 5), "expected nd is null\n");
+  E(cql_result_set_get_meta(rs)->heapPending, "expected the cells still pending\n");
+  E(cql_outstanding_refs == refs + 1, "expected no new references\n");
+
+  // and the string and blob getters make only the cell they read
+  E(!strcmp(load_lazy_strings_get_s(lazy, 2)->ptr, "str_2"), "expected s is str_2\n");
+  E(load_lazy_strings_get_s(lazy, 2) == cql_result_set_get_string_col(rs, 2, 6), "expected the same string\n");
+  E(!load_lazy_strings_get_nbl(lazy, 6), "expected nbl is null\n");
+  E(cql_result_set_get_meta(rs)->heapPending, "expected the other cells still pending\n");
+  E(cql_outstanding_refs == refs + 2, "expected one new reference\n");
+
+  E(cql_result_set_get_is_null_col(rs, 6, 9), "expected nbl is null\n");
+  E(!cql_result_set_get_is_null_col(rs, 7, 9), "expected nbl is not null\n");
+
+  cql_string_ref s = cql_result_set_get_string_col(rs, 3, 6);
+  E(!strcmp(s->ptr, "str_3"), "expected s is str_3\n");
+  E(cql_result_set_get_string_col(rs, 3, 6) == s, "expected the same string the second time\n");
+  E(cql_result_set_get_string_col(rs, 14, 7)->length == 0, "expected ns is empty\n");
+  cql_blob_ref b = cql_result_set_get_blob_col(rs, 7, 9);
+  E(b->size == 1 && !((const uint8_t *)b->ptr)[0], "expected nbl is a zero byte\n");
+  E(!cql_result_set_get_string_col(rs, 4, 7), "expected ns is null\n");
+  E(cql_outstanding_refs == refs + 5, "expected only four strings and blobs\n");
+  E(cql_result_set_get_meta(rs)->heapPending, "expected the other cells still pending\n");
+
+  // a value that is kept stays good after the result set is gone
+  cql_string_retain(s);
+
+  load_wire_format_rows_result_set_ref eager;
+  SQL_E(load_wire_format_rows_fetch_results(db, &eager));
+  for (cql_int32 row = 0; row < 50; row++) {
+    E(cql_result_set_get_meta(rs)->rowsEqual((cql_result_set_ref)eager, row, rs, row), "row %d is different when lazy\n", row);
+  }
+  E(!cql_result_set_get_meta(rs)->heapPending, "expected no pending cells\n");
+  E(!strcmp(load_lazy_strings_get_s(lazy, 7)->ptr, "str_7"), "expected s is str_7\n");
+
+  cql_result_set_release(eager);
+  cql_result_set_release(lazy);
+
+  E(!strcmp(s->ptr, "str_3"), "expected s is still str_3\n");
+  cql_string_release(s);
+
+  // released while still pending
+  SQL_E(load_lazy_strings_fetch_results(db, &lazy));
+  E(!strcmp(cql_result_set_get_string_col((cql_result_set_ref)lazy, 5, 6)->ptr, "str_5"), "expected s is str_5\n");
+  cql_result_set_release(lazy);
+
+  tests_passed++;
+  return SQLITE_OK;
+}
+
 cql_code test_all_column_encoded_cursor(sqlite3 *db) {
   printf("Running column encoded cursor fetchers test\n");
   tests++;
@@ -1782,6 +2213,14 @@ void corrupt_blob_with_invalid_shenanigans(cql_blob_ref b) {
   }
 }
 
+// How many times the reference runtime has seen the given rebuild step finish
+static int32_t rebuild_step_count(const char *step) {
+  int32_t count;
+  double seconds;
+  cql_rebuild_step_stats(step, &count, &seconds);
+  return seconds >= 0 ? count : -1;
+}
+
 // This test first creates a sample recreate group with twp dependent tables
 // one table with interesting string literals, and an index that will exist in sqlite_master.
 // We will make sure the function succesfully drops and recreates with SQLITE_OK.
@@ -1789,7 +2228,9 @@ cql_code test_cql_rebuild_recreate_group(sqlite3 *db) {
   cql_string_ref tables = cql_string_ref_new(" CREATE TABLE g1( id INTEGER PRIMARY KEY, name TEXT ); "
                                             "CREATE TABLE use_g1( id INTEGER PRIMARY KEY REFERENCES g1 (id), name2 TEXT); "
                                             "CREATE TABLE foo(y text DEFAULT 'it''s, ('); ");
-  cql_string_ref indices = cql_string_ref_new("CREATE INDEX extra_index ON g1 (id); ");
+  cql_string_ref indices = cql_string_ref_new("CREATE INDEX extra_index ON g1 (id); "
+                                             "CREATE INDEX use_g1_ON_index ON use_g1 (name2); "
+                                             "CREATE INDEX g1_name_index ON g1 (name); ");
   cql_string_ref deletes = cql_string_ref_new("DROP TABLE IF EXISTS g2; ");
   cql_code rc;
   cql_bool result = false;
@@ -1797,12 +2238,235 @@ cql_code test_cql_rebuild_recreate_group(sqlite3 *db) {
   E(rc == SQLITE_OK, "expected succesful table creates\n");
   rc = cql_exec_internal(db, indices);
   E(rc == SQLITE_OK, "expected succesful index create\n");
+  rc = cql_exec(db, "INSERT INTO g1 VALUES(1, 'one')");
+  E(rc == SQLITE_OK, "expected succesful insert\n");
+  int32_t parses = rebuild_step_count("parse");
+  int32_t deletes_runs = rebuild_step_count("deletes");
+  int32_t rebuilds = rebuild_step_count("rebuild");
+  int32_t drops = rebuild_step_count("drops");
+  int32_t creates = rebuild_step_count("creates");
   rc = cql_rebuild_recreate_group(db, tables, indices, deletes, &result);
   E(rc == SQLITE_OK, "expected succesful recreate group upgrade\n");
+
+  // every step of a plain recreate was timed, there was no attempt to keep the data
+  E(rebuild_step_count("parse") == parses + 1, "expected the parse step to be timed\n");
+  E(rebuild_step_count("deletes") == deletes_runs + 1, "expected the deletes step to be timed\n");
+  E(rebuild_step_count("rebuild") == rebuilds, "expected no rebuild step\n");
+  E(rebuild_step_count("drops") == drops + 1, "expected the drops step to be timed\n");
+  E(rebuild_step_count("creates") == creates + 1, "expected the creates step to be timed\n");
+
+  // the tables were recreated (hence empty) and every index came back on its own table
+  sqlite3_stmt *stmt = NULL;
+  rc = sqlite3_prepare_v2(db,
+    "SELECT (SELECT count(*) FROM g1), group_concat(name || ':' || tbl_name, ',') "
+    "FROM (SELECT name, tbl_name FROM sqlite_master WHERE type = 'index' AND name NOT LIKE 'sqlite%' ORDER BY name)",
+    -1, &stmt, NULL);
+  E(rc == SQLITE_OK, "expected succesful prepare\n");
+  E(sqlite3_step(stmt) == SQLITE_ROW, "expected a row\n");
+  E(sqlite3_column_int(stmt, 0) == 0, "expected g1 to have been recreated\n");
+  E(!strcmp((const char *)sqlite3_column_text(stmt, 1), "extra_index:g1,g1_name_index:g1,use_g1_ON_index:use_g1"),
+    "indices not recreated correctly: %s\n", sqlite3_column_text(stmt, 1));
+  sqlite3_finalize(stmt);
+
+  // a failure part way through leaves the group exactly as it was
+  rc = cql_exec(db, "INSERT INTO g1 VALUES(2, 'two')");
+  E(rc == SQLITE_OK, "expected succesful insert\n");
+  cql_string_ref bad_tables = cql_string_ref_new("CREATE TABLE g1( id INTEGER PRIMARY KEY, name TEXT ); "
+                                                "CREATE TABLE use_g1( id INTEGER PRIMARY KEY REFERENCES g1 (id), name2 TEXT); "
+                                                "CREATE TABLE foo(y text DEFAULT 'it''s, (', y text); ");
+  rc = cql_rebuild_recreate_group(db, bad_tables, indices, deletes, &result);
+  cql_string_release(bad_tables);
+  E(rc != SQLITE_OK, "expected the duplicate column to fail the recreate group upgrade\n");
+  rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM g1", -1, &stmt, NULL);
+  E(rc == SQLITE_OK, "expected g1 to still be there\n");
+  E(sqlite3_step(stmt) == SQLITE_ROW, "expected a row\n");
+  E(sqlite3_column_int(stmt, 0) == 1, "expected the failed rebuild to be rolled back\n");
+  sqlite3_finalize(stmt);
+
+  // an index that can't be parsed fails the upgrade before anything is touched
+  cql_string_ref bad_indices = cql_string_ref_new("CREATE INDEX extra_index ON g1 (id); "
+                                                 "CREATE INDEX no_table_index; ");
+  parses = rebuild_step_count("parse");
+  deletes_runs = rebuild_step_count("deletes");
+  rc = cql_rebuild_recreate_group(db, tables, bad_indices, deletes, &result);
+  cql_string_release(bad_indices);
+  E(rc != SQLITE_OK, "expected the malformed index to fail the recreate group upgrade\n");
+  E(!result, "expected no rebuild\n");
+  E(rebuild_step_count("parse") == parses + 1, "expected the parse step to be timed\n");
+  E(rebuild_step_count("deletes") == deletes_runs, "expected nothing to run after the parse\n");
+  rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM g1", -1, &stmt, NULL);
+  E(rc == SQLITE_OK, "expected g1 to still be there\n");
+  E(sqlite3_step(stmt) == SQLITE_ROW, "expected a row\n");
+  E(sqlite3_column_int(stmt, 0) == 1, "expected g1 to be untouched\n");
+  sqlite3_finalize(stmt);
+
   cql_string_release(tables);
   cql_string_release(indices);
   cql_string_release(deletes);
-  return rc;
+  return SQLITE_OK;
+}
+
+// Runs the query and checks that its one text result is as expected
+static cql_code expect_text(sqlite3 *db, const char *sql, const char *expected) {
+  sqlite3_stmt *stmt = NULL;
+  cql_code rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  E(rc == SQLITE_OK, "expected succesful prepare of %s\n", sql);
+  E(sqlite3_step(stmt) == SQLITE_ROW, "expected a row from %s\n", sql);
+  const char *actual = (const char *)sqlite3_column_text(stmt, 0);
+  cql_bool ok = actual && !strcmp(actual, expected);
+  if (!ok) {
+    printf("%s\n  expected: %s\n  actual: %s\n", sql, expected, actual ? actual : "null");
+  }
+  sqlite3_finalize(stmt);
+  E(ok, "query result mismatch\n");
+  return SQLITE_OK;
+}
+
+cql_code test_cql_rebuild_recreate_group_preserving_data(sqlite3 *db) {
+  printf("Running cql_rebuild_recreate_group_preserving_data test\n");
+  tests++;
+
+  SQL_E(cql_exec(db,
+    "CREATE TABLE rebuild_facets(facet TEXT PRIMARY KEY, version LONG INTEGER);"
+    "CREATE TABLE rp(id INTEGER PRIMARY KEY, name TEXT);"
+    "CREATE TABLE rc(id INTEGER PRIMARY KEY, p_id INTEGER REFERENCES rp(id), note TEXT);"
+    "INSERT INTO rp VALUES(1, 'one'), (2, 'two');"
+    "INSERT INTO rc VALUES(10, 1, 'x'), (20, 2, 'y');"));
+
+  // rp gets a column, rc loses one and gets an index; the surviving columns are kept
+  cql_string_ref tables = cql_string_ref_new("CREATE TABLE rp(id INTEGER PRIMARY KEY, name TEXT, extra TEXT); "
+                                            "CREATE TABLE rc(id INTEGER PRIMARY KEY, p_id INTEGER REFERENCES rp(id)); ");
+  cql_string_ref indices = cql_string_ref_new("CREATE INDEX rc_p_id ON rc (p_id); ");
+  cql_string_ref deletes = cql_string_ref_new("");
+  cql_string_ref facets = cql_string_ref_new("rebuild_facets");
+  cql_bool result = false;
+  int32_t rebuilds = rebuild_step_count("rebuild");
+  int32_t drops = rebuild_step_count("drops");
+  cql_code rc = cql_rebuild_recreate_group_preserving_data(db, tables, indices, deletes, facets, &result);
+  cql_string_release(tables);
+  E(rc == SQLITE_OK, "expected succesful rebuild\n");
+  E(result, "expected the group to be rebuilt, not recreated\n");
+  E(rebuild_step_count("rebuild") == rebuilds + 1, "expected the rebuild step to be timed\n");
+  E(rebuild_step_count("drops") == drops, "expected no drops step after a rebuild\n");
+  SQL_E(expect_text(db, "SELECT group_concat(id || name || ifnull(extra, '-'), ',') FROM rp", "1one-,2two-"));
+  SQL_E(expect_text(db, "SELECT group_concat(id || ':' || p_id, ',') FROM rc", "10:1,20:2"));
+  SQL_E(expect_text(db, "SELECT tbl_name FROM sqlite_master WHERE name = 'rc_p_id'", "rc"));
+  SQL_E(expect_text(db, "SELECT count(*) FROM sqlite_master WHERE name LIKE 'cql_rebuild_new%'", "0"));
+
+  // a new NOT NULL column with no default can't be filled in, so the group is recreated
+  tables = cql_string_ref_new("CREATE TABLE rp(id INTEGER PRIMARY KEY, name TEXT, extra TEXT, needed TEXT NOT NULL); "
+                              "CREATE TABLE rc(id INTEGER PRIMARY KEY, p_id INTEGER REFERENCES rp(id)); ");
+  rc = cql_rebuild_recreate_group_preserving_data(db, tables, indices, deletes, facets, &result);
+  E(rc == SQLITE_OK, "expected succesful recreate\n");
+  E(!result, "expected the group to be recreated\n");
+  SQL_E(expect_text(db, "SELECT count(*) FROM rp", "0"));
+  SQL_E(expect_text(db, "SELECT count(*) FROM pragma_table_info('rp')", "4"));
+
+  // with foreign keys enforced, anything that refers to the group forces the recreate
+  SQL_E(cql_exec(db, "INSERT INTO rp VALUES(1, 'one', NULL, 'n'); PRAGMA foreign_keys = ON;"));
+  rc = cql_rebuild_recreate_group_preserving_data(db, tables, indices, deletes, facets, &result);
+  SQL_E(cql_exec(db, "PRAGMA foreign_keys = OFF"));
+  E(rc == SQLITE_OK, "expected succesful recreate\n");
+  E(!result, "expected the group to be recreated when foreign keys are enforced\n");
+  SQL_E(expect_text(db, "SELECT count(*) FROM rp", "0"));
+
+  cql_string_release(tables);
+  cql_string_release(indices);
+  cql_string_release(deletes);
+  cql_string_release(facets);
+  SQL_E(cql_exec(db, "DROP TABLE rc; DROP TABLE rp; DROP TABLE rebuild_facets;"));
+  tests_passed++;
+  return SQLITE_OK;
+}
+
+// The copy ahead of the rebuild goes one batch per call, records its progress, and
+// starts over if a row it already copied changes
+cql_code test_cql_rebuild_copy_group_data(sqlite3 *db) {
+  printf("Running cql_rebuild_copy_group_data test\n");
+  tests++;
+
+  // two and a bit batches worth of rows
+  char *sql = sqlite3_mprintf(
+    "CREATE TABLE rebuild_facets(facet TEXT PRIMARY KEY, version LONG INTEGER);"
+    "CREATE TABLE big(id INTEGER PRIMARY KEY, v TEXT, gone TEXT);"
+    "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %d) "
+    "INSERT INTO big SELECT i, 'v' || i, 'g' FROM n;", 2 * CQL_REBUILD_COPY_BATCH_ROWS + 1);
+  SQL_E(cql_exec(db, sql));
+  sqlite3_free(sql);
+
+  char progress[32];
+  char rows[32];
+  const char *progress_sql = "SELECT ifnull(max(version), -1) FROM rebuild_facets WHERE facet = 'cql_rebuild_copy_big'";
+  cql_string_ref tables = cql_string_ref_new("CREATE TABLE big(id INTEGER PRIMARY KEY, v TEXT, more TEXT DEFAULT 'm'); ");
+  cql_string_ref indices = cql_string_ref_new("");
+  cql_string_ref deletes = cql_string_ref_new("");
+  cql_string_ref facets = cql_string_ref_new("rebuild_facets");
+  cql_bool pending = false;
+
+  cql_code rc = cql_rebuild_copy_group_data(db, tables, facets, &pending);
+  E(rc == SQLITE_OK, "expected succesful copy\n");
+  E(pending, "expected more rows to copy\n");
+  snprintf(progress, sizeof(progress), "%d", CQL_REBUILD_COPY_BATCH_ROWS);
+  SQL_E(expect_text(db, progress_sql, progress));
+  SQL_E(expect_text(db, "SELECT count(*) FROM cql_rebuild_new_big", progress));
+  SQL_E(expect_text(db, "SELECT count(*) FROM sqlite_master WHERE type = 'trigger' AND tbl_name = 'big'", "3"));
+
+  // the next call (it could be in a later run) resumes after the recorded row
+  rc = cql_rebuild_copy_group_data(db, tables, facets, &pending);
+  E(rc == SQLITE_OK && pending, "expected the copy to resume\n");
+  snprintf(progress, sizeof(progress), "%d", 2 * CQL_REBUILD_COPY_BATCH_ROWS);
+  SQL_E(expect_text(db, progress_sql, progress));
+
+  // changing a row that was already copied discards the progress, the copy starts over
+  SQL_E(cql_exec(db, "UPDATE big SET v = 'changed' WHERE id = 1"));
+  SQL_E(expect_text(db, progress_sql, "-1"));
+  rc = cql_rebuild_copy_group_data(db, tables, facets, &pending);
+  E(rc == SQLITE_OK && pending, "expected the copy to start over\n");
+  snprintf(progress, sizeof(progress), "%d", CQL_REBUILD_COPY_BATCH_ROWS);
+  SQL_E(expect_text(db, progress_sql, progress));
+  SQL_E(expect_text(db, "SELECT v FROM cql_rebuild_new_big WHERE id = 1", "changed"));
+
+  // rows that weren't copied yet can change freely
+  SQL_E(cql_exec(db, "UPDATE big SET v = 'late' WHERE id = (SELECT max(id) FROM big)"));
+  SQL_E(expect_text(db, progress_sql, progress));
+
+  int32_t calls = 0;
+  do {
+    rc = cql_rebuild_copy_group_data(db, tables, facets, &pending);
+    E(rc == SQLITE_OK, "expected succesful copy\n");
+    calls++;
+  } while (pending && calls < 10);
+  E(!pending, "expected the copy to finish\n");
+  snprintf(rows, sizeof(rows), "%d", 2 * CQL_REBUILD_COPY_BATCH_ROWS + 1);
+  SQL_E(expect_text(db, "SELECT count(*) FROM cql_rebuild_new_big", rows));
+
+  // the rebuild finishes with the copy that is already there and cleans up after it
+  cql_bool result = false;
+  rc = cql_rebuild_recreate_group_preserving_data(db, tables, indices, deletes, facets, &result);
+  E(rc == SQLITE_OK, "expected succesful rebuild\n");
+  E(result, "expected the group to be rebuilt, not recreated\n");
+  SQL_E(expect_text(db, "SELECT count(*) FROM big", rows));
+  SQL_E(expect_text(db, "SELECT v || more FROM big WHERE id = 1", "changedm"));
+  SQL_E(expect_text(db, "SELECT v FROM big WHERE id = (SELECT max(id) FROM big)", "late"));
+  SQL_E(expect_text(db, "SELECT count(*) FROM sqlite_master WHERE name LIKE 'cql_rebuild%'", "0"));
+  SQL_E(expect_text(db, "SELECT count(*) FROM rebuild_facets", "0"));
+
+  // a group that can't keep its data is not copied ahead at all
+  cql_string_release(tables);
+  tables = cql_string_ref_new("CREATE TABLE big(id INTEGER PRIMARY KEY, v TEXT, needed TEXT NOT NULL); ");
+  rc = cql_rebuild_copy_group_data(db, tables, facets, &pending);
+  E(rc == SQLITE_OK, "expected the copy to be skipped quietly\n");
+  E(!pending, "expected nothing pending\n");
+  SQL_E(expect_text(db, "SELECT count(*) FROM sqlite_master WHERE name LIKE 'cql_rebuild%'", "0"));
+  SQL_E(expect_text(db, "SELECT count(*) FROM rebuild_facets", "0"));
+
+  cql_string_release(tables);
+  cql_string_release(indices);
+  cql_string_release(deletes);
+  cql_string_release(facets);
+  SQL_E(cql_exec(db, "DROP TABLE big; DROP TABLE rebuild_facets;"));
+  tests_passed++;
+  return SQLITE_OK;
 }
 
 void take_bool(cql_nullable_bool x, cql_nullable_bool y)
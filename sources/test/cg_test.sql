@@ -76,9 +76,9 @@ set t0_nullable := t2;
 set t0_nullable := null;
 
 -- TEST: simple unary operators
--- + SET i2 := - -1;
--- + i2 = - - 1;
-set i2 := - -1;
+-- + SET i2 := - -i2;
+-- + i2 = - - i2;
+set i2 := - -i2;
 
 -- + cql_set_notnull(i0_nullable, - i2);
 set i0_nullable := -i2;
@@ -99,8 +99,8 @@ set r0_nullable := null;
 -- + r2 = 3.5%;
 set r2 := 3.5;
 
--- + cql_set_nullable(_tmp_n_bool_1, i0_nullable.is_null, ! i0_nullable.value);
--- + cql_set_nullable(_tmp_n_bool_0, _tmp_n_bool_1.is_null, ! _tmp_n_bool_1.value);
+-- + cql_set_nullable(_tmp_n_bool_0, i0_nullable.is_null, ! i0_nullable.value);
+-- + cql_set_nullable(_tmp_n_bool_0, _tmp_n_bool_0.is_null, ! _tmp_n_bool_0.value);
 -- + cql_set_nullable(i1_nullable, _tmp_n_bool_0.is_null, _tmp_n_bool_0.value);
 set i1_nullable := NOT NOT i0_nullable;
 
@@ -108,9 +108,38 @@ set i1_nullable := NOT NOT i0_nullable;
 set i2 := NOT NOT b2;
 
 -- TEST: not null arithmetic
--- + i2 = 1 * 3 + 5;
+-- + i2 = i2 * 3 + 5;
+set i2 := i2 * 3 + 5;
+
+-- TEST: constant arithmetic is folded
+-- + i2 = 8;
 set i2 := 1 * 3 + 5;
 
+-- TEST: constant folding uses the type of the expression
+-- + r2 = 3.5%e+00;
+set r2 := 1 + 2.5;
+
+-- TEST: reals that would not print exactly are not folded
+-- + r2 = 0.1 + 0.2;
+set r2 := 0.1 + 0.2;
+
+-- TEST: constant null results are folded too
+-- + cql_set_null(i0_nullable);
+-- - _tmp
+set i0_nullable := 1 + null;
+
+-- TEST: negative constants are safe in unary contexts
+-- + i2 = - i2 - -4;
+set i2 := -i2 - (1 - 5);
+
+-- TEST: integer operations at the edges of the range still fold, the ones that
+-- overflow are not folded (see sem_test, the C compiler rejects them here)
+-- + i2 = -2147483647;
+set i2 := -2147483647 - 1 + 1;
+
+-- + l2 = _64(9223372036854775807);
+set l2 := 9223372036854775806 + 1;
+
 -- TEST: everything in sight is nullable
 -- + cql_combine_nullables(r0_nullable, r0_nullable.is_null, i1_nullable.is_null, r0_nullable.value * i1_nullable.value);
 set r0_nullable := r0_nullable * i1_nullable;
@@ -128,16 +157,23 @@ set i0_nullable := 12 * i1_nullable;
 set i0_nullable := null * i1_nullable;
 
 -- TEST: make sure the stacking is working correctly
+-- + cql_combine_nullables(_tmp_n_double_0, r0_nullable.is_null, i1_nullable.is_null, r0_nullable.value * i1_nullable.value);
 -- + cql_combine_nullables(_tmp_n_double_1, r0_nullable.is_null, i1_nullable.is_null, r0_nullable.value * i1_nullable.value);
--- + cql_combine_nullables(_tmp_n_double_2, r0_nullable.is_null, i1_nullable.is_null, r0_nullable.value * i1_nullable.value);
--- + cql_combine_nullables(r0_nullable, _tmp_n_double_1.is_null, _tmp_n_double_2.is_null, _tmp_n_double_1.value + _tmp_n_double_2.value);
+-- + cql_combine_nullables(r0_nullable, _tmp_n_double_0.is_null, _tmp_n_double_1.is_null, _tmp_n_double_0.value + _tmp_n_double_1.value);
 set r0_nullable := r0_nullable * i1_nullable + r0_nullable * i1_nullable;
 
+-- TEST: a long left associated chain needs only one scratch variable
+-- +3 cql_combine_nullables(_tmp_n_double_0, _tmp_n_double_0.is_null,
+-- - _tmp_n_double_1
+set r0_nullable := r0_nullable * i1_nullable + r0_nullable + i1_nullable - r0_nullable + i0_nullable;
+
 -- TEST: a more complex stacking example
--- + cql_combine_nullables(_tmp_n_double_2, r0_nullable.is_null, i1_nullable.is_null, r0_nullable.value * i1_nullable.value);
--- + cql_combine_nullables(_tmp_n_double_3, r0_nullable.is_null, i0_nullable.is_null, r0_nullable.value * i0_nullable.value);
--- + cql_combine_nullables(_tmp_n_double_1, _tmp_n_double_2.is_null, _tmp_n_double_3.is_null, _tmp_n_double_2.value + _tmp_n_double_3.value);
--- + cql_combine_nullables(r0_nullable, _tmp_n_double_1.is_null, r0_nullable.is_null, _tmp_n_double_1.value + r0_nullable.value);
+-- the left operand of each operator shares the slot of the result
+-- + cql_combine_nullables(_tmp_n_double_0, r0_nullable.is_null, i1_nullable.is_null, r0_nullable.value * i1_nullable.value);
+-- + cql_combine_nullables(_tmp_n_double_1, r0_nullable.is_null, i0_nullable.is_null, r0_nullable.value * i0_nullable.value);
+-- + cql_combine_nullables(_tmp_n_double_0, _tmp_n_double_0.is_null, _tmp_n_double_1.is_null, _tmp_n_double_0.value + _tmp_n_double_1.value);
+-- + cql_combine_nullables(r0_nullable, _tmp_n_double_0.is_null, r0_nullable.is_null, _tmp_n_double_0.value + r0_nullable.value);
+-- - _tmp_n_double_2
 set r0_nullable := (r0_nullable * i1_nullable + r0_nullable * i0_nullable) + r0_nullable;
 
 -- TEST: string assignment -- nasty string
@@ -186,9 +222,9 @@ declare function side_effect2() integer;
 -- +  i2 = _tmp_bool_0;
 set i2 := coalesce(side_effect1(), 7) and coalesce(side_effect2(), 5);
 
--- TEST: trival NULL on AND
--- + cql_set_null(_tmp_n_bool_0);
--- + cql_set_nullable(i0_nullable, _tmp_n_bool_0.is_null, _tmp_n_bool_0.value);
+-- TEST: trival NULL on AND, this folds to null
+-- + cql_set_null(i0_nullable);
+-- - _tmp_n_bool_0
 set i0_nullable := NULL and NULL;
 
 -- TEST: logical AND with nullables
@@ -237,9 +273,9 @@ set i2 := r2 or l2;
 -- +  i2 = _tmp_bool_0;
 set i2 := coalesce(side_effect1(), 7) or coalesce(side_effect2(), 5);
 
--- TEST: trival NULL on OR
--- + cql_set_null(_tmp_n_bool_0);
--- + cql_set_nullable(i0_nullable, _tmp_n_bool_0.is_null, _tmp_n_bool_0.value);
+-- TEST: trival NULL on OR, this folds to null
+-- + cql_set_null(i0_nullable);
+-- - _tmp_n_bool_0
 set i0_nullable := NULL or NULL;
 
 -- TEST: logical OR with nullables
@@ -268,7 +304,7 @@ set i2 := null is null;
 set i2 := (i0_nullable + i1_nullable) is null;
 
 -- TEST: is not null basic test
--- + i2 = !1;
+-- + i2 = 0;
 set i2 := null is not null;
 
 -- TEST: is not null test general case
@@ -441,8 +477,8 @@ end;
 -- + cql_nullable_int64 longint_var = { .is_null = 1 };
 declare longint_var long integer;
 
--- + cql_combine_nullables(_tmp_n_int64_1, l0_nullable.is_null, l1_nullable.is_null, l0_nullable.value + l1_nullable.value);
--- + cql_set_nullable(longint_var, _tmp_n_int64_1.is_null, _tmp_n_int64_1.value * 5);
+-- + cql_combine_nullables(_tmp_n_int64_0, l0_nullable.is_null, l1_nullable.is_null, l0_nullable.value + l1_nullable.value);
+-- + cql_set_nullable(longint_var, _tmp_n_int64_0.is_null, _tmp_n_int64_0.value * 5);
 set longint_var := (l0_nullable + l1_nullable) * 5;
 
 -- TEST: make a cursor
@@ -550,16 +586,20 @@ end;
 
 -- TEST: a simple case expression
 -- + do {
--- +  if (1) {
+-- +  if (i2) {
 -- +   i2 = 100;
 -- +   break;
 -- +  }
--- +  if (2) {
+-- +  if (b2) {
 -- +   i2 = 200;
 -- +   break;
 -- +  }
 -- +  i2 = 300;
 -- + } while (0);
+set i2 := case when i2 then 100 when b2 then 200 when null then 500 else 300 end;
+
+-- TEST: a constant case expression is folded
+-- + i2 = 100;
 set i2 := case when 1 then 100 when 2 then 200 when null then 500 else 300 end;
 
 -- TEST: a simple in expression
@@ -881,8 +921,8 @@ set s := printf('%d and %d', 1, 2);
 set s := printf('%d and %d', 3, 4);
 
 -- TEST: printf inserts casts for numeric types (but only as needed)
--- + sqlite3_mprintf("%lld %lld %lld %llu %d %d %llu %d %f %f %s %f", ((cql_int64)(4)), _tmp_n_int64_%.value,
--- + ((cql_int64)!!(1)), _64(0), ((cql_int32)!!(0)), 0, _64(6), 7, 0.0, 0.0, NULL, ((cql_double)(8)));
+-- + sqlite3_mprintf("%lld %lld %lld %llu %d %d %llu %d %f %f %s %f", _64(4), _tmp_n_int64_%.value,
+-- + _64(1), _64(0), 0, 0, _64(6), 7, 0.0, 0.0, NULL, 8.000000e+00);
 set s := printf('%lld %lld %lld %llu %d %d %llu %d %f %f %s %f', 4, nullable(5), true, null, false, null, 6L, 7, 0.0, null, null, 8);
 
 -- TEST: printf doesn't insert casts when used in SQL
@@ -1321,10 +1361,10 @@ end;
 -- + INSERT INTO bar(id, name, rate, type, size) VALUES(_seed_, printf('name_%d', _seed_), _seed_, _seed_, _seed_)
 -- + @DUMMY_SEED(123) @DUMMY_DEFAULTS @DUMMY_NULLABLES;
 -- + _seed_ = 123;
--- + "INSERT INTO bar(id, name, rate, type, size) VALUES(?, printf('name_%d', ?), ?, ?, ?)"
--- + cql_multibind(&_rc_, _db_, &_temp_stmt, 5,
--- +4              CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_INT32, _seed_,
--- +               CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_INT32, _seed_);
+-- the seed is bound once and the other uses refer back to it
+-- + "INSERT INTO bar(id, name, rate, type, size) VALUES(?, printf('name_%d', ?1), ?1, ?1, ?1)"
+-- + cql_multibind(&_rc_, _db_, &_temp_stmt, 1,
+-- +1              CQL_DATA_TYPE_NOT_NULL | CQL_DATA_TYPE_INT32, _seed_);
 create proc dummy_user()
 begin
   insert into bar () values () @dummy_seed(123) @dummy_nullables @dummy_defaults;
@@ -2120,27 +2160,27 @@ set i2 := (select 'x' GLOB 'y');
 -- TEST: use lot of bitwise operators
 -- NOTE the SQL order of ops is different...
 -- no parens used here
--- +  SET i2 := 1 << 2 | 1 << 4 & 1 >> 8;
+-- +  SET i2 := i2 << 2 | i2 << 4 & i2 >> 8;
 -- in Sqlite binary math operators all bind equal and left to right so the above is the same as
---    SET i2 :=  (((((1 << 2) | 1) << 4) & 1) >> 8);
+--    SET i2 :=  (((((i2 << 2) | i2) << 4) & i2) >> 8);
 -- in C that becomes
 -- because i C  << and >> are stronger than | and &
--- + i2 = ((1 << 2 | 1) << 4 & 1) >> 8;
-set i2 := 1 << 2 | 1 << 4 & 1 >> 8;
+-- + i2 = ((i2 << 2 | i2) << 4 & i2) >> 8;
+set i2 := i2 << 2 | i2 << 4 & i2 >> 8;
 
 -- TEST: now maybe what you expected to see.  Force the issue with parens
--- + SET i2 := 1 << 2 | (1 << 4) & (1 >> 8);
+-- + SET i2 := i2 << 2 | (i2 << 4) & (i2 >> 8);
 -- Still not what you expected... remember | and & are EQUAL in sql
 -- so the above was parsed left to right...
--- + i2 = (1 << 2 | 1 << 4) & 1 >> 8;
-set i2 := (1 << 2) | (1 << 4) & (1 >> 8);
+-- + i2 = (i2 << 2 | i2 << 4) & i2 >> 8;
+set i2 := (i2 << 2) | (i2 << 4) & (i2 >> 8);
 
 -- TEST: this is really the normal thing
 -- some parens were redunant, removed...
--- + SET i2 := 1 << 2 | (1 << 4 & (1 >> 8));
+-- + SET i2 := i2 << 2 | (i2 << 4 & (i2 >> 8));
 -- now this is the usual C order of ops and no parens are in the C
--- + i2 = 1 << 2 | 1 << 4 & 1 >> 8;
-set i2 := (1 << 2) | ((1 << 4) & (1 >> 8));
+-- + i2 = i2 << 2 | i2 << 4 & i2 >> 8;
+set i2 := (i2 << 2) | ((i2 << 4) & (i2 >> 8));
 
 -- TEST: force a high binding ~
 -- nothing weird here, ~ binds very strong in both languages
@@ -2168,10 +2208,10 @@ begin
 end;
 
 -- TEST: IS patterns
--- + b = 1 == 1;
+-- + b = 1;
 -- + b = cql_string_equal(_literal_%_x_, _literal_%_x_);
 -- + b = cql_string_equal(_literal_%_x_, _literal_%_y_);
--- + b = !!(1 + (3 == 4));
+-- + b = 1;
 -- + cql_set_notnull(i, 1);
 -- + cql_set_notnull(j, 2);
 -- + b = ((i.is_null == j.is_null) && (j.is_null || i.value == j.value))
@@ -2202,10 +2242,10 @@ begin
 end;
 
 -- TEST: IS NOT patterns
--- + b = 1 != 1;
+-- + b = 0;
 -- + b = !cql_string_equal(_literal_%_x_, _literal_%_x_);
 -- + b = !cql_string_equal(_literal_%_x_, _literal_%_y_);
--- + b = !!(1 + (3 != 4));
+-- + b = !!(2);
 -- + cql_set_notnull(i, 1);
 -- + cql_set_notnull(j, 2);
 -- + b = !((i.is_null == j.is_null) && (j.is_null || i.value == j.value))
@@ -2871,6 +2911,16 @@ begin
   select * from bar;
 end;
 
+-- TEST: without --share_result_set_accessors a proc with the same shape as an earlier one
+-- still gets its own metadata tables, these are real symbols and not aliases
+-- + uint8_t same_shape_own_tables_data_types[same_shape_own_tables_data_types_count] = {
+-- + static cql_uint16 same_shape_own_tables_col_offsets[] = { 5,
+-- - #define same_shape_own_tables_col_offsets
+create proc same_shape_own_tables()
+begin
+  select * from bar;
+end;
+
 
 -- TEST: a copy function will be generated
 -- + cql_code sproc_with_copy(sqlite3 *_Nonnull _db_, sqlite3_stmt *_Nullable *_Nonnull _result_stmt)
@@ -2880,6 +2930,28 @@ begin
   select * from bar;
 end;
 
+-- TEST: strings and blobs are made only when they are read
+-- the getters make only the cell they read, the others read the rows as they are
+-- + .lazy_strings = 1,
+-- + return cql_fetch_all_results(&info, (cql_result_set_ref *)result_set);
+-- + sproc_with_lazy_strings_row *data = (sproc_with_lazy_strings_row *)cql_result_set_get_rows((cql_result_set_ref)result_set);
+-- + return cql_result_set_get_string_col((cql_result_set_ref)result_set, row, 1);
+-- + return cql_result_set_get_blob_col((cql_result_set_ref)result_set, row, 3);
+-- - cql_result_set_get_data(
+@attribute(cql:lazy_strings)
+create proc sproc_with_lazy_strings()
+begin
+  select id, name, rate, cast(name as blob) as bl from bar;
+end;
+
+-- TEST: no references, nothing to be lazy about
+-- - .lazy_strings
+@attribute(cql:lazy_strings)
+create proc sproc_with_lazy_strings_no_refs()
+begin
+  select id from bar;
+end;
+
 -- TEST: emit an object result set with setters with not null values
 -- + extern void emit_object_with_setters_set_o(emit_object_with_setters_result_set_ref _Nonnull result_set, cql_object_ref _Nonnull new_value) {
 -- +   cql_contract_argument_notnull((void *)new_value, 2);
@@ -3200,8 +3272,17 @@ begin
 end;
 
 -- TEST: numeric cast operation int32
--- + x = ((cql_int32)(3.2));
+-- + x = ((cql_int32)(r));
 create proc local_cast_int_notnull()
+begin
+  declare x integer not null;
+  let r := 3.2;
+  set x := cast(r as integer);
+end;
+
+-- TEST: numeric cast of a constant is folded
+-- + x = 3;
+create proc local_cast_int_constant()
 begin
   declare x integer not null;
   set x := cast(3.2 as integer);
@@ -3218,11 +3299,12 @@ begin
 end;
 
 -- TEST: numeric cast operation int64 nullable
--- + x = ((cql_int64)(3.2));
+-- + x = ((cql_int64)(r));
 create proc local_cast_long_notnull()
 begin
   declare x long not null;
-  set x := cast(3.2 as long);
+  let r := 3.2;
+  set x := cast(r as long);
 end;
 
 -- TEST: numeric cast operation int64 nullable
@@ -3236,11 +3318,12 @@ begin
 end;
 
 -- TEST: numeric cast operation real
--- + x = ((cql_double)(3));
+-- + x = ((cql_double)(i));
 create proc local_cast_real_notnull()
 begin
   declare x real not null;
-  set x := cast(3 as real);
+  let i := 3;
+  set x := cast(i as real);
 end;
 
 -- TEST: numeric cast operation real nullable
@@ -3254,11 +3337,12 @@ begin
 end;
 
 -- TEST: numeric cast operation bool (and normalize)
--- + x = ((cql_bool)!!(3.2));
+-- + x = ((cql_bool)!!(r));
 create proc local_cast_bool_notnull()
 begin
   declare x bool not null;
-  set x := cast(3.2 as bool);
+  let r := 3.2;
+  set x := cast(r as bool);
 end;
 
 -- TEST: numeric cast operation bool nullable (and normalize)
@@ -3370,114 +3454,115 @@ begin
 end;
 
 DECLARE x INTEGER NOT NULL;
+DECLARE n1, n2, n3, n4, n5 INTEGER NOT NULL;
 
 -- TEST: a series of paren checks on left association
 -- avoid hard coded divide by zero
--- + x = 1 * (4 / 3);
-SET x := 1 * (4 / 3);
+-- + x = n1 * (n4 / n3);
+SET x := n1 * (n4 / n3);
 
--- + x = 1 * 2 / 3;
-SET x := 1 * 2 / 3;
+-- + x = n1 * n2 / n3;
+SET x := n1 * n2 / n3;
 
--- + x = 1 + 2 / 3;
-SET x := 1 + 2 / 3;
+-- + x = n1 + n2 / n3;
+SET x := n1 + n2 / n3;
 
--- + x = 1 + (2 - 3);
-SET x := 1 + (2 - 3);
+-- + x = n1 + (n2 - n3);
+SET x := n1 + (n2 - n3);
 
--- + x = 1 + 2 * 3;
-SET x := 1 + 2 * 3;
+-- + x = n1 + n2 * n3;
+SET x := n1 + n2 * n3;
 
--- + x = 1 * (2 + 3);
-SET x := 1 * (2 + 3);
+-- + x = n1 * (n2 + n3);
+SET x := n1 * (n2 + n3);
 
--- + x = 1 - (2 + 3);
-SET x := 1 - (2 + 3);
+-- + x = n1 - (n2 + n3);
+SET x := n1 - (n2 + n3);
 
--- + x = 1 - (2 - 3);
-SET x := 1 - (2 - 3);
+-- + x = n1 - (n2 - n3);
+SET x := n1 - (n2 - n3);
 
--- + x = 1 - 2 - (2 - 3);
-SET x := 1 - 2 - (2 - 3);
+-- + x = n1 - n2 - (n2 - n3);
+SET x := n1 - n2 - (n2 - n3);
 
 -- the first parens do not change eval order from left to right at all
--- + x = 1 - 2 - (2 - 3);
-SET x := (1 - 2) - (2 - 3);
+-- + x = n1 - n2 - (n2 - n3);
+SET x := (n1 - n2) - (n2 - n3);
 
--- + x = 1 / 2 / 3;
-SET x := 1 / 2 / 3;
+-- + x = n1 / n2 / n3;
+SET x := n1 / n2 / n3;
 
 -- avoid hard coded divide by zero
--- + x = 1 / (4 / 3);
-SET x := 1 / (4 / 3);
+-- + x = n1 / (n4 / n3);
+SET x := n1 / (n4 / n3);
 
--- + x = 1 / 2;
-SET x := 1 / 2;
+-- + x = n1 / n2;
+SET x := n1 / n2;
 
--- + x = 1 * 2 * (3 * 4)
-SET x := 1 * 2 * (3 * 4);
+-- + x = n1 * n2 * (n3 * n4)
+SET x := n1 * n2 * (n3 * n4);
 
 -- the first parens don't change anything
 -- the second parens could matter if it was floating point
--- + x = 1 * 2 * (3 * 4)
-SET x := (1 * 2) * (3 * 4);
+-- + x = n1 * n2 * (n3 * n4)
+SET x := (n1 * n2) * (n3 * n4);
 
 -- note that in C & binds tighter than | so parens are required in C
 -- note that in SQL | and & are equal so this expression left associates
--- + x = (1 | 2) & 3;
-SET x := 1 | 2 & 3;
+-- + x = (n1 | n2) & n3;
+SET x := n1 | n2 & n3;
 
--- + x = 1 | 2 & 3;
-SET x := 1 | (2 & 3);
+-- + x = n1 | n2 & n3;
+SET x := n1 | (n2 & n3);
 
--- + x = 1 | 2 | 3
-SET x := 1 | 2 | 3;
+-- + x = n1 | n2 | n3
+SET x := n1 | n2 | n3;
 
 -- sub optimal but we're trying to preserve written order due to floating point
--- + x = 1 | (2 | 3)
-SET x := 1 | (2 | 3);
+-- + x = n1 | (n2 | n3)
+SET x := n1 | (n2 | n3);
 
--- + x = 1 | (3 + 4 | 5);
-SET x := 1 | (3 + 4 | 5);
+-- + x = n1 | (n3 + n4 | n5);
+SET x := n1 | (n3 + n4 | n5);
 
--- + x = 1 | 3 + (4 | 5);
-SET x := 1 | 3 + (4 | 5);
+-- + x = n1 | n3 + (n4 | n5);
+SET x := n1 | n3 + (n4 | n5);
 
--- +  x = (1 | 3) + (4 | 5);
-SET x := (1 | 3) + (4 | 5);
+-- +  x = (n1 | n3) + (n4 | n5);
+SET x := (n1 | n3) + (n4 | n5);
 
--- + x = (1 + 2) * 5;
-set x := (1 + 2) * 5;
+-- + x = (n1 + n2) * n5;
+set x := (n1 + n2) * n5;
 
--- + x = 1 + 2 - 1;
-set x := (1 + 2) - 1;
+-- + x = n1 + n2 - n1;
+set x := (n1 + n2) - n1;
 
--- + x = 1 << 2 | 3;
-set x := 1 << 2 | 3;
+-- + x = n1 << n2 | n3;
+set x := n1 << n2 | n3;
 
--- + x = 1 << (2 | 3);
-set x := 1 << (2 | 3);
+-- + x = n1 << (n2 | n3);
+set x := n1 << (n2 | n3);
 
--- + x = 1 | 2 << 3
-set x := 1 | (2 << 3);
+-- + x = n1 | n2 << n3
+set x := n1 | (n2 << n3);
 
--- + x = 1 << (2 << 3);
-set x := 1 << (2 << 3);
+-- + x = n1 << (n2 << n3);
+set x := n1 << (n2 << n3);
 
--- + x = 1 < (2 > 3);
-set x := 1 < (2 > 3);
+-- + x = n1 < (n2 > n3);
+set x := n1 < (n2 > n3);
 
--- + x = 1 << (2 >> 3);
-set x := 1 << (2 >> 3);
+-- + x = n1 << (n2 >> n3);
+set x := n1 << (n2 >> n3);
 
--- + x = 1 | (2 | 3);
-set x := 1 | (2 | 3);
+-- + x = n1 | (n2 | n3);
+set x := n1 | (n2 | n3);
 
--- + x = 1 | 2 | 3;
-set x := (1 | 2) | 3;
+-- + x = n1 | n2 | n3;
+set x := (n1 | n2) | n3;
 
--- + x = 1 == (2 != 3);
-set x := 1 == (2 != 3);
+-- + x = n1 == (n2 != n3);
+set x := n1 == (n2 != n3);
 
 create table SalesInfo(
   month integer,
@@ -4058,12 +4143,12 @@ end;
 -- + i = 1;
 -- + l = _64(1);
 -- + cql_set_string_ref(&t, _literal_%_T_various_lets);
--- + cql_set_notnull(nl, (~_64(2)));
--- + cql_set_notnull(ni, (2 + 2));
+-- + cql_set_notnull(nl, _64(-3));
+-- + cql_set_notnull(ni, 4);
 -- + cql_set_notnull(nr, 2.0);
 -- + cql_set_string_ref(&nt, _literal_%_NT_various_lets);
--- + sl = (~_64(3));
--- + si = (3 + 3);
+-- + sl = _64(-4);
+-- + si = 6;
 -- + sr = 3.0;
 -- + cql_set_string_ref(&st, _literal_%_ST_various_lets);
 -- - Error
@@ -4419,12 +4504,12 @@ end;
 select 1 x;
 
 -- TEST: we should infer a bool not null variable and compute is true correctly
--- + true_test = !!(1);
-let true_test := 1 is true;
+-- + true_test = !!(i2);
+let true_test := i2 is true;
 
 -- TEST: we should infer a bool not null variable and compute is false correctly
--- + false_test = !(0);
-let false_test := 0 is false;
+-- + false_test = !(i2);
+let false_test := i2 is false;
 
 -- TEST: we should infer a bool type and use the nullable version of the test
 -- + true_test = cql_is_nullable_true(i0_nullable.is_null, i0_nullable.value);
@@ -4435,12 +4520,16 @@ set true_test := i0_nullable is true;
 set false_test := i0_nullable is false;
 
 -- TEST: we should infer a bool not null variable and compute is true correctly
--- + true_test = !(1);
-set true_test := 1 is not true;
+-- + true_test = !(i2);
+set true_test := i2 is not true;
 
 -- TEST: we should infer a bool not null variable and compute is false correctly
--- + false_test = !!(0);
-set false_test := 0 is not false;
+-- + false_test = !!(i2);
+set false_test := i2 is not false;
+
+-- TEST: a constant is true test is folded
+-- + true_test = 1;
+set true_test := 1 is true;
 
 -- TEST: we should infer a bool type and use the nullable version of the test
 -- + true_test = !cql_is_nullable_true(i0_nullable.is_null, i0_nullable.value);
@@ -4544,33 +4633,33 @@ BEGIN
 END;
 
 -- TEST: codegen for sign
--- + _tmp_int_2 = - 2;
--- + sign_val_int = ((_tmp_int_2 > 0) - (_tmp_int_2 < 0));
+-- + _tmp_int_1 = - 2;
+-- + sign_val_int = ((_tmp_int_1 > 0) - (_tmp_int_1 < 0));
 LET sign_val_int := sign(-2);
 
 -- TEST: codegen for sign: nullable arg
--- + cql_set_notnull(_tmp_n_int_2, (-2));
--- + cql_set_nullable(sign_val_nullable, _tmp_n_int_2.is_null, ((_tmp_n_int_2.value > 0) - (_tmp_n_int_2.value < 0)));
+-- + cql_set_notnull(_tmp_n_int_1, (-2));
+-- + cql_set_nullable(sign_val_nullable, _tmp_n_int_1.is_null, ((_tmp_n_int_1.value > 0) - (_tmp_n_int_1.value < 0)));
 LET sign_val_nullable := sign(nullable(-2));
 
 -- TEST: codegen for absolute value
--- + _tmp_int_2 = - 2;
--- + abs_val_int = abs(_tmp_int_2);
+-- + _tmp_int_1 = - 2;
+-- + abs_val_int = abs(_tmp_int_1);
 LET abs_val_int := abs(-2);
 
 -- TEST: codegen for absolute value: nullable arg
--- + cql_set_notnull(_tmp_n_int_2, (-2));
--- + cql_set_nullable(abs_val_nullable, _tmp_n_int_2.is_null, abs(_tmp_n_int_2.value));
+-- + cql_set_notnull(_tmp_n_int_1, (-2));
+-- + cql_set_nullable(abs_val_nullable, _tmp_n_int_1.is_null, abs(_tmp_n_int_1.value));
 LET abs_val_nullable := abs(nullable(-2));
 
 -- TEST: codegen for absolute value long
--- +  _tmp_int64_2 = - _64(2);
--- +  abs_val_long = labs(_tmp_int64_2);
+-- +  _tmp_int64_1 = - _64(2);
+-- +  abs_val_long = labs(_tmp_int64_1);
 LET abs_val_long := abs(-2L);
 
 -- TEST: codegen for absolute value real
--- + _tmp_double_2 = - 2.0;
--- + abs_val_real = fabs(_tmp_double_2);
+-- + _tmp_double_1 = - 2.0;
+-- + abs_val_real = fabs(_tmp_double_1);
 LET abs_val_real := abs(-2.0);
 
 -- TEST: codegen for absolute value bool
@@ -4653,25 +4742,26 @@ end;
 -- and we reused tmp1 again for the next call resulting in tmp1 + tmp2 + tmp1
 -- which is very bad indeed
 --- NOT NULL CASE: NO TEMPS CAN BE REUSED!
+-- +  f1(&_tmp_int_0);
+-- +  f1(&_tmp_int_1);
 -- +  f1(&_tmp_int_2);
--- +  f1(&_tmp_int_3);
--- +  f1(&_tmp_int_4);
--- +  q = _tmp_int_2 + _tmp_int_3 + _tmp_int_4;
---- NULLABLE CASE: TEMPS CAN BE REUSED tmp1 combines tmp2 and tmp3, tmp2 can be reused!
--- +  f2(&_tmp_n_int_2);
--- +  f2(&_tmp_n_int_3);
--- +  cql_combine_nullables(_tmp_n_int_1, _tmp_n_int_2.is_null, _tmp_n_int_3.is_null, _tmp_n_int_2.value + _tmp_n_int_3.value);
--- +  f2(&_tmp_n_int_2);
--- +  cql_combine_nullables(r, _tmp_n_int_1.is_null, _tmp_n_int_2.is_null, _tmp_n_int_1.value + _tmp_n_int_2.value);
---- NULLABLE CASE WITH BOXING: TEMPS CAN BE REUSED tmp1 combines tmp2 and tmp3, both can be reused
--- +  cql_set_notnull(_tmp_n_int_3, 0);
--- +  f3(_tmp_n_int_3, &_tmp_n_int_2);
--- +  cql_set_notnull(_tmp_n_int_4, 1);
--- +  f3(_tmp_n_int_4, &_tmp_n_int_3);
--- +  cql_combine_nullables(_tmp_n_int_1, _tmp_n_int_2.is_null, _tmp_n_int_3.is_null, _tmp_n_int_2.value + _tmp_n_int_3.value);
--- +  cql_set_notnull(_tmp_n_int_3, 2);
--- +  f3(_tmp_n_int_3, &_tmp_n_int_2);
--- + cql_combine_nullables(s, _tmp_n_int_1.is_null, _tmp_n_int_2.is_null, _tmp_n_int_1.value + _tmp_n_int_2.value);
+-- +  q = _tmp_int_0 + _tmp_int_1 + _tmp_int_2;
+--- NULLABLE CASE: TEMPS CAN BE REUSED tmp0 holds the first call and then the first sum, tmp1 can be reused!
+-- +  f2(&_tmp_n_int_0);
+-- +  f2(&_tmp_n_int_1);
+-- +  cql_combine_nullables(_tmp_n_int_0, _tmp_n_int_0.is_null, _tmp_n_int_1.is_null, _tmp_n_int_0.value + _tmp_n_int_1.value);
+-- +  f2(&_tmp_n_int_1);
+-- +  cql_combine_nullables(r, _tmp_n_int_0.is_null, _tmp_n_int_1.is_null, _tmp_n_int_0.value + _tmp_n_int_1.value);
+--- NULLABLE CASE WITH BOXING: TEMPS CAN BE REUSED tmp0 holds the first call and then the first sum
+-- +  cql_set_notnull(_tmp_n_int_1, 0);
+-- +  f3(_tmp_n_int_1, &_tmp_n_int_0);
+-- +  cql_set_notnull(_tmp_n_int_2, 1);
+-- +  f3(_tmp_n_int_2, &_tmp_n_int_1);
+-- +  cql_combine_nullables(_tmp_n_int_0, _tmp_n_int_0.is_null, _tmp_n_int_1.is_null, _tmp_n_int_0.value + _tmp_n_int_1.value);
+-- +  cql_set_notnull(_tmp_n_int_2, 2);
+-- +  f3(_tmp_n_int_2, &_tmp_n_int_1);
+-- + cql_combine_nullables(s, _tmp_n_int_0.is_null, _tmp_n_int_1.is_null, _tmp_n_int_0.value + _tmp_n_int_1.value);
+-- - _tmp_n_int_3
 create proc multi_call_temp_reuse()
 begin
   let q := f1() + f1() + f1();
@@ -4823,8 +4913,8 @@ end;
 -- (see above) and after the conditionals
 -- 5 text fragments
 -- + char _preds_1[5];
--- 8 variable usages
--- + char _vpreds_1[8];
+-- 8 variable usages but only 2 distinct variables
+-- + char _vpreds_1[2];
 -- + memset(&_preds_1[0], 0, sizeof(_preds_1));
 -- + memset(&_vpreds_1[0], 0, sizeof(_vpreds_1));
 -- control flow to figure out which predicates to enable
@@ -4838,43 +4928,40 @@ end;
 -- + else {
 -- +   if (_p1_x_ == 2) {
 -- +     _preds_1[2] = 1;
--- +     _vpreds_1[2] = 1; // pred 2 known to be 1
--- +     _vpreds_1[3] = 1; // pred 2 known to be 1
+-- +     _vpreds_1[1] = 1; // pred 2 known to be 1
 -- +   }
 -- +   else {
 -- +     _preds_1[3] = 1;
--- +     _vpreds_1[4] = 1; // pred 3 known to be 1
--- +     _vpreds_1[5] = 1; // pred 3 known to be 1
--- +     _vpreds_1[6] = 1; // pred 3 known to be 1
+-- +     _vpreds_1[1] = 1; // pred 3 known to be 1
 -- +   }
 -- + }
 -- + _preds_1[4] = 1;
--- + _vpreds_1[7] = 1; // pred 0 known to be 1
+-- + _vpreds_1[0] = 1; // pred 0 known to be 1
 -- + _rc_ = cql_prepare_var(_db_, _result_stmt,
 -- + 5, _preds_1,
 --
 -- root fragment 0 always present
 -- + "WITH "
--- +   "some_cte (id) AS (SELECT ?), "
+-- +   "some_cte (id) AS (SELECT ?1), "
 -- +   "shared_conditional (x) AS (",
 --
 -- option 1 fragment 1
--- + "SELECT ?",
+-- + "SELECT ?2",
 --
 -- option 2 fragment 2
--- + "SELECT ? + ?",
+-- + "SELECT ?2 + ?2",
 --
 -- option 3 fragment 3
--- + "SELECT ? + ? + ?",
+-- + "SELECT ?2 + ?2 + ?2",
 --
 -- pop to root, fragment 4 condition same as fragment 0
 -- + ") "
 -- +   "SELECT bar.id, bar.name, bar.rate, bar.type, bar.size "
 -- +     "FROM bar "
--- +     "INNER JOIN some_cte ON ? = 5"
+-- +     "INNER JOIN some_cte ON ?1 = 5"
 --
--- 8 variable sites, only some of which are used
--- + cql_multibind_var(&_rc_, _db_, _result_stmt, 8, _vpreds_1,
+-- 8 variable sites but each variable is bound once
+-- + cql_multibind_var(&_rc_, _db_, _result_stmt, 2, _vpreds_1,
 create proc shared_conditional_user(x integer not null)
 begin
   with
@@ -4912,23 +4999,20 @@ end;
 -- +   else {
 -- +     if (_p2_x_ == 2) {
 -- +       _preds_1[3] = 1;
--- +       _vpreds_1[1] = 1; // pred 3 known to be 1
--- +       _vpreds_1[2] = 1; // pred 3 known to be 1
+-- +       _vpreds_1[0] = 1; // pred 3 known to be 1
 -- +     }
 -- +     else {
 -- +       _preds_1[4] = 1;
--- +       _vpreds_1[3] = 1; // pred 4 known to be 1
--- +       _vpreds_1[4] = 1; // pred 4 known to be 1
--- +       _vpreds_1[5] = 1; // pred 4 known to be 1
+-- +       _vpreds_1[0] = 1; // pred 4 known to be 1
 -- +     }
 -- +   }
 -- this is what's unique about this test, we popped back to the context of predicate 1
 -- +   _preds_1[5] = _preds_1[1];
--- +   _vpreds_1[6] = _preds_1[1];
+-- +   _vpreds_1[1] = _preds_1[1];
 -- + }
 -- + else {
 -- +   _preds_1[6] = 1;
--- +   _vpreds_1[7] = 1; // pred 6 known to be 1
+-- +   _vpreds_1[1] = 1; // pred 6 known to be 1
 -- + }
 create proc nested_shared_stuff()
 begin
@@ -4939,11 +5023,11 @@ end;
 
 -- TEST: nested select syntax with complex fragment
 --
--- 10 fragments and 8 variables as expected
+-- 10 fragments and 8 variable uses of 2 variables as expected
 -- control flow corresponds to the nested selects (manually verified)
 -- see discussion per fragment
 -- +  char _preds_1[10];
--- +  char _vpreds_1[8];
+-- +  char _vpreds_1[2];
 -- +  memset(&_preds_1[0], 0, sizeof(_preds_1));
 -- +  memset(&_vpreds_1[0], 0, sizeof(_vpreds_1));
 -- +  _p1_x__ = 1;
@@ -4959,22 +5043,19 @@ end;
 -- +    else {
 -- +      if (_p2_x_ == 2) {
 -- +        _preds_1[4] = 1;
--- +        _vpreds_1[1] = 1; // pred 4 known to be 1
--- +        _vpreds_1[2] = 1; // pred 4 known to be 1
+-- +        _vpreds_1[0] = 1; // pred 4 known to be 1
 -- +      }
 -- +      else {
 -- +        _preds_1[5] = 1;
--- +        _vpreds_1[3] = 1; // pred 5 known to be 1
--- +        _vpreds_1[4] = 1; // pred 5 known to be 1
--- +        _vpreds_1[5] = 1; // pred 5 known to be 1
+-- +        _vpreds_1[0] = 1; // pred 5 known to be 1
 -- +      }
 -- +    }
 -- +    _preds_1[6] = _preds_1[2];
--- +    _vpreds_1[6] = _preds_1[2];
+-- +    _vpreds_1[1] = _preds_1[2];
 -- +  }
 -- +  else {
 -- +    _preds_1[7] = 1;
--- +    _vpreds_1[7] = 1; // pred 7 known to be 1
+-- +    _vpreds_1[1] = 1; // pred 7 known to be 1
 -- +  }
 -- +  _preds_1[8] = 1;
 -- +  _preds_1[9] = 1;
@@ -4994,26 +5075,26 @@ end;
 --
 -- fragment 3 present if x == 1
 -- first variable binding v[0] = pred[3]
--- +  "SELECT ?",
+-- +  "SELECT ?1",
 --
 -- fragment 4 present if x == 2
--- second variable binding v[1], v[2] = pred[4]
--- +  "SELECT ? + ?",
+-- the same variable again v[0] = pred[4]
+-- +  "SELECT ?1 + ?1",
 --
 -- fragment 5 present if x == 3
--- third variable binding v[3], v[4], v[5] = pred[5]
--- +  "SELECT ? + ? + ?",
+-- the same variable again v[0] = pred[5]
+-- +  "SELECT ?1 + ?1 + ?1",
 --
 -- fragment 6 the tail of fragment 2, present if x <= 5
--- fourth variable binding v[6] = pred[6] = pred[2]
+-- second variable binding v[1] = pred[6] = pred[2]
 -- +  ") "
 -- +    "SELECT x "
 -- +      "FROM shared_conditional "
--- +      "WHERE ? = 5",
+-- +      "WHERE ?2 = 5",
 --
 -- fragment 7 present if x > 5
--- fifth variable binding v[7] = pred[7] = !pred[2]
--- +  "SELECT ?",
+-- the second variable again v[1] = pred[7] = !pred[2]
+-- +  "SELECT ?2",
 --
 -- fragment 8 present always
 -- +  ") SELECT * FROM _ns_",
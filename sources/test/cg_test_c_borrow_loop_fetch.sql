@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Note this file is compiled with --borrow_loop_fetch in test.sh
+ */
+
+declare proc printf no check;
+
+create table foo (
+  id integer not null,
+  name text,
+  data blob,
+  rate long
+);
+
+-- TEST: loop fetch with string and blob columns uses borrowed views
+-- + cql_multifetch_borrowed(_rc_, C_stmt, 4,
+-- + cql_own_borrowed_refs(2, &C.name, &C.data);
+-- - cql_multifetch(
+create proc scan_foo()
+begin
+  declare C cursor for select * from foo;
+  loop fetch C
+  begin
+    call printf("%s\n", C.name);
+  end;
+end;
+
+-- TEST: the value escapes the loop, it's still a borrowed fetch, retaining the view copies it
+-- + cql_multifetch_borrowed(_rc_, C_stmt, 2,
+-- + cql_set_string_ref(&*last_name, C.name);
+-- + cql_own_borrowed_refs(1, &C.name);
+create proc last_name(out last_name text)
+begin
+  declare C cursor for select id, name from foo;
+  loop fetch C
+  begin
+    set last_name := C.name;
+    if C.id > 10 then
+      leave;
+    end if;
+  end;
+end;
+
+-- TEST: no reference columns, nothing to borrow
+-- + cql_multifetch(_rc_, C_stmt, 2,
+-- - cql_multifetch_borrowed
+-- - cql_own_borrowed_refs
+create proc scan_numbers()
+begin
+  declare C cursor for select id, rate from foo;
+  loop fetch C
+  begin
+    call printf("%d\n", C.id);
+  end;
+end;
+
+-- TEST: fetch into variables is not borrowed, the values outlive the row
+-- + cql_multifetch(_rc_, C_stmt, 1,
+-- - cql_multifetch_borrowed
+create proc fetch_into_locals()
+begin
+  declare name text;
+  declare C cursor for select foo.name from foo;
+  loop fetch C into name
+  begin
+    call printf("%s\n", name);
+  end;
+end;
+
+-- TEST: a plain fetch is not borrowed
+-- + cql_multifetch(_rc_, C_stmt, 4,
+-- - cql_multifetch_borrowed
+create proc plain_fetch()
+begin
+  declare C cursor for select * from foo;
+  fetch C;
+end;
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Note this file is set up to verify the .h file rather than the .c file in test.sh
+ */
+
+create table foo (
+  id integer not null,
+  name text,
+  rate long
+);
+
+-- TEST: the first proc with this shape gets real accessors
+-- + extern cql_int32 first_shape_get_id(first_shape_result_set_ref _Nonnull result_set, cql_int32 row);
+-- + extern cql_string_ref _Nullable first_shape_get_name(first_shape_result_set_ref _Nonnull result_set, cql_int32 row);
+-- + extern cql_bool first_shape_get_rate_is_null(first_shape_result_set_ref _Nonnull result_set, cql_int32 row);
+-- + extern cql_int64 first_shape_get_rate_value(first_shape_result_set_ref _Nonnull result_set, cql_int32 row);
+-- - #define first_shape_get_id
+create proc first_shape()
+begin
+  select * from foo;
+end;
+
+-- TEST: same shape, the accessors forward to first_shape
+-- + #define same_shape_get_id(result_set, row) first_shape_get_id((first_shape_result_set_ref)(result_set), row)
+-- + #define same_shape_get_name(result_set, row) first_shape_get_name((first_shape_result_set_ref)(result_set), row)
+-- + #define same_shape_get_rate_is_null(result_set, row) first_shape_get_rate_is_null((first_shape_result_set_ref)(result_set), row)
+-- + #define same_shape_get_rate_value(result_set, row) first_shape_get_rate_value((first_shape_result_set_ref)(result_set), row)
+-- - extern cql_int32 same_shape_get_id(
+-- the per proc API is still there
+-- + extern CQL_WARN_UNUSED cql_code same_shape_fetch_results(
+-- + extern cql_int32 same_shape_result_count(same_shape_result_set_ref _Nonnull result_set);
+create proc same_shape()
+begin
+  select * from foo where id = 1;
+end;
+
+-- TEST: different column names are a different shape
+-- + extern cql_int32 renamed_shape_get_key(renamed_shape_result_set_ref _Nonnull result_set, cql_int32 row);
+-- - #define renamed_shape_get_key
+create proc renamed_shape()
+begin
+  select id as key, name, rate from foo;
+end;
+
+-- TEST: an out proc has one row, there is no row argument
+-- + extern cql_int32 first_out_get_id(first_out_result_set_ref _Nonnull result_set);
+create proc first_out()
+begin
+  declare C cursor like foo;
+  fetch C using 1 id, 'x' name, 2 rate;
+  out C;
+end;
+
+-- TEST: same out shape, the macro has no row argument either
+-- + #define same_out_get_id(result_set) first_out_get_id((first_out_result_set_ref)(result_set))
+-- + #define same_out_get_name(result_set) first_out_get_name((first_out_result_set_ref)(result_set))
+create proc same_out()
+begin
+  declare C cursor like foo;
+  fetch C using 3 id, 'y' name, 4 rate;
+  out C;
+end;
+
+-- TEST: with setters the owner must have setters too, so this starts a new group
+-- + extern cql_int32 first_setters_get_id(first_setters_result_set_ref _Nonnull result_set, cql_int32 row);
+-- + extern void first_setters_set_id(first_setters_result_set_ref _Nonnull result_set, cql_int32 row, cql_int32 new_value);
+@attribute(cql:emit_setters)
+create proc first_setters()
+begin
+  select * from foo;
+end;
+
+-- TEST: setters are forwarded just like getters
+-- + #define same_setters_get_id(result_set, row) first_setters_get_id((first_setters_result_set_ref)(result_set), row)
+-- + #define same_setters_set_id(result_set, row, new_value) first_setters_set_id((first_setters_result_set_ref)(result_set), row, new_value)
+-- + #define same_setters_set_rate_to_null(result_set, row) first_setters_set_rate_to_null((first_setters_result_set_ref)(result_set), row)
+@attribute(cql:emit_setters)
+create proc same_setters()
+begin
+  select * from foo where id = 2;
+end;
+
+-- TEST: suppressed getters don't make a proc the owner of a shape
+-- - no_getters_get_only_col
+@attribute(cql:suppress_getters)
+create proc no_getters()
+begin
+  select id as only_col from foo;
+end;
+
+-- TEST: so this proc gets real accessors
+-- + extern cql_int32 has_getters_get_only_col(has_getters_result_set_ref _Nonnull result_set, cql_int32 row);
+create proc has_getters()
+begin
+  select id as only_col from foo;
+end;
+
+-- TEST: the first proc with an identity shape owns the metadata tables
+-- + extern cql_uint16 first_identity_identity_columns[];
+-- - #define first_identity_identity_columns
+@attribute(cql:identity=(id))
+create proc first_identity()
+begin
+  select id, name from foo;
+end;
+
+-- TEST: the same shape shares the data types and identity columns of first_identity
+-- the names are aliases of the owner's tables (the column offsets alias is in the .c)
+-- + #define same_identity_data_types first_identity_data_types
+-- + #define same_identity_identity_columns first_identity_identity_columns
+-- - extern cql_uint16 same_identity_identity_columns[];
+@attribute(cql:identity=(id))
+create proc same_identity()
+begin
+  select id, name from foo where id = 3;
+end;
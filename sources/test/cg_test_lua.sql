@@ -76,14 +76,15 @@ set t0_nullable := t2;
 set t0_nullable := null;
 
 -- TEST: simple unary operators
--- + SET i2 := - -1;
--- + i2 = - - 1
-set i2 := - -1;
+-- + SET i2 := - -i2;
+-- + i2 = - - i2
+set i2 := - -i2;
 
 -- + i0_nullable = - i2
 set i0_nullable := -i2;
 
--- + i0_nullable = cql_unary_uminus(nil)
+-- + i0_nullable = nil
+-- - cql_unary_uminus(nil)
 set i0_nullable := -null;
 
 -- + i1_nullable = cql_unary_uminus(i0_nullable)
@@ -106,9 +107,36 @@ set i1_nullable := NOT NOT i0_nullable;
 set i2 := NOT NOT b2;
 
 -- TEST: not null arithmetic
--- + i2 = 1 * 3 + 5
+-- + i2 = i2 * 3 + 5
+set i2 := i2 * 3 + 5;
+
+-- TEST: constant arithmetic is folded
+-- + i2 = 8
 set i2 := 1 * 3 + 5;
 
+-- TEST: constant folding uses the type of the expression
+-- + r2 = 3.5%e+00
+set r2 := 1 + 2.5;
+
+-- TEST: reals that would not print exactly are not folded
+-- + r2 = 0.1 + 0.2
+set r2 := 0.1 + 0.2;
+
+-- TEST: negative constants are safe in unary contexts
+-- + i2 = - i2 - -4
+set i2 := -i2 - (1 - 5);
+
+-- TEST: integer operations that overflow are not folded
+-- + i2 = cql_idiv(-2147483648, - 1)
+set i2 := (-2147483647 - 1) / -1;
+
+-- + l2 = 9223372036854775807 + 1
+set l2 := 9223372036854775807 + 1;
+
+-- TEST: the same operations fold when they stay in range
+-- + i2 = -2147483647
+set i2 := -2147483647 - 1 + 1;
+
 -- TEST: everything in sight is nullable
 -- + r0_nullable = cql_mul(r0_nullable, i1_nullable)
 set r0_nullable := r0_nullable * i1_nullable;
@@ -241,7 +269,7 @@ set i0_nullable := NULL or i1_nullable;
 set i0_nullable := i0_nullable or NULL;
 
 -- TEST: is null basic test
--- + i2 = cql_to_num(nil == nil)
+-- + i2 = 1
 set i2 := null is null;
 
 -- TEST: is null test general case
@@ -249,7 +277,7 @@ set i2 := null is null;
 set i2 := (i0_nullable + i1_nullable) is null;
 
 -- TEST: is not null basic test
--- + i2 = cql_to_num(nil ~= nil)
+-- + i2 = 0
 set i2 := null is not null;
 
 -- TEST: is not null test general case
@@ -503,16 +531,21 @@ end;
 
 -- TEST: a simple case expression
 -- + repeat
--- +   if true then
+-- +   if b2 then
 -- +     i2 = 100
 -- +     break
 -- +   end
--- +   if cql_to_bool(2) then
+-- +   if cql_to_bool(i2) then
 -- +     i2 = 200
 -- +     break
 -- +   end
 -- +   i2 = 300
 -- + until true
+set i2 := case when b2 then 100 when i2 then 200 when null then 500 else 300 end;
+
+-- TEST: a constant case expression is folded
+-- + i2 = 100
+-- - cql_to_bool(2)
 set i2 := case when 1 then 100 when 2 then 200 when null then 500 else 300 end;
 
 -- TEST: a simple in expression
@@ -762,7 +795,7 @@ set s := printf('%d and %d', 1, 2);
 set s := printf('%d and %d', 3, 4);
 
 -- TEST: printf inserts casts for numeric types (but only as needed)
--- + s = cql_printf("%lld %lld %lld %llu %d %d %llu %d %f %f %s %f", cql_to_integer(4), cql_to_integer(5), cql_to_integer(true), 0, cql_to_integer(false), 0, 6, 7, 0.0, 0.0, nil, cql_to_float(8))
+-- + s = cql_printf("%lld %lld %lld %llu %d %d %llu %d %f %f %s %f", 4, cql_to_integer(5), 1, 0, 0, 0, 6, 7, 0.0, 0.0, nil, 8.000000e+00)
 set s := printf('%lld %lld %lld %llu %d %d %llu %d %f %f %s %f', 4, nullable(5), true, null, false, null, 6L, 7, 0.0, null, null, 8);
 
 -- TEST: printf doesn't insert casts when used in SQL
@@ -1231,8 +1264,9 @@ end;
 -- + INSERT INTO bar(id, name, rate, type, size) VALUES(_seed_, printf('name_%d', _seed_), _seed_, _seed_, _seed_)
 -- + @DUMMY_SEED(123) @DUMMY_DEFAULTS @DUMMY_NULLABLES;
 -- + _seed_ = 123
--- + "INSERT INTO bar(id, name, rate, type, size) VALUES(?, printf('name_%d', ?), ?, ?, ?)"
--- + _rc_ = cql_multibind(_db_, _temp_stmt, "IIIII", _seed_, _seed_, _seed_, _seed_, _seed_)
+-- the seed is bound once and the other uses refer back to it
+-- + "INSERT INTO bar(id, name, rate, type, size) VALUES(?, printf('name_%d', ?1), ?1, ?1, ?1)"
+-- + _rc_ = cql_multibind(_db_, _temp_stmt, "I", _seed_)
 create proc dummy_user()
 begin
   insert into bar () values () @dummy_seed(123) @dummy_nullables @dummy_defaults;
@@ -2019,26 +2053,26 @@ set i2 := (select 'x' GLOB 'y');
 -- TEST: use lot of bitwise operators
 -- NOTE the SQL order of ops is different...
 -- no parens used here
--- +  SET i2 := 1 << 2 | 1 << 4 & 1 >> 8;
+-- +  SET i2 := i2 << 2 | i2 << 4 & i2 >> 8;
 -- in Sqlite binary math operators all bind equal and left to right so the above is the same as
---    SET i2 :=  (((((1 << 2) | 1) << 4) & 1) >> 8);
+--    SET i2 :=  (((((i2 << 2) | i2) << 4) & i2) >> 8);
 -- in LUA that changes because << and >> are stronger than | and &
--- + i2 = ((1 << 2 | 1) << 4 & 1) >> 8
-set i2 := 1 << 2 | 1 << 4 & 1 >> 8;
+-- + i2 = ((i2 << 2 | i2) << 4 & i2) >> 8
+set i2 := i2 << 2 | i2 << 4 & i2 >> 8;
 
 -- TEST: now maybe what you expected to see.  Force the issue with parens
--- + SET i2 := 1 << 2 | (1 << 4) & (1 >> 8);
+-- + SET i2 := i2 << 2 | (i2 << 4) & (i2 >> 8);
 -- Still not what you expected... remember | and & are EQUAL in sql
 -- so the above was parsed left to right...
--- + i2 = (1 << 2 | 1 << 4) & 1 >> 8
-set i2 := (1 << 2) | (1 << 4) & (1 >> 8);
+-- + i2 = (i2 << 2 | i2 << 4) & i2 >> 8
+set i2 := (i2 << 2) | (i2 << 4) & (i2 >> 8);
 
 -- TEST: this is really the normal thing
 -- some parens were redunant, removed...
--- + SET i2 := 1 << 2 | (1 << 4 & (1 >> 8));
+-- + SET i2 := i2 << 2 | (i2 << 4 & (i2 >> 8));
 -- now this is the usual C order of ops and no parens are in the C
--- + i2 = 1 << 2 | 1 << 4 & 1 >> 8
-set i2 := (1 << 2) | ((1 << 4) & (1 >> 8));
+-- + i2 = i2 << 2 | i2 << 4 & i2 >> 8
+set i2 := (i2 << 2) | ((i2 << 4) & (i2 >> 8));
 
 -- TEST: force a high binding ~
 -- nothing weird here, ~ binds very strong in both languages
@@ -2059,10 +2093,10 @@ begin
 end;
 
 -- TEST: IS patterns
--- + b = 1 == 1
+-- + b = true
 -- + b = "x" == "x"
 -- + b = "x" == "y"
--- + b = cql_to_bool(1 + cql_to_num((3 == 4)))
+-- + b = true
 -- + i = 1
 -- + j = 2
 -- + b = i == j
@@ -2093,10 +2127,10 @@ begin
 end;
 
 -- TEST: IS NOT patterns
--- + b = 1 ~= 1
+-- + b = false
 -- + b = "x" ~= "x"
 -- + b = "x" ~= "y"
--- + b = cql_to_bool(1 + cql_to_num((3 ~= 4)))
+-- + b = cql_to_bool(2)
 -- + i = 1
 -- + j = 2
 -- + b = i ~= j
@@ -3072,8 +3106,18 @@ begin
 end;
 
 -- TEST: numeric cast operation int32
--- + x = cql_to_integer(3.2)
+-- + x = cql_to_integer(r)
 create proc local_cast_int_notnull()
+begin
+  declare x integer not null;
+  let r := 3.2;
+  set x := cast(r as integer);
+end;
+
+-- TEST: numeric cast of a constant is folded
+-- + x = 3
+-- - cql_to_integer(3.2)
+create proc local_cast_int_constant()
 begin
   declare x integer not null;
   set x := cast(3.2 as integer);
@@ -3091,11 +3135,12 @@ begin
 end;
 
 -- TEST: numeric cast operation int64 nullable
--- + x = cql_to_integer(3.2)
+-- + x = cql_to_integer(r)
 create proc local_cast_long_notnull()
 begin
   declare x long not null;
-  set x := cast(3.2 as long);
+  let r := 3.2;
+  set x := cast(r as long);
 end;
 
 -- TEST: numeric cast operation int64 nullable
@@ -3110,11 +3155,12 @@ begin
 end;
 
 -- TEST: numeric cast operation real
--- + x = cql_to_float(3)
+-- + x = cql_to_float(i)
 create proc local_cast_real_notnull()
 begin
   declare x real not null;
-  set x := cast(3 as real);
+  let i := 3;
+  set x := cast(i as real);
 end;
 
 -- TEST: numeric cast operation real nullable
@@ -3129,11 +3175,12 @@ begin
 end;
 
 -- TEST: numeric cast operation bool (and normalize)
--- + x = cql_to_bool(3.2)
+-- + x = cql_to_bool(r)
 create proc local_cast_bool_notnull()
 begin
   declare x bool not null;
-  set x := cast(3.2 as bool);
+  let r := 3.2;
+  set x := cast(r as bool);
 end;
 
 -- TEST: numeric cast operation bool nullable (and normalize)
@@ -3252,114 +3299,115 @@ begin
 end;
 
 DECLARE x INTEGER NOT NULL;
+DECLARE n1, n2, n3, n4, n5 INTEGER NOT NULL;
 
 -- TEST: a series of paren checks on left association
 -- avoid hard coded divide by zero (hence 4/3 not e.g 1/3)
--- + x = 1 * cql_idiv(4, 3)
-SET x := 1 * (4 / 3);
+-- + x = n1 * cql_idiv(n4, n3)
+SET x := n1 * (n4 / n3);
 
--- + x = cql_idiv(1 * 2, 3)
-SET x := 1 * 2 / 3;
+-- + x = cql_idiv(n1 * n2, n3)
+SET x := n1 * n2 / n3;
 
--- + x = 1 + cql_idiv(2, 3)
-SET x := 1 + 2 / 3;
+-- + x = n1 + cql_idiv(n2, n3)
+SET x := n1 + n2 / n3;
 
--- + x = 1 + (2 - 3)
-SET x := 1 + (2 - 3);
+-- + x = n1 + (n2 - n3)
+SET x := n1 + (n2 - n3);
 
--- + x = 1 + 2 * 3
-SET x := 1 + 2 * 3;
+-- + x = n1 + n2 * n3
+SET x := n1 + n2 * n3;
 
--- + x = 1 * (2 + 3)
-SET x := 1 * (2 + 3);
+-- + x = n1 * (n2 + n3)
+SET x := n1 * (n2 + n3);
 
--- + x = 1 - (2 + 3)
-SET x := 1 - (2 + 3);
+-- + x = n1 - (n2 + n3)
+SET x := n1 - (n2 + n3);
 
--- + x = 1 - (2 - 3)
-SET x := 1 - (2 - 3);
+-- + x = n1 - (n2 - n3)
+SET x := n1 - (n2 - n3);
 
--- + x = 1 - 2 - (2 - 3)
-SET x := 1 - 2 - (2 - 3);
+-- + x = n1 - n2 - (n2 - n3)
+SET x := n1 - n2 - (n2 - n3);
 
 -- the first parens do not change eval order from left to right at all
--- + x = 1 - 2 - (2 - 3)
-SET x := (1 - 2) - (2 - 3);
+-- + x = n1 - n2 - (n2 - n3)
+SET x := (n1 - n2) - (n2 - n3);
 
--- + x = cql_idiv(cql_idiv(1, 2), 3)
-SET x := 1 / 2 / 3;
+-- + x = cql_idiv(cql_idiv(n1, n2), n3)
+SET x := n1 / n2 / n3;
 
 -- avoid hard coded divide by zero
--- + x = cql_idiv(1, cql_idiv(4, 3))
-SET x := 1 / (4 / 3);
+-- + x = cql_idiv(n1, cql_idiv(n4, n3))
+SET x := n1 / (n4 / n3);
 
--- + x = cql_idiv(1, 2)
-SET x := 1 / 2;
+-- + x = cql_idiv(n1, n2)
+SET x := n1 / n2;
 
--- + x = 1 * 2 * (3 * 4)
-SET x := 1 * 2 * (3 * 4);
+-- + x = n1 * n2 * (n3 * n4)
+SET x := n1 * n2 * (n3 * n4);
 
 -- the first parens don't change anything
 -- the second parens could matter if it was floating point
--- + x = 1 * 2 * (3 * 4)
-SET x := (1 * 2) * (3 * 4);
+-- + x = n1 * n2 * (n3 * n4)
+SET x := (n1 * n2) * (n3 * n4);
 
 -- note that in C & binds tighter than | so parens are required in C
 -- note that in SQL | and & are equal so this expression left associates
--- + x = (1 | 2) & 3
-SET x := 1 | 2 & 3;
+-- + x = (n1 | n2) & n3
+SET x := n1 | n2 & n3;
 
--- + x = 1 | 2 & 3
-SET x := 1 | (2 & 3);
+-- + x = n1 | n2 & n3
+SET x := n1 | (n2 & n3);
 
--- + x = 1 | 2 | 3
-SET x := 1 | 2 | 3;
+-- + x = n1 | n2 | n3
+SET x := n1 | n2 | n3;
 
 -- sub optimal but we're trying to preserve written order due to floating point
--- + x = 1 | (2 | 3)
-SET x := 1 | (2 | 3);
+-- + x = n1 | (n2 | n3)
+SET x := n1 | (n2 | n3);
 
--- + x = 1 | (3 + 4 | 5)
-SET x := 1 | (3 + 4 | 5);
+-- + x = n1 | (n3 + n4 | n5)
+SET x := n1 | (n3 + n4 | n5);
 
--- + x = 1 | 3 + (4 | 5)
-SET x := 1 | 3 + (4 | 5);
+-- + x = n1 | n3 + (n4 | n5)
+SET x := n1 | n3 + (n4 | n5);
 
--- +  x = (1 | 3) + (4 | 5)
-SET x := (1 | 3) + (4 | 5);
+-- +  x = (n1 | n3) + (n4 | n5)
+SET x := (n1 | n3) + (n4 | n5);
 
--- + x = (1 + 2) * 5
-set x := (1 + 2) * 5;
+-- + x = (n1 + n2) * n5
+set x := (n1 + n2) * n5;
 
--- + x = 1 + 2 - 1
-set x := (1 + 2) - 1;
+-- + x = n1 + n2 - n1
+set x := (n1 + n2) - n1;
 
--- + x = 1 << 2 | 3
-set x := 1 << 2 | 3;
+-- + x = n1 << n2 | n3
+set x := n1 << n2 | n3;
 
--- + x = 1 << (2 | 3)
-set x := 1 << (2 | 3);
+-- + x = n1 << (n2 | n3)
+set x := n1 << (n2 | n3);
 
--- + x = 1 | 2 << 3
-set x := 1 | (2 << 3);
+-- + x = n1 | n2 << n3
+set x := n1 | (n2 << n3);
 
--- + x = 1 << (2 << 3)
-set x := 1 << (2 << 3);
+-- + x = n1 << (n2 << n3)
+set x := n1 << (n2 << n3);
 
--- + cql_to_num(1 < cql_to_num((2 > 3)))
-set x := 1 < (2 > 3);
+-- + cql_to_num(n1 < cql_to_num((n2 > n3)))
+set x := n1 < (n2 > n3);
 
--- + x = 1 << (2 >> 3)
-set x := 1 << (2 >> 3);
+-- + x = n1 << (n2 >> n3)
+set x := n1 << (n2 >> n3);
 
--- + x = 1 | (2 | 3)
-set x := 1 | (2 | 3);
+-- + x = n1 | (n2 | n3)
+set x := n1 | (n2 | n3);
 
--- + x = 1 | 2 | 3
-set x := (1 | 2) | 3;
+-- + x = n1 | n2 | n3
+set x := (n1 | n2) | n3;
 
--- + cql_to_num(1 == cql_to_num((2 ~= 3)))
-set x := 1 == (2 != 3);
+-- + cql_to_num(n1 == cql_to_num((n2 ~= n3)))
+set x := n1 == (n2 != n3);
 
 create table SalesInfo(
   month integer,
@@ -3907,12 +3955,12 @@ end;
 -- + i = 1
 -- + l = 1
 -- + t = "T"
--- + nl = (~2)
--- + ni = (2 + 2)
+-- + nl = (-3)
+-- + ni = 4
 -- + nr = 2.0
 -- + nt = "NT"
--- + sl = (~3)
--- + si = (3 + 3)
+-- + sl = (-4)
+-- + si = 6
 -- + sr = 3.0
 -- + st = "ST"
 create proc various_lets()
@@ -4272,12 +4320,12 @@ end;
 select 1 x;
 
 -- TEST: numeric is true case
--- + true_test = (1 ~= 0)
-let true_test := 1 is true;
+-- + true_test = (i2 ~= 0)
+let true_test := i2 is true;
 
 -- TEST: numberic is false case
--- + false_test = (0 == 0)
-let false_test := 0 is false;
+-- + false_test = (i2 == 0)
+let false_test := i2 is false;
 
 -- TEST: the helper handles all the weird cases...
 -- + true_test = cql_is_true(i0_nullable)
@@ -4288,12 +4336,16 @@ set true_test := i0_nullable is true;
 set false_test := i0_nullable is false;
 
 -- TEST: number is not true test
--- + true_test = (1 == 0)
-set true_test := 1 is not true;
+-- + true_test = (i2 == 0)
+set true_test := i2 is not true;
 
 -- TEST: numeric is not false test
--- + false_test = (0 ~= 0)
-set false_test := 0 is not false;
+-- + false_test = (i2 ~= 0)
+set false_test := i2 is not false;
+
+-- TEST: a constant is true test is folded
+-- + true_test = true
+set true_test := 1 is true;
 
 -- TEST: the helper handles all the weird cases...
 -- + true_test = cql_is_not_true(i0_nullable)
@@ -4604,10 +4656,10 @@ end;
 -- variables before the conditionals inside the conditonals
 -- (see above) and after the conditionals
 -- 5 text fragments
--- 8 variable usages
+-- 8 variable usages but only 2 distinct variables
 --
 -- + local _preds_1  -- 5 possible fragments
--- + local _vpreds_1 -- 8 possible bindings
+-- + local _vpreds_1 -- 2 possible bindings
 -- + _preds_1 = {}
 -- + _vpreds_1 = {}
 --
@@ -4621,37 +4673,34 @@ end;
 -- + else
 -- +   if _p1_x_ == 2 then
 -- +     _preds_1[2] = true
--- +     _vpreds_1[2] = true -- pred 2 known to be true
--- +     _vpreds_1[3] = true -- pred 2 known to be true
+-- +     _vpreds_1[1] = true -- pred 2 known to be true
 -- +   else
 -- +     _preds_1[3] = true
--- +     _vpreds_1[4] = true -- pred 3 known to be true
--- +     _vpreds_1[5] = true -- pred 3 known to be true
--- +     _vpreds_1[6] = true -- pred 3 known to be true
+-- +     _vpreds_1[1] = true -- pred 3 known to be true
 -- +   end
 -- + end
 -- + _preds_1[4] = true
--- + _vpreds_1[7] = true -- pred 0 known to be true
+-- + _vpreds_1[0] = true -- pred 0 known to be true
 -- + _rc_, _result_stmt = cql_prepare_var(_db_,
 -- + 5, _preds_1,
 --
 -- root fragment 0 always present
--- + "WITH some_cte (id) AS (SELECT ?), shared_conditional (x) AS (",
+-- + "WITH some_cte (id) AS (SELECT ?1), shared_conditional (x) AS (",
 --
 -- option 1 fragment 1
--- + "SELECT ?",
+-- + "SELECT ?2",
 --
 -- option 2 fragment 2
--- + "SELECT ? + ?",
+-- + "SELECT ?2 + ?2",
 --
 -- option 3 fragment 3
--- + "SELECT ? + ? + ?",
+-- + "SELECT ?2 + ?2 + ?2",
 --
 -- pop to root, fragment 4 condition same as fragment 0
--- + ") SELECT bar.id, bar.name, bar.rate, bar.type, bar.size FROM bar INNER JOIN some_cte ON ? = 5"
+-- + ") SELECT bar.id, bar.name, bar.rate, bar.type, bar.size FROM bar INNER JOIN some_cte ON ?1 = 5"
 --
--- 8 variable sites, only some of which are used
--- + _rc_ = cql_multibind_var(_db_, _result_stmt, 8, _vpreds_1, "IIIIIIII", x, _p1_x_, _p1_x_, _p1_x_, _p1_x_, _p1_x_, _p1_x_, x)
+-- 8 variable sites but each variable is bound once
+-- + _rc_ = cql_multibind_var(_db_, _result_stmt, 2, _vpreds_1, "II", x, _p1_x_)
 create proc shared_conditional_user(x integer not null)
 begin
   with
@@ -4677,7 +4726,7 @@ end;
 
 -- TEST: variable arg management in a nested context
 -- + local _preds_1  -- 8 possible fragments
--- + local _vpreds_1 -- 8 possible bindings
+-- + local _vpreds_1 -- 2 possible bindings
 -- + _preds_1 = {}
 -- + _vpreds_1 = {}
 -- + _p1_x__ = 1
@@ -4691,21 +4740,18 @@ end;
 -- +   else
 -- +     if _p2_x_ == 2 then
 -- +       _preds_1[3] = true
--- +       _vpreds_1[1] = true -- pred 3 known to be true
--- +       _vpreds_1[2] = true -- pred 3 known to be true
+-- +       _vpreds_1[0] = true -- pred 3 known to be true
 -- +     else
 -- +       _preds_1[4] = true
--- +       _vpreds_1[3] = true -- pred 4 known to be true
--- +       _vpreds_1[4] = true -- pred 4 known to be true
--- +       _vpreds_1[5] = true -- pred 4 known to be true
+-- +       _vpreds_1[0] = true -- pred 4 known to be true
 -- +     end
 -- +   end
 -- this is what's unique about this test, we popped back to the context of predicate 1
 -- +   _preds_1[5] = _preds_1[1]
--- +   _vpreds_1[6] = _preds_1[1]
+-- +   _vpreds_1[1] = _preds_1[1]
 -- + else
 -- +   _preds_1[6] = true
--- +   _vpreds_1[7] = true -- pred 6 known to be true
+-- +   _vpreds_1[1] = true -- pred 6 known to be true
 -- + end
 create proc nested_shared_stuff()
 begin
@@ -4717,11 +4763,11 @@ end;
 
 -- TEST: nested select syntax with complex fragment
 --
--- 10 fragments and 8 variables as expected
+-- 10 fragments and 8 variable uses of 2 variables as expected
 -- control flow corresponds to the nested selects (manually verified)
 -- see discussion per fragment
 -- +  local _preds_1  -- 10 possible fragments
--- +  local _vpreds_1 -- 8 possible bindings
+-- +  local _vpreds_1 -- 2 possible bindings
 -- +  _preds_1 = {}
 -- +  _vpreds_1 = {}
 -- +  _p1_x__ = 1
@@ -4736,20 +4782,17 @@ end;
 -- +    else
 -- +      if _p2_x_ == 2 then
 -- +        _preds_1[4] = true
--- +        _vpreds_1[1] = true -- pred 4 known to be true
--- +        _vpreds_1[2] = true -- pred 4 known to be true
+-- +        _vpreds_1[0] = true -- pred 4 known to be true
 -- +      else
 -- +        _preds_1[5] = true
--- +        _vpreds_1[3] = true -- pred 5 known to be true
--- +        _vpreds_1[4] = true -- pred 5 known to be true
--- +        _vpreds_1[5] = true -- pred 5 known to be true
+-- +        _vpreds_1[0] = true -- pred 5 known to be true
 -- +      end
 -- +    end
 -- +    _preds_1[6] = _preds_1[2]
--- +    _vpreds_1[6] = _preds_1[2]
+-- +    _vpreds_1[1] = _preds_1[2]
 -- +  else
 -- +    _preds_1[7] = true
--- +    _vpreds_1[7] = true -- pred 7 known to be true
+-- +    _vpreds_1[1] = true -- pred 7 known to be true
 -- +  end
 -- +  _preds_1[8] = true
 -- +  _preds_1[9] = true
@@ -4767,23 +4810,23 @@ end;
 --
 -- fragment 3 present if x == 1
 -- first variable binding v[0] = pred[3]
--- +  "SELECT ?",
+-- +  "SELECT ?1",
 --
 -- fragment 4 present if x == 2
--- second variable binding v[1], v[2] = pred[4]
--- +  "SELECT ? + ?",
+-- the same variable again v[0] = pred[4]
+-- +  "SELECT ?1 + ?1",
 --
 -- fragment 5 present if x == 3
--- third variable binding v[3], v[4], v[5] = pred[5]
--- +  "SELECT ? + ? + ?",
+-- the same variable again v[0] = pred[5]
+-- +  "SELECT ?1 + ?1 + ?1",
 --
 -- fragment 6 the tail of fragment 2, present if x <= 5
--- fourth variable binding v[6] = pred[6] = pred[2]
--- +  ") SELECT x FROM shared_conditional WHERE ? = 5",
+-- second variable binding v[1] = pred[6] = pred[2]
+-- +  ") SELECT x FROM shared_conditional WHERE ?2 = 5",
 --
 -- fragment 7 present if x > 5
--- fifth variable binding v[7] = pred[7] = !pred[2]
--- +  "SELECT ?",
+-- the second variable again v[1] = pred[7] = !pred[2]
+-- +  "SELECT ?2",
 --
 -- fragment 8 present always
 -- +  ") SELECT * FROM _ns_",
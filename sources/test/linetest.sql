@@ -56,7 +56,7 @@ begin
   declare x integer;
 
   set x :=  coalesce( case 
-             when  1 
+             when  x 
            then 200
          when 2
    then 300
@@ -104,6 +104,21 @@ BEGIN_TEST(arithmetic)
   EXPECT_SQL_TOO(-3 % -2 == -1);
 END_TEST(arithmetic)
 
+BEGIN_TEST(nullable_arithmetic_chains)
+  let one := nullable(1);
+  let two := nullable(2);
+  let three := nullable(3);
+  declare none integer;
+
+  -- each operator writes the scratch variable holding its left operand
+  EXPECT(one + two + three + one * two - three == 5);
+  EXPECT((one + two) * (two + three) - (one + one) * three == 9);
+  EXPECT(- -(one + two) - - three == 6);
+  EXPECT((one + two + none + three) is null);
+  EXPECT((one + two + three) * (none + one) is null);
+  EXPECT(not (one + two + three) == 7);
+END_TEST(nullable_arithmetic_chains)
+
 declare side_effect_0_count integer not null;
 declare side_effect_1_count integer not null;
 declare side_effect_null_count integer not null;
@@ -2694,6 +2709,71 @@ begin
   select * from all_types_encoded_with_context_table;
 end;
 
+@attribute(cql:vault_sensitive=(context, (s, bl, i)))
+create procedure load_encoded_column_batches()
+begin
+  create table encoded_column_batches_table(
+    s text @sensitive,
+    bl blob @sensitive,
+    i integer @sensitive,
+    context text not null
+  );
+
+  -- every row has its own context and the columns have nulls in different rows
+  let n := 0;
+  while n < 100
+  begin
+    insert into encoded_column_batches_table values (
+      iif(n % 3 == 0, null, printf("s_%d", n)),
+      iif(n % 5 == 0, null, cast(printf("b_%d", n) as blob)),
+      iif(n % 4 == 0, null, n),
+      printf("cxt_%d", n)
+    );
+    set n := n + 1;
+  end;
+
+  select * from encoded_column_batches_table;
+end;
+
+create procedure load_wire_format_rows()
+begin
+  -- every kind of column, nullable and not, with nulls and empty values sprinkled in
+  with recursive
+    nums(n) as (select 0 union all select n + 1 from nums where n < 49)
+  select
+    n % 2 == 0 as b,
+    iif(n % 3 == 0, null, n % 2 == 1) as nb,
+    n as i,
+    iif(n % 4 == 0, null, -n) as ni,
+    n * 1000000000000 as l,
+    iif(n % 5 == 0, null, n * 1.5) as nd,
+    printf("str_%d", n) as s,
+    iif(n % 3 == 1, null, iif(n % 7 == 0, "", printf("s_%d", n))) as ns,
+    cast(printf("blob_%d", n) as blob) as bl,
+    iif(n % 6 == 0, null, iif(n % 7 == 0, x'00', cast(printf("b_%d", n) as blob))) as nbl
+  from nums;
+end;
+
+@attribute(cql:lazy_strings)
+create procedure load_lazy_strings()
+begin
+  -- the same rows as load_wire_format_rows, fetched lazily
+  with recursive
+    nums(n) as (select 0 union all select n + 1 from nums where n < 49)
+  select
+    n % 2 == 0 as b,
+    iif(n % 3 == 0, null, n % 2 == 1) as nb,
+    n as i,
+    iif(n % 4 == 0, null, -n) as ni,
+    n * 1000000000000 as l,
+    iif(n % 5 == 0, null, n * 1.5) as nd,
+    printf("str_%d", n) as s,
+    iif(n % 3 == 1, null, iif(n % 7 == 0, "", printf("s_%d", n))) as ns,
+    cast(printf("blob_%d", n) as blob) as bl,
+    iif(n % 6 == 0, null, iif(n % 7 == 0, x'00', cast(printf("b_%d", n) as blob))) as nbl
+  from nums;
+end;
+
 @attribute(cql:vault_sensitive)
 create procedure load_encoded_cursor()
 begin
@@ -3559,6 +3639,15 @@ BEGIN_TEST(const_folding)
 
 END_TEST(const_folding)
 
+BEGIN_TEST(overflow_not_folded)
+  -- operations that overflow are not folded (see cg_test), the ones at the
+  -- edges of the range still fold to the right answer
+  EXPECT(-2147483647 - 1 + 1 == -2147483647);
+  EXPECT(9223372036854775806 + 1 == 9223372036854775807);
+  EXPECT((-9223372036854775807 - 1) / 1 == -9223372036854775807 - 1);
+  EXPECT((-2147483647 - 1) % 2 == 0);
+END_TEST(overflow_not_folded)
+
 BEGIN_TEST(long_literals)
   declare x long not null;
   declare z long;
@@ -4118,6 +4207,46 @@ BEGIN_TEST(conditional_fragment)
   EXPECT(not E);
 END_TEST(conditional_fragment)
 
+@attribute(cql:shared_fragment)
+create proc repeated_args(a integer not null, b text)
+begin
+  if a == 1 then
+    select 1 id, b || b t;
+  else
+    select a + a id, nullable('z') t;
+  end if;
+end;
+
+BEGIN_TEST(repeated_variables)
+  let v := 7;
+  declare s text;
+  set s := 'ab';
+
+  -- each variable is bound once no matter how often it is used
+  declare C cursor for select v + v x, v * v y, s || s z, s w;
+  fetch C;
+  EXPECT(C.x = 14);
+  EXPECT(C.y = 49);
+  EXPECT(C.z = 'abab');
+  EXPECT(C.w = 'ab');
+
+  -- the included branch uses only the second binding
+  declare D cursor for select * from (call repeated_args(2, s));
+  fetch D;
+  EXPECT(D.id = 4);
+  EXPECT(D.t = 'z');
+  fetch D;
+  EXPECT(not D);
+
+  -- the included branch uses only the first binding
+  declare E cursor for select * from (call repeated_args(1, s));
+  fetch E;
+  EXPECT(E.id = 1);
+  EXPECT(E.t = 'abab');
+  fetch E;
+  EXPECT(not E);
+END_TEST(repeated_variables)
+
 BEGIN_TEST(conditional_fragment_no_with)
   declare C cursor for select * from (call conditional_values(1));
 
@@ -5292,6 +5421,131 @@ BEGIN_TEST(child_results)
   end;
 END_TEST(child_results)
 
+BEGIN_TEST(child_results_interleaved)
+  -- the hints are deliberately too small so that everything has to grow
+  let p := cql_partition_create_sized(10, 4);
+
+  declare v cursor like (x integer not null, y text not null, z bool);
+  declare k cursor like v(x);
+
+  -- rows for all the keys arrive interleaved, each key must get its own rows back in order
+  let i := 0;
+  while i < 500
+  begin
+    fetch v(x, y, z) from values(i % 50, printf("y_%d", i), i % 2);
+    fetch k from v(like k);
+    let added := cql_partition_cursor(p, k, v);
+    EXPECT(added);
+    set i := i + 1;
+  end;
+
+  -- odd keys are never extracted, their rows are cleaned up with the partition
+  set i := 0;
+  while i < 50
+  begin
+    fetch k(x) from values(i);
+    declare rs object<get_rows set>;
+    set rs := cql_extract_partition(p, k);
+
+    declare C cursor for rs;
+    let row_count := 0;
+    loop fetch C
+    begin
+      EXPECT(C.x == i);
+      EXPECT(C.y == printf("y_%d", i + row_count * 50));
+      EXPECT(C.z == (i % 2 == 1));
+      set row_count := row_count + 1;
+    end;
+    EXPECT(row_count == 10);
+
+    set i := i + 2;
+  end;
+END_TEST(child_results_interleaved)
+
+BEGIN_TEST(child_results_huge_hints)
+  -- hints this big can't be met, they are ignored rather than overflowing
+  let p := cql_partition_create_sized(2147483647, 2147483647);
+
+  declare v cursor like (x integer not null, y text not null, z bool);
+  declare k cursor like v(x);
+
+  let i := 0;
+  while i < 20
+  begin
+    fetch v(x, y, z) from values(i % 4, printf("y_%d", i), i % 2);
+    fetch k from v(like k);
+    let added := cql_partition_cursor(p, k, v);
+    EXPECT(added);
+    set i := i + 1;
+  end;
+
+  -- the other keys, including the very first run, are cleaned up with the partition
+  fetch k(x) from values(3);
+  declare rs object<get_rows set>;
+  set rs := cql_extract_partition(p, k);
+
+  declare C cursor for rs;
+  let row_count := 0;
+  loop fetch C
+  begin
+    EXPECT(C.y == printf("y_%d", 3 + row_count * 4));
+    set row_count := row_count + 1;
+  end;
+  EXPECT(row_count == 5);
+END_TEST(child_results_huge_hints)
+
+BEGIN_TEST(child_results_all_extracted)
+  let p := cql_partition_create();
+
+  declare v cursor like (x integer not null, y text not null, z bool);
+  declare k cursor like v(x);
+
+  let i := 0;
+  while i < 30
+  begin
+    fetch v(x, y, z) from values(i % 3, printf("y_%d", i), i % 2);
+    fetch k from v(like k);
+    let added := cql_partition_cursor(p, k, v);
+    EXPECT(added);
+    set i := i + 1;
+  end;
+
+  -- extracting the last key frees the arenas, the results must be unaffected
+  declare rs0 object<get_rows set>;
+  declare rs object<get_rows set>;
+  set i := 0;
+  while i < 3
+  begin
+    fetch k(x) from values(i);
+    set rs := cql_extract_partition(p, k);
+    if i == 0 then
+      set rs0 := rs;
+    end if;
+    set i := i + 1;
+  end;
+
+  -- a key that was extracted before and a missing key still work
+  fetch k(x) from values(0);
+  set rs := cql_extract_partition(p, k);
+  EXPECT(rs == rs0);
+
+  declare C cursor for rs;
+  let row_count := 0;
+  loop fetch C
+  begin
+    EXPECT(C.x == 0);
+    EXPECT(C.y == printf("y_%d", row_count * 3));
+    set row_count := row_count + 1;
+  end;
+  EXPECT(row_count == 10);
+
+  fetch k(x) from values(7);
+  set rs := cql_extract_partition(p, k);
+  declare D cursor for rs;
+  fetch D;
+  EXPECT(not D);
+END_TEST(child_results_all_extracted)
+
 create proc ch1()
 begin
   let i := 0;
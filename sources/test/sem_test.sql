@@ -1767,6 +1767,36 @@ declare proc bad_constants_proc();
 @attribute(whatever=(1, const(1/0), 1))
 declare proc bad_constants_nested_proc();
 
+-- TEST: integer overflow is undefined so it is not evaluated
+-- + {const}: err
+-- + error: % evaluation of constant failed
+let overflow_div := const((-2147483647 - 1) / -1);
+
+-- TEST: likewise for remainder
+-- + {const}: err
+-- + error: % evaluation of constant failed
+let overflow_mod := const((-9223372036854775807 - 1) % -1);
+
+-- TEST: likewise for addition
+-- + {const}: err
+-- + error: % evaluation of constant failed
+let overflow_add := const(9223372036854775807 + 1);
+
+-- TEST: likewise for multiplication
+-- + {const}: err
+-- + error: % evaluation of constant failed
+let overflow_mul := const(65536 * 32768);
+
+-- TEST: likewise for negation
+-- + {const}: err
+-- + error: % evaluation of constant failed
+let overflow_neg := const(-(-9223372036854775807 - 1));
+
+-- TEST: the edges of the range are fine
+-- + LET edge_sub := -2147483648;
+-- - error:
+let edge_sub := const(-2147483647 - 1);
+
 -- TEST: try to use a NULL default value on a non nullable column
 -- + {create_table_stmt}: err
 -- + {col_def}: err
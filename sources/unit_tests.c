@@ -14,6 +14,7 @@ cql_noexport void run_unit_tests() {}
 
 #include "cql.h"
 #include "cg_common.h"
+#include "rope.h"
 #include "unit_tests.h"
 
 // This file implement very simple unit tests for functions that are too complicated
@@ -193,6 +194,111 @@ static bool test_sha256_example6() {
   return result;
 }
 
+static bool test_breserve__grows_geometrically() {
+  CHARBUF_OPEN(temp);
+  breserve(&temp, CHARBUF_INTERNAL_SIZE * 4);
+  uint32_t max = temp.max;
+  bool result = max >= CHARBUF_INTERNAL_SIZE * 4 + 1 && temp.used == 1 && temp.ptr[0] == 0;
+
+  // fill it up and then one more byte, the buffer should at least double
+  while (temp.used < temp.max) bputc(&temp, 'x');
+  bputc(&temp, 'y');
+  result = result && temp.max >= 2 * max && temp.ptr[temp.used - 2] == 'y';
+  CHARBUF_CLOSE(temp);
+  return result;
+}
+
+static bool test_bprintf__fills_then_overflows() {
+  CHARBUF_OPEN(temp);
+
+  // fits in the space that is left, one formatting pass
+  bprintf(&temp, "%s=%d;", "x", 5);
+  bool result = temp.used == 5 && !strcmp(temp.ptr, "x=5;");
+
+  // much bigger than what is left, this has to grow and format again
+  char big[CHARBUF_INTERNAL_SIZE * 2 + 1];
+  memset(big, 'z', sizeof(big) - 1);
+  big[sizeof(big) - 1] = 0;
+  bprintf(&temp, "[%s]", big);
+  result = result && temp.used == 5 + sizeof(big) + 1;
+  result = result && temp.ptr[4] == '[' && temp.ptr[temp.used - 2] == ']';
+
+  bputs(&temp, "end");
+  result = result && !strcmp(temp.ptr + temp.used - 4, "end");
+  CHARBUF_CLOSE(temp);
+  return result;
+}
+
+static bool test_rope__append_crosses_chunks() {
+  ROPE_OPEN(r);
+  CHARBUF_OPEN(big);
+  for (int32_t i = 0; i < ROPE_CHUNK_SIZE + 10; i++) bputc(&big, (char)('a' + i % 26));
+
+  rope_puts(&r, "start ");
+  rope_append(&r, big.ptr, big.used - 1);
+  rope_puts(&r, " end");
+
+  CHARBUF_OPEN(flat);
+  rope_to_charbuf(&r, &flat);
+  bool result = r.length == big.used - 1 + 10 &&
+    flat.used == r.length + 1 &&
+    !strncmp(flat.ptr, "start abc", 9) &&
+    !strcmp(flat.ptr + flat.used - 5, " end") &&
+    r.head != r.tail;
+  CHARBUF_CLOSE(flat);
+  CHARBUF_CLOSE(big);
+  ROPE_CLOSE(r);
+  return result;
+}
+
+static bool test_rope__printf_fits_and_overflows() {
+  ROPE_OPEN(r);
+  rope_printf(&r, "%s=%d;", "x", 5);
+
+  // this one can't fit in the rest of the first chunk
+  CHARBUF_OPEN(big);
+  for (int32_t i = 0; i < ROPE_CHUNK_SIZE; i++) bputc(&big, 'z');
+  rope_printf(&r, "[%s]", big.ptr);
+  rope_printf(&r, "%s", "");
+
+  CHARBUF_OPEN(flat);
+  rope_to_charbuf(&r, &flat);
+  bool result = r.length == 4 + ROPE_CHUNK_SIZE + 2 &&
+    !strncmp(flat.ptr, "x=5;[zzz", 8) &&
+    flat.ptr[flat.used - 2] == ']';
+  CHARBUF_CLOSE(flat);
+  CHARBUF_CLOSE(big);
+  ROPE_CLOSE(r);
+  return result;
+}
+
+static bool test_rope__borrow_and_splice() {
+  ROPE_OPEN(r1);
+  ROPE_OPEN(r2);
+  CHARBUF_OPEN(borrowed);
+  bprintf(&borrowed, "middle");
+
+  rope_puts(&r1, "first ");
+  rope_borrow_charbuf(&r2, &borrowed);
+  rope_puts(&r2, " last");
+  rope_splice(&r1, &r2);
+
+  // splicing an empty rope is a no-op
+  rope_splice(&r1, &r2);
+
+  CHARBUF_OPEN(flat);
+  bprintf(&flat, "> ");
+  rope_to_charbuf(&r1, &flat);
+  bool result = !strcmp(flat.ptr, "> first middle last") &&
+    r1.length == 17 &&
+    r2.length == 0 && !r2.head && !r2.tail;
+  CHARBUF_CLOSE(flat);
+  CHARBUF_CLOSE(borrowed);
+  ROPE_CLOSE(r2);
+  ROPE_CLOSE(r1);
+  return result;
+}
+
 cql_noexport void run_unit_tests() {
   TEST_ASSERT(test_Strdup__empty_string());
   TEST_ASSERT(test_Strdup__one_character_string());
@@ -225,6 +331,11 @@ cql_noexport void run_unit_tests() {
   TEST_ASSERT(test_sha256_example4());
   TEST_ASSERT(test_sha256_example5());
   TEST_ASSERT(test_sha256_example6());
+  TEST_ASSERT(test_breserve__grows_geometrically());
+  TEST_ASSERT(test_bprintf__fills_then_overflows());
+  TEST_ASSERT(test_rope__append_crosses_chunks());
+  TEST_ASSERT(test_rope__printf_fits_and_overflows());
+  TEST_ASSERT(test_rope__borrow_and_splice());
 }
 
 #endif
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Driver for upgrade_bench.sh.  It is linked with exactly one generated
+// upgrader and has two modes:
+//
+//   seed <db> <rows>   run the upgrader and then put <rows> rows in every table
+//   measure <db>       run the upgrader and report its cost
+//
+// The cost is the wall time of the upgrade (including the commit), the number
+// of SQL statements it ran, and the number of pages it wrote to the database.
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cqlrt.h"
+
+// Every generated upgrader has this entry point, the name comes from
+// --global_proc test.  We don't need the shape of the result set.
+extern cql_code test_fetch_results(sqlite3 *_Nonnull db, cql_result_set_ref _Nullable *_Nonnull result_set);
+
+static int32_t statement_count;
+
+// Statements run by triggers are reported with a leading "--" comment, those
+// are part of some other statement so they are not counted again.
+static int count_statements(unsigned type, void *context, void *p, void *x) {
+  const char *sql = x;
+  if (strncmp(sql, "--", 2)) {
+    statement_count++;
+  }
+  return 0;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static cql_code exec(sqlite3 *db, const char *sql) {
+  char *err = NULL;
+  cql_code rc = sqlite3_exec(db, sql, NULL, NULL, &err);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "%s\n  %s\n", err ? err : sqlite3_errmsg(db), sql);
+    sqlite3_free(err);
+  }
+  return rc;
+}
+
+static cql_code upgrade(sqlite3 *db) {
+  cql_code rc = exec(db, "BEGIN");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  cql_result_set_ref result_set = NULL;
+  rc = test_fetch_results(db, &result_set);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "upgrade failed: %s\n", sqlite3_errmsg(db));
+    exec(db, "ROLLBACK");
+    return rc;
+  }
+  cql_result_set_release(result_set);
+
+  return exec(db, "COMMIT");
+}
+
+// Builds one INSERT ... SELECT that makes "rows" rows for the table.  Each
+// column gets a value derived from the row number so that primary keys and
+// indexed columns have realistic (distinct) values.
+static cql_code seed_table(sqlite3 *db, const char *table, int32_t rows) {
+  sqlite3_stmt *stmt;
+  char *sql = sqlite3_mprintf("SELECT name, type FROM pragma_table_info(%Q)", table);
+  cql_code rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  sqlite3_free(sql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  sqlite3_str *names = sqlite3_str_new(db);
+  sqlite3_str *values = sqlite3_str_new(db);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *name = (const char *)sqlite3_column_text(stmt, 0);
+    const char *type = (const char *)sqlite3_column_text(stmt, 1);
+    const char *sep = sqlite3_str_length(names) ? ", " : "";
+
+    sqlite3_str_appendf(names, "%s\"%w\"", sep, name);
+    if (sqlite3_strlike("%TEXT%", type, 0) == 0) {
+      sqlite3_str_appendf(values, "%sprintf('%s_%%d', i)", sep, name);
+    }
+    else if (sqlite3_strlike("%REAL%", type, 0) == 0) {
+      sqlite3_str_appendf(values, "%si * 1.5", sep);
+    }
+    else if (sqlite3_strlike("%BLOB%", type, 0) == 0) {
+      sqlite3_str_appendf(values, "%srandomblob(16)", sep);
+    }
+    else {
+      sqlite3_str_appendf(values, "%si", sep);
+    }
+  }
+  sqlite3_finalize(stmt);
+
+  char *name_list = sqlite3_str_finish(names);
+  char *value_list = sqlite3_str_finish(values);
+
+  sql = sqlite3_mprintf(
+    "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %d) "
+    "INSERT INTO \"%w\"(%s) SELECT %s FROM n",
+    rows, table, name_list, value_list);
+
+  rc = exec(db, sql);
+
+  sqlite3_free(sql);
+  sqlite3_free(name_list);
+  sqlite3_free(value_list);
+  return rc;
+}
+
+// Every table except the upgrader's own bookkeeping gets rows.
+static cql_code seed(sqlite3 *db, int32_t rows) {
+  sqlite3_stmt *stmt;
+  cql_code rc = sqlite3_prepare_v2(db,
+    "SELECT name FROM sqlite_master WHERE type = 'table' "
+    "AND name NOT LIKE 'sqlite_%' AND name NOT LIKE '%cql_schema%' "
+    "ORDER BY name", -1, &stmt, NULL);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  exec(db, "BEGIN");
+  while (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    rc = seed_table(db, (const char *)sqlite3_column_text(stmt, 0), rows);
+  }
+  sqlite3_finalize(stmt);
+
+  if (rc != SQLITE_OK) {
+    exec(db, "ROLLBACK");
+    return rc;
+  }
+  return exec(db, "COMMIT");
+}
+
+static cql_code measure(sqlite3 *db) {
+  sqlite3_trace_v2(db, SQLITE_TRACE_STMT, count_statements, NULL);
+
+  int current, highwater;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &current, &highwater, 1);
+
+  double start = now_ms();
+  cql_code rc = upgrade(db);
+  double elapsed = now_ms() - start;
+
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &current, &highwater, 0);
+  sqlite3_trace_v2(db, 0, NULL, NULL);
+
+  if (rc == SQLITE_OK) {
+    printf("%10.1f %10d %10d\n", elapsed, statement_count, current);
+  }
+  return rc;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || (!strcmp(argv[1], "seed") && argc != 4)) {
+    fprintf(stderr, "usage: %s seed <db> <rows> | measure <db>\n", argv[0]);
+    return 1;
+  }
+
+  sqlite3 *db;
+  if (sqlite3_open(argv[2], &db) != SQLITE_OK) {
+    fprintf(stderr, "unable to open %s\n", argv[2]);
+    return 1;
+  }
+
+  cql_code rc;
+  if (!strcmp(argv[1], "seed")) {
+    rc = upgrade(db);
+    if (rc == SQLITE_OK) {
+      rc = seed(db, atoi(argv[3]));
+    }
+  }
+  else {
+    rc = measure(db);
+  }
+
+  sqlite3_close_v2(db);
+  return rc == SQLITE_OK ? 0 : 1;
+}
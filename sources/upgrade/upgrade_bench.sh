@@ -0,0 +1,164 @@
+#!/bin/bash
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# Measures the cost of the generated schema upgrader.  We make a synthetic
+# schema with some tables and indices that evolves over some versions, then
+# for each historical version we make a database at that version with rows in
+# every table and time the upgrade to the final version.  The upgrade from an
+# empty database and the no-op upgrade of a current database are measured too.
+#
+# Each table has an id, name, and value column and about a quarter of the
+# tables get a new column in each version.  Tables appear over the versions and
+# every tenth table is @recreate.  Indices appear over the versions as well.
+#
+# usage: upgrade/upgrade_bench.sh [tables] [indices] [versions] [rows] [path to cql]
+
+TABLES="${1:-50}"
+INDICES="${2:-100}"
+VERSIONS="${3:-10}"
+ROWS="${4:-1000}"
+CQL="${5:-out/cql}"
+
+OUT_DIR="out"
+DB="${OUT_DIR}/upgrade_bench.db"
+
+DIR="$( dirname -- "$0"; )"
+cd "${DIR}/.." || exit 1
+
+if [ "$#" -lt 5 ]
+then
+  if ! make >"${OUT_DIR}/make.out" 2>&1
+  then
+    echo "CQL build failed"
+    cat "${OUT_DIR}/make.out"
+    exit 1
+  fi
+fi
+
+# the version in which table $1 first appears
+table_version() {
+  echo $(( $1 % (VERSIONS + 1) ))
+}
+
+# the schema as it is at version $1
+gen_schema() {
+  local v=$1
+  local i j w t cols
+
+  for ((i = 0; i < TABLES; i++))
+  do
+    t=$(table_version $i)
+    if [ $t -gt $v ]
+    then
+      continue
+    fi
+
+    cols="  id INTEGER PRIMARY KEY,\n  name TEXT,\n  value LONG INT"
+    for ((w = 1; w <= v; w++))
+    do
+      if [ $(( (i + w) % 4 )) -ne 0 ]
+      then
+        continue
+      fi
+
+      if [ $(( i % 10 )) -eq 9 ] || [ $w -le $t ]
+      then
+        cols="${cols},\n  c$w TEXT"
+      else
+        cols="${cols},\n  c$w TEXT @create($w)"
+      fi
+    done
+
+    echo "CREATE TABLE bench_t$i("
+    echo -e "${cols}"
+    if [ $(( i % 10 )) -eq 9 ]
+    then
+      echo ") @recreate;"
+    elif [ $t -gt 0 ]
+    then
+      echo ") @create($t);"
+    else
+      echo ");"
+    fi
+    echo
+  done
+
+  for ((j = 0; j < INDICES; j++))
+  do
+    i=$(( j % TABLES ))
+    t=$(table_version $i)
+    if [ $t -gt $v ] || [ $(( j % (VERSIONS + 1) )) -gt $v ]
+    then
+      continue
+    fi
+
+    if [ $(( j % 2 )) -eq 0 ]
+    then
+      echo "CREATE INDEX bench_i$j ON bench_t$i (name);"
+    else
+      echo "CREATE INDEX bench_i$j ON bench_t$i (value, name);"
+    fi
+  done
+}
+
+echo "generating ${VERSIONS} versions of a schema with ${TABLES} tables and ${INDICES} indices"
+
+for ((v = 0; v <= VERSIONS; v++))
+do
+  gen_schema $v >"${OUT_DIR}/upgrade_bench_schema$v.sql"
+
+  if ! ${CQL} --in "${OUT_DIR}/upgrade_bench_schema$v.sql" --rt schema_upgrade --cg "${OUT_DIR}/upgrade_bench_gen$v.sql" --global_proc test
+  then
+    echo "failed generating the upgrader for version $v"
+    exit 1
+  fi
+
+  if ! ${CQL} --in "${OUT_DIR}/upgrade_bench_gen$v.sql" --cg "${OUT_DIR}/upgrade_bench_gen$v.h" "${OUT_DIR}/upgrade_bench_gen$v.c"
+  then
+    echo "failed compiling the upgrader for version $v"
+    exit 1
+  fi
+
+  if ! make "${OUT_DIR}/upgrade_bench_v$v" >"${OUT_DIR}/make.out" 2>&1
+  then
+    echo "failed building the upgrader for version $v"
+    cat "${OUT_DIR}/make.out"
+    exit 1
+  fi
+done
+
+FINAL="${OUT_DIR}/upgrade_bench_v${VERSIONS}"
+
+echo "upgrading to version ${VERSIONS} with ${ROWS} rows per table"
+echo
+printf "%-8s %10s %10s %10s\n" "from" "ms" "statements" "pages"
+
+rm -f "${DB}"
+printf "%-8s " "empty"
+if ! "${FINAL}" measure "${DB}"
+then
+  echo "upgrade from an empty database failed"
+  exit 1
+fi
+
+for ((v = 0; v <= VERSIONS; v++))
+do
+  rm -f "${DB}"
+  if ! "${OUT_DIR}/upgrade_bench_v$v" seed "${DB}" "${ROWS}"
+  then
+    echo "failed making a version $v database"
+    exit 1
+  fi
+
+  printf "%-8s " "v$v"
+  if ! "${FINAL}" measure "${DB}"
+  then
+    echo "upgrade from version $v failed"
+    exit 1
+  fi
+done
+
+rm -f "${DB}"
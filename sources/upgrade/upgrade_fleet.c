@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// See upgrade_fleet.h for the overall scheme.  The work is done in three
+// phases, each spread over the thread pool:
+//
+//  1. fingerprint every database
+//  2. upgrade one pilot per distinct fingerprint, recording its plan
+//  3. upgrade (or replay the plan on) everything else
+//
+// Grouping happens between phases 1 and 2 on the calling thread.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upgrade_fleet.h"
+
+typedef struct fleet_plan {
+  uint64_t before;          // the fingerprint of every database in the group
+  uint64_t after;           // the pilot's fingerprint after its upgrade
+  int32_t pilot;            // index of the pilot database
+  cql_code rc;              // how the pilot's upgrade went
+  cql_bool replayable;      // false if some statement could not be recorded
+  char *_Nullable *_Nullable statements;
+  int32_t count;
+  int32_t capacity;
+} fleet_plan;
+
+typedef struct fleet {
+  const char *_Nonnull const *_Nonnull paths;
+  int32_t count;
+  const cql_upgrade_fleet_options *_Nonnull options;
+  cql_code *_Nonnull results;
+  uint64_t *_Nonnull fingerprints;
+  int32_t *_Nonnull plan_of;        // -1 if the database could not be fingerprinted
+  fleet_plan *_Nonnull plans;
+  int32_t plan_count;
+  cql_upgrade_fleet_stats stats;
+
+  // the generated upgrader keeps its state in globals, it can't run on two threads at once
+  pthread_mutex_t upgrader_lock;
+
+  // the current phase, items are handed out by atomic increment of next
+  void (*_Nonnull work)(struct fleet *_Nonnull f, int32_t index);
+  int32_t items;
+  int32_t next;
+} fleet;
+
+static cql_code fleet_exec(sqlite3 *_Nonnull db, const char *_Nonnull sql) {
+  return sqlite3_exec(db, sql, NULL, NULL, NULL);
+}
+
+static void fleet_hash(uint64_t *_Nonnull hash, const unsigned char *_Nullable text) {
+  // FNV-1a, each value is followed by a separator so that "ab","c" != "a","bc"
+  if (text) {
+    for (const unsigned char *p = text; *p; p++) {
+      *hash = (*hash ^ *p) * 0x100000001b3ull;
+    }
+  }
+  *hash = (*hash ^ 0xff) * 0x100000001b3ull;
+}
+
+static cql_code fleet_hash_query(sqlite3 *_Nonnull db, const char *_Nonnull sql, uint64_t *_Nonnull hash) {
+  sqlite3_stmt *stmt;
+  cql_code rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  int32_t columns = sqlite3_column_count(stmt);
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    for (int32_t i = 0; i < columns; i++) {
+      fleet_hash(hash, sqlite3_column_text(stmt, i));
+    }
+  }
+
+  sqlite3_finalize(stmt);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// The upgrader's decisions depend only on the facets and on the schema, so
+// those are what we hash.  A missing facets table is just an empty one.
+static cql_code fleet_fingerprint(fleet *_Nonnull f, sqlite3 *_Nonnull db, uint64_t *_Nonnull fingerprint) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  cql_code rc = fleet_hash_query(db, "SELECT type, name, tbl_name, sql FROM sqlite_master ORDER BY type, name", &hash);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  fleet_hash(&hash, (const unsigned char *)"facets");
+
+  sqlite3_stmt *probe;
+  char *sql = sqlite3_mprintf("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = %Q", f->options->facets_table);
+  rc = sqlite3_prepare_v2(db, sql, -1, &probe, NULL);
+  sqlite3_free(sql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  bool has_facets = sqlite3_step(probe) == SQLITE_ROW;
+  sqlite3_finalize(probe);
+
+  if (has_facets) {
+    sql = sqlite3_mprintf("SELECT facet, version FROM \"%w\" ORDER BY facet", f->options->facets_table);
+    rc = fleet_hash_query(db, sql, &hash);
+    sqlite3_free(sql);
+  }
+
+  *fingerprint = hash;
+  return rc;
+}
+
+static cql_code fleet_open(fleet *_Nonnull f, int32_t index, sqlite3 *_Nullable *_Nonnull db) {
+  cql_code rc = sqlite3_open_v2(f->paths[index], db, SQLITE_OPEN_READWRITE, NULL);
+  if (rc == SQLITE_OK && f->options->setup) {
+    rc = f->options->setup(*db, f->options->context);
+  }
+  return rc;
+}
+
+// Transaction control and pragmas are "read only" as far as SQLite is
+// concerned but they matter to the plan (e.g. a savepoint that was rolled back).
+static bool fleet_is_control(const char *_Nonnull sql) {
+  while (*sql == ' ' || *sql == '\t' || *sql == '\n') {
+    sql++;
+  }
+
+  static const char *const prefixes[] = { "SAVEPOINT", "RELEASE", "ROLLBACK", "PRAGMA" };
+  for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+    if (!sqlite3_strnicmp(sql, prefixes[i], (int)strlen(prefixes[i]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Trace callback, adds each writing statement to the plan with its bindings
+// expanded.  Statements run by triggers (they start with "--") are not
+// recorded, they'll run again when the statement that fired them does.
+static int fleet_record(unsigned type, void *_Nullable context, void *_Nullable p, void *_Nullable x) {
+  fleet_plan *plan = context;
+  sqlite3_stmt *stmt = p;
+  const char *sql = x;
+
+  if (!strncmp(sql, "--", 2) || (sqlite3_stmt_readonly(stmt) && !fleet_is_control(sql))) {
+    return 0;
+  }
+
+  char *expanded = sqlite3_expanded_sql(stmt);
+  if (!expanded) {
+    plan->replayable = false;
+    return 0;
+  }
+
+  if (plan->count == plan->capacity) {
+    plan->capacity = plan->capacity ? plan->capacity * 2 : 64;
+    plan->statements = realloc(plan->statements, plan->capacity * sizeof(char *));
+  }
+  plan->statements[plan->count++] = expanded;
+  return 0;
+}
+
+// Runs the real upgrader in its own transaction, recording the plan if asked.
+static cql_code fleet_upgrade(fleet *_Nonnull f, sqlite3 *_Nonnull db, fleet_plan *_Nullable record) {
+  cql_code rc = fleet_exec(db, "BEGIN");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  if (record) {
+    sqlite3_trace_v2(db, SQLITE_TRACE_STMT, fleet_record, record);
+  }
+
+  pthread_mutex_lock(&f->upgrader_lock);
+  rc = f->options->upgrade(db, f->options->context);
+  pthread_mutex_unlock(&f->upgrader_lock);
+
+  if (record) {
+    sqlite3_trace_v2(db, 0, NULL, NULL);
+    if (rc == SQLITE_OK) {
+      rc = fleet_fingerprint(f, db, &record->after);
+    }
+  }
+
+  if (rc != SQLITE_OK) {
+    fleet_exec(db, "ROLLBACK");
+    return rc;
+  }
+
+  return fleet_exec(db, "COMMIT");
+}
+
+// Replays the plan in its own transaction.  Anything other than a perfect
+// match with the pilot's result is rolled back and reported as an error.
+static cql_code fleet_replay(fleet *_Nonnull f, sqlite3 *_Nonnull db, fleet_plan *_Nonnull plan) {
+  cql_code rc = fleet_exec(db, "BEGIN");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  for (int32_t i = 0; rc == SQLITE_OK && i < plan->count; i++) {
+    rc = fleet_exec(db, plan->statements[i]);
+  }
+
+  uint64_t after = 0;
+  if (rc == SQLITE_OK) {
+    rc = fleet_fingerprint(f, db, &after);
+  }
+
+  if (rc == SQLITE_OK && after != plan->after) {
+    rc = SQLITE_MISMATCH;
+  }
+
+  if (rc != SQLITE_OK) {
+    fleet_exec(db, "ROLLBACK");
+    return rc;
+  }
+
+  return fleet_exec(db, "COMMIT");
+}
+
+static void fleet_fingerprint_work(fleet *_Nonnull f, int32_t index) {
+  sqlite3 *db = NULL;
+  cql_code rc = fleet_open(f, index, &db);
+  if (rc == SQLITE_OK) {
+    rc = fleet_fingerprint(f, db, &f->fingerprints[index]);
+  }
+  sqlite3_close_v2(db);
+
+  f->results[index] = rc;
+}
+
+static void fleet_pilot_work(fleet *_Nonnull f, int32_t index) {
+  fleet_plan *plan = &f->plans[index];
+  sqlite3 *db = NULL;
+  cql_code rc = fleet_open(f, plan->pilot, &db);
+  if (rc == SQLITE_OK) {
+    rc = fleet_upgrade(f, db, f->options->replay_plans ? plan : NULL);
+  }
+  sqlite3_close_v2(db);
+
+  plan->rc = rc;
+  f->results[plan->pilot] = rc;
+  __atomic_fetch_add(rc == SQLITE_OK ? &f->stats.upgraded : &f->stats.failed, 1, __ATOMIC_RELAXED);
+}
+
+// If the pilot failed there is no plan, but the failure might be specific to
+// the pilot (e.g. it was busy or damaged) so the rest of the group just runs
+// the upgrader on its own.
+static void fleet_follower_work(fleet *_Nonnull f, int32_t index) {
+  int32_t p = f->plan_of[index];
+  if (p < 0 || f->plans[p].pilot == index) {
+    return;
+  }
+
+  fleet_plan *plan = &f->plans[p];
+  sqlite3 *db = NULL;
+  cql_code rc = fleet_open(f, index, &db);
+  bool replayed = false;
+
+  if (rc == SQLITE_OK && f->options->replay_plans && plan->rc == SQLITE_OK && plan->replayable) {
+    replayed = fleet_replay(f, db, plan) == SQLITE_OK;
+  }
+
+  if (rc == SQLITE_OK && !replayed) {
+    rc = fleet_upgrade(f, db, NULL);
+  }
+  sqlite3_close_v2(db);
+
+  f->results[index] = rc;
+  int32_t *counter = rc != SQLITE_OK ? &f->stats.failed : replayed ? &f->stats.replayed : &f->stats.upgraded;
+  __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void *_Nullable fleet_thread(void *_Nullable context) {
+  fleet *f = context;
+  for (;;) {
+    int32_t index = __atomic_fetch_add(&f->next, 1, __ATOMIC_RELAXED);
+    if (index >= f->items) {
+      break;
+    }
+    f->work(f, index);
+  }
+  return NULL;
+}
+
+// Runs work(0..items-1) over the thread pool and waits for all of it.
+static void fleet_parallel(fleet *_Nonnull f, int32_t items, void (*_Nonnull work)(fleet *_Nonnull f, int32_t index)) {
+  f->work = work;
+  f->items = items;
+  f->next = 0;
+
+  int32_t count = f->options->threads < items ? f->options->threads : items;
+  if (count < 1) {
+    count = 1;
+  }
+
+  pthread_t *threads = calloc(count, sizeof(pthread_t));
+  for (int32_t i = 0; i < count; i++) {
+    pthread_create(&threads[i], NULL, fleet_thread, f);
+  }
+  for (int32_t i = 0; i < count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+}
+
+// Assigns each database to the plan for its fingerprint, making a new plan
+// (with this database as its pilot) the first time a fingerprint is seen.
+// There are normally very few distinct fingerprints so a linear search is fine.
+static void fleet_group(fleet *_Nonnull f) {
+  for (int32_t i = 0; i < f->count; i++) {
+    f->plan_of[i] = -1;
+    if (f->results[i] != SQLITE_OK) {
+      f->stats.failed++;
+      continue;
+    }
+
+    int32_t p = 0;
+    while (p < f->plan_count && f->plans[p].before != f->fingerprints[i]) {
+      p++;
+    }
+
+    if (p == f->plan_count) {
+      fleet_plan *plan = &f->plans[f->plan_count++];
+      memset(plan, 0, sizeof(*plan));
+      plan->before = f->fingerprints[i];
+      plan->pilot = i;
+      plan->replayable = true;
+    }
+
+    f->plan_of[i] = p;
+  }
+}
+
+cql_code cql_upgrade_fleet(
+  const char *_Nonnull const *_Nonnull paths,
+  int32_t count,
+  const cql_upgrade_fleet_options *_Nonnull options,
+  cql_code *_Nonnull results,
+  cql_upgrade_fleet_stats *_Nullable stats)
+{
+  fleet f = {
+    .paths = paths,
+    .count = count,
+    .options = options,
+    .results = results,
+    .fingerprints = calloc(count + 1, sizeof(uint64_t)),
+    .plan_of = calloc(count + 1, sizeof(int32_t)),
+    .plans = calloc(count + 1, sizeof(fleet_plan)),
+  };
+
+  pthread_mutex_init(&f.upgrader_lock, NULL);
+
+  fleet_parallel(&f, count, fleet_fingerprint_work);
+  fleet_group(&f);
+  fleet_parallel(&f, f.plan_count, fleet_pilot_work);
+  fleet_parallel(&f, count, fleet_follower_work);
+
+  cql_code rc = SQLITE_OK;
+  for (int32_t i = 0; i < count; i++) {
+    if (results[i] != SQLITE_OK) {
+      rc = results[i];
+      break;
+    }
+  }
+
+  for (int32_t p = 0; p < f.plan_count; p++) {
+    for (int32_t i = 0; i < f.plans[p].count; i++) {
+      sqlite3_free(f.plans[p].statements[i]);
+    }
+    free(f.plans[p].statements);
+  }
+
+  if (stats) {
+    f.stats.fingerprints = f.plan_count;
+    *stats = f.stats;
+  }
+
+  pthread_mutex_destroy(&f.upgrader_lock);
+  free(f.plans);
+  free(f.plan_of);
+  free(f.fingerprints);
+  return rc;
+}
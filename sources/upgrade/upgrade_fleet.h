@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// A driver for running one generated upgrader over many databases that share
+// a schema, e.g. one database per tenant.
+//
+// Each database is fingerprinted by the contents of its facets table and its
+// sqlite_master.  Databases with the same fingerprint are in the same state as
+// far as the upgrader is concerned so the upgrader makes the same decisions for
+// all of them.  The upgrader is run for real on one database of each group (the
+// pilot) and the SQL writes it does are recorded; that is the plan for the
+// group.  The other databases in the group then either run the upgrader too or,
+// if replay_plans is set, just execute the recorded plan.  A replayed database
+// must end up with the same fingerprint as its pilot did or the replay is
+// rolled back and the upgrader is run instead.
+//
+// Replay is only correct if the migration procedures (if any) write the same
+// thing no matter what data is in the database, the fingerprint can't see the
+// data.  When in doubt, leave replay_plans off and every database runs the
+// upgrader, one at a time (see below).
+//
+// All the work is spread over a pool of threads, each with its own connection
+// to whatever database it is working on.  Each upgrade (or replay) is done in
+// its own transaction.  The generated upgrader keeps its state in globals so
+// only one thread at a time runs it; fingerprinting and replay are fully
+// parallel, which is where the time goes for a big fleet.
+
+#pragma once
+
+#include "cqlrt.h"
+
+typedef struct cql_upgrade_fleet_options {
+  // number of worker threads, at least 1
+  int32_t threads;
+
+  // the facets table of the upgrader, "<global_proc>_cql_schema_facets"
+  const char *_Nonnull facets_table;
+
+  // run the upgrader only on the pilots and replay their plans on the rest
+  cql_bool replay_plans;
+
+  // optional, called on every new connection (e.g. to register modules)
+  cql_code (*_Nullable setup)(sqlite3 *_Nonnull db, void *_Nullable context);
+
+  // runs the generated upgrader (and releases its result set), the driver
+  // has already started a transaction
+  cql_code (*_Nonnull upgrade)(sqlite3 *_Nonnull db, void *_Nullable context);
+
+  void *_Nullable context;
+} cql_upgrade_fleet_options;
+
+typedef struct cql_upgrade_fleet_stats {
+  int32_t fingerprints;   // distinct starting states (i.e. plans)
+  int32_t upgraded;       // databases where the upgrader ran
+  int32_t replayed;       // databases where a plan was replayed
+  int32_t failed;         // databases that could not be upgraded
+} cql_upgrade_fleet_stats;
+
+// Upgrades every database in paths.  results[i] gets the outcome for paths[i]
+// and the return value is SQLITE_OK only if every database was upgraded.  If a
+// pilot fails there is no plan for its group and each of the others runs
+// the upgrader instead.
+cql_code cql_upgrade_fleet(
+  const char *_Nonnull const *_Nonnull paths,
+  int32_t count,
+  const cql_upgrade_fleet_options *_Nonnull options,
+  cql_code *_Nonnull results,
+  cql_upgrade_fleet_stats *_Nullable stats);
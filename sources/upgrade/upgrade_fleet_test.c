@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Runs the fleet driver with the latest upgrader over databases at assorted
+// versions (made by upgrade_test.sh).  Databases that start out the same must
+// end up with the same schema, and since there are several databases with the
+// same starting state some of them must have been done by replaying the plan.  A second
+// pass over the (now current) fleet must also succeed, even when the first pilot fails;
+// the rest of its group must still be upgraded.
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generated_upgrade4.h"
+#include "upgrade_fleet.h"
+
+static cql_code vtab_create(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab, char **err) {
+  *vtab = sqlite3_malloc(sizeof(sqlite3_vtab));
+  memset(*vtab, 0, sizeof(sqlite3_vtab));
+  return sqlite3_declare_vtab(db, "CREATE TABLE x(id INTEGER)");
+}
+
+static cql_code vtab_disconnect(sqlite3_vtab *vtab) {
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+static cql_code setup(sqlite3 *db, void *context) {
+  static sqlite3_module module = {
+    .iVersion = 0,
+    .xCreate = vtab_create,
+    .xConnect = vtab_create,
+    .xDisconnect = vtab_disconnect,
+    .xDestroy = vtab_disconnect,
+  };
+
+  return sqlite3_create_module(db, "test_module", &module, NULL);
+}
+
+// The path of a database whose upgrade fails, if any.
+static const char *failing_path;
+
+static cql_code upgrade(sqlite3 *db, void *context) {
+  const char *path = sqlite3_db_filename(db, "main");
+  size_t len = strlen(path);
+  if (failing_path && len >= strlen(failing_path) && !strcmp(path + len - strlen(failing_path), failing_path)) {
+    return SQLITE_ABORT;
+  }
+
+  test_result_set_ref result_set;
+  cql_code rc = test_fetch_results(db, &result_set);
+  if (rc == SQLITE_OK) {
+    cql_result_set_release(result_set);
+  }
+  return rc;
+}
+
+// The schema in a canonical form, the caller frees it.
+static char *schema_of(const char *path) {
+  sqlite3 *db;
+  sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL);
+
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, "SELECT type, name, sql FROM sqlite_master ORDER BY type, name", -1, &stmt, NULL);
+
+  sqlite3_str *text = sqlite3_str_new(db);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    sqlite3_str_appendf(text, "%s %s %s\n",
+      sqlite3_column_text(stmt, 0),
+      sqlite3_column_text(stmt, 1),
+      sqlite3_column_text(stmt, 2));
+  }
+  sqlite3_finalize(stmt);
+
+  char *result = sqlite3_str_finish(text);
+  sqlite3_close_v2(db);
+  return result;
+}
+
+static int run(const char **paths, int32_t count, int32_t failures, cql_upgrade_fleet_stats *stats) {
+  cql_upgrade_fleet_options options = {
+    .threads = 4,
+    .facets_table = "test_cql_schema_facets",
+    .replay_plans = true,
+    .setup = setup,
+    .upgrade = upgrade,
+  };
+
+  cql_code *results = calloc(count, sizeof(cql_code));
+  cql_code rc = cql_upgrade_fleet(paths, count, &options, results, stats);
+
+  for (int32_t i = 0; i < count; i++) {
+    if (results[i] != SQLITE_OK && !failures) {
+      fprintf(stderr, "upgrade of %s failed with %d\n", paths[i], results[i]);
+    }
+  }
+  free(results);
+
+  if (stats->upgraded + stats->replayed != count - failures || stats->failed != failures) {
+    fprintf(stderr, "%d upgraded + %d replayed, %d failed, expected %d and %d failed\n",
+      stats->upgraded, stats->replayed, stats->failed, count - failures, failures);
+    return 1;
+  }
+
+  return (rc != SQLITE_OK) != (failures != 0);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: upgrade_fleet_test db1 db2 ...\n");
+    return 1;
+  }
+
+  const char **paths = (const char **)argv + 1;
+  int32_t count = argc - 1;
+
+  char **before = calloc(count, sizeof(char *));
+  for (int32_t i = 0; i < count; i++) {
+    before[i] = schema_of(paths[i]);
+  }
+
+  cql_upgrade_fleet_stats stats;
+  if (run(paths, count, 0, &stats)) {
+    return 1;
+  }
+
+  if (stats.fingerprints >= count || stats.replayed == 0) {
+    fprintf(stderr, "expected some shared plans, %d plans for %d databases, %d replayed\n",
+      stats.fingerprints, count, stats.replayed);
+    return 1;
+  }
+
+  // databases that started out the same must have ended up the same, no
+  // matter which of them were replayed
+  char **after = calloc(count, sizeof(char *));
+  for (int32_t i = 0; i < count; i++) {
+    after[i] = schema_of(paths[i]);
+    for (int32_t j = 0; j < i; j++) {
+      if (!strcmp(before[i], before[j]) && strcmp(after[i], after[j])) {
+        fprintf(stderr, "%s does not have the same schema as %s\n", paths[i], paths[j]);
+        return 1;
+      }
+    }
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    sqlite3_free(before[i]);
+    sqlite3_free(after[i]);
+  }
+  free(before);
+  free(after);
+
+  // everything is current now, this is all no-op upgrades
+  if (run(paths, count, 0, &stats)) {
+    return 1;
+  }
+
+  // the first database is a pilot, only it may fail
+  failing_path = paths[0];
+  if (run(paths, count, 1, &stats)) {
+    return 1;
+  }
+
+  return 0;
+}
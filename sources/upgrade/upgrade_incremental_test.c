@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Drives the incremental entry point of the latest upgrader (made with
+// --incremental_upgrade and --preserve_recreate_data by upgrade_test.sh) over
+// databases at assorted versions, some with enough data in a @recreate group
+// that its copy takes several steps.  Each database is upgraded three ways: one
+// step per call with a new connection each time (like an app that resumes in a
+// later run), one step per call because the time budget is used up, and all at
+// once.  Every way must finish, forget its step facets, and end up with the same
+// schema as the reference database that was upgraded in one go.
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generated_upgrade_incremental.h"
+
+static cql_code vtab_create(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab, char **err) {
+  *vtab = sqlite3_malloc(sizeof(sqlite3_vtab));
+  memset(*vtab, 0, sizeof(sqlite3_vtab));
+  return sqlite3_declare_vtab(db, "CREATE TABLE x(id INTEGER)");
+}
+
+static cql_code vtab_disconnect(sqlite3_vtab *vtab) {
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+// The upgrader measures its budget with julianday('now'), which comes from the
+// VFS.  This one is the default VFS except every reading of the clock is a
+// second after the last, so any budget runs out after the first step.
+static sqlite3_vfs fake_clock_vfs;
+static sqlite3_int64 fake_now;
+
+static int fake_clock_current_time(sqlite3_vfs *vfs, sqlite3_int64 *now) {
+  fake_now += 1000;
+  *now = fake_now;
+  return SQLITE_OK;
+}
+
+static sqlite3 *open_db(const char *path, const char *vfs) {
+  static sqlite3_module module = {
+    .iVersion = 0,
+    .xCreate = vtab_create,
+    .xConnect = vtab_create,
+    .xDisconnect = vtab_disconnect,
+    .xDestroy = vtab_disconnect,
+  };
+
+  sqlite3 *db = NULL;
+  if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, vfs) != SQLITE_OK ||
+      sqlite3_create_module(db, "test_module", &module, NULL) != SQLITE_OK) {
+    fprintf(stderr, "unable to open %s\n", path);
+    exit(1);
+  }
+  return db;
+}
+
+static void copy_db(const char *from, const char *to) {
+  sqlite3 *src = open_db(from, NULL);
+  sqlite3 *dest = open_db(to, NULL);
+  sqlite3_backup *backup = sqlite3_backup_init(dest, "main", src, "main");
+  if (!backup || sqlite3_backup_step(backup, -1) != SQLITE_DONE || sqlite3_backup_finish(backup) != SQLITE_OK) {
+    fprintf(stderr, "unable to copy %s to %s\n", from, to);
+    exit(1);
+  }
+  sqlite3_close_v2(src);
+  sqlite3_close_v2(dest);
+}
+
+static int32_t query_int(sqlite3 *db, const char *sql) {
+  sqlite3_stmt *stmt;
+  int32_t result = -1;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    result = sqlite3_column_int(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+  return result;
+}
+
+// Copies the database and, if it has the recreate group with g1 in it, puts a few
+// batches of rows in g1; the data in that group is kept by the upgrade.  Returns
+// the number of rows added.
+static int32_t copy_and_seed_db(const char *from, const char *to) {
+  copy_db(from, to);
+  sqlite3 *db = open_db(to, NULL);
+  char *sql = sqlite3_mprintf(
+    "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %d) "
+    "INSERT INTO g1(id, name) SELECT i, 'name' || i FROM n", 2 * CQL_REBUILD_COPY_BATCH_ROWS + 1);
+  int32_t rows = sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK ? sqlite3_changes(db) : 0;
+  sqlite3_free(sql);
+  sqlite3_close_v2(db);
+  return rows;
+}
+
+// The rows in g1 (which exists after the upgrade).
+static int32_t seeded_rows(const char *path) {
+  sqlite3 *db = open_db(path, NULL);
+  int32_t rows = query_int(db, "SELECT count(*) FROM g1");
+  sqlite3_close_v2(db);
+  return rows;
+}
+
+// The steps recorded as done so far.
+static int32_t steps_done(sqlite3 *db) {
+  return query_int(db, "SELECT count(*) FROM test_cql_schema_facets WHERE facet GLOB 'cql_upgrade_step_*'");
+}
+
+// The shape of the schema, the caller frees it.  Tables that kept their data
+// were renamed into place so their text differs (quoted names) but their
+// columns are the same, hence the columns rather than the text.  The list of
+// rebuilt groups only exists if something was rebuilt.
+static char *schema_of(const char *path) {
+  sqlite3 *db = open_db(path, NULL);
+
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db,
+    "SELECT M.type, M.name, M.tbl_name, "
+    "  (SELECT group_concat(C.name || ' ' || C.type || ' ' || C.\"notnull\" || ' ' || ifnull(C.dflt_value, '-') || ' ' || C.pk, ', ') "
+    "   FROM pragma_table_xinfo(M.name) C WHERE M.type = 'table') "
+    "FROM sqlite_master M "
+    "WHERE M.name NOT IN ('cql_schema_rebuilt_tables') "
+    "ORDER BY M.type, M.name", -1, &stmt, NULL);
+
+  sqlite3_str *text = sqlite3_str_new(db);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    sqlite3_str_appendf(text, "%s %s %s %s\n",
+      sqlite3_column_text(stmt, 0),
+      sqlite3_column_text(stmt, 1),
+      sqlite3_column_text(stmt, 2),
+      sqlite3_column_text(stmt, 3));
+  }
+  sqlite3_finalize(stmt);
+
+  char *result = sqlite3_str_finish(text);
+  sqlite3_close_v2(db);
+  return result;
+}
+
+// Calls the incremental upgrade until it is finished and returns the number of
+// calls (or -1 on failure).  With a limit each call may complete at most one step,
+// a step that has more to do (the copy of preserved data) may complete none.
+static int32_t upgrade(const char *path, const char *vfs, cql_int32 max_steps, cql_int64 budget_ms, cql_bool reopen) {
+  sqlite3 *db = open_db(path, vfs);
+  cql_bool finished = false;
+  int32_t calls = 0;
+
+  while (!finished) {
+    if (++calls > 100) {
+      fprintf(stderr, "%s: the upgrade did not finish\n", path);
+      return -1;
+    }
+
+    int32_t before = steps_done(db);
+    if (test_upgrade_incrementally(db, true, max_steps, budget_ms, &finished) != SQLITE_OK) {
+      fprintf(stderr, "%s: incremental upgrade failed: %s\n", path, sqlite3_errmsg(db));
+      return -1;
+    }
+
+    int32_t after = steps_done(db);
+    if (!finished && (max_steps || budget_ms) && after > before + 1) {
+      fprintf(stderr, "%s: %d steps done in one call\n", path, after - before);
+      return -1;
+    }
+
+    if (reopen) {
+      sqlite3_close_v2(db);
+      db = open_db(path, vfs);
+    }
+  }
+
+  if (steps_done(db)) {
+    fprintf(stderr, "%s: the step facets were not forgotten\n", path);
+    return -1;
+  }
+
+  // once finished, it stays finished
+  finished = false;
+  if (test_upgrade_incrementally(db, true, max_steps, budget_ms, &finished) != SQLITE_OK || !finished) {
+    fprintf(stderr, "%s: a finished upgrade had more to do\n", path);
+    return -1;
+  }
+
+  sqlite3_close_v2(db);
+  return calls;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: upgrade_incremental_test reference.db db1 db2 ...\n");
+    return 1;
+  }
+
+  sqlite3_vfs *vfs = sqlite3_vfs_find(NULL);
+  fake_clock_vfs = *vfs;
+  fake_clock_vfs.zName = "fake_clock";
+  fake_clock_vfs.xCurrentTimeInt64 = fake_clock_current_time;
+  vfs->xCurrentTimeInt64(vfs, &fake_now);
+  sqlite3_vfs_register(&fake_clock_vfs, 0);
+
+  char *expected = schema_of(argv[1]);
+
+  for (int32_t i = 2; i < argc; i++) {
+    char *path = sqlite3_mprintf("%s.incremental", argv[i]);
+
+    // one step per call, resumed from a new connection every time
+    int32_t rows = copy_and_seed_db(argv[i], path);
+    int32_t stepped_calls = upgrade(path, NULL, 1, 0, true);
+    if (stepped_calls < 0) {
+      return 1;
+    }
+    if (stepped_calls < 2) {
+      fprintf(stderr, "%s: expected the upgrade to take several calls\n", argv[i]);
+      return 1;
+    }
+    char *actual = schema_of(path);
+    if (strcmp(expected, actual) || seeded_rows(path) != rows) {
+      fprintf(stderr, "%s: upgraded a step at a time it does not match %s\n", argv[i], argv[1]);
+      fprintf(stderr, "expected:\n%s\nactual:\n%s\n", expected, actual);
+      return 1;
+    }
+    sqlite3_free(actual);
+
+    // the budget runs out after every step so this is the same as above
+    copy_and_seed_db(argv[i], path);
+    int32_t budget_calls = upgrade(path, "fake_clock", 0, 1, false);
+    if (budget_calls != stepped_calls) {
+      fprintf(stderr, "%s: %d calls with a budget, %d calls a step at a time\n", argv[i], budget_calls, stepped_calls);
+      return 1;
+    }
+    actual = schema_of(path);
+    if (strcmp(expected, actual) || seeded_rows(path) != rows) {
+      fprintf(stderr, "%s: upgraded within a budget it does not match %s\n", argv[i], argv[1]);
+      return 1;
+    }
+    sqlite3_free(actual);
+
+    // no limits, it's all done in one call
+    copy_and_seed_db(argv[i], path);
+    if (upgrade(path, NULL, 0, 0, false) != 1) {
+      fprintf(stderr, "%s: expected the upgrade to finish in one call\n", argv[i]);
+      return 1;
+    }
+    actual = schema_of(path);
+    if (strcmp(expected, actual) || seeded_rows(path) != rows) {
+      fprintf(stderr, "%s: upgraded in one call it does not match %s\n", argv[i], argv[1]);
+      return 1;
+    }
+    sqlite3_free(actual);
+
+    remove(path);
+    sqlite3_free(path);
+  }
+
+  sqlite3_free(expected);
+  return 0;
+}
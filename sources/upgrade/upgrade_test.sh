@@ -89,6 +89,20 @@ do
   fi
 done
 
+echo "creating the incremental upgrader to v4"
+
+if ! ${CQL} --schema_exclusive --incremental_upgrade --preserve_recreate_data --in "upgrade/SchemaPersistentV4.sql" --rt schema_upgrade --cg "${OUT_DIR}/generated_upgrader_incremental.sql" --global_proc "$TEST_PREFIX"; then
+  echo ${CQL} --schema_exclusive --incremental_upgrade --preserve_recreate_data --in "upgrade/SchemaPersistentV4.sql" --rt schema_upgrade --cg "${OUT_DIR}/generated_upgrader_incremental.sql" --global_proc "$TEST_PREFIX"
+  echo "failed generating the incremental upgrade CQL"
+  exit 1
+fi
+
+if ! ${CQL} --in "${OUT_DIR}/generated_upgrader_incremental.sql" --compress --cg "${OUT_DIR}/generated_upgrade_incremental.h" "${OUT_DIR}/generated_upgrade_incremental.c"; then
+  echo ${CQL} --in "${OUT_DIR}/generated_upgrader_incremental.sql" --compress --cg "${OUT_DIR}/generated_upgrade_incremental.h" "${OUT_DIR}/generated_upgrade_incremental.c"
+  echo "failed C from the incremental upgrader"
+  exit 1
+fi
+
 # compile the upgraders above to executables upgrade0-4
 
 if ! make ${MAKE_COVERAGE_ARGS} upgrade_test; then
@@ -182,6 +196,39 @@ do
   done
 done
 
+echo "Upgrading a fleet of databases at assorted versions to v4"
+
+FLEET=""
+for j in {0..3}
+do
+  for k in a b c
+  do
+    rm -f "${OUT_DIR}/fleet_$j$k.db"
+    if ! ${OUT_DIR}/upgrade$j "${OUT_DIR}/fleet_$j$k.db" > /dev/null; then
+      echo ${OUT_DIR}/upgrade$j "${OUT_DIR}/fleet_$j$k.db"
+      echo "making a version $j database for the fleet failed"
+      exit 1
+    fi
+    FLEET="${FLEET} ${OUT_DIR}/fleet_$j$k.db"
+  done
+done
+
+# shellcheck disable=SC2086
+if ! ${OUT_DIR}/upgrade_fleet_test ${FLEET}; then
+  echo ${OUT_DIR}/upgrade_fleet_test "${FLEET}"
+  echo "fleet upgrade failed"
+  exit 1
+fi
+
+echo "Upgrading databases at assorted versions to v4 a few steps at a time"
+
+# shellcheck disable=SC2086
+if ! ${OUT_DIR}/upgrade_incremental_test "${OUT_DIR}/test_4.db" ${OUT_DIR}/test_{0..3}.db; then
+  echo ${OUT_DIR}/upgrade_incremental_test "${OUT_DIR}/test_4.db" ${OUT_DIR}/test_{0..3}.db
+  echo "incremental upgrade failed"
+  exit 1
+fi
+
 # ----- END UPGRADE TESTING -----
 
 # ----- BEGIN DOWNGRADE TESTING -----